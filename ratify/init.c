@@ -15,19 +15,21 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "config.h"
 
-#include <stdbool.h>
+#include <stddef.h>
 
 #include <glib.h>
 #include <glib/gi18n-lib.h>
 
 /* This function is called at every entry point of the library, as suggested in
-chapter 4.10 of the gettext manual. It sets up gettext for the library. */
+chapter 4.10 of the gettext manual. It sets up gettext for the library, once,
+even if the library is entered from several threads at the same time. */
 void
 rtf_init(void)
 {
-    static bool initialized = false;
-    if (G_UNLIKELY(!initialized)) {
+    static size_t initialized = 0;
+    if (g_once_init_enter(&initialized)) {
         bindtextdomain(GETTEXT_PACKAGE, LOCALEDIR);
         bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+        g_once_init_leave(&initialized, 1);
     }
 }
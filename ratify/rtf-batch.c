@@ -0,0 +1,140 @@
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <stdbool.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "init.h"
+#include "rtf-core.h"
+
+/* rtf-batch.c - Processing many documents at once on several threads. Each
+thread takes the next document that nobody has started on yet, until there are
+none left, so a thread that gets short documents simply does more of them. The
+documents are independent of each other, so no other coordination is needed. */
+
+typedef struct {
+    GFile * const *files;
+    RtfBatchResult **results;
+    int n_files;
+    volatile int next_file;
+    GCancellable *cancellable;
+} Batch;
+
+static RtfBatchResult *
+extract_text_from_file(GFile *file, GCancellable *cancellable)
+{
+    RtfBatchResult *result = g_slice_new0(RtfBatchResult);
+    result->file = g_object_ref(file);
+
+    g_autofree char *contents = NULL;
+    size_t length;
+    if (g_cancellable_set_error_if_cancelled(cancellable, &result->error) ||
+        !g_file_load_contents(file, cancellable, &contents, &length, NULL, &result->error))
+        return result;
+
+    result->text = rtf_extract_text(contents, length, &result->error);
+    return result;
+}
+
+static void *
+batch_worker(Batch *batch)
+{
+    int ix;
+    while ((ix = g_atomic_int_add(&batch->next_file, 1)) < batch->n_files)
+        batch->results[ix] = extract_text_from_file(batch->files[ix], batch->cancellable);
+    return NULL;
+}
+
+/**
+ * RtfBatchResult:
+ * @file: the file that was read
+ * @text: the text of the document, or %NULL if there was an error
+ * @error: the error that occurred, or %NULL
+ *
+ * The outcome of extracting the text from one file with
+ * rtf_extract_text_batch().
+ */
+
+/**
+ * rtf_batch_result_free:
+ * @result: an #RtfBatchResult
+ *
+ * Frees @result and everything in it.
+ */
+void
+rtf_batch_result_free(RtfBatchResult *result)
+{
+    g_return_if_fail(result != NULL);
+
+    g_object_unref(result->file);
+    g_free(result->text);
+    g_clear_error(&result->error);
+    g_slice_free(RtfBatchResult, result);
+}
+
+/**
+ * rtf_extract_text_batch:
+ * @files: (array length=n_files): RTF files
+ * @n_files: number of elements in @files
+ * @n_threads: number of threads to use, or 0 for one per processor
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL
+ *
+ * Extracts the plain text of many RTF documents at once, using up to
+ * @n_threads threads, as if by calling rtf_extract_text() on the contents of
+ * each file. This function blocks until all the files have been processed.
+ *
+ * If @cancellable is triggered from another thread, the files that have not
+ * been read yet get a %G_IO_ERROR_CANCELLED error.
+ *
+ * Returns: (transfer full) (element-type RtfBatchResult): an array of
+ * #RtfBatchResult, one for each file, in the same order as @files. Free it with
+ * g_ptr_array_unref().
+ */
+GPtrArray *
+rtf_extract_text_batch(GFile * const *files, unsigned n_files, unsigned n_threads, GCancellable *cancellable)
+{
+    rtf_init();
+    g_return_val_if_fail(files != NULL || n_files == 0, NULL);
+    g_return_val_if_fail(n_files <= G_MAXINT, NULL);
+    g_return_val_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable), NULL);
+
+    GPtrArray *results = g_ptr_array_new_full(n_files, (GDestroyNotify)rtf_batch_result_free);
+    g_ptr_array_set_size(results, n_files);
+
+    Batch batch;
+    batch.files = files;
+    batch.results = (RtfBatchResult **)results->pdata;
+    batch.n_files = (int)n_files;
+    batch.next_file = 0;
+    batch.cancellable = cancellable;
+
+    if (n_threads == 0)
+        n_threads = g_get_num_processors();
+    n_threads = MIN(n_threads, n_files);
+
+    /* The calling thread does its share of the work too */
+    g_autofree GThread **threads = g_new0(GThread *, n_threads);
+    for (unsigned ix = 1; ix < n_threads; ix++)
+        threads[ix] = g_thread_new("rtf-batch", (GThreadFunc)batch_worker, &batch);
+    batch_worker(&batch);
+    for (unsigned ix = 1; ix < n_threads; ix++)
+        g_thread_join(threads[ix]);
+
+    return results;
+}
@@ -0,0 +1,340 @@
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "init.h"
+#include "rtf-core.h"
+#include "rtf-deserialize.h"
+#include "rtf-sink.h"
+#include "rtf-state.h"
+
+/* rtf-callbacks.c - Output sink that passes the document on to the public
+RtfParseCallbacks as it is parsed, without keeping any of it. Only the font and
+color tables are kept, so that the attributes can refer to them. */
+
+typedef struct {
+    const RtfParseCallbacks *callbacks;
+    void *user_data;
+
+    GHashTable *fonts; /* Font index -> family */
+    GPtrArray *colors;
+
+    /* The attributes last passed to on_run_attributes */
+    bool have_attributes;
+    RtfRunAttributes attributes;
+    /* Text without attributes of its own, such as list numbers and PAGE field
+    results, waiting to be passed on with the attributes of the next text */
+    GString *pending;
+
+    RtfPictureInfo picture;
+} CallbackParser;
+
+static const char *
+get_color(CallbackParser *parser, int index)
+{
+    if (index < 0 || (unsigned)index >= parser->colors->len)
+        return NULL;
+    return g_ptr_array_index(parser->colors, index);
+}
+
+static bool
+run_attributes_equal(const RtfRunAttributes *a, const RtfRunAttributes *b)
+{
+    return a->font_family == b->font_family &&
+        a->size == b->size &&
+        a->foreground == b->foreground &&
+        a->background == b->background &&
+        a->highlight == b->highlight &&
+        a->bold == b->bold &&
+        a->italic == b->italic &&
+        a->smallcaps == b->smallcaps &&
+        a->strikethrough == b->strikethrough &&
+        a->subscript == b->subscript &&
+        a->superscript == b->superscript &&
+        a->hidden == b->hidden &&
+        a->underline == b->underline &&
+        a->rise == b->rise &&
+        a->scale == b->scale &&
+        a->language == b->language &&
+        a->style == b->style;
+}
+
+/* Tell the callbacks about the attributes, if they are different from the
+last ones. The strings in the public attributes point into the font and color
+tables, so comparing the pointers is enough. */
+static void
+report_attributes(ParserContext *ctx, CallbackParser *parser, const Attributes *attr)
+{
+    if (parser->callbacks->on_run_attributes == NULL)
+        return;
+
+    int font = attr->font != -1 ? attr->font : ctx->default_font;
+    RtfRunAttributes attributes = {
+        .font_family = g_hash_table_lookup(parser->fonts, GINT_TO_POINTER(font)),
+        .size = attr->size,
+        .foreground = get_color(parser, attr->foreground),
+        .background = get_color(parser, attr->background),
+        .highlight = get_color(parser, attr->highlight),
+        .bold = attr->bold,
+        .italic = attr->italic,
+        .smallcaps = attr->smallcaps,
+        .strikethrough = attr->strikethrough,
+        .subscript = attr->subscript,
+        .superscript = attr->superscript,
+        .hidden = attr->invisible,
+        .underline = attr->underline != -1 ? (RtfUnderline)attr->underline : RTF_UNDERLINE_NONE,
+        .rise = attr->rise,
+        .scale = attr->scale,
+        .language = attr->language,
+        .style = attr->style
+    };
+
+    if (parser->have_attributes && run_attributes_equal(&attributes, &parser->attributes))
+        return;
+    parser->attributes = attributes;
+    parser->have_attributes = true;
+    parser->callbacks->on_run_attributes(&parser->attributes, parser->user_data);
+}
+
+/* Pass on length bytes of text a paragraph at a time */
+static void
+pass_on_text(CallbackParser *parser, const char *text, size_t length)
+{
+    const RtfParseCallbacks *callbacks = parser->callbacks;
+    const char *end = text + length;
+
+    const char *newline;
+    while ((newline = memchr(text, '\n', end - text)) != NULL) {
+        if (newline > text && callbacks->on_text)
+            callbacks->on_text(text, newline - text, parser->user_data);
+        if (callbacks->on_paragraph_end)
+            callbacks->on_paragraph_end(parser->user_data);
+        text = newline + 1;
+    }
+    if (text < end && callbacks->on_text)
+        callbacks->on_text(text, end - text, parser->user_data);
+}
+
+/* Pass on the text waiting for attributes with the attributes it has so far,
+because something else is about to be reported */
+static void
+flush_pending_text(CallbackParser *parser)
+{
+    if (parser->pending->len == 0)
+        return;
+    pass_on_text(parser, parser->pending->str, parser->pending->len);
+    g_string_truncate(parser->pending, 0);
+}
+
+/* Pass on the text straight out of the parser's text buffer. As in a text
+buffer, text without attributes gets the attributes of the next text, so it
+waits for that, unless the paragraph ends first. */
+static void
+callbacks_insert_text(ParserContext *ctx, const char *text, const Attributes *attr)
+{
+    CallbackParser *parser = ctx->sink_data;
+
+    if (attr == NULL) {
+        g_string_append(parser->pending, text);
+        const char *newline = strrchr(parser->pending->str, '\n');
+        if (newline != NULL) {
+            size_t length = newline + 1 - parser->pending->str;
+            pass_on_text(parser, parser->pending->str, length);
+            g_string_erase(parser->pending, 0, length);
+        }
+        return;
+    }
+
+    report_attributes(ctx, parser, attr);
+    flush_pending_text(parser);
+    pass_on_text(parser, text, strlen(text));
+}
+
+/* Nothing is kept, so text meant for the start of the line can only be passed
+on where it is. In practice the line is still empty at that point. */
+static void
+callbacks_insert_at_line_start(ParserContext *ctx, const char *text)
+{
+    callbacks_insert_text(ctx, text, NULL);
+}
+
+static void
+callbacks_footnote_begin(ParserContext *ctx)
+{
+    CallbackParser *parser = ctx->sink_data;
+    flush_pending_text(parser);
+    if (parser->callbacks->on_footnote_begin)
+        parser->callbacks->on_footnote_begin(parser->user_data);
+}
+
+static void
+callbacks_footnote_end(ParserContext *ctx)
+{
+    CallbackParser *parser = ctx->sink_data;
+    flush_pending_text(parser);
+    if (parser->callbacks->on_footnote_end)
+        parser->callbacks->on_footnote_end(parser->user_data);
+}
+
+static void
+callbacks_define_font(ParserContext *ctx, int index, const char *family)
+{
+    CallbackParser *parser = ctx->sink_data;
+    g_hash_table_replace(parser->fonts, GINT_TO_POINTER(index), g_strdup(family));
+    /* The old name may have been freed */
+    parser->have_attributes = false;
+}
+
+static void
+callbacks_define_color(ParserContext *ctx, int index, const char *color)
+{
+    CallbackParser *parser = ctx->sink_data;
+    if ((unsigned)index >= parser->colors->len)
+        g_ptr_array_set_size(parser->colors, index + 1);
+    g_free(g_ptr_array_index(parser->colors, index));
+    g_ptr_array_index(parser->colors, index) = g_strdup(color);
+    parser->have_attributes = false;
+}
+
+/* The picture type values are the same in the public enum */
+static void
+set_picture_info(CallbackParser *parser, const PictureInfo *info)
+{
+    parser->picture.type = (RtfPictureType)info->type;
+    parser->picture.width = info->width;
+    parser->picture.height = info->height;
+    parser->picture.width_goal = info->width_goal;
+    parser->picture.height_goal = info->height_goal;
+    parser->picture.xscale = info->xscale;
+    parser->picture.yscale = info->yscale;
+}
+
+/* If nobody is interested in pictures, returning NULL means the picture data
+isn't even decoded */
+static void *
+callbacks_picture_begin(ParserContext *ctx, const PictureInfo *info)
+{
+    CallbackParser *parser = ctx->sink_data;
+    if (!parser->callbacks->on_picture_bytes && !parser->callbacks->on_picture_end)
+        return NULL;
+    flush_pending_text(parser);
+    return parser;
+}
+
+static bool
+callbacks_picture_write(ParserContext *ctx, void *picture, const PictureInfo *info, const uint8_t *data, size_t length)
+{
+    CallbackParser *parser = picture;
+    if (parser->callbacks->on_picture_bytes) {
+        set_picture_info(parser, info);
+        parser->callbacks->on_picture_bytes(&parser->picture, data, length, parser->user_data);
+    }
+    return true;
+}
+
+static void
+callbacks_picture_end(ParserContext *ctx, void *picture, const PictureInfo *info, bool ok)
+{
+    CallbackParser *parser = picture;
+    if (parser->callbacks->on_picture_end) {
+        set_picture_info(parser, info);
+        parser->callbacks->on_picture_end(&parser->picture, ok, parser->user_data);
+    }
+}
+
+static void
+callbacks_field(ParserContext *ctx, const char *type, const char *argument)
+{
+    CallbackParser *parser = ctx->sink_data;
+    flush_pending_text(parser);
+    if (parser->callbacks->on_field)
+        parser->callbacks->on_field(type, argument, parser->user_data);
+}
+
+static const OutputSink callbacks_sink = {
+    callbacks_insert_text,
+    callbacks_insert_text, /* append_text; footnotes are passed on in place */
+    callbacks_insert_at_line_start,
+    callbacks_footnote_begin,
+    callbacks_footnote_end,
+    callbacks_define_font,
+    callbacks_define_color,
+    NULL, /* define_style */
+    callbacks_picture_begin,
+    callbacks_picture_write,
+    callbacks_picture_end,
+    NULL, /* picture_file; INCLUDEPICTURE fields are reported by on_field */
+    callbacks_field
+};
+
+/**
+ * rtf_parse:
+ * @data: RTF code
+ * @length: length of @data in bytes, or -1 if @data is nul-terminated
+ * @callbacks: functions to call as the document is read
+ * @user_data: data to pass to the functions in @callbacks
+ * @error: return location for an error, or %NULL
+ *
+ * Reads an RTF document in one pass, calling the functions in @callbacks for
+ * the text, formatting, paragraphs, pictures, fields, and footnotes in the
+ * order they occur. Nothing is kept after the callbacks return, so programs
+ * can build their own representation of a document without paying for a
+ * #GtkTextBuffer, and large documents can be processed in a constant amount of
+ * memory.
+ *
+ * Footnotes are reported where they occur in the text, not at the end of the
+ * document as in a text buffer. Pictures from external files are not loaded;
+ * the <quote>INCLUDEPICTURE</quote> fields that refer to them are reported to
+ * the <structfield>on_field</structfield> callback.
+ *
+ * If the document can't be parsed, then the callbacks will have been called for
+ * the part of the document before the error.
+ *
+ * Returns: %TRUE if the document was read successfully, %FALSE if not, in
+ * which case @error is set.
+ */
+gboolean
+rtf_parse(const char *data, gssize length, const RtfParseCallbacks *callbacks, void *user_data, GError **error)
+{
+    rtf_init();
+    g_return_val_if_fail(data != NULL, false);
+    g_return_val_if_fail(callbacks != NULL, false);
+    g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+    if (length < 0)
+        length = strlen(data);
+
+    CallbackParser parser = { 0 };
+    parser.callbacks = callbacks;
+    parser.user_data = user_data;
+    parser.fonts = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    parser.colors = g_ptr_array_new_with_free_func(g_free);
+    parser.pending = g_string_new("");
+
+    bool retval = parse_rtf_with_sink(data, length, NULL, &callbacks_sink, &parser, error);
+    flush_pending_text(&parser);
+
+    g_hash_table_unref(parser.fonts);
+    g_ptr_array_unref(parser.colors);
+    g_string_free(parser.pending, true);
+    return retval;
+}
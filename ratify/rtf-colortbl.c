@@ -21,6 +21,7 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include <glib.h>
 
 #include "rtf-deserialize.h"
+#include "rtf-sink.h"
 
 /* rtf-colortbl.c - \colortbl destination */
 
@@ -60,8 +61,8 @@ const DestinationInfo colortbl_destination = {
     colortbl_state_free
 };
 
-/* If the text contains a semicolon, add the RGB code to the color table and
-reset the color table state */
+/* If the text contains a semicolon, add the RGB code to the color table, tell
+the output sink about it, and reset the color table state */
 static void
 color_table_text(ParserContext *ctx)
 {
@@ -69,6 +70,8 @@ color_table_text(ParserContext *ctx)
     if (strchr(ctx->text->str, ';')) {
         char *color = g_strdup_printf("#%02x%02x%02x", state->red, state->green, state->blue);
         ctx->color_table = g_slist_append(ctx->color_table, color);
+        if (ctx->sink->define_color)
+            ctx->sink->define_color(ctx, g_slist_length(ctx->color_table) - 1, color);
         state->red = state->green = state->blue = 0;
     }
     g_string_truncate(ctx->text, 0);
@@ -0,0 +1,149 @@
+/* Copyright 2009, 2011, 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "init.h"
+#include "rtf-core.h"
+#include "rtf-deserialize.h"
+#include "rtf-sink.h"
+
+/**
+ * SECTION:rtf-core
+ * @title: RTF core
+ * @short_description: Parts of Ratify that don't require GTK
+ * @stability: Unstable
+ * @include: ratify/rtf-core.h
+ *
+ * The RTF parser is available separately from the GTK integration, in the
+ * <literal>ratify-core-2</literal> library, which depends only on GLib. It is
+ * meant for programs that process RTF without displaying it, such as
+ * conversion servers, and that would otherwise have to pay for starting up
+ * GTK.
+ *
+ * The functions documented here are also available in the full
+ * <literal>ratify-2</literal> library.
+ *
+ * The parser keeps no global state, so different documents may be parsed on
+ * different threads at the same time.
+ */
+
+/**
+ * rtf_error_quark:
+ *
+ * The error domain for RTF serializer errors.
+ *
+ * Returns: The string <quote>rtf-error-quark</quote> as a
+ * <link linkend="GQuark">GQuark</link>.
+ */
+GQuark
+rtf_error_quark(void)
+{
+    rtf_init();
+    return g_quark_from_static_string("rtf-error-quark");
+}
+
+/* Output sink for rtf_extract_text(), which only keeps the text. As in a text
+buffer, footnotes are collected separately and come after the document. */
+typedef struct {
+    GString *text;
+    GString *notes;
+} TextExtraction;
+
+static void
+extract_insert_text(ParserContext *ctx, const char *text, const Attributes *attr)
+{
+    TextExtraction *extraction = ctx->sink_data;
+    g_string_append(extraction->text, text);
+}
+
+static void
+extract_append_text(ParserContext *ctx, const char *text, const Attributes *attr)
+{
+    TextExtraction *extraction = ctx->sink_data;
+    g_string_append(extraction->notes, text);
+}
+
+static void
+extract_insert_at_line_start(ParserContext *ctx, const char *text)
+{
+    TextExtraction *extraction = ctx->sink_data;
+    size_t pos = extraction->text->len;
+    while (pos > 0 && extraction->text->str[pos - 1] != '\n')
+        pos--;
+    g_string_insert(extraction->text, pos, text);
+}
+
+static void
+extract_footnote_begin(ParserContext *ctx)
+{
+    TextExtraction *extraction = ctx->sink_data;
+    g_string_append_c(extraction->notes, '\n');
+}
+
+/* Fonts, colors, styles, and pictures are all ignored. Without a picture_begin
+function, picture data isn't even decoded. */
+static const OutputSink extract_text_sink = {
+    extract_insert_text,
+    extract_append_text,
+    extract_insert_at_line_start,
+    extract_footnote_begin
+};
+
+/**
+ * rtf_extract_text:
+ * @data: RTF code
+ * @length: length of @data in bytes, or -1 if @data is nul-terminated
+ * @error: return location for an error, or %NULL
+ *
+ * Extracts the plain text of an RTF document, as UTF-8. This is the same text
+ * that importing the document into a #GtkTextBuffer would produce, including
+ * footnotes, which come after the rest of the text; but no formatting is
+ * applied and pictures are skipped entirely, which makes this much faster. It
+ * is meant for applications such as search indexers, which only need the
+ * words.
+ *
+ * Returns: (transfer full): a newly allocated string containing the text of
+ * the document, or %NULL if @data could not be parsed, in which case @error is
+ * set.
+ */
+char *
+rtf_extract_text(const char *data, gssize length, GError **error)
+{
+    rtf_init();
+    g_return_val_if_fail(data != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    if (length < 0)
+        length = strlen(data);
+
+    TextExtraction extraction;
+    extraction.text = g_string_new("");
+    extraction.notes = g_string_new("");
+    if (!parse_rtf_with_sink(data, length, NULL, &extract_text_sink, &extraction, error)) {
+        g_string_free(extraction.text, true);
+        g_string_free(extraction.notes, true);
+        return NULL;
+    }
+
+    g_string_append_len(extraction.text, extraction.notes->str, extraction.notes->len);
+    g_string_free(extraction.notes, true);
+    return g_string_free(extraction.text, false);
+}
@@ -0,0 +1,280 @@
+#ifndef RATIFY_RTF_CORE_H
+#define RATIFY_RTF_CORE_H
+
+/* Copyright 2009, 2011, 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * RtfError:
+ * @RTF_ERROR_FAILED: A generic error.
+ * @RTF_ERROR_INVALID_RTF: The file was not correct RTF.
+ * @RTF_ERROR_MISSING_PARAMETER: A numerical parameter was missing from a
+ * control word which requires one.
+ * @RTF_ERROR_MISSING_BRACE: Not all groups were closed before the end of the
+ * file.
+ * @RTF_ERROR_EXTRA_CHARACTERS: There was junk after the last '}'.
+ * @RTF_ERROR_BAD_VERSION: The RTF file was an incompatible version.
+ * @RTF_ERROR_UNDEFINED_COLOR: A color was used which was not defined in the
+ * color table.
+ * @RTF_ERROR_UNDEFINED_FONT: A font was used which was not defined in the font
+ * table.
+ * @RTF_ERROR_UNDEFINED_STYLE: A style was used which was not defined in the
+ * stylesheet.
+ * @RTF_ERROR_BAD_HEX_CODE: Incorrect characters were encountered when expecting
+ * hexadecimal digits (0-9, A-F)
+ * @RTF_ERROR_BAD_PICT_TYPE: An invalid type of bitmap was specified.
+ * @RTF_ERROR_BAD_FONT_SIZE: A negative font size was specified.
+ * @RTF_ERROR_UNSUPPORTED_CHARSET: A character set with no iconv equivalent was
+ * specified.
+ *
+ * The different codes which can be thrown in the #RTF_ERROR domain.
+ */
+typedef enum {
+    RTF_ERROR_FAILED,
+    RTF_ERROR_INVALID_RTF,
+    RTF_ERROR_MISSING_PARAMETER,
+    RTF_ERROR_MISSING_BRACE,
+    RTF_ERROR_EXTRA_CHARACTERS,
+    RTF_ERROR_BAD_VERSION,
+    RTF_ERROR_UNDEFINED_COLOR,
+    RTF_ERROR_UNDEFINED_FONT,
+    RTF_ERROR_UNDEFINED_STYLE,
+    RTF_ERROR_BAD_HEX_CODE,
+    RTF_ERROR_BAD_PICT_TYPE,
+    RTF_ERROR_BAD_FONT_SIZE,
+    RTF_ERROR_UNSUPPORTED_CHARSET
+} RtfError;
+
+/**
+ * RTF_ERROR:
+ *
+ * The domain of errors raised by RTF processing in Ratify.
+ */
+#define RTF_ERROR rtf_error_quark()
+
+/**
+ * RtfUnderline:
+ * @RTF_UNDERLINE_NONE: No underline.
+ * @RTF_UNDERLINE_SINGLE: A single line. Other kinds of lines that Ratify
+ * doesn't distinguish, such as dotted lines, are also reported as this.
+ * @RTF_UNDERLINE_DOUBLE: A double line.
+ * @RTF_UNDERLINE_WAVE: A wavy line.
+ *
+ * Kinds of underlining in #RtfRunAttributes.
+ */
+typedef enum {
+    RTF_UNDERLINE_NONE,
+    RTF_UNDERLINE_SINGLE,
+    RTF_UNDERLINE_DOUBLE,
+    RTF_UNDERLINE_WAVE
+} RtfUnderline;
+
+/**
+ * RtfRunAttributes:
+ * @font_family: comma-separated list of font family names, or %NULL if the
+ * font is not known
+ * @size: font size in points, or 0 for the default size
+ * @foreground: text color as a <quote>#rrggbb</quote> string, or %NULL for the
+ * default color
+ * @background: background color, in the same format, or %NULL
+ * @highlight: paragraph background color, in the same format, or %NULL
+ * @bold: whether the text is bold
+ * @italic: whether the text is italic
+ * @smallcaps: whether the text is in small capitals
+ * @strikethrough: whether the text is struck through
+ * @subscript: whether the text is subscript
+ * @superscript: whether the text is superscript
+ * @hidden: whether the text is hidden
+ * @underline: the kind of underlining
+ * @rise: distance the text is raised above the baseline, in half-points;
+ * negative if the text is lowered
+ * @scale: horizontal scale of the text, in percent
+ * @language: Windows language code of the text, or 1024 if none
+ * @style: index of the text's style in the document's stylesheet, or -1
+ *
+ * Character formatting of a run of text, passed to the
+ * <structfield>on_run_attributes</structfield> callback of
+ * #RtfParseCallbacks. The strings are owned by the parser.
+ */
+typedef struct {
+    const char *font_family;
+    double size;
+    const char *foreground;
+    const char *background;
+    const char *highlight;
+    gboolean bold;
+    gboolean italic;
+    gboolean smallcaps;
+    gboolean strikethrough;
+    gboolean subscript;
+    gboolean superscript;
+    gboolean hidden;
+    RtfUnderline underline;
+    int rise;
+    int scale;
+    int language;
+    int style;
+} RtfRunAttributes;
+
+/**
+ * RtfPictureType:
+ * @RTF_PICTURE_EMF: Windows enhanced metafile.
+ * @RTF_PICTURE_PNG: PNG image.
+ * @RTF_PICTURE_JPEG: JPEG image.
+ * @RTF_PICTURE_MACPICT: QuickDraw picture.
+ * @RTF_PICTURE_OS2: OS/2 metafile.
+ * @RTF_PICTURE_WMF: Windows metafile.
+ * @RTF_PICTURE_DIB: Device-independent bitmap.
+ * @RTF_PICTURE_BMP: Device-dependent bitmap.
+ *
+ * Formats of the picture data in an RTF document.
+ */
+typedef enum {
+    RTF_PICTURE_EMF,
+    RTF_PICTURE_PNG,
+    RTF_PICTURE_JPEG,
+    RTF_PICTURE_MACPICT,
+    RTF_PICTURE_OS2,
+    RTF_PICTURE_WMF,
+    RTF_PICTURE_DIB,
+    RTF_PICTURE_BMP
+} RtfPictureType;
+
+/**
+ * RtfPictureInfo:
+ * @type: the format of the picture data
+ * @width: width of the picture in pixels, or -1 if not given
+ * @height: height of the picture in pixels, or -1 if not given
+ * @width_goal: width at which the picture should be displayed, in twips, or
+ * -1 if not given
+ * @height_goal: height at which the picture should be displayed, in twips, or
+ * -1 if not given
+ * @xscale: horizontal scale at which the picture should be displayed, in
+ * percent
+ * @yscale: vertical scale at which the picture should be displayed, in percent
+ *
+ * Description of an embedded picture, passed to the picture callbacks of
+ * #RtfParseCallbacks. The control words that describe a picture's size may
+ * come after the picture data, so the description is only final in the
+ * <structfield>on_picture_end</structfield> callback.
+ */
+typedef struct {
+    RtfPictureType type;
+    long width;
+    long height;
+    long width_goal;
+    long height_goal;
+    int xscale;
+    int yscale;
+} RtfPictureInfo;
+
+/**
+ * RtfParseCallbacks:
+ * @on_text: called with a piece of text, which is @length bytes of UTF-8
+ * starting at @text. The text is not nul-terminated, and points into the
+ * parser's buffers, so it is only valid during the call.
+ * @on_run_attributes: called before any text whose formatting is different
+ * from that of the previous text. Text with no formatting of its own, such as
+ * list numbering, has the formatting of the text that follows it, as in an
+ * imported #GtkTextBuffer.
+ * @on_paragraph_end: called at the end of each paragraph.
+ * @on_picture_bytes: called with each chunk of the data of an embedded
+ * picture, in order.
+ * @on_picture_end: called after the last chunk of picture data; @complete is
+ * %FALSE if the picture data was corrupt and should be discarded.
+ * @on_field: called when a field instruction has been read, with the name of
+ * the field, such as <quote>HYPERLINK</quote>, and its argument, such as the
+ * URL, or %NULL. The field result, if any, follows as text.
+ * @on_footnote_begin: called at the start of a footnote. The text of the
+ * footnote is reported in between this and
+ * <structfield>on_footnote_end</structfield>.
+ * @on_footnote_end: called at the end of a footnote.
+ *
+ * Functions called by rtf_parse() as it reads a document. Any of them may be
+ * %NULL. Each is passed the user data given to rtf_parse().
+ */
+typedef struct {
+    void (*on_text)(const char *text, gsize length, void *user_data);
+    void (*on_run_attributes)(const RtfRunAttributes *attributes, void *user_data);
+    void (*on_paragraph_end)(void *user_data);
+    void (*on_picture_bytes)(const RtfPictureInfo *info, const guint8 *data, gsize length, void *user_data);
+    void (*on_picture_end)(const RtfPictureInfo *info, gboolean complete, void *user_data);
+    void (*on_field)(const char *type, const char *argument, void *user_data);
+    void (*on_footnote_begin)(void *user_data);
+    void (*on_footnote_end)(void *user_data);
+} RtfParseCallbacks;
+
+typedef struct {
+    GFile *file;
+    char *text;
+    GError *error;
+} RtfBatchResult;
+
+typedef enum {
+    RTF_ALIGNMENT_LEFT,
+    RTF_ALIGNMENT_RIGHT,
+    RTF_ALIGNMENT_CENTER,
+    RTF_ALIGNMENT_JUSTIFIED
+} RtfAlignment;
+
+typedef struct {
+    RtfAlignment alignment;
+    int left_margin;
+    int right_margin;
+    int first_indent;
+    int space_before;
+    int space_after;
+} RtfParagraphAttributes;
+
+typedef struct _RtfWriter RtfWriter;
+typedef struct _RtfTemplate RtfTemplate;
+
+#ifdef G_HAVE_GNUC_VISIBILITY
+#define _RTF_API __attribute__((visibility("default")))
+#else
+#define _RTF_API
+#endif
+
+_RTF_API GQuark rtf_error_quark(void);
+_RTF_API char *rtf_extract_text(const char *data, gssize length, GError **error);
+_RTF_API GPtrArray *rtf_extract_text_batch(GFile * const *files, unsigned n_files, unsigned n_threads, GCancellable *cancellable);
+_RTF_API void rtf_batch_result_free(RtfBatchResult *result);
+_RTF_API gboolean rtf_parse(const char *data, gssize length, const RtfParseCallbacks *callbacks, void *user_data, GError **error);
+_RTF_API RtfWriter *rtf_writer_new(void);
+_RTF_API RtfWriter *rtf_writer_new_for_stream(GOutputStream *stream, GCancellable *cancellable);
+_RTF_API void rtf_writer_declare_font(RtfWriter *writer, const char *family);
+_RTF_API void rtf_writer_declare_color(RtfWriter *writer, const char *color);
+_RTF_API void rtf_writer_begin_paragraph(RtfWriter *writer, const RtfParagraphAttributes *attributes);
+_RTF_API void rtf_writer_push_format(RtfWriter *writer, const RtfRunAttributes *attributes);
+_RTF_API void rtf_writer_pop_format(RtfWriter *writer);
+_RTF_API void rtf_writer_text(RtfWriter *writer, const char *text, gssize length);
+_RTF_API void rtf_writer_picture(RtfWriter *writer, const RtfPictureInfo *info, const guint8 *data, gsize length, gboolean binary);
+_RTF_API GBytes *rtf_writer_finish(RtfWriter *writer);
+_RTF_API gboolean rtf_writer_finish_to_stream(RtfWriter *writer, GOutputStream *stream, GCancellable *cancellable, GError **error);
+_RTF_API void rtf_writer_free(RtfWriter *writer);
+_RTF_API RtfTemplate *rtf_template_new(const char *data, gssize length, GError **error);
+_RTF_API const char * const *rtf_template_get_field_names(RtfTemplate *tmpl);
+_RTF_API GBytes *rtf_template_render(RtfTemplate *tmpl, GHashTable *values);
+_RTF_API gboolean rtf_template_render_to_stream(RtfTemplate *tmpl, GHashTable *values, GOutputStream *stream, GCancellable *cancellable, GError **error);
+_RTF_API void rtf_template_free(RtfTemplate *tmpl);
+
+G_END_DECLS
+
+#endif  /* RATIFY_RTF_CORE_H */
@@ -16,18 +16,20 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include "config.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <gio/gio.h>
 #include <glib.h>
 #include <glib/gi18n-lib.h>
-#include <gtk/gtk.h>
 
-#include "rtf.h"
+#include "rtf-core.h"
 #include "rtf-document.h"
 #include "rtf-deserialize.h"
 #include "rtf-ignore.h"
+#include "rtf-scan.h"
 
 /* rtf-deserialize.c - Modular RTF reader. Works by maintaining a stack of
 destinations (for more information on what a destination is, read the excellent
@@ -52,12 +54,19 @@ words applies.
  * License: GPLv2
  */
 
+static void
+close_converter(GIConv converter)
+{
+    if (converter != (GIConv)-1)
+        g_iconv_close(converter);
+}
+
 /* Allocate a new parser context and initialize it with the main document
 destination */
 static ParserContext *
-parser_context_new(const char *rtftext, GtkTextBuffer *textbuffer, GtkTextIter *insert)
+parser_context_new(const char *rtftext, size_t length, GFile *base_dir, const OutputSink *sink, void *sink_data)
 {
-    g_assert(rtftext != NULL && textbuffer != NULL);
+    g_assert(rtftext != NULL && sink != NULL);
 
     ParserContext *ctx = g_slice_new0(ParserContext);
     ctx->codepage = -1;
@@ -67,16 +76,18 @@ parser_context_new(const char *rtftext, GtkTextBuffer *textbuffer, GtkTextIter *
     ctx->group_nesting_level = 0;
     ctx->color_table = NULL;
     ctx->font_table = NULL;
+    ctx->style_table = g_hash_table_new(NULL, NULL);
     ctx->footnote_number = 1;
+    ctx->base_dir = base_dir ? g_object_ref(base_dir) : NULL;
     ctx->rtftext = rtftext;
     ctx->pos = rtftext;
+    ctx->end = rtftext + length;
     ctx->convertbuffer = g_string_new("");
+    ctx->converters = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)close_converter);
     ctx->text = g_string_new("");
 
-    ctx->textbuffer = textbuffer;
-    ctx->tags = gtk_text_buffer_get_tag_table(textbuffer);
-    ctx->startmark = gtk_text_buffer_create_mark(textbuffer, NULL, insert, true);
-    ctx->endmark = gtk_text_buffer_create_mark(textbuffer, NULL, insert, false);
+    ctx->sink = sink;
+    ctx->sink_data = sink_data;
 
     Destination *dest = g_slice_new0(Destination);
     dest->info = &document_destination;
@@ -113,6 +124,14 @@ push_new_destination(ParserContext *ctx, const DestinationInfo *destinfo, void *
     else
         g_queue_push_head(dest->state_stack, dest->info->state_new());
     g_queue_push_head(ctx->destination_stack, dest);
+
+    /* Don't spend any time on the contents of a group that is ignored anyway;
+    the closing brace pops the destination as usual */
+    if (destinfo == &ignore_destination) {
+        const char *group_end = find_group_end(ctx->pos, ctx->end);
+        if (group_end != NULL)
+            ctx->pos = group_end;
+    }
 }
 
 /* Free destination */
@@ -125,11 +144,12 @@ destination_free(Destination *dest)
 }
 
 /* Free parser context */
-static void
+void
 parser_context_free(ParserContext *ctx)
 {
     g_assert(ctx != NULL);
     g_string_free(ctx->convertbuffer, true);
+    g_hash_table_unref(ctx->converters);
 
     g_slist_foreach(ctx->color_table, (GFunc)g_free, NULL);
     g_slist_free(ctx->color_table);
@@ -137,12 +157,12 @@ parser_context_free(ParserContext *ctx)
     g_slist_foreach(ctx->font_table, (GFunc)font_properties_free, NULL);
     g_slist_free(ctx->font_table);
 
+    g_hash_table_unref(ctx->style_table);
+    g_clear_object(&ctx->base_dir);
+
     g_queue_foreach(ctx->destination_stack, (GFunc)destination_free, NULL);
     g_queue_free(ctx->destination_stack);
 
-    gtk_text_buffer_delete_mark(ctx->textbuffer, ctx->startmark);
-    gtk_text_buffer_delete_mark(ctx->textbuffer, ctx->endmark);
-
     g_string_free(ctx->text, true);
 
     g_slice_free(ParserContext, ctx);
@@ -163,25 +183,25 @@ font does not exist */
 FontProperties *
 get_font_properties(ParserContext *ctx, int index)
 {
-    for (unsigned i = 0; i < g_slist_length(ctx->font_table); i++) {
-        FontProperties *properties = g_slist_nth_data(ctx->font_table, i);
+    for (GSList *iter = ctx->font_table; iter != NULL; iter = g_slist_next(iter)) {
+        FontProperties *properties = iter->data;
         if (properties != NULL && properties->index == index)
             return properties;
     }
     return NULL;
 }
 
-/* Return the name of a GIconv converter for the specified codepage, if it
-exists; otherwise NULL */
-static char *
-get_charset_for_codepage(int codepage)
+/* Open a GIConv converter to UTF-8 from the specified codepage, if one
+exists; otherwise return (GIConv)-1 */
+static GIConv
+open_converter_for_codepage(int codepage)
 {
     struct codepage_to_locale {
         int codepage;
         const char* locale;
     };
 
-    static struct codepage_to_locale ansicpgs[] = {
+    static const struct codepage_to_locale ansicpgs[] = {
         { 943, "SJIS" },
         { 950, "BIG5" },
         { 709, "ASMO_449" },
@@ -192,28 +212,37 @@ get_charset_for_codepage(int codepage)
     };
 
     if (codepage == -1)
-        return NULL;
+        return (GIConv)-1;
 
     /* First try the "CP<cpge>" charset */
     g_autofree char *charset = g_strdup_printf("CP%i", codepage);
     GIConv converter = g_iconv_open("UTF-8", charset);
-
-    if (converter != (GIConv)-1) {
-        g_iconv_close(converter);
-        return g_steal_pointer(&charset);
-    }
+    if (converter != (GIConv)-1)
+        return converter;
 
     /* If there is no such converter, try the hard-coded table */
     for (int i = 0; ansicpgs[i].codepage != 0; i++) {
         if (ansicpgs[i].codepage == codepage) {
             converter = g_iconv_open("UTF-8", ansicpgs[i].locale);
-            if (converter != (GIConv)-1) {
-                g_iconv_close(converter);
-                return g_strdup(ansicpgs[i].locale);
-            }
+            if (converter != (GIConv)-1)
+                return converter;
         }
     }
-    return NULL;
+    return (GIConv)-1;
+}
+
+/* Return the context's converter for the specified codepage. Opening a
+converter is expensive compared to converting one character, so each one is
+opened only once per context. */
+static GIConv
+get_converter(ParserContext *ctx, int codepage)
+{
+    void *converter;
+    if (!g_hash_table_lookup_extended(ctx->converters, GINT_TO_POINTER(codepage), NULL, &converter)) {
+        converter = open_converter_for_codepage(codepage);
+        g_hash_table_insert(ctx->converters, GINT_TO_POINTER(codepage), converter);
+    }
+    return (GIConv)converter;
 }
 
 /* Convert the character ch to UTF-8 and add to the context's buffer */
@@ -229,39 +258,46 @@ convert_hex_to_utf8(ParserContext *ctx, char ch, GError **error)
         codepage = dest->info->get_codepage(ctx);
     if (codepage == -1)
         codepage = ctx->codepage;
-    g_autofree char *charset = get_charset_for_codepage(codepage);
-    if (charset == NULL)
-        charset = get_charset_for_codepage(ctx->default_codepage);
-    if (charset == NULL) {
+    GIConv converter = get_converter(ctx, codepage);
+    if (converter == (GIConv)-1)
+        converter = get_converter(ctx, ctx->default_codepage);
+    if (converter == (GIConv)-1) {
         g_set_error(error, RTF_ERROR, RTF_ERROR_UNSUPPORTED_CHARSET, _("Character set %d is not supported"), (ctx->default_codepage == -1)? codepage : ctx->default_codepage);
         return false;
     }
 
-    /* Now see if there was any incompletely converted text left over from
-    previous characters */
-    g_autofree char *text_to_convert = NULL;
-    if (ctx->convertbuffer->len) {
-        g_string_append_c(ctx->convertbuffer, ch);
-        text_to_convert = g_strdup(ctx->convertbuffer->str);
-        g_string_truncate(ctx->convertbuffer, 0);
-    } else {
-        text_to_convert = g_strndup(&ch, 1);
-    }
-
-    GError *converterror = NULL;
-    g_autofree char *converted_text = g_convert_with_fallback(text_to_convert, -1, "UTF-8", charset, "?", NULL, NULL, &converterror);
-    if (converterror) {
-        /* If there is a "partial input" error, then save the text
-         in the convert buffer and retrieve it if there is another
-         consecutive \'xx code */
-        if (converterror->code == G_CONVERT_ERROR_PARTIAL_INPUT)
-            g_string_append(ctx->convertbuffer, text_to_convert);
-        else
-            g_warning(_("Conversion error: %s"), converterror->message);
-        g_clear_error(&converterror);
-    } else {
-        g_string_append(ctx->text, converted_text);
+    /* Convert the character along with any incompletely converted text left
+    over from previous characters */
+    g_string_append_c(ctx->convertbuffer, ch);
+    char *inbuf = ctx->convertbuffer->str;
+    size_t inbytes_left = ctx->convertbuffer->len;
+    g_iconv(converter, NULL, NULL, NULL, NULL);
+    while (inbytes_left > 0) {
+        char outbuf[32];
+        char *outptr = outbuf;
+        size_t outbytes_left = sizeof(outbuf);
+        size_t result = g_iconv(converter, &inbuf, &inbytes_left, &outptr, &outbytes_left);
+        int saved_errno = errno;
+        g_string_append_len(ctx->text, outbuf, outptr - outbuf);
+        if (result != (size_t)-1 || saved_errno == E2BIG)
+            continue;
+
+        if (saved_errno == EINVAL) {
+            /* Partial input: keep the rest in the convert buffer, and retrieve
+            it if there is another consecutive \'xx code */
+            break;
+        }
+        if (saved_errno == EILSEQ) {
+            /* Replace the invalid byte, as g_convert_with_fallback() would */
+            g_string_append_c(ctx->text, '?');
+            inbuf++;
+            inbytes_left--;
+            continue;
+        }
+        g_warning(_("Conversion error: %s"), g_strerror(saved_errno));
+        inbytes_left = 0;
     }
+    g_string_erase(ctx->convertbuffer, 0, ctx->convertbuffer->len - inbytes_left);
     return true;
 }
 
@@ -343,6 +379,29 @@ parse_int_parameter(ParserContext *ctx, int32_t *value)
     return true;
 }
 
+/* Reads the parameter of a \binN control word and returns in 'data' and
+'length' the N bytes of binary data that follow it, moving the current position
+past them. The data is not copied; it points into the RTF text. */
+static bool
+parse_binary_data(ParserContext *ctx, const uint8_t **data, size_t *length, GError **error)
+{
+    int32_t param;
+
+    if (!parse_int_parameter(ctx, &param)) {
+        g_set_error(error, RTF_ERROR, RTF_ERROR_MISSING_PARAMETER, _("Expected a number after control word '\\%s'"), "bin");
+        return false;
+    }
+    if (param < 0 || (size_t)param > (size_t)(ctx->end - ctx->pos)) {
+        g_set_error(error, RTF_ERROR, RTF_ERROR_INVALID_RTF, _("Invalid length %d for binary data"), param);
+        return false;
+    }
+
+    *data = (const uint8_t *)ctx->pos;
+    *length = param;
+    ctx->pos += param;
+    return true;
+}
+
 /* Skip one character or control word according to the RTF spec's convoluted
 skipping rules */
 bool
@@ -362,10 +421,17 @@ skip_character_or_control_word(ParserContext *ctx, GError **error)
                 return true;
             } else {
                 g_autofree char *word = NULL;
-                bool success = parse_control_word(ctx, &word, error);
+                if (!parse_control_word(ctx, &word, error))
+                    return false;
+                /* \binN and its data count as one character */
+                if (strcmp(word, "bin") == 0) {
+                    const uint8_t *data;
+                    size_t length;
+                    return parse_binary_data(ctx, &data, &length, error);
+                }
                 if (!parse_int_parameter(ctx, NULL) && *(ctx->pos) == ' ')
                     ctx->pos++;
-                return success;
+                return true;
             }
         } else if (*ctx->pos == '\n' || *ctx->pos == '\r') {
             ctx->pos++;
@@ -505,16 +571,19 @@ push_state(ParserContext *ctx)
     g_queue_push_head(dest->state_stack, dest->info->state_copy(g_queue_peek_head(dest->state_stack)));
 }
 
-/* The main parser loop */
+/* The main parser loop. Parses until the end of the document, or if stop is not
+NULL, until the position stop has been reached. */
 static bool
-parse_rtf(ParserContext *ctx, GError **error)
+parse_until(ParserContext *ctx, const char *stop, GError **error)
 {
     do {
-        if (*ctx->pos == '\0') {
+        if (ctx->pos >= ctx->end || *ctx->pos == '\0') {
             g_set_error(error, RTF_ERROR, RTF_ERROR_MISSING_BRACE, _("File ended unexpectedly"));
             return false;
         }
         if (*ctx->pos == '{') {
+            if (g_cancellable_set_error_if_cancelled(ctx->cancellable, error))
+                return false;
             ctx->pos++;
             push_state(ctx);
         } else if (*ctx->pos == '}') {
@@ -535,8 +604,23 @@ parse_rtf(ParserContext *ctx, GError **error)
                     return false;
             } else {
                 g_autofree char *word = NULL;
-                if (!parse_control_word(ctx, &word, error) || !do_word_action(ctx, word, error))
+                if (!parse_control_word(ctx, &word, error))
                     return false;
+                if (strcmp(word, "bin") == 0) {
+                    /* Hand the binary data to the current destination, if it
+                    wants it, without copying it */
+                    const uint8_t *data;
+                    size_t length;
+                    if (!parse_binary_data(ctx, &data, &length, error))
+                        return false;
+                    Destination *dest = g_queue_peek_head(ctx->destination_stack);
+                    if (dest->info->binary) {
+                        dest->info->flush(ctx);
+                        dest->info->binary(ctx, data, length);
+                    }
+                } else if (!do_word_action(ctx, word, error)) {
+                    return false;
+                }
             }
         } else if (*ctx->pos == '\n' || *ctx->pos == '\r') {
             /* Ignore newlines */
@@ -553,16 +637,27 @@ parse_rtf(ParserContext *ctx, GError **error)
             } else {
                 /* Add character to current string */
                 g_string_append_c(ctx->text, *ctx->pos);
+                if (G_UNLIKELY(ctx->text->len >= STREAM_CHUNK_SIZE)) {
+                    Destination *dest = g_queue_peek_head(ctx->destination_stack);
+                    if (dest->info->stream_text)
+                        dest->info->flush(ctx);
+                }
             }
             ctx->pos++;
         }
 
-    } while (ctx->group_nesting_level > 0);
+    } while (ctx->group_nesting_level > 0 && (stop == NULL || ctx->pos < stop));
+
+    return true;
+}
 
-    /* Check that there isn't anything but whitespace after the last brace */
-    while (isspace(*ctx->pos))
+/* Check that there isn't anything but whitespace after the last brace */
+static bool
+check_document_end(ParserContext *ctx, GError **error)
+{
+    while (ctx->pos < ctx->end && isspace(*ctx->pos))
         ctx->pos++;
-    if (*ctx->pos != '\0') {
+    if (ctx->pos < ctx->end && *ctx->pos != '\0') {
         g_set_error(error, RTF_ERROR, RTF_ERROR_EXTRA_CHARACTERS, _("Characters found after final closing brace"));
         return false;
     }
@@ -570,15 +665,408 @@ parse_rtf(ParserContext *ctx, GError **error)
     return true;
 }
 
-/* This function is called by gtk_text_buffer_deserialize() */
-bool
-rtf_deserialize(GtkTextBuffer *register_buffer, GtkTextBuffer *content_buffer, GtkTextIter *iter, const char *data, size_t length, bool create_tags, void *user_data, GError **error)
+/* Make a filename found in the document absolute. This doesn't depend on the
+current directory of the process, which other threads may be relying on. */
+char *
+resolve_filename(ParserContext *ctx, const char *filename)
+{
+    if (g_path_is_absolute(filename))
+        return g_strdup(filename);
+
+    if (ctx->base_dir == NULL) {
+        g_autofree char *cwd = g_get_current_dir();
+        return g_build_filename(cwd, filename, NULL);
+    }
+
+    g_autoptr(GFile) file = g_file_resolve_relative_path(ctx->base_dir, filename);
+    char *path = g_file_get_path(file);
+    if (path == NULL) {
+        /* The base directory has no local path, e.g. it is a remote URI */
+        g_autofree char *uri = g_file_get_uri(file);
+        g_warning(_("Could not resolve '%s' to a local file"), uri);
+        return g_strdup(filename);
+    }
+    return path;
+}
+
+static bool
+check_rtf_signature(const char *data, size_t length, GError **error)
 {
-    if (!g_str_has_prefix(data, "{\\rtf")) {
+    if (length < 5 || strncmp(data, "{\\rtf", 5) != 0) {
         g_set_error(error, RTF_ERROR, RTF_ERROR_INVALID_RTF, _("RTF format must begin with '{\\rtf'"));
         return false;
     }
+    return true;
+}
+
+/* Parse length bytes of RTF code, handing the document to sink. Filenames in
+the document are relative to base_dir, if it is not NULL. */
+bool
+parse_rtf_with_sink(const char *data, size_t length, GFile *base_dir, const OutputSink *sink, void *sink_data, GError **error)
+{
+    if (!check_rtf_signature(data, length, error))
+        return false;
+
+    g_autoptr(ParserContext) ctx = parser_context_new(data, length, base_dir, sink, sink_data);
+    return parse_until(ctx, NULL, error) && check_document_end(ctx, error);
+}
+
+/* Parsing a document a piece at a time: parse_rtf_begin() returns a new parser
+context for the RTF code, and each call to parse_rtf_step() parses about
+max_bytes more of it, until done is set. Free the context afterwards with
+parser_context_free(). */
+ParserContext *
+parse_rtf_begin(const char *data, size_t length, GFile *base_dir, const OutputSink *sink, void *sink_data, GError **error)
+{
+    if (!check_rtf_signature(data, length, error))
+        return NULL;
+    return parser_context_new(data, length, base_dir, sink, sink_data);
+}
+
+bool
+parse_rtf_step(ParserContext *ctx, size_t max_bytes, bool *done, GError **error)
+{
+    const char *stop = NULL;
+    if (max_bytes < (size_t)(ctx->end - ctx->pos))
+        stop = ctx->pos + max_bytes;
+
+    *done = false;
+    if (!parse_until(ctx, stop, error))
+        return false;
+    if (ctx->group_nesting_level > 0)
+        return true;
+    *done = true;
+    return check_document_end(ctx, error);
+}
+
+/* Parsing large documents in parallel. The document is split into segments at
+paragraphs that reset the formatting (see find_split_points()), and each segment
+is parsed on its own thread into its own sink data, starting from the state that
+the parser was in at the end of the document's header. That guess is checked
+afterwards, in order, against the state at the end of the segment before; the
+few segments for which it was wrong are parsed again from the right state. */
+
+/* Documents are only split into segments of at least this many bytes, since
+starting a segment has a cost */
+#define SEGMENT_MIN_LENGTH (4 * 1024 * 1024)
+
+typedef struct {
+    const char *start;
+    const char *stop; /* NULL for the last segment */
+    ParserContext *ctx;
+    void *sink_data;
+    int start_footnote_number;
+    /* Whether the segment was parsed without errors, and ended up at the split
+    point in the document group */
+    bool parsed;
+    GError *error;
+} Segment;
+
+typedef struct {
+    const SegmentedSink *sink;
+    const ParserContext *header;
+    Segment *segments;
+    int n_segments;
+    volatile int next_segment;
+} SegmentedParse;
+
+static FontProperties *
+font_properties_copy(const FontProperties *fontprop)
+{
+    FontProperties *copy = g_slice_dup(FontProperties, fontprop);
+    copy->font_name = g_strdup(fontprop->font_name);
+    return copy;
+}
+
+/* Allocate a new parser context at pos, in the same state as template, which
+must be in the main document destination */
+static ParserContext *
+parser_context_new_from(const ParserContext *template, const char *pos, void *sink_data)
+{
+    ParserContext *ctx = parser_context_new(template->rtftext, template->end - template->rtftext, template->base_dir, template->sink, sink_data);
+    ctx->codepage = template->codepage;
+    ctx->default_codepage = template->default_codepage;
+    ctx->default_font = template->default_font;
+    ctx->default_language = template->default_language;
+    ctx->group_nesting_level = template->group_nesting_level;
+    ctx->footnote_number = template->footnote_number;
+    ctx->cancellable = template->cancellable;
+    ctx->color_table = g_slist_copy_deep(template->color_table, (GCopyFunc)g_strdup, NULL);
+    ctx->font_table = g_slist_copy_deep(template->font_table, (GCopyFunc)font_properties_copy, NULL);
+    GHashTableIter iter;
+    void *style;
+    g_hash_table_iter_init(&iter, template->style_table);
+    while (g_hash_table_iter_next(&iter, &style, NULL))
+        g_hash_table_add(ctx->style_table, style);
+    ctx->pos = pos;
+
+    /* Replace the blank document state with a copy of the template's */
+    Destination *dest = g_queue_peek_head(ctx->destination_stack);
+    const Destination *template_dest = g_queue_peek_head(template->destination_stack);
+    g_queue_foreach(dest->state_stack, (GFunc)dest->info->state_free, NULL);
+    g_queue_clear(dest->state_stack);
+    for (GList *item = template_dest->state_stack->head; item != NULL; item = item->next)
+        g_queue_push_tail(dest->state_stack, dest->info->state_copy(item->data));
+
+    return ctx;
+}
+
+/* Check that ctx stopped at a split point, directly in the document group, and
+hand over the text before it */
+static bool
+finish_at_split_point(ParserContext *ctx, const char *stop)
+{
+    if (ctx->pos != stop || ctx->group_nesting_level != 1 ||
+        g_queue_get_length(ctx->destination_stack) != 1 || ctx->convertbuffer->len != 0)
+        return false;
+
+    Destination *dest = g_queue_peek_head(ctx->destination_stack);
+    dest->info->flush(ctx);
+    return true;
+}
+
+static bool
+attributes_identical(const Attributes *a, const Attributes *b)
+{
+    if ((a->tabs == NULL) != (b->tabs == NULL))
+        return false;
+    if (a->tabs && (a->tabs->len != b->tabs->len ||
+        memcmp(a->tabs->data, b->tabs->data, a->tabs->len * sizeof(int)) != 0))
+        return false;
+
+    return a->style == b->style &&
+        a->justification == b->justification &&
+        a->pardirection == b->pardirection &&
+        a->space_before == b->space_before &&
+        a->space_after == b->space_after &&
+        a->ignore_space_before == b->ignore_space_before &&
+        a->ignore_space_after == b->ignore_space_after &&
+        a->left_margin == b->left_margin &&
+        a->right_margin == b->right_margin &&
+        a->indent == b->indent &&
+        a->leading == b->leading &&
+        a->foreground == b->foreground &&
+        a->background == b->background &&
+        a->highlight == b->highlight &&
+        a->font == b->font &&
+        a->size == b->size &&
+        a->italic == b->italic &&
+        a->bold == b->bold &&
+        a->smallcaps == b->smallcaps &&
+        a->strikethrough == b->strikethrough &&
+        a->subscript == b->subscript &&
+        a->superscript == b->superscript &&
+        a->invisible == b->invisible &&
+        a->underline == b->underline &&
+        a->chardirection == b->chardirection &&
+        a->language == b->language &&
+        a->rise == b->rise &&
+        a->scale == b->scale &&
+        a->unicode_skip == b->unicode_skip &&
+        a->unicode_ignore == b->unicode_ignore;
+}
+
+/* The formatting state at a split point, after the \pard\plain there */
+static void
+get_state_after_reset(ParserContext *ctx, Attributes *attr)
+{
+    *attr = *(Attributes *)get_state(ctx);
+    attr->tabs = NULL; /* Reset by \pard anyway */
+    doc_pard(ctx, attr, NULL);
+    doc_plain(ctx, attr, NULL);
+}
+
+/* Whether two color tables, lists of "#rrggbb" strings, have the same colors
+in the same order. The body of a document may redefine the color table. */
+static bool
+color_tables_equal(GSList *a, GSList *b)
+{
+    for (; a && b; a = a->next, b = b->next) {
+        if (strcmp(a->data, b->data) != 0)
+            return false;
+    }
+    return a == NULL && b == NULL;
+}
+
+/* Whether two sets of defined style indices have the same members */
+static bool
+style_tables_equal(GHashTable *a, GHashTable *b)
+{
+    if (g_hash_table_size(a) != g_hash_table_size(b))
+        return false;
+
+    GHashTableIter iter;
+    void *style;
+    g_hash_table_iter_init(&iter, a);
+    while (g_hash_table_iter_next(&iter, &style, NULL)) {
+        if (!g_hash_table_contains(b, style))
+            return false;
+    }
+    return true;
+}
+
+/* Whether parsing a segment from the state guess gives the same result as
+parsing it from the state actual. The segment starts with \pard\plain, so
+the formatting only has to be the same after that. The footnote number only
+matters if the segment has footnotes. */
+static bool
+same_state_at_split_point(ParserContext *guess, ParserContext *actual, bool compare_footnotes)
+{
+    if (guess->codepage != actual->codepage ||
+        guess->default_codepage != actual->default_codepage ||
+        guess->default_font != actual->default_font ||
+        guess->default_language != actual->default_language ||
+        (compare_footnotes && guess->footnote_number != actual->footnote_number))
+        return false;
+
+    if (!color_tables_equal(guess->color_table, actual->color_table) ||
+        !style_tables_equal(guess->style_table, actual->style_table))
+        return false;
+    GSList *guess_font = guess->font_table, *actual_font = actual->font_table;
+    for (; guess_font && actual_font; guess_font = guess_font->next, actual_font = actual_font->next) {
+        const FontProperties *a = guess_font->data, *b = actual_font->data;
+        if (a->index != b->index || a->codepage != b->codepage)
+            return false;
+    }
+    if (guess_font || actual_font)
+        return false;
+
+    Attributes guess_attr, actual_attr;
+    get_state_after_reset(guess, &guess_attr);
+    get_state_after_reset(actual, &actual_attr);
+    return attributes_identical(&guess_attr, &actual_attr);
+}
+
+static void
+segment_clear(SegmentedParse *parse, Segment *segment)
+{
+    g_clear_pointer(&segment->ctx, parser_context_free);
+    if (segment->sink_data)
+        parse->sink->free_data(g_steal_pointer(&segment->sink_data));
+    g_clear_error(&segment->error);
+    segment->parsed = false;
+}
+
+static void
+parse_segment(SegmentedParse *parse, Segment *segment, const ParserContext *start_state)
+{
+    segment->sink_data = parse->sink->new_data();
+    segment->ctx = parser_context_new_from(start_state, segment->start, segment->sink_data);
+    segment->start_footnote_number = segment->ctx->footnote_number;
+
+    if (!parse_until(segment->ctx, segment->stop, &segment->error))
+        return;
+    if (segment->stop)
+        segment->parsed = finish_at_split_point(segment->ctx, segment->stop);
+    else
+        segment->parsed = check_document_end(segment->ctx, &segment->error);
+}
 
-    g_autoptr(ParserContext) ctx = parser_context_new(data, content_buffer, iter);
-    return parse_rtf(ctx, error);
+static void *
+segment_worker(SegmentedParse *parse)
+{
+    int ix;
+    while ((ix = g_atomic_int_add(&parse->next_segment, 1)) < parse->n_segments)
+        parse_segment(parse, &parse->segments[ix], parse->header);
+    return NULL;
+}
+
+static void *
+parse_rtf_sequentially(const char *data, size_t length, GFile *base_dir, GCancellable *cancellable, const SegmentedSink *sink, GError **error)
+{
+    void *sink_data = sink->new_data();
+    g_autoptr(ParserContext) ctx = parser_context_new(data, length, base_dir, sink->sink, sink_data);
+    ctx->cancellable = cancellable;
+    if (!parse_until(ctx, NULL, error) || !check_document_end(ctx, error)) {
+        sink->free_data(sink_data);
+        return NULL;
+    }
+    return sink_data;
+}
+
+/* Parse length bytes of RTF code into new sink data, using all the processors
+if the document is large enough. Returns NULL if the code couldn't be parsed, or
+if cancellable was cancelled. */
+void *
+parse_rtf_in_segments(const char *data, size_t length, GFile *base_dir, GCancellable *cancellable, const SegmentedSink *sink, GError **error)
+{
+    if (!check_rtf_signature(data, length, error))
+        return NULL;
+
+    unsigned n_threads = g_get_num_processors();
+    if (n_threads < 2 || length < 2 * SEGMENT_MIN_LENGTH)
+        return parse_rtf_sequentially(data, length, base_dir, cancellable, sink, error);
+
+    g_autoptr(GPtrArray) points = find_split_points(data, data + length, SEGMENT_MIN_LENGTH);
+    if (points->len < 2)
+        return parse_rtf_sequentially(data, length, base_dir, cancellable, sink, error);
+
+    /* Parse the header as usual, up to the first split point */
+    void *sink_data = sink->new_data();
+    ParserContext *header = parser_context_new(data, length, base_dir, sink->sink, sink_data);
+    header->cancellable = cancellable;
+    if (!parse_until(header, points->pdata[0], error)) {
+        parser_context_free(header);
+        sink->free_data(sink_data);
+        return NULL;
+    }
+    if (!finish_at_split_point(header, points->pdata[0])) {
+        parser_context_free(header);
+        sink->free_data(sink_data);
+        return parse_rtf_sequentially(data, length, base_dir, cancellable, sink, error);
+    }
+
+    SegmentedParse parse = { sink, header };
+    parse.n_segments = points->len;
+    parse.segments = g_new0(Segment, parse.n_segments);
+    for (int ix = 0; ix < parse.n_segments; ix++) {
+        parse.segments[ix].start = points->pdata[ix];
+        parse.segments[ix].stop = ix + 1 < parse.n_segments ? points->pdata[ix + 1] : NULL;
+    }
+
+    /* The calling thread does its share of the work too */
+    n_threads = MIN(n_threads, (unsigned)parse.n_segments);
+    g_autofree GThread **threads = g_new0(GThread *, n_threads);
+    for (unsigned ix = 1; ix < n_threads; ix++)
+        threads[ix] = g_thread_new("rtf-segment", (GThreadFunc)segment_worker, &parse);
+    segment_worker(&parse);
+    for (unsigned ix = 1; ix < n_threads; ix++)
+        g_thread_join(threads[ix]);
+
+    /* Join the segments in order, parsing any of them again that started from
+    the wrong state */
+    bool ok = true, split = true;
+    ParserContext *previous = header;
+    for (int ix = 0; ix < parse.n_segments; ix++) {
+        Segment *segment = &parse.segments[ix];
+        bool has_footnotes = segment->error || segment->ctx->footnote_number != segment->start_footnote_number;
+        if (ix > 0 && !same_state_at_split_point(header, previous, has_footnotes)) {
+            segment_clear(&parse, segment);
+            parse_segment(&parse, segment, previous);
+        }
+        if (segment->error) {
+            g_propagate_error(error, g_steal_pointer(&segment->error));
+            ok = false;
+            break;
+        }
+        if (!segment->parsed) {
+            split = false;
+            break;
+        }
+        sink->append_data(sink_data, segment->sink_data);
+        previous = segment->ctx;
+    }
+
+    for (int ix = 0; ix < parse.n_segments; ix++)
+        segment_clear(&parse, &parse.segments[ix]);
+    g_free(parse.segments);
+    parser_context_free(header);
+
+    if (!ok || !split) {
+        sink->free_data(sink_data);
+        /* The document can't be split where it seemed it could, for example
+        because a \u character swallowed the \pard at a split point */
+        return ok ? parse_rtf_sequentially(data, length, base_dir, cancellable, sink, error) : NULL;
+    }
+    return sink_data;
 }
@@ -16,9 +16,10 @@ You should have received a copy of the GNU Lesser General Public License along
 with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <stdbool.h>
+#include <stdint.h>
 
+#include <gio/gio.h>
 #include <glib.h>
-#include <gtk/gtk.h>
 
 #include "rtf-state.h"
 
@@ -26,10 +27,10 @@ typedef struct _ParserContext ParserContext;
 typedef struct _ControlWord ControlWord;
 typedef struct _Destination Destination;
 typedef struct _DestinationInfo DestinationInfo;
+typedef struct _OutputSink OutputSink;
 
-#define POINTS_TO_PANGO(pts) ((int)(pts * PANGO_SCALE))
-#define HALF_POINTS_TO_PANGO(halfpts) (halfpts * PANGO_SCALE / 2)
-#define TWIPS_TO_PANGO(twips) (twips * PANGO_SCALE / 20)
+/* Amount of pending text after which a streaming destination is flushed */
+#define STREAM_CHUNK_SIZE 65536
 
 struct _ParserContext {
     /* Header information */
@@ -45,22 +46,31 @@ struct _ParserContext {
     /* Tables */
     GSList *color_table;
     GSList *font_table;
+    GHashTable *style_table; /* Set of defined style indices */
 
     /* Other document attributes */
     int footnote_number;
+    /* Directory that filenames in the document are relative to, or NULL for
+    the current directory */
+    GFile *base_dir;
+    /* Checked at the start of every group; may be NULL */
+    GCancellable *cancellable;
 
     /* Text information */
     const char *rtftext;
     const char *pos;
+    /* End of the RTF text; \bin data may contain NUL bytes before this */
+    const char *end;
     GString *convertbuffer;
+    /* Converters to UTF-8, by code page, opened the first time each code page
+    is needed; (GIConv)-1 if there is none */
+    GHashTable *converters;
     /* Text waiting for insertion */
     GString *text;
 
-    /* Output references */
-    GtkTextBuffer *textbuffer;
-    GtkTextTagTable *tags;
-    GtkTextMark *startmark;
-    GtkTextMark *endmark;
+    /* Where the parsed document goes; see rtf-sink.h */
+    const OutputSink *sink;
+    void *sink_data;
 };
 
 struct _DestinationInfo {
@@ -71,6 +81,12 @@ struct _DestinationInfo {
     StateFreeFunc *state_free;
     void (*cleanup)(ParserContext *);
     int (*get_codepage)(ParserContext *);
+    /* If true, pending text is flushed every STREAM_CHUNK_SIZE bytes instead of
+    being held until the next control word or group boundary */
+    bool stream_text;
+    /* Called with the raw bytes following a \binN control word, pointing
+    directly into the RTF text. If NULL, binary data is skipped. */
+    void (*binary)(ParserContext *, const uint8_t *, size_t);
 };
 
 typedef enum {
@@ -103,9 +119,24 @@ typedef struct {
     char *font_name;
 } FontProperties;
 
+/* An output sink whose output can be collected in pieces and joined together
+afterwards, so that parts of a document can be parsed in parallel */
+typedef struct {
+    const OutputSink *sink;
+    void *(*new_data)(void);
+    void (*free_data)(void *sink_data);
+    /* Add the output collected in segment_data to the end of sink_data */
+    void (*append_data)(void *sink_data, void *segment_data);
+} SegmentedSink;
+
 void push_new_destination(ParserContext *ctx, const DestinationInfo *destinfo, void *state_to_copy);
 void *get_state(ParserContext *ctx);
 FontProperties *get_font_properties(ParserContext *ctx, int index);
 void flush_text(ParserContext *ctx);
 bool skip_character_or_control_word(ParserContext *ctx, GError **error);
-bool rtf_deserialize(GtkTextBuffer *register_buffer, GtkTextBuffer *content_buffer, GtkTextIter *iter, const char *data, size_t length, bool create_tags, void *user_data, GError **error);
+char *resolve_filename(ParserContext *ctx, const char *filename);
+bool parse_rtf_with_sink(const char *data, size_t length, GFile *base_dir, const OutputSink *sink, void *sink_data, GError **error);
+ParserContext *parse_rtf_begin(const char *data, size_t length, GFile *base_dir, const OutputSink *sink, void *sink_data, GError **error);
+bool parse_rtf_step(ParserContext *ctx, size_t max_bytes, bool *done, GError **error);
+void parser_context_free(ParserContext *ctx);
+void *parse_rtf_in_segments(const char *data, size_t length, GFile *base_dir, GCancellable *cancellable, const SegmentedSink *sink, GError **error);
@@ -21,13 +21,11 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <glib.h>
 #include <glib/gi18n-lib.h>
-#include <gtk/gtk.h>
-#include <pango/pango.h>
 
-#include "rtf.h"
+#include "rtf-core.h"
 #include "rtf-deserialize.h"
 #include "rtf-document.h"
-#include "rtf-langcode.h"
+#include "rtf-sink.h"
 #include "rtf-state.h"
 
 /* rtf-document.c - Main document destination. This destination is not entirely
@@ -80,113 +78,6 @@ const DestinationInfo document_destination = {
     document_get_codepage
 };
 
-/* Space-saving function for apply_attributes() */
-static void
-apply_attribute(ParserContext *ctx, GtkTextIter *start, GtkTextIter *end, char *format, ...)
-{
-    va_list args;
-
-    va_start(args, format);
-    g_autofree char *tagname = g_strdup_vprintf(format, args);
-    va_end(args);
-    gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, tagname, start, end);
-}
-
-/* Apply GtkTextTags to the range from start to end, depending on the current
-attributes 'attr'. */
-void
-apply_attributes(ParserContext *ctx, Attributes *attr, GtkTextIter *start, GtkTextIter *end)
-{
-    /* Tags with parameters */
-    if (attr->style != -1)
-        apply_attribute(ctx, start, end, "rtf-style-%i", attr->style);
-    if (attr->foreground != -1)
-        apply_attribute(ctx, start, end, "rtf-foreground-%i", attr->foreground);
-    if (attr->background != -1)
-        apply_attribute(ctx, start, end, "rtf-background-%i", attr->background);
-    if (attr->highlight != -1)
-        apply_attribute(ctx, start, end, "rtf-highlight-%i", attr->highlight);
-    if (attr->size != 0.0)
-        apply_attribute(ctx, start, end, "rtf-fontsize-%.3f", attr->size);
-    if (attr->space_before != 0 && !attr->ignore_space_before)
-        apply_attribute(ctx, start, end, "rtf-space-before-%i", attr->space_before);
-    if (attr->space_after != 0 && !attr->ignore_space_after)
-        apply_attribute(ctx, start, end, "rtf-space-after-%i", attr->space_after);
-    if (attr->left_margin != 0)
-        apply_attribute(ctx, start, end, "rtf-left-margin-%i", attr->left_margin);
-    if (attr->right_margin != 0)
-        apply_attribute(ctx, start, end, "rtf-right-margin-%i", attr->right_margin);
-    if (attr->indent != 0)
-        apply_attribute(ctx, start, end, "rtf-indent-%i", attr->indent);
-    if (attr->invisible)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-invisible", start, end);
-    if (attr->language != 1024)
-        apply_attribute(ctx, start, end, "rtf-language-%i", attr->language);
-    if (attr->rise != 0)
-        apply_attribute(ctx, start, end, "rtf-%s-%i",
-            (attr->rise > 0)? "up" : "down",
-            ((attr->rise > 0)? 1 : -1) * attr->rise);
-    if (attr->leading != 0)
-        apply_attribute(ctx, start, end, "rtf-leading-%i", attr->leading);
-    if (attr->scale != 100)
-        apply_attribute(ctx, start, end, "rtf-scale-%i", attr->scale);
-    /* Boolean tags */
-    if (attr->italic)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-italic", start, end);
-    if (attr->bold)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-bold", start, end);
-    if (attr->smallcaps)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-smallcaps", start, end);
-    if (attr->strikethrough)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-strikethrough", start, end);
-    if (attr->underline == PANGO_UNDERLINE_SINGLE)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-underline-single", start, end);
-    if (attr->underline == PANGO_UNDERLINE_DOUBLE)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-underline-double", start, end);
-    if (attr->underline == PANGO_UNDERLINE_ERROR)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-underline-wave", start, end);
-    if (attr->justification == GTK_JUSTIFY_LEFT)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-left", start, end);
-    if (attr->justification == GTK_JUSTIFY_RIGHT)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-right", start, end);
-    if (attr->justification == GTK_JUSTIFY_CENTER)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-center", start, end);
-    if (attr->justification == GTK_JUSTIFY_FILL)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-justified", start, end);
-    if (attr->pardirection == GTK_TEXT_DIR_RTL)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-right-to-left", start, end);
-    if (attr->pardirection == GTK_TEXT_DIR_LTR)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-left-to-right", start, end);
-    /* Character-formatting direction overrides paragraph formatting */
-    if (attr->chardirection == GTK_TEXT_DIR_RTL)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-right-to-left", start, end);
-    if (attr->chardirection == GTK_TEXT_DIR_LTR)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-left-to-right", start, end);
-    if (attr->subscript)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-subscript", start, end);
-    if (attr->superscript)
-        gtk_text_buffer_apply_tag_by_name(ctx->textbuffer, "rtf-superscript", start, end);
-    /* Special */
-    if (attr->font != -1)
-        apply_attribute(ctx, start, end, "rtf-font-%i", attr->font);
-    else if (ctx->default_font != -1 && g_slist_length(ctx->font_table) > (unsigned)ctx->default_font)
-        apply_attribute(ctx, start, end, "rtf-font-%i", ctx->default_font);
-    if (attr->tabs != NULL) {
-        /* Create a separate tag for each PangoTabArray */
-        g_autofree char *tagname = g_strdup_printf("rtf-tabs-%p", attr->tabs);
-        GtkTextTag *tag;
-        if ((tag = gtk_text_tag_table_lookup(ctx->tags, tagname)) == NULL) {
-            tag = gtk_text_tag_new(tagname);
-            g_object_set(tag,
-                         "tabs", attr->tabs,
-                         "tabs-set", true,
-                         NULL);
-            gtk_text_tag_table_add(ctx->tags, tag);
-        }
-        gtk_text_buffer_apply_tag(ctx->textbuffer, tag, start, end);
-    }
-}
-
 /* Inserts the pending text with the current attributes. This function is called
 whenever a group is opened or closed, or a control word specifies to flush the
 pending text. */
@@ -205,18 +96,8 @@ document_text(ParserContext *ctx)
         text[length] = '\0';
 
     Attributes *attr = get_state(ctx);
-    if (!attr->unicode_ignore) {
-        GtkTextIter start, end;
-        gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &end, ctx->endmark); /* shouldn't invalidate end, but it does? */
-        gtk_text_buffer_insert(ctx->textbuffer, &end, text, -1);
-        gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &start, ctx->startmark);
-        gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &end, ctx->endmark);
-
-        apply_attributes(ctx, attr, &start, &end);
-
-        /* Move the two marks back together again */
-        gtk_text_buffer_move_mark(ctx->textbuffer, ctx->startmark, &end);
-    }
+    if (!attr->unicode_ignore && ctx->sink->insert_text)
+        ctx->sink->insert_text(ctx, text, attr);
     g_string_truncate(ctx->text, 0);
 }
 
@@ -252,11 +133,6 @@ doc_ansicpg(ParserContext *ctx, Attributes *attr, int32_t codepage, GError **err
 bool
 doc_b(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-bold")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-bold");
-        g_object_set(tag, "weight", PANGO_WEIGHT_BOLD, NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
     attr->bold = (param != 0);
     return true;
 }
@@ -271,16 +147,6 @@ doc_cb(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
         return false;
     }
 
-    g_autofree char *tagname = g_strdup_printf("rtf-background-%i", param);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "background", color,
-                     "background-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->background = param;
     return true;
 }
@@ -295,16 +161,6 @@ doc_cf(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
         return false;
     }
 
-    g_autofree char *tagname = g_strdup_printf("rtf-foreground-%i", param);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "foreground", color,
-                     "foreground-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->foreground = param;
     return true;
 }
@@ -317,16 +173,6 @@ doc_charscalex(ParserContext *ctx, Attributes *attr, int32_t scale, GError **err
         return false;
     }
 
-    g_autofree char *tagname = g_strdup_printf("rtf-scale-%i", scale);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "scale", (double)scale / 100.0,
-                     "scale-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->scale = scale;
     return true;
 }
@@ -356,18 +202,6 @@ doc_deflang(ParserContext *ctx, Attributes *attr, int32_t language, GError **err
 bool
 doc_dn(ParserContext *ctx, Attributes *attr, int32_t halfpoints, GError **error)
 {
-    if (halfpoints != 0) {
-        g_autofree char *tagname = g_strdup_printf("rtf-down-%i", halfpoints);
-        if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-            GtkTextTag *tag = gtk_text_tag_new(tagname);
-            g_object_set(tag,
-                         "rise", HALF_POINTS_TO_PANGO(-halfpoints),
-                         "rise-set", true,
-                         NULL);
-            gtk_text_tag_table_add(ctx->tags, tag);
-        }
-    }
-
     attr->rise = -halfpoints;
     return true;
 }
@@ -387,16 +221,6 @@ doc_f(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 bool
 doc_fi(ParserContext *ctx, Attributes *attr, int32_t twips, GError **error)
 {
-    g_autofree char *tagname = g_strdup_printf("rtf-indent-%i", twips);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "indent", PANGO_PIXELS(TWIPS_TO_PANGO(twips)),
-                     "indent-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->indent = twips;
     return true;
 }
@@ -404,15 +228,8 @@ doc_fi(ParserContext *ctx, Attributes *attr, int32_t twips, GError **error)
 static bool
 doc_footnote(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    GtkTextIter iter;
-
-    /* Insert a newline at the end of the document, to separate the coming
-    footnote */
-    gtk_text_buffer_get_end_iter(ctx->textbuffer, &iter);
-    gtk_text_buffer_insert(ctx->textbuffer, &iter, "\n", -1);
-    /* Move the start and end marks back together */
-    gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &iter, ctx->startmark);
-    gtk_text_buffer_move_mark(ctx->textbuffer, ctx->endmark, &iter);
+    if (ctx->sink->footnote_begin)
+        ctx->sink->footnote_begin(ctx);
     return true;
 }
 
@@ -424,18 +241,7 @@ doc_fs(ParserContext *ctx, Attributes *attr, int32_t halfpoints, GError **error)
         return false;
     }
 
-    double points = halfpoints / 2.0;
-    g_autofree char *tagname = g_strdup_printf("rtf-fontsize-%.3f", points);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "size", POINTS_TO_PANGO(points),
-                     "size-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
-    attr->size = points;
+    attr->size = halfpoints / 2.0;
     return true;
 }
 
@@ -447,18 +253,7 @@ doc_fsmilli(ParserContext *ctx, Attributes *attr, int32_t milli, GError **error)
         return false;
     }
 
-    double points = milli / 1000.0;
-    g_autofree char *tagname = g_strdup_printf("rtf-fontsize-%.3f", points);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "size", POINTS_TO_PANGO(points),
-                     "size-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
-    attr->size = points;
+    attr->size = milli / 1000.0;
     return true;
 }
 
@@ -472,16 +267,6 @@ doc_highlight(ParserContext *ctx, Attributes *attr, int32_t param, GError **erro
         return false;
     }
 
-    g_autofree char *tagname = g_strdup_printf("rtf-highlight-%i", param);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "paragraph-background", color,
-                     "paragraph-background-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->background = param;
     return true;
 }
@@ -489,14 +274,6 @@ doc_highlight(ParserContext *ctx, Attributes *attr, int32_t param, GError **erro
 bool
 doc_i(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-italic")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-italic");
-        g_object_set(tag,
-                     "style", PANGO_STYLE_ITALIC,
-                     "style-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
     attr->italic = (param != 0);
     return true;
 }
@@ -505,33 +282,15 @@ static bool
 doc_ilvl(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
     /* Insert n tabs at beginning of line */
-    GtkTextIter iter;
     g_autofree char *tabstring = g_strnfill(param, '\t');
-
-    gtk_text_buffer_get_end_iter(ctx->textbuffer, &iter);
-    gtk_text_iter_set_line_offset(&iter, 0);
-    gtk_text_buffer_insert(ctx->textbuffer, &iter, tabstring, -1);
-    /* Move the start and end marks back together */
-    gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &iter, ctx->startmark);
-    gtk_text_buffer_move_mark(ctx->textbuffer, ctx->endmark, &iter);
-
+    if (ctx->sink->insert_at_line_start)
+        ctx->sink->insert_at_line_start(ctx, tabstring);
     return true;
 }
 
 bool
 doc_lang(ParserContext *ctx, Attributes *attr, int32_t language, GError **error)
 {
-
-    g_autofree char *tagname = g_strdup_printf("rtf-language-%i", language);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "language", language_to_iso(language),
-                     "language-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->language = language;
     return true;
 }
@@ -542,16 +301,6 @@ doc_li(ParserContext *ctx, Attributes *attr, int32_t twips, GError **error)
     if (twips < 0)
         return true; /* Silently ignore, not supported in GtkTextBuffer */
 
-    g_autofree char *tagname = g_strdup_printf("rtf-left-margin-%i", twips);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "left-margin", PANGO_PIXELS(TWIPS_TO_PANGO(twips)),
-                     "left-margin-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->left_margin = twips;
     return true;
 }
@@ -559,24 +308,14 @@ doc_li(ParserContext *ctx, Attributes *attr, int32_t twips, GError **error)
 bool
 doc_ltrch(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-left-to-right")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-left-to-right");
-        g_object_set(tag, "direction", GTK_TEXT_DIR_LTR, NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->chardirection = GTK_TEXT_DIR_LTR;
+    attr->chardirection = DIRECTION_LTR;
     return true;
 }
 
 bool
 doc_ltrpar(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-left-to-right")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-left-to-right");
-        g_object_set(tag, "direction", GTK_TEXT_DIR_LTR, NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->pardirection = GTK_TEXT_DIR_LTR;
+    attr->pardirection = DIRECTION_LTR;
     return true;
 }
 
@@ -609,7 +348,7 @@ doc_pard(ParserContext *ctx, Attributes *attr, GError **error)
     attr->right_margin = 0;
     attr->indent = 0;
     if (attr->tabs)
-        pango_tab_array_free(attr->tabs);
+        g_array_unref(attr->tabs);
     attr->tabs = NULL;
     return true;
 }
@@ -639,60 +378,28 @@ doc_plain(ParserContext *ctx, Attributes *attr, GError **error)
 bool
 doc_qc(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-center")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-center");
-        g_object_set(tag,
-                     "justification", GTK_JUSTIFY_CENTER,
-                     "justification-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->justification = GTK_JUSTIFY_CENTER;
+    attr->justification = JUSTIFY_CENTER;
     return true;
 }
 
 bool
 doc_qj(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-justified")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-justified");
-        g_object_set(tag,
-                     "justification", GTK_JUSTIFY_FILL,
-                     "justification-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->justification = GTK_JUSTIFY_FILL;
+    attr->justification = JUSTIFY_FILL;
     return true;
 }
 
 bool
 doc_ql(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-left")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-left");
-        g_object_set(tag,
-                     "justification", GTK_JUSTIFY_LEFT,
-                     "justification-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->justification = GTK_JUSTIFY_LEFT;
+    attr->justification = JUSTIFY_LEFT;
     return true;
 }
 
 bool
 doc_qr(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-right")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-right");
-        g_object_set(tag,
-                     "justification", GTK_JUSTIFY_RIGHT,
-                     "justification-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->justification = GTK_JUSTIFY_RIGHT;
+    attr->justification = JUSTIFY_RIGHT;
     return true;
 }
 
@@ -702,16 +409,6 @@ doc_ri(ParserContext *ctx, Attributes *attr, int32_t twips, GError **error)
     if (twips < 0)
         return true; /* Silently ignore, not supported in GtkTextBuffer */
 
-    g_autofree char *tagname = g_strdup_printf("rtf-right-margin-%i", twips);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "right-margin", PANGO_PIXELS(TWIPS_TO_PANGO(twips)),
-                     "right-margin-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->right_margin = twips;
     return true;
 }
@@ -729,32 +426,21 @@ doc_rtf(ParserContext *ctx, Attributes *attr, int32_t version, GError **error)
 bool
 doc_rtlch(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-right-to-left")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-right-to-left");
-        g_object_set(tag, "direction", GTK_TEXT_DIR_RTL, NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->chardirection = GTK_TEXT_DIR_RTL;
+    attr->chardirection = DIRECTION_RTL;
     return true;
 }
 
 bool
 doc_rtlpar(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-right-to-left")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-right-to-left");
-        g_object_set(tag, "direction", GTK_TEXT_DIR_RTL, NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->pardirection = GTK_TEXT_DIR_RTL;
+    attr->pardirection = DIRECTION_RTL;
     return true;
 }
 
 bool
 doc_s(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
-    g_autofree char *tagname = g_strdup_printf("rtf-style-%i", param);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
+    if (!g_hash_table_contains(ctx->style_table, GINT_TO_POINTER(param))) {
         g_warning(_("Style '%i' undefined"), param);
         return true;
     }
@@ -768,16 +454,6 @@ doc_sa(ParserContext *ctx, Attributes *attr, int32_t twips, GError **error)
     if (twips < 0)
         return true; /* Silently ignore, not supported in GtkTextBuffer */
 
-    g_autofree char *tagname = g_strdup_printf("rtf-space-after-%i", twips);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "pixels-below-lines", PANGO_PIXELS(TWIPS_TO_PANGO(twips)),
-                     "pixels-below-lines-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->space_after = twips;
     return true;
 }
@@ -795,16 +471,6 @@ doc_sb(ParserContext *ctx, Attributes *attr, int32_t twips, GError **error)
     if (twips < 0)
         return true; /* Silently ignore, not supported in GtkTextBuffer */
 
-    g_autofree char *tagname = g_strdup_printf("rtf-space-before-%i", twips);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "pixels-above-lines", PANGO_PIXELS(TWIPS_TO_PANGO(twips)),
-                     "pixels-above-lines-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->space_before = twips;
     return true;
 }
@@ -819,14 +485,6 @@ doc_sbauto(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 bool
 doc_scaps(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-smallcaps")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-smallcaps");
-        g_object_set(tag,
-                     "variant", PANGO_VARIANT_SMALL_CAPS,
-                     "variant-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
     attr->smallcaps = (param != 0);
     return true;
 }
@@ -837,16 +495,6 @@ doc_slleading(ParserContext *ctx, Attributes *attr, int32_t twips, GError **erro
     if (twips < 0)
         return true; /* Silently ignore, not supported in GtkTextBuffer */
 
-    g_autofree char *tagname = g_strdup_printf("rtf-leading-%i", twips);
-    if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-        GtkTextTag *tag = gtk_text_tag_new(tagname);
-        g_object_set(tag,
-                     "pixels-inside-wrap", PANGO_PIXELS(TWIPS_TO_PANGO(twips)),
-                     "pixels-inside-wrap-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-
     attr->leading = twips;
     return true;
 }
@@ -854,14 +502,6 @@ doc_slleading(ParserContext *ctx, Attributes *attr, int32_t twips, GError **erro
 bool
 doc_strike(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-strikethrough")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-strikethrough");
-        g_object_set(tag,
-                     "strikethrough", true,
-                     "strikethrough-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
     attr->strikethrough = (param != 0);
     return true;
 }
@@ -869,16 +509,6 @@ doc_strike(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 bool
 doc_sub(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-subscript")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-subscript");
-        g_object_set(tag,
-                     "rise", POINTS_TO_PANGO(-6),
-                     "rise-set", true,
-                     "scale", PANGO_SCALE_X_SMALL,
-                     "scale-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
     attr->subscript = true;
     return true;
 }
@@ -886,16 +516,6 @@ doc_sub(ParserContext *ctx, Attributes *attr, GError **error)
 bool
 doc_super(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-superscript")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-superscript");
-        g_object_set(tag,
-                     "rise", POINTS_TO_PANGO(6),
-                     "rise-set", true,
-                     "scale", PANGO_SCALE_X_SMALL,
-                     "scale-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
     attr->superscript = true;
     return true;
 }
@@ -903,17 +523,9 @@ doc_super(ParserContext *ctx, Attributes *attr, GError **error)
 bool
 doc_tx(ParserContext *ctx, Attributes *attr, int32_t twips, GError **error)
 {
-    int tab_index = 0;
-
-    if (attr->tabs == NULL) {
-        attr->tabs = pango_tab_array_new(1, false);
-    } else {
-        tab_index = pango_tab_array_get_size(attr->tabs);
-        pango_tab_array_resize(attr->tabs, tab_index + 1);
-    }
-
-    pango_tab_array_set_tab(attr->tabs, tab_index, PANGO_TAB_LEFT, TWIPS_TO_PANGO(twips));
-
+    if (attr->tabs == NULL)
+        attr->tabs = g_array_new(false, false, sizeof(int));
+    g_array_append_val(attr->tabs, twips);
     return true;
 }
 
@@ -955,37 +567,21 @@ doc_ud(ParserContext *ctx, Attributes *attr, GError **error)
 bool
 doc_ul(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-underline-single")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-underline-single");
-        g_object_set(tag,
-                     "underline", PANGO_UNDERLINE_SINGLE,
-                     "underline-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->underline = param? PANGO_UNDERLINE_SINGLE : PANGO_UNDERLINE_NONE;
+    attr->underline = param? UNDERLINE_SINGLE : UNDERLINE_NONE;
     return true;
 }
 
 bool
 doc_uldb(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-underline-double")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-underline-double");
-        g_object_set(tag,
-                     "underline", PANGO_UNDERLINE_DOUBLE,
-                     "underline-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->underline = param? PANGO_UNDERLINE_DOUBLE : PANGO_UNDERLINE_NONE;
+    attr->underline = param? UNDERLINE_DOUBLE : UNDERLINE_NONE;
     return true;
 }
 
 bool
 doc_ulnone(ParserContext *ctx, Attributes *attr, GError **error)
 {
-    attr->underline = PANGO_UNDERLINE_NONE;
+    attr->underline = UNDERLINE_NONE;
     return true;
 }
 
@@ -1004,33 +600,13 @@ doc_ulstyle(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 bool
 doc_ulwave(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-underline-wave")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-underline-wave");
-        g_object_set(tag,
-                     "underline", PANGO_UNDERLINE_ERROR,
-                     "underline-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
-    attr->underline = param? PANGO_UNDERLINE_ERROR : PANGO_UNDERLINE_NONE;
+    attr->underline = param? UNDERLINE_WAVE : UNDERLINE_NONE;
     return true;
 }
 
 bool
 doc_up(ParserContext *ctx, Attributes *attr, int32_t halfpoints, GError **error)
 {
-    if (halfpoints != 0) {
-        g_autofree char *tagname = g_strdup_printf("rtf-up-%i", halfpoints);
-        if (!gtk_text_tag_table_lookup(ctx->tags, tagname)) {
-            GtkTextTag *tag = gtk_text_tag_new(tagname);
-            g_object_set(tag,
-                         "rise", HALF_POINTS_TO_PANGO(halfpoints),
-                         "rise-set", true,
-                         NULL);
-            gtk_text_tag_table_add(ctx->tags, tag);
-        }
-    }
-
     attr->rise = halfpoints;
     return true;
 }
@@ -1045,14 +621,6 @@ doc_upr(ParserContext *ctx, Attributes *attr, GError **error)
 bool
 doc_v(ParserContext *ctx, Attributes *attr, int32_t param, GError **error)
 {
-    if (!gtk_text_tag_table_lookup(ctx->tags, "rtf-invisible")) {
-        GtkTextTag *tag = gtk_text_tag_new("rtf-invisible");
-        g_object_set(tag,
-                     "invisible", true,
-                     "invisible-set", true,
-                     NULL);
-        gtk_text_tag_table_add(ctx->tags, tag);
-    }
     attr->invisible = (param != 0);
     return true;
 }
@@ -18,7 +18,6 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include <stdbool.h>
 
 #include <glib.h>
-#include <pango/pango.h>
 
 #include "rtf-deserialize.h"
 #include "rtf-ignore.h"
@@ -26,7 +25,6 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 
 extern const DestinationInfo document_destination;
 
-void apply_attributes(ParserContext *ctx, Attributes *attr, GtkTextIter *start, GtkTextIter *end);
 void document_text(ParserContext *ctx);
 int document_get_codepage(ParserContext *ctx);
 
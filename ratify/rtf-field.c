@@ -24,6 +24,7 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include "rtf-deserialize.h"
 #include "rtf-document.h"
 #include "rtf-ignore.h"
+#include "rtf-sink.h"
 #include "rtf-state.h"
 
 /* field.c - \field, \fldinst, and \fldrslt destinations. The markup language
@@ -43,8 +44,10 @@ questionable benefit. */
 /* These are the supported field types. Add new values here as more field types
 get implemented. */
 typedef enum {
+    FIELD_TYPE_DOCVARIABLE,
     FIELD_TYPE_HYPERLINK,
     FIELD_TYPE_INCLUDEPICTURE,
+    FIELD_TYPE_MERGEFIELD,
     FIELD_TYPE_PAGE
 } FieldType;
 
@@ -59,8 +62,10 @@ typedef struct {
 } FieldInfo;
 
 const FieldInfo fields[] = {
+    { "DOCVARIABLE", FIELD_TYPE_DOCVARIABLE, true, "", "", "", "" },
     { "HYPERLINK", FIELD_TYPE_HYPERLINK, true, "mn", "lot", "", "" },
     { "INCLUDEPICTURE", FIELD_TYPE_INCLUDEPICTURE, true, "d", "c", "", "" },
+    { "MERGEFIELD", FIELD_TYPE_MERGEFIELD, true, "mv", "bf", "", "" },
     { "PAGE", FIELD_TYPE_PAGE, false, "", "", "", "" },
     { NULL }
 };
@@ -357,7 +362,8 @@ static void field_instruction_end(ParserContext *ctx)
                 state->general_number_format = NUMBER_DECIMAL_ENCLOSED_PARENTHESES;
             else if (strcmp(info->switcharg, "Hex") == 0)
                 state->general_number_format = NUMBER_HEX;
-            else if (strcmp(info->switcharg, "MERGEFORMATINET") == 0)
+            else if (strcmp(info->switcharg, "MERGEFORMAT") == 0 ||
+                strcmp(info->switcharg, "MERGEFORMATINET") == 0)
                 ; /* ignore */
             else if (strcmp(info->switcharg, "Ordinal") == 0)
                 state->general_number_format = NUMBER_ORDINAL;
@@ -371,10 +377,20 @@ static void field_instruction_end(ParserContext *ctx)
         }
     }
 
+    if (ctx->sink->field)
+        ctx->sink->field(ctx, field_info->name, state->argument);
+
     Destination *fielddest = g_queue_peek_nth(ctx->destination_stack, 1);
     FieldState *fieldstate = g_queue_peek_tail(fielddest->state_stack);
 
     switch (state->type) {
+    case FIELD_TYPE_DOCVARIABLE:
+    case FIELD_TYPE_MERGEFIELD:
+        /* The value isn't known here, but the field result is the value that
+        was last merged in, or a placeholder */
+        fieldstate->ignore_field_result = false;
+        break;
+
     case FIELD_TYPE_HYPERLINK:
         /* Actually inserting hyperlinks into the text buffer is a whole
         security can of worms I don't want to open! Just use field result */
@@ -382,19 +398,11 @@ static void field_instruction_end(ParserContext *ctx)
         break;
 
     case FIELD_TYPE_INCLUDEPICTURE: {
-        GError *error = NULL;
         g_auto(GStrv) pathcomponents = g_strsplit(state->argument, "\\", 0);
-        g_autofree char *realfilename = g_build_filenamev(pathcomponents);
-
-        g_autoptr(GdkPixbuf) picture = gdk_pixbuf_new_from_file(realfilename, &error);
-        if (!picture) {
-            g_warning(_("Error loading picture from file '%s': %s"), realfilename, error->message);
-        } else {
-            /* Insert picture into text buffer */
-            GtkTextIter iter;
-            gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &iter, ctx->endmark);
-            gtk_text_buffer_insert_pixbuf(ctx->textbuffer, &iter, picture);
-        }
+        g_autofree char *relfilename = g_build_filenamev(pathcomponents);
+        g_autofree char *realfilename = resolve_filename(ctx, relfilename);
+        if (ctx->sink->picture_file)
+            ctx->sink->picture_file(ctx, realfilename, -1, -1);
     }
         /* Don't use calculated field result */
         fieldstate->ignore_field_result = true;
@@ -402,9 +410,8 @@ static void field_instruction_end(ParserContext *ctx)
 
     case FIELD_TYPE_PAGE: {
         g_autofree char *output = format_integer(1, state->general_number_format);
-        GtkTextIter iter;
-        gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &iter, ctx->endmark);
-        gtk_text_buffer_insert(ctx->textbuffer, &iter, output, -1);
+        if (ctx->sink->insert_text)
+            ctx->sink->insert_text(ctx, output, NULL);
     }
         /* Don't use calculated field result */
         fieldstate->ignore_field_result = true;
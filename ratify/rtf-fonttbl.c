@@ -23,9 +23,10 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "rtf-deserialize.h"
 #include "rtf-document.h"
+#include "rtf-sink.h"
 
 /* rtf-fonttbl.c - The \fonttbl destination. Builds the parser context's font
-table and adds tags to the GtkTextBuffer's tag table for each font. */
+table and tells the output sink about each font. */
 
 typedef enum {
     FONT_FAMILY_NIL,
@@ -123,15 +124,8 @@ font_table_text(ParserContext *ctx)
     fontprop->font_name = g_strconcat(state->name, name, NULL);
     ctx->font_table = g_slist_prepend(ctx->font_table, fontprop);
 
-    /* Add the tag to the buffer right now instead of when the font is used,
-    since any font might be declared the default font; remove any previous font
-    with this font table index first */
-    g_autofree char *tagname = g_strdup_printf("rtf-font-%i", state->index);
-    GtkTextTag *tag = gtk_text_tag_table_lookup(ctx->tags, tagname);
-    if (tag != NULL)
-        gtk_text_tag_table_remove(ctx->tags, tag);
-    tag = gtk_text_tag_new(tagname);
-
+    /* Define the font right now instead of when the font is used, since any
+    font might be declared the default font */
     g_autofree char *fontstring = NULL;
     if (fontprop->font_name && font_suggestions[state->family]) {
         fontstring = g_strconcat(fontprop->font_name,
@@ -144,13 +138,8 @@ font_table_text(ParserContext *ctx)
         fontstring = g_strdup(font_suggestions[state->family]);
     }
 
-    if (fontstring) {
-        g_object_set(tag,
-                     "family", fontstring,
-                     "family-set", true,
-                     NULL);
-    }
-    gtk_text_tag_table_add(ctx->tags, tag);
+    if (ctx->sink->define_font)
+        ctx->sink->define_font(ctx, state->index, fontstring);
 
     g_free(state->name);
     state->index = 0;
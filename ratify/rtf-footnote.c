@@ -21,6 +21,7 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "rtf-deserialize.h"
 #include "rtf-document.h"
+#include "rtf-sink.h"
 #include "rtf-state.h"
 
 /* rtf-footnote.c - Very similar to the main document destination, but adds its
@@ -48,7 +49,7 @@ const DestinationInfo footnote_destination = {
 };
 
 /* This function is mostly the same as document_text(), but adds the text to the
-end of the textbuffer */
+end of the document */
 static void
 footnote_text(ParserContext *ctx)
 {
@@ -62,28 +63,16 @@ footnote_text(ParserContext *ctx)
     if (!ctx->group_nesting_level && text[length] == '\n')
         text[length] = '\0';
 
-    GtkTextIter start, end;
-    gtk_text_buffer_get_end_iter(ctx->textbuffer, &end);
-    GtkTextMark *placeholder = gtk_text_buffer_create_mark(ctx->textbuffer, NULL, &end, true);
-    gtk_text_buffer_insert(ctx->textbuffer, &end, text, -1);
-    gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &start, placeholder);
-    gtk_text_buffer_get_end_iter(ctx->textbuffer, &end);
-
     Attributes *attr = get_state(ctx);
-    apply_attributes(ctx, attr, &start, &end);
-
-    gtk_text_buffer_delete_mark(ctx->textbuffer, placeholder);
-
+    if (ctx->sink->append_text)
+        ctx->sink->append_text(ctx, text, attr);
     g_string_truncate(ctx->text, 0);
-
-    /* Move the regular document endmark back to the startmark so that
-    subsequent document text is inserted before the footnotes */
-    gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &start, ctx->startmark);
-    gtk_text_buffer_move_mark(ctx->textbuffer, ctx->endmark, &start);
 }
 
 static void
 footnote_end(ParserContext *ctx)
 {
+    if (ctx->sink->footnote_end)
+        ctx->sink->footnote_end(ctx);
     ctx->footnote_number++;
 }
@@ -20,7 +20,9 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include "rtf-deserialize.h"
 #include "rtf-ignore.h"
 
-/* rtf-ignore.c - Used to ignore destinations that are not implemented */
+/* rtf-ignore.c - Used to ignore destinations that are not implemented. Since
+nothing in an ignored group is used, the parser doesn't tokenize it at all, but
+jumps straight to the end of the group; see rtf-scan.c. */
 
 const ControlWord ignore_word_table[] = {{ NULL }};
 
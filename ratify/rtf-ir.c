@@ -0,0 +1,659 @@
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "rtf-deserialize.h"
+#include "rtf-ir.h"
+#include "rtf-sink.h"
+#include "rtf-state.h"
+
+/* rtf-ir.c - Output sink that builds a ParsedDocument. The document text and
+the footnote text are collected separately while parsing, since footnotes are
+added at the end of the document but the document text continues before them,
+and are joined when parsing is done. */
+
+typedef struct {
+    GString *text;
+    GArray *runs;
+    GString *notes;
+    GArray *note_runs;
+    /* Text that was inserted without attributes, and is formatted along with
+    the next text that has them, starts here */
+    bool pending;
+    size_t pending_offset;
+
+    /* Attributes are interned: the table maps each distinct set of attributes
+    to its index in attrs, plus one */
+    GHashTable *attr_ids;
+    GPtrArray *attrs;
+
+    GArray *objects;
+    GPtrArray *colors;
+    GArray *fonts;
+    GArray *styles;
+} DocumentBuilder;
+
+/* Only the attributes that affect the output are considered when interning */
+static unsigned
+attributes_hash(const void *key)
+{
+    const Attributes *attr = key;
+    unsigned hash = 17;
+
+#define HASH(value) hash = hash * 31 + (unsigned)(value)
+    HASH(attr->style);
+    HASH(attr->justification);
+    HASH(attr->pardirection);
+    HASH(attr->ignore_space_before ? 0 : attr->space_before);
+    HASH(attr->ignore_space_after ? 0 : attr->space_after);
+    HASH(attr->left_margin);
+    HASH(attr->right_margin);
+    HASH(attr->indent);
+    HASH(attr->leading);
+    HASH(attr->foreground);
+    HASH(attr->background);
+    HASH(attr->highlight);
+    HASH(attr->font);
+    HASH(g_double_hash(&attr->size));
+    HASH(attr->italic | attr->bold << 1 | attr->smallcaps << 2 | attr->strikethrough << 3 |
+         attr->subscript << 4 | attr->superscript << 5 | attr->invisible << 6);
+    HASH(attr->underline);
+    HASH(attr->chardirection);
+    HASH(attr->language);
+    HASH(attr->rise);
+    HASH(attr->scale);
+    if (attr->tabs) {
+        for (unsigned ix = 0; ix < attr->tabs->len; ix++)
+            HASH(g_array_index(attr->tabs, int, ix));
+    }
+#undef HASH
+
+    return hash;
+}
+
+static gboolean
+attributes_equal(const void *a, const void *b)
+{
+    const Attributes *attr1 = a;
+    const Attributes *attr2 = b;
+
+    if ((attr1->tabs == NULL) != (attr2->tabs == NULL))
+        return false;
+    if (attr1->tabs && (attr1->tabs->len != attr2->tabs->len ||
+        memcmp(attr1->tabs->data, attr2->tabs->data, attr1->tabs->len * sizeof(int)) != 0))
+        return false;
+
+    return attr1->style == attr2->style &&
+        attr1->justification == attr2->justification &&
+        attr1->pardirection == attr2->pardirection &&
+        (attr1->ignore_space_before ? 0 : attr1->space_before) == (attr2->ignore_space_before ? 0 : attr2->space_before) &&
+        (attr1->ignore_space_after ? 0 : attr1->space_after) == (attr2->ignore_space_after ? 0 : attr2->space_after) &&
+        attr1->left_margin == attr2->left_margin &&
+        attr1->right_margin == attr2->right_margin &&
+        attr1->indent == attr2->indent &&
+        attr1->leading == attr2->leading &&
+        attr1->foreground == attr2->foreground &&
+        attr1->background == attr2->background &&
+        attr1->highlight == attr2->highlight &&
+        attr1->font == attr2->font &&
+        attr1->size == attr2->size &&
+        attr1->italic == attr2->italic &&
+        attr1->bold == attr2->bold &&
+        attr1->smallcaps == attr2->smallcaps &&
+        attr1->strikethrough == attr2->strikethrough &&
+        attr1->subscript == attr2->subscript &&
+        attr1->superscript == attr2->superscript &&
+        attr1->invisible == attr2->invisible &&
+        attr1->underline == attr2->underline &&
+        attr1->chardirection == attr2->chardirection &&
+        attr1->language == attr2->language &&
+        attr1->rise == attr2->rise &&
+        attr1->scale == attr2->scale;
+}
+
+static void
+attributes_free(Attributes *attr)
+{
+    if (attr->tabs)
+        g_array_unref(attr->tabs);
+    g_slice_free(Attributes, attr);
+}
+
+static void
+document_object_clear(DocumentObject *object)
+{
+    g_clear_pointer(&object->data, g_bytes_unref);
+    g_clear_pointer(&object->filename, g_free);
+}
+
+static void
+font_definition_clear(FontDefinition *font)
+{
+    g_clear_pointer(&font->family, g_free);
+}
+
+static DocumentBuilder *
+document_builder_new(void)
+{
+    DocumentBuilder *builder = g_slice_new0(DocumentBuilder);
+    builder->text = g_string_new("");
+    builder->runs = g_array_new(false, false, sizeof(TextRun));
+    builder->notes = g_string_new("");
+    builder->note_runs = g_array_new(false, false, sizeof(TextRun));
+    builder->attr_ids = g_hash_table_new(attributes_hash, attributes_equal);
+    builder->attrs = g_ptr_array_new_with_free_func((GDestroyNotify)attributes_free);
+    builder->objects = g_array_new(false, true, sizeof(DocumentObject));
+    g_array_set_clear_func(builder->objects, (GDestroyNotify)document_object_clear);
+    builder->colors = g_ptr_array_new_with_free_func(g_free);
+    builder->fonts = g_array_new(false, false, sizeof(FontDefinition));
+    g_array_set_clear_func(builder->fonts, (GDestroyNotify)font_definition_clear);
+    builder->styles = g_array_new(false, false, sizeof(StyleDefinition));
+    return builder;
+}
+
+static void
+document_builder_free(DocumentBuilder *builder)
+{
+    if (builder->text)
+        g_string_free(builder->text, true);
+    if (builder->notes)
+        g_string_free(builder->notes, true);
+    g_clear_pointer(&builder->runs, g_array_unref);
+    g_clear_pointer(&builder->note_runs, g_array_unref);
+    g_hash_table_unref(builder->attr_ids);
+    g_clear_pointer(&builder->attrs, g_ptr_array_unref);
+    g_clear_pointer(&builder->objects, g_array_unref);
+    g_clear_pointer(&builder->colors, g_ptr_array_unref);
+    g_clear_pointer(&builder->fonts, g_array_unref);
+    g_clear_pointer(&builder->styles, g_array_unref);
+    g_slice_free(DocumentBuilder, builder);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(DocumentBuilder, document_builder_free);
+
+/* Return the index of this set of attributes, adding a copy of it if it hasn't
+been seen before */
+static int
+intern_attributes(DocumentBuilder *builder, const Attributes *attr)
+{
+    void *id = g_hash_table_lookup(builder->attr_ids, attr);
+    if (id != NULL)
+        return GPOINTER_TO_INT(id) - 1;
+
+    Attributes *copy = g_slice_dup(Attributes, attr);
+    if (attr->tabs)
+        copy->tabs = tab_array_copy(attr->tabs);
+    g_ptr_array_add(builder->attrs, copy);
+    g_hash_table_insert(builder->attr_ids, copy, GINT_TO_POINTER(builder->attrs->len));
+    return builder->attrs->len - 1;
+}
+
+/* Add a run to the end of a run table, merging it with the previous run if
+that one is formatted the same way */
+static void
+add_run(GArray *runs, size_t offset, size_t length, int attr)
+{
+    if (runs->len > 0) {
+        TextRun *last = &g_array_index(runs, TextRun, runs->len - 1);
+        if (last->attr == attr && last->offset + last->length == offset) {
+            last->length += length;
+            return;
+        }
+    }
+    TextRun run = { offset, length, attr };
+    g_array_append_val(runs, run);
+}
+
+/* Text without its own font gets the document's default font, if there is
+one; resolve that here so that the runs don't depend on the parser context */
+static int
+intern_run_attributes(ParserContext *ctx, DocumentBuilder *builder, const Attributes *attr)
+{
+    if (attr->font == -1 && ctx->default_font != -1 && g_slist_length(ctx->font_table) > (unsigned)ctx->default_font) {
+        Attributes resolved = *attr;
+        resolved.font = ctx->default_font;
+        return intern_attributes(builder, &resolved);
+    }
+    return intern_attributes(builder, attr);
+}
+
+static void
+builder_insert_text(ParserContext *ctx, const char *text, const Attributes *attr)
+{
+    DocumentBuilder *builder = ctx->sink_data;
+
+    if (attr == NULL) {
+        if (!builder->pending) {
+            builder->pending = true;
+            builder->pending_offset = builder->text->len;
+        }
+        g_string_append(builder->text, text);
+        return;
+    }
+
+    size_t offset = builder->pending ? builder->pending_offset : builder->text->len;
+    builder->pending = false;
+    g_string_append(builder->text, text);
+    add_run(builder->runs, offset, builder->text->len - offset, intern_run_attributes(ctx, builder, attr));
+}
+
+static void
+builder_append_text(ParserContext *ctx, const char *text, const Attributes *attr)
+{
+    DocumentBuilder *builder = ctx->sink_data;
+    size_t offset = builder->notes->len;
+
+    g_string_append(builder->notes, text);
+    add_run(builder->note_runs, offset, builder->notes->len - offset, attr ? intern_run_attributes(ctx, builder, attr) : -1);
+}
+
+/* Insert unformatted text at the start of the last line of the document text,
+moving everything after it along */
+static void
+builder_insert_at_line_start(ParserContext *ctx, const char *text)
+{
+    DocumentBuilder *builder = ctx->sink_data;
+    size_t length = strlen(text);
+
+    size_t pos = builder->text->len;
+    while (pos > 0 && builder->text->str[pos - 1] != '\n')
+        pos--;
+    g_string_insert(builder->text, pos, text);
+
+    for (unsigned obj = 0; obj < builder->objects->len; obj++) {
+        DocumentObject *object = &g_array_index(builder->objects, DocumentObject, obj);
+        if (object->offset >= pos)
+            object->offset += length;
+    }
+    /* Text inserted into unformatted text that is still waiting for the next
+    attributes will be formatted with it */
+    if (builder->pending && pos >= builder->pending_offset)
+        return;
+
+    /* Find the first run that ends after the insertion point */
+    unsigned ix = builder->runs->len;
+    while (ix > 0) {
+        TextRun *run = &g_array_index(builder->runs, TextRun, ix - 1);
+        if (run->offset + run->length <= pos)
+            break;
+        ix--;
+    }
+    for (unsigned later = ix; later < builder->runs->len; later++)
+        g_array_index(builder->runs, TextRun, later).offset += length;
+
+    /* If the insertion point is in the middle of that run, split it */
+    if (ix < builder->runs->len) {
+        TextRun *run = &g_array_index(builder->runs, TextRun, ix);
+        size_t run_start = run->offset - length;
+        if (run_start < pos) {
+            TextRun tail = { pos + length, run->length - (pos - run_start), run->attr };
+            run->offset = run_start;
+            run->length = pos - run_start;
+            ix++;
+            g_array_insert_val(builder->runs, ix, tail);
+        }
+    }
+    TextRun inserted = { pos, length, -1 };
+    g_array_insert_val(builder->runs, ix, inserted);
+
+    if (builder->pending)
+        builder->pending_offset += length;
+}
+
+/* Insert a newline at the end of the footnotes, to separate the coming
+footnote */
+static void
+builder_footnote_begin(ParserContext *ctx)
+{
+    builder_append_text(ctx, "\n", NULL);
+}
+
+static void
+builder_define_font(ParserContext *ctx, int index, const char *family)
+{
+    DocumentBuilder *builder = ctx->sink_data;
+    FontDefinition font = { index, g_strdup(family) };
+    g_array_append_val(builder->fonts, font);
+}
+
+static void
+builder_define_color_at(DocumentBuilder *builder, int index, const char *color)
+{
+    if ((unsigned)index >= builder->colors->len)
+        g_ptr_array_set_size(builder->colors, index + 1);
+    g_free(g_ptr_array_index(builder->colors, index));
+    g_ptr_array_index(builder->colors, index) = g_strdup(color);
+}
+
+static void
+builder_define_color(ParserContext *ctx, int index, const char *color)
+{
+    builder_define_color_at(ctx->sink_data, index, color);
+}
+
+static void
+builder_define_style(ParserContext *ctx, int index, const Attributes *attr)
+{
+    DocumentBuilder *builder = ctx->sink_data;
+    StyleDefinition style = { index, intern_attributes(builder, attr) };
+    g_array_append_val(builder->styles, style);
+}
+
+/* Add an object to the object table, and its placeholder to the text. Like a
+picture in a GtkTextBuffer, the placeholder is formatted with the next text. */
+static void
+add_object(ParserContext *ctx, DocumentObject *object)
+{
+    DocumentBuilder *builder = ctx->sink_data;
+
+    object->offset = builder->text->len;
+    g_array_append_vals(builder->objects, object, 1);
+    builder_insert_text(ctx, OBJECT_REPLACEMENT_CHARACTER, NULL);
+}
+
+/* The document keeps the picture data as it is, and decoding it is up to
+whoever displays the document. \bin data is left where it is in the RTF code, as
+long as it is all the picture's data; anything else is collected in a
+GByteArray. Hex data decodes to half its size, so the pictures never take more
+memory than the RTF code they came from. */
+typedef struct {
+    const uint8_t *code_data; /* Points into the RTF code, or NULL */
+    size_t code_length;
+    GByteArray *bytes; /* NULL as long as the data is only in the RTF code */
+} PictureData;
+
+static void *
+builder_picture_begin(ParserContext *ctx, const PictureInfo *info)
+{
+    return g_slice_new0(PictureData);
+}
+
+static bool
+builder_picture_write(ParserContext *ctx, void *picture, const PictureInfo *info, const uint8_t *data, size_t length)
+{
+    PictureData *picture_data = picture;
+    const char *chars = (const char *)data;
+    bool in_code = chars >= ctx->rtftext && chars + length <= ctx->end;
+
+    if (in_code && picture_data->code_data == NULL && picture_data->bytes == NULL) {
+        picture_data->code_data = data;
+        picture_data->code_length = length;
+        return true;
+    }
+    if (picture_data->bytes == NULL) {
+        picture_data->bytes = g_byte_array_new();
+        if (picture_data->code_data != NULL)
+            g_byte_array_append(picture_data->bytes, picture_data->code_data, picture_data->code_length);
+    }
+    g_byte_array_append(picture_data->bytes, data, length);
+    return true;
+}
+
+static void
+builder_picture_end(ParserContext *ctx, void *picture, const PictureInfo *info, bool ok)
+{
+    PictureData *picture_data = picture;
+
+    if (ok) {
+        DocumentObject object = { DOCUMENT_OBJECT_PICTURE };
+        object.info = *info;
+        if (picture_data->bytes != NULL) {
+            object.data = g_byte_array_free_to_bytes(g_steal_pointer(&picture_data->bytes));
+        } else {
+            /* The slice of the RTF code is made when parsing is done */
+            object.data_in_code = true;
+            object.code_offset = (const char *)picture_data->code_data - ctx->rtftext;
+            object.code_length = picture_data->code_length;
+        }
+        add_object(ctx, &object);
+    }
+
+    if (picture_data->bytes != NULL)
+        g_byte_array_unref(picture_data->bytes);
+    g_slice_free(PictureData, picture_data);
+}
+
+static void
+builder_picture_file(ParserContext *ctx, const char *filename, int width, int height)
+{
+    DocumentObject object = { DOCUMENT_OBJECT_PICTURE_FILE };
+    object.filename = g_strdup(filename);
+    object.width = width;
+    object.height = height;
+    add_object(ctx, &object);
+}
+
+static const OutputSink document_builder_sink = {
+    builder_insert_text,
+    builder_append_text,
+    builder_insert_at_line_start,
+    builder_footnote_begin,
+    NULL, /* footnote_end */
+    builder_define_font,
+    builder_define_color,
+    builder_define_style,
+    builder_picture_begin,
+    builder_picture_write,
+    builder_picture_end,
+    builder_picture_file
+};
+
+/* Add everything that segment collected to the end of builder. Used when parts
+of the document are parsed separately. */
+static void
+document_builder_append(DocumentBuilder *builder, DocumentBuilder *segment)
+{
+    /* The segment's attributes have different indices in this builder */
+    g_autofree int *attr_ids = g_new(int, segment->attrs->len);
+    for (unsigned ix = 0; ix < segment->attrs->len; ix++)
+        attr_ids[ix] = intern_attributes(builder, g_ptr_array_index(segment->attrs, ix));
+
+    size_t offset = builder->text->len;
+    g_string_append_len(builder->text, segment->text->str, segment->text->len);
+    for (unsigned ix = 0; ix < segment->runs->len; ix++) {
+        TextRun *run = &g_array_index(segment->runs, TextRun, ix);
+        size_t run_offset = run->offset + offset;
+        size_t run_length = run->length;
+        /* Text still waiting for attributes at the end of the previous part is
+        formatted with the first text of this one */
+        if (builder->pending) {
+            run_length += run_offset - builder->pending_offset;
+            run_offset = builder->pending_offset;
+            builder->pending = false;
+        }
+        add_run(builder->runs, run_offset, run_length, run->attr == -1 ? -1 : attr_ids[run->attr]);
+    }
+    if (segment->pending && !builder->pending) {
+        builder->pending = true;
+        builder->pending_offset = segment->pending_offset + offset;
+    }
+
+    size_t notes_offset = builder->notes->len;
+    g_string_append_len(builder->notes, segment->notes->str, segment->notes->len);
+    for (unsigned ix = 0; ix < segment->note_runs->len; ix++) {
+        TextRun *run = &g_array_index(segment->note_runs, TextRun, ix);
+        add_run(builder->note_runs, run->offset + notes_offset, run->length, run->attr == -1 ? -1 : attr_ids[run->attr]);
+    }
+
+    /* Take over the objects' data, leaving nothing behind to free */
+    for (unsigned ix = 0; ix < segment->objects->len; ix++) {
+        DocumentObject *object = &g_array_index(segment->objects, DocumentObject, ix);
+        object->offset += offset;
+        g_array_append_vals(builder->objects, object, 1);
+        object->data = NULL;
+        object->filename = NULL;
+    }
+
+    for (unsigned ix = 0; ix < segment->colors->len; ix++) {
+        char *color = g_ptr_array_index(segment->colors, ix);
+        if (color != NULL)
+            builder_define_color_at(builder, ix, color);
+    }
+    for (unsigned ix = 0; ix < segment->fonts->len; ix++) {
+        FontDefinition *font = &g_array_index(segment->fonts, FontDefinition, ix);
+        FontDefinition copy = { font->index, g_steal_pointer(&font->family) };
+        g_array_append_val(builder->fonts, copy);
+    }
+    for (unsigned ix = 0; ix < segment->styles->len; ix++) {
+        StyleDefinition style = g_array_index(segment->styles, StyleDefinition, ix);
+        style.attr = attr_ids[style.attr];
+        g_array_append_val(builder->styles, style);
+    }
+}
+
+static const SegmentedSink document_builder_segmented_sink = {
+    &document_builder_sink,
+    (void *(*)(void))document_builder_new,
+    (void (*)(void *))document_builder_free,
+    (void (*)(void *, void *))document_builder_append
+};
+
+/* Join the document text and footnote text, and hand everything over to a new
+ParsedDocument for the RTF code, code */
+static ParsedDocument *
+document_builder_finish(DocumentBuilder *builder, GBytes *code)
+{
+    if (builder->pending)
+        add_run(builder->runs, builder->pending_offset, builder->text->len - builder->pending_offset, -1);
+
+    ParsedDocument *doc = g_slice_new0(ParsedDocument);
+    doc->ref_count = 1;
+
+    doc->notes_offset = builder->text->len;
+    g_string_append_len(builder->text, builder->notes->str, builder->notes->len);
+    doc->length = builder->text->len;
+    doc->text = g_string_free(g_steal_pointer(&builder->text), false);
+
+    doc->runs = g_steal_pointer(&builder->runs);
+    for (unsigned ix = 0; ix < builder->note_runs->len; ix++) {
+        TextRun *run = &g_array_index(builder->note_runs, TextRun, ix);
+        add_run(doc->runs, run->offset + doc->notes_offset, run->length, run->attr);
+    }
+
+    doc->attrs = g_steal_pointer(&builder->attrs);
+    doc->objects = g_steal_pointer(&builder->objects);
+    for (unsigned ix = 0; ix < doc->objects->len; ix++) {
+        DocumentObject *object = &g_array_index(doc->objects, DocumentObject, ix);
+        if (object->type == DOCUMENT_OBJECT_PICTURE && object->data == NULL)
+            object->data = g_bytes_new_from_bytes(code, object->code_offset, object->code_length);
+    }
+    doc->code = g_bytes_ref(code);
+    doc->colors = g_steal_pointer(&builder->colors);
+    doc->fonts = g_steal_pointer(&builder->fonts);
+    doc->styles = g_steal_pointer(&builder->styles);
+    return doc;
+}
+
+/* Parse RTF code into a new ParsedDocument, or return NULL if the code couldn't
+be parsed or cancellable was cancelled. The code may contain binary data and
+therefore NUL bytes, but must be followed by a NUL byte. The document keeps a
+reference to code, since \bin picture data is not copied out of it. Filenames
+are relative to base_dir, or the current directory if it is NULL. Large
+documents are parsed in parallel. */
+ParsedDocument *
+parse_rtf_to_document(GBytes *code, GFile *base_dir, GCancellable *cancellable, GError **error)
+{
+    size_t length;
+    const char *data = g_bytes_get_data(code, &length);
+    g_autoptr(DocumentBuilder) builder = parse_rtf_in_segments(data, length, base_dir, cancellable, &document_builder_segmented_sink, error);
+    if (builder == NULL)
+        return NULL;
+    return document_builder_finish(builder, code);
+}
+
+/* Parsing a document into a ParsedDocument a piece at a time, so that a caller
+on the main thread can do other things in between */
+struct _DocumentParser {
+    GBytes *code;
+    ParserContext *ctx;
+    DocumentBuilder *builder;
+};
+
+DocumentParser *
+document_parser_new(GBytes *code, GFile *base_dir, GError **error)
+{
+    size_t length;
+    const char *data = g_bytes_get_data(code, &length);
+    DocumentBuilder *builder = document_builder_new();
+    ParserContext *ctx = parse_rtf_begin(data, length, base_dir, &document_builder_sink, builder, error);
+    if (ctx == NULL) {
+        document_builder_free(builder);
+        return NULL;
+    }
+
+    DocumentParser *parser = g_slice_new0(DocumentParser);
+    parser->code = g_bytes_ref(code);
+    parser->ctx = ctx;
+    parser->builder = builder;
+    return parser;
+}
+
+void
+document_parser_free(DocumentParser *parser)
+{
+    parser_context_free(parser->ctx);
+    document_builder_free(parser->builder);
+    g_bytes_unref(parser->code);
+    g_slice_free(DocumentParser, parser);
+}
+
+/* Parse about max_bytes more of the RTF code. When the end of the document is
+reached, done is set, and the document can be had from
+document_parser_finish(). */
+bool
+document_parser_step(DocumentParser *parser, size_t max_bytes, bool *done, GError **error)
+{
+    return parse_rtf_step(parser->ctx, max_bytes, done, error);
+}
+
+/* Free parser and return the document it parsed */
+ParsedDocument *
+document_parser_finish(DocumentParser *parser)
+{
+    ParsedDocument *doc = document_builder_finish(parser->builder, parser->code);
+    document_parser_free(parser);
+    return doc;
+}
+
+ParsedDocument *
+parsed_document_ref(ParsedDocument *doc)
+{
+    g_atomic_int_inc(&doc->ref_count);
+    return doc;
+}
+
+void
+parsed_document_unref(ParsedDocument *doc)
+{
+    if (!g_atomic_int_dec_and_test(&doc->ref_count))
+        return;
+
+    g_free(doc->text);
+    g_array_unref(doc->runs);
+    g_ptr_array_unref(doc->attrs);
+    g_array_unref(doc->objects);
+    g_ptr_array_unref(doc->colors);
+    g_array_unref(doc->fonts);
+    g_array_unref(doc->styles);
+    g_bytes_unref(doc->code);
+    g_slice_free(ParsedDocument, doc);
+}
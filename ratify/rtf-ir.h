@@ -0,0 +1,114 @@
+#pragma once
+
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "rtf-sink.h"
+#include "rtf-state.h"
+
+/* rtf-ir.h - Toolkit-independent representation of a parsed document. The
+document's text is kept in one UTF-8 string, and its formatting in a table of
+runs that each refer to one of a set of distinct Attributes. Once parsed, a
+ParsedDocument is never modified, so it may be shared between threads. */
+
+/* Stands in for a picture in the document text; UTF-8 for U+FFFC OBJECT
+REPLACEMENT CHARACTER */
+#define OBJECT_REPLACEMENT_CHARACTER "\xef\xbf\xbc"
+#define OBJECT_REPLACEMENT_LENGTH 3
+
+/* A stretch of text that is formatted the same way */
+typedef struct {
+    size_t offset; /* Byte offset into the document text */
+    size_t length;
+    int attr; /* Index into the document's attribute sets, or -1 if the text is
+              not formatted at all */
+} TextRun;
+
+typedef enum {
+    DOCUMENT_OBJECT_PICTURE,
+    DOCUMENT_OBJECT_PICTURE_FILE
+} DocumentObjectType;
+
+/* A picture in the document, either from \pict data or from a file */
+typedef struct {
+    DocumentObjectType type;
+    /* Byte offset of the OBJECT_REPLACEMENT_CHARACTER that stands in for the
+    object in the document text */
+    size_t offset;
+
+    /* DOCUMENT_OBJECT_PICTURE. \bin data is not copied: data is then a slice of
+    the document's RTF code, and data_in_code is set. While parsing, data is
+    NULL and the slice is at code_offset. */
+    PictureInfo info;
+    GBytes *data;
+    bool data_in_code;
+    size_t code_offset;
+    size_t code_length;
+
+    /* DOCUMENT_OBJECT_PICTURE_FILE: absolute filename and size in twips, or -1
+    for the picture's natural size */
+    char *filename;
+    int width;
+    int height;
+} DocumentObject;
+
+typedef struct {
+    int index;
+    char *family; /* May be NULL */
+} FontDefinition;
+
+typedef struct {
+    int index;
+    int attr; /* Index into the document's attribute sets */
+} StyleDefinition;
+
+typedef struct {
+    volatile int ref_count;
+
+    /* The text of the document, followed by the text of the footnotes, which
+    start at notes_offset */
+    char *text;
+    size_t length;
+    size_t notes_offset;
+
+    GArray *runs; /* TextRun, in order, covering all of the text */
+    GPtrArray *attrs; /* Distinct Attributes, referred to by index */
+    GArray *objects; /* DocumentObject, in order of their offsets */
+
+    GPtrArray *colors; /* Color table, as "#rrggbb" strings */
+    GArray *fonts; /* FontDefinition, in the order they were defined */
+    GArray *styles; /* StyleDefinition, in the order they were defined */
+
+    GBytes *code; /* The RTF code that was parsed */
+} ParsedDocument;
+
+typedef struct _DocumentParser DocumentParser;
+
+ParsedDocument *parse_rtf_to_document(GBytes *code, GFile *base_dir, GCancellable *cancellable, GError **error);
+DocumentParser *document_parser_new(GBytes *code, GFile *base_dir, GError **error);
+bool document_parser_step(DocumentParser *parser, size_t max_bytes, bool *done, GError **error);
+ParsedDocument *document_parser_finish(DocumentParser *parser);
+void document_parser_free(DocumentParser *parser);
+ParsedDocument *parsed_document_ref(ParsedDocument *doc);
+void parsed_document_unref(ParsedDocument *doc);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(ParsedDocument, parsed_document_unref);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(DocumentParser, document_parser_free);
@@ -15,59 +15,39 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "config.h"
 
-#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <stdlib.h>
 #include <string.h>
 
-#include <gdk-pixbuf/gdk-pixbuf.h>
 #include <glib.h>
 #include <glib/gi18n-lib.h>
-#include <gtk/gtk.h>
 
-#include "rtf.h"
+#include "rtf-core.h"
 #include "rtf-deserialize.h"
 #include "rtf-ignore.h"
+#include "rtf-sink.h"
 
 /* rtf-picture.c - All destinations dealing with inserting graphics into the
-document: \pict, \shppict, \NeXTgraphic. */
-
-typedef enum {
-    PICT_TYPE_EMF,
-    PICT_TYPE_PNG,
-    PICT_TYPE_JPEG,
-    PICT_TYPE_MAC,
-    PICT_TYPE_OS2,
-    PICT_TYPE_WMF,
-    PICT_TYPE_DIB,
-    PICT_TYPE_BMP
-} PictType;
+document: \pict, \shppict, \NeXTgraphic. The picture data is decoded here and
+handed to the output sink, which does the actual loading. */
 
 typedef struct {
-    PictType type;
-    int type_param;
-    GdkPixbufLoader *loader;
+    PictureInfo info;
+    void *picture; /* The output sink's handle for the picture */
     bool error;
-
-    long width;
-    long height;
-    long width_goal;
-    long height_goal;
-    int xscale;
-    int yscale;
 } PictState;
 
 typedef struct {
-    long width;
+    long width; /* Twips */
     long height;
 } NeXTGraphicState;
 
 #define PICT_STATE_INIT \
-    state->type = PICT_TYPE_WMF; \
-    state->type_param = 1; \
-    state->xscale = state->yscale = 100; \
-    state->width = state->height = state->width_goal = state->height_goal = -1;
+    state->info.type = PICT_TYPE_WMF; \
+    state->info.type_param = 1; \
+    state->info.xscale = state->info.yscale = 100; \
+    state->info.width = state->info.height = -1; \
+    state->info.width_goal = state->info.height_goal = -1;
 DEFINE_STATE_FUNCTIONS_WITH_INIT(PictState, pict, PICT_STATE_INIT)
 #define NEXTGRAPHIC_STATE_INIT state->width = state->height = -1;
 DEFINE_STATE_FUNCTIONS_WITH_INIT(NeXTGraphicState, nextgraphic, NEXTGRAPHIC_STATE_INIT)
@@ -75,6 +55,7 @@ DEFINE_STATE_FUNCTIONS_WITH_INIT(NeXTGraphicState, nextgraphic, NEXTGRAPHIC_STAT
 /* Forward declarations */
 static void pict_text(ParserContext *ctx);
 static void pict_end(ParserContext *ctx);
+static void pict_binary(ParserContext *ctx, const uint8_t *data, size_t length);
 static void nextgraphic_text(ParserContext *ctx);
 static void nextgraphic_end(ParserContext *ctx);
 static int nextgraphic_get_codepage(ParserContext *ctx);
@@ -115,7 +96,10 @@ const DestinationInfo pict_destination = {
     pict_state_new,
     pict_state_copy,
     pict_state_free,
-    pict_end
+    pict_end,
+    NULL,
+    true, /* stream picture data */
+    pict_binary
 };
 
 const ControlWord nextgraphic_word_table[] = {
@@ -147,128 +131,118 @@ const DestinationInfo shppict_destination = {
     ignore_state_free
 };
 
-/* Insert picture into text buffer at current insertion mark */
-static void
-insert_picture_into_textbuffer(ParserContext *ctx, GdkPixbuf *pixbuf)
+/* Size of the buffer that hex picture data is decoded into before being handed
+to the output sink */
+#define PICT_DECODE_CHUNK_SIZE 4096
+
+/* Start the picture in the output sink if that hasn't been done yet. Returns
+false, and marks the picture as erroneous, if the picture can't be loaded. */
+static bool
+pict_ensure_started(ParserContext *ctx, PictState *state)
 {
-    GtkTextIter iter;
-    gtk_text_buffer_get_iter_at_mark(ctx->textbuffer, &iter, ctx->endmark);
-    gtk_text_buffer_insert_pixbuf(ctx->textbuffer, &iter, pixbuf);
+    if (state->picture)
+        return true;
+
+    if (ctx->sink->picture_begin)
+        state->picture = ctx->sink->picture_begin(ctx, &state->info);
+    if (!state->picture) {
+        state->error = true;
+        return false;
+    }
+    return true;
 }
 
-/* Send a message to the GdkPixbufLoader to change its expected size after
-parsing a width or height declaration */
-static void
-adjust_loader_size(PictState *state)
+/* Write a chunk of decoded picture data to the output sink */
+static bool
+pict_write(ParserContext *ctx, PictState *state, const uint8_t *data, size_t length)
 {
-    if (state->loader && (state->width != -1 || state->width_goal != -1) && (state->height != -1 || state->height_goal != -1)) {
-        gdk_pixbuf_loader_set_size(state->loader,
-                                   (state->width_goal != -1)? state->width_goal : state->width,
-                                   (state->height_goal != -1)? state->height_goal : state->height);
+    if (length == 0)
+        return true;
+    if (!ctx->sink->picture_write(ctx, state->picture, &state->info, data, length)) {
+        state->error = true;
+        return false;
     }
+    return true;
 }
 
 /* The "text" in a \pict destination is the picture, expressed as a long string
-of hexadecimal digits */
+of hexadecimal digits. This destination streams its text, so this is called
+once per chunk of data; each chunk is decoded in pieces into a small fixed-size
+buffer and fed to the output sink, so that the hex digits never need to be held
+in memory in their entirety. */
 static void
 pict_text(ParserContext *ctx)
 {
-    GError *error = NULL;
     PictState *state = get_state(ctx);
-    static const char *mimetypes[] = {
-        "image/x-emf", "image/png", "image/jpeg", "image/x-pict",
-        "OS/2 Presentation Manager", "image/x-wmf", "image/x-bmp", "image-x-bmp"
-    }; /* "OS/2 Presentation Manager" isn't supported */
 
-    if (state->error)
+    if (state->error || ctx->text->len == 0 || !pict_ensure_started(ctx, state)) {
+        g_string_truncate(ctx->text, 0);
         return;
-
-    if (strlen(ctx->text->str) == 0)
-        return;
-
-    /* If no GdkPixbufLoader has been initialized yet, then do that */
-    if (!state->loader) {
-        g_autoptr(GSList) formats = gdk_pixbuf_get_formats();
-
-        /* Make sure the MIME type we want to load is present in the list of
-        formats compiled into our GdkPixbuf library */
-        for (GSList *iter = formats; iter && !state->loader; iter = g_slist_next(iter)) {
-            g_auto(GStrv) mimes = gdk_pixbuf_format_get_mime_types(iter->data);
-
-            for (size_t i = 0; mimes[i] != NULL; i++) {
-                if (g_ascii_strcasecmp(mimes[i], mimetypes[state->type]) == 0) {
-                    state->loader = gdk_pixbuf_loader_new_with_mime_type(mimetypes[state->type], &error);
-                    if (!state->loader) {
-                        g_warning(_("Error loading picture of MIME type '%s': %s"), mimetypes[state->type], error->message);
-                        state->error = true;
-                    }
-                    break;
-                }
-            }
-        }
-        if (!state->loader && !state->error) {
-            g_warning(_("Module for loading MIME type '%s' not found"), mimetypes[state->type]);
-            state->error = true;
-        }
-
-        if (state->error)
-            return;
-
-        adjust_loader_size(state);
     }
 
-    /* Convert the "text" into binary data */
-    g_autofree uint8_t *writebuffer = g_new0(uint8_t, strlen(ctx->text->str));
-    size_t count;
-    for (count = 0; ctx->text->str[count * 2] && ctx->text->str[count * 2 + 1]; count++) {
-        char buf[3];
-
-        memcpy(buf, ctx->text->str + (count * 2), 2);
-        buf[2] = '\0';
-        errno = 0;
-        uint8_t byte = (uint8_t)strtol(buf, NULL, 16);
-        if (errno) {
-            g_warning(_("Error in \\pict data: '%s'"), buf);
+    /* Convert the "text" into binary data, skipping any whitespace */
+    uint8_t writebuffer[PICT_DECODE_CHUNK_SIZE];
+    size_t count = 0;
+    int high_nibble = -1;
+    const char *text = ctx->text->str;
+    for (size_t i = 0; i < ctx->text->len; i++) {
+        if (g_ascii_isspace(text[i]))
+            continue;
+        int nibble = g_ascii_xdigit_value(text[i]);
+        if (nibble == -1) {
+            g_warning(_("Error in \\pict data: '%c'"), text[i]);
             state->error = true;
+            g_string_truncate(ctx->text, 0);
             return;
         }
-        writebuffer[count] = byte;
-    }
-    /* Write the "text" into the GdkPixbufLoader */
-    if (!gdk_pixbuf_loader_write(state->loader, writebuffer, count, &error)) {
-        g_warning(_("Error reading \\pict data: %s"), error->message);
-        state->error = true;
+        if (high_nibble == -1) {
+            high_nibble = nibble;
+            continue;
+        }
+        writebuffer[count++] = (uint8_t)(high_nibble << 4 | nibble);
+        high_nibble = -1;
+        if (count == PICT_DECODE_CHUNK_SIZE) {
+            if (!pict_write(ctx, state, writebuffer, count)) {
+                g_string_truncate(ctx->text, 0);
+                return;
+            }
+            count = 0;
+        }
     }
+    pict_write(ctx, state, writebuffer, count);
 
+    /* If the chunk ended in the middle of a byte, keep the dangling hex digit
+    for the next chunk */
     g_string_truncate(ctx->text, 0);
+    if (high_nibble != -1 && !state->error)
+        g_string_append_c(ctx->text, "0123456789abcdef"[high_nibble]);
+}
+
+/* Picture data may also be given as raw bytes with \binN, in which case it is
+written to the output sink straight from the RTF text */
+static void
+pict_binary(ParserContext *ctx, const uint8_t *data, size_t length)
+{
+    PictState *state = get_state(ctx);
+
+    if (state->error || !pict_ensure_started(ctx, state))
+        return;
+    pict_write(ctx, state, data, length);
 }
 
-/* When the destination is closed, then there is no more picture data, so close
-the GdkPixbufLoader and load the picture */
+/* When the destination is closed, then there is no more picture data, so tell
+the output sink to finish the picture */
 static void
 pict_end(ParserContext *ctx)
 {
     PictState *state = get_state(ctx);
+    void *picture = g_steal_pointer(&state->picture);
 
-    if (!state->error) {
-        GError *error = NULL;
-        if (state->loader && !gdk_pixbuf_loader_close(state->loader, &error))
-            g_warning(_("Error closing pixbuf loader: %s"), error->message);
-        GdkPixbuf *picture = gdk_pixbuf_loader_get_pixbuf(state->loader);
-        if (!picture) {
-            g_warning(_("Error loading picture"));
-        } else {
-            /* Scale picture if needed */
-            if (state->xscale != 100 || state->yscale != 100) {
-                int newwidth = gdk_pixbuf_get_width(picture) * state->xscale / 100;
-                int newheight = gdk_pixbuf_get_height(picture) * state->yscale / 100;
-                GdkPixbuf *newpicture = gdk_pixbuf_scale_simple(picture, newwidth, newheight, GDK_INTERP_BILINEAR);
-                g_object_unref(picture);
-                picture = newpicture;
-            }
-            insert_picture_into_textbuffer(ctx, picture);
-        }
-    }
+    /* Discard a dangling hex digit, if any */
+    g_string_truncate(ctx->text, 0);
+
+    if (picture)
+        ctx->sink->picture_end(ctx, picture, &state->info, !state->error);
 }
 
 static bool
@@ -278,90 +252,86 @@ pic_dibitmap(ParserContext *ctx, PictState *state, int32_t param, GError **error
         g_set_error(error, RTF_ERROR, RTF_ERROR_BAD_PICT_TYPE, _("Invalid bitmap type '%i' for \\dibitmap"), param);
         return false;
     }
-    state->type = PICT_TYPE_DIB;
-    state->type_param = 0;
+    state->info.type = PICT_TYPE_DIB;
+    state->info.type_param = 0;
     return true;
 }
 
 static bool
 pic_emfblip(ParserContext *ctx, PictState *state, GError **error)
 {
-    state->type = PICT_TYPE_EMF;
+    state->info.type = PICT_TYPE_EMF;
     return true;
 }
 
 static bool
 pic_jpegblip(ParserContext *ctx, PictState *state, GError **error)
 {
-    state->type = PICT_TYPE_JPEG;
+    state->info.type = PICT_TYPE_JPEG;
     return true;
 }
 
 static bool
 pic_macpict(ParserContext *ctx, PictState *state, GError **error)
 {
-    state->type = PICT_TYPE_MAC;
+    state->info.type = PICT_TYPE_MAC;
     return true;
 }
 
 static bool
 pic_pich(ParserContext *ctx, PictState *state, int32_t pixels, GError **error)
 {
-    state->height = pixels;
-    adjust_loader_size(state);
+    state->info.height = pixels;
     return true;
 }
 
 static bool
 pic_pichgoal(ParserContext *ctx, PictState *state, int32_t twips, GError **error)
 {
-    state->height_goal = PANGO_PIXELS(TWIPS_TO_PANGO(twips));
-    adjust_loader_size(state);
+    state->info.height_goal = twips;
     return true;
 }
 
 static bool
 pic_picscalex(ParserContext *ctx, PictState *state, int32_t percent, GError **error)
 {
-    state->xscale = percent;
+    state->info.xscale = percent;
     return true;
 }
 
 static bool
 pic_picscaley(ParserContext *ctx, PictState *state, int32_t percent, GError **error)
 {
-    state->yscale = percent;
+    state->info.yscale = percent;
     return true;
 }
 
 static bool
 pic_picw(ParserContext *ctx, PictState *state, int32_t pixels, GError **error)
 {
-    state->width = pixels;
-    adjust_loader_size(state);
+    state->info.width = pixels;
     return true;
 }
 
 static bool
 pic_picwgoal(ParserContext *ctx, PictState *state, int32_t twips, GError **error)
 {
-    state->width_goal = PANGO_PIXELS(TWIPS_TO_PANGO(twips));
-    adjust_loader_size(state);
+    state->info.width_goal = twips;
     return true;
 }
 
 static bool
 pic_pmmetafile(ParserContext *ctx, PictState *state, int32_t param, GError **error)
 {
-    state->type = PICT_TYPE_OS2;
-    state->type_param = param;
+    state->info.type = PICT_TYPE_OS2;
+    state->info.type_param = param;
     return true;
 }
 
 static bool
 pic_pngblip(ParserContext *ctx, PictState *state, GError **error)
 {
-    state->type = PICT_TYPE_PNG;
+    state->info.type = PICT_TYPE_PNG;
     return true;
 }
 
@@ -372,16 +342,16 @@ pic_wbitmap(ParserContext *ctx, PictState *state, int32_t param, GError **error)
         g_set_error(error, RTF_ERROR, RTF_ERROR_BAD_PICT_TYPE, _("Invalid bitmap type '%i' for \\wbitmap"), param);
         return false;
     }
-    state->type = PICT_TYPE_BMP;
-    state->type_param = 0;
+    state->info.type = PICT_TYPE_BMP;
+    state->info.type_param = 0;
     return true;
 }
 
 static bool
 pic_wmetafile(ParserContext *ctx, PictState *state, int32_t param, GError **error)
 {
-    state->type = PICT_TYPE_WMF;
-    state->type_param = param;
+    state->info.type = PICT_TYPE_WMF;
+    state->info.type_param = param;
     return true;
 }
 
@@ -397,17 +367,12 @@ static void
 nextgraphic_end(ParserContext *ctx)
 {
     NeXTGraphicState *state = get_state(ctx);
-    GError *error = NULL;
 
-    g_autofree char *filename = g_strstrip(g_strdup(ctx->text->str));
+    g_autofree char *relfilename = g_strstrip(g_strdup(ctx->text->str));
     g_string_truncate(ctx->text, 0);
-    GdkPixbuf *pixbuf = gdk_pixbuf_new_from_file_at_scale(filename, state->width, state->height, false /* preserve aspect ratio */, &error);
-    if (!pixbuf) {
-        g_warning(_("Error loading picture from file '%s': %s"), filename, error->message);
-        return;
-    }
-
-    insert_picture_into_textbuffer(ctx, pixbuf);
+    g_autofree char *filename = resolve_filename(ctx, relfilename);
+    if (ctx->sink->picture_file)
+        ctx->sink->picture_file(ctx, filename, state->width, state->height);
 }
 
 static int
@@ -419,13 +384,13 @@ nextgraphic_get_codepage(ParserContext *ctx)
 static bool
 ng_height(ParserContext *ctx, NeXTGraphicState *state, int32_t twips, GError **error)
 {
-    state->height = PANGO_PIXELS(TWIPS_TO_PANGO(twips));
+    state->height = twips;
     return true;
 }
 
 static bool
 ng_width(ParserContext *ctx, NeXTGraphicState *state, int32_t twips, GError **error)
 {
-    state->width = PANGO_PIXELS(TWIPS_TO_PANGO(twips));
+    state->width = twips;
     return true;
 }
@@ -0,0 +1,373 @@
+/* Copyright 2009, 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib.h>
+#include <glib/gi18n-lib.h>
+#include <gtk/gtk.h>
+
+#include "rtf-deserialize.h"
+#include "rtf-ir.h"
+#include "rtf-sink.h"
+#include "rtf-textbuffer.h"
+
+/* rtf-pixbuf.c - Pictures in a GtkTextBuffer. The pictures from a parsed
+document are loaded with GdkPixbuf and inserted into the text buffer. */
+
+/* The size at which a picture from \pict data should be decoded */
+typedef struct {
+    const PictureInfo *info;
+    int max_width;
+    int max_height;
+} PictureSize;
+
+/* A picture being decoded on a worker thread in asynchronous picture mode. The
+picture's place in the text buffer is held by a child anchor until it is
+ready. */
+typedef struct {
+    GtkTextBuffer *textbuffer;
+    GtkTextChildAnchor *anchor;
+    GMainContext *context; /* Where to insert the picture when it's ready */
+    int max_width;
+    int max_height;
+
+    /* Either picture data and the GdkPixbuf format to load it with, and the
+    \pict description for its size and scale... */
+    GBytes *data;
+    const char *format;
+    PictureInfo info;
+    /* ...or a file to load at the given size */
+    char *filename;
+    int width;
+    int height;
+
+    GdkPixbuf *pixbuf;
+} PictureJob;
+
+/* Shrink a picture size, preserving its aspect ratio, so that it fits within
+max_width by max_height. A limit of 0 or less means no limit. */
+static void
+fit_picture_size(int max_width, int max_height, int *width, int *height)
+{
+    double factor = 1.0;
+
+    if (max_width > 0 && *width > max_width)
+        factor = (double)max_width / *width;
+    if (max_height > 0 && *height > max_height)
+        factor = MIN(factor, (double)max_height / *height);
+
+    if (factor < 1.0) {
+        *width = MAX(1, (int)(*width * factor));
+        *height = MAX(1, (int)(*height * factor));
+    }
+}
+
+/* Load a picture from a file, at the given size, or its natural size in either
+dimension that is -1, fitting it within the given maximum picture size. The
+picture is decoded directly at that size. */
+static GdkPixbuf *
+load_picture_file(const char *filename, int width, int height, int max_width, int max_height, GError **error)
+{
+    if (max_width > 0 || max_height > 0) {
+        int natural_width, natural_height;
+        if (gdk_pixbuf_get_file_info(filename, &natural_width, &natural_height)) {
+            if (width == -1 && height == -1) {
+                width = natural_width;
+                height = natural_height;
+            } else if (width == -1) {
+                width = natural_width * height / natural_height;
+            } else if (height == -1) {
+                height = natural_height * width / natural_width;
+            }
+            fit_picture_size(max_width, max_height, &width, &height);
+        }
+    }
+
+    return gdk_pixbuf_new_from_file_at_scale(filename, width, height, false /* preserve aspect ratio */, error);
+}
+
+/* Calculate the size at which to display a picture whose data is
+natural_width by natural_height pixels, from the size and scale control words
+read so far */
+static void
+pict_get_display_size(const PictureInfo *info, int max_width, int max_height, int natural_width, int natural_height, int *width, int *height)
+{
+    int64_t w = natural_width;
+    int64_t h = natural_height;
+
+    if ((info->width != -1 || info->width_goal != -1) && (info->height != -1 || info->height_goal != -1)) {
+        w = (info->width_goal != -1)? PANGO_PIXELS(TWIPS_TO_PANGO(info->width_goal)) : info->width;
+        h = (info->height_goal != -1)? PANGO_PIXELS(TWIPS_TO_PANGO(info->height_goal)) : info->height;
+    }
+    w = w * info->xscale / 100;
+    h = h * info->yscale / 100;
+
+    *width = (int)CLAMP(w, 1, G_MAXINT);
+    *height = (int)CLAMP(h, 1, G_MAXINT);
+    fit_picture_size(max_width, max_height, width, height);
+}
+
+/* As soon as the GdkPixbufLoader knows the size of the picture, tell it the
+size we want, so that it decodes the picture at that size directly */
+static void
+pict_size_prepared(GdkPixbufLoader *loader, int natural_width, int natural_height, PictureSize *size)
+{
+    int width, height;
+    pict_get_display_size(size->info, size->max_width, size->max_height, natural_width, natural_height, &width, &height);
+    if (width != natural_width || height != natural_height)
+        gdk_pixbuf_loader_set_size(loader, width, height);
+}
+
+/* Load a picture from \pict data with the given GdkPixbuf format, at its
+display size. Warns and returns NULL if the picture can't be loaded. */
+static GdkPixbuf *
+load_picture_data(GBytes *data, const char *format, const PictureInfo *info, int max_width, int max_height)
+{
+    GError *error = NULL;
+    GdkPixbuf *pixbuf = NULL;
+    PictureSize size = { info, max_width, max_height };
+
+    g_autoptr(GdkPixbufLoader) loader = gdk_pixbuf_loader_new_with_type(format, &error);
+    if (loader) {
+        g_signal_connect(loader, "size-prepared", G_CALLBACK(pict_size_prepared), &size);
+        /* Write the data in chunks, as the parser would, so that the loader
+        can start decoding and choose the picture's size early */
+        size_t length;
+        const uint8_t *bytes = g_bytes_get_data(data, &length);
+        bool ok = true;
+        for (size_t offset = 0; offset < length && ok; offset += STREAM_CHUNK_SIZE)
+            ok = gdk_pixbuf_loader_write(loader, bytes + offset, MIN(STREAM_CHUNK_SIZE, length - offset), &error);
+        if (ok && gdk_pixbuf_loader_close(loader, &error)) {
+            pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+            if (pixbuf)
+                g_object_ref(pixbuf);
+        } else {
+            /* Make sure the loader doesn't complain about being freed without
+            being closed */
+            gdk_pixbuf_loader_close(loader, NULL);
+        }
+    }
+    if (error)
+        g_warning(_("Error reading \\pict data: %s"), error->message);
+    else if (!pixbuf)
+        g_warning(_("Error loading picture"));
+    g_clear_error(&error);
+    return pixbuf;
+}
+
+/* Reserve a place for a picture at iter, and create a job for decoding it */
+static PictureJob *
+picture_job_new(TextBufferOutput *out, GtkTextIter *iter)
+{
+    PictureJob *job = g_slice_new0(PictureJob);
+
+    job->textbuffer = g_object_ref(out->textbuffer);
+    job->anchor = g_object_ref(gtk_text_buffer_create_child_anchor(out->textbuffer, iter));
+    job->context = g_main_context_ref_thread_default();
+    job->max_width = out->max_picture_width;
+    job->max_height = out->max_picture_height;
+    return job;
+}
+
+static void
+picture_job_free(PictureJob *job)
+{
+    g_object_unref(job->textbuffer);
+    g_object_unref(job->anchor);
+    g_main_context_unref(job->context);
+    g_clear_pointer(&job->data, g_bytes_unref);
+    g_free(job->filename);
+    g_clear_object(&job->pixbuf);
+    g_slice_free(PictureJob, job);
+}
+
+/* Runs in the main context that the picture was imported in. Replace the
+placeholder with the picture, giving the picture the placeholder's tags, unless
+the placeholder has been deleted in the meantime. */
+static gboolean
+picture_job_insert(PictureJob *job)
+{
+    if (gtk_text_child_anchor_get_deleted(job->anchor))
+        return G_SOURCE_REMOVE;
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_iter_at_child_anchor(job->textbuffer, &start, job->anchor);
+    end = start;
+    gtk_text_iter_forward_char(&end);
+    g_autoptr(GSList) tags = gtk_text_iter_get_tags(&start);
+    gtk_text_buffer_delete(job->textbuffer, &start, &end);
+
+    if (job->pixbuf) {
+        gtk_text_buffer_insert_pixbuf(job->textbuffer, &start, job->pixbuf);
+        end = start;
+        gtk_text_iter_backward_char(&start);
+        for (GSList *iter = tags; iter; iter = g_slist_next(iter))
+            gtk_text_buffer_apply_tag(job->textbuffer, iter->data, &start, &end);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/* Runs on a worker thread. Decode the picture, then hand it back to the main
+context. */
+static void
+picture_job_run(PictureJob *job, void *unused)
+{
+    if (job->filename) {
+        GError *error = NULL;
+        job->pixbuf = load_picture_file(job->filename, job->width, job->height, job->max_width, job->max_height, &error);
+        if (!job->pixbuf) {
+            g_warning(_("Error loading picture from file '%s': %s"), job->filename, error->message);
+            g_clear_error(&error);
+        }
+    } else {
+        job->pixbuf = load_picture_data(job->data, job->format, &job->info, job->max_width, job->max_height);
+    }
+
+    g_main_context_invoke_full(job->context, G_PRIORITY_DEFAULT, (GSourceFunc)picture_job_insert, job, (GDestroyNotify)picture_job_free);
+}
+
+/* Start decoding a picture in the background. The pool of worker threads is
+shared by all imports, and created the first time it's needed. */
+static void
+picture_job_start(PictureJob *job)
+{
+    static GThreadPool *pool = NULL;
+
+    if (g_once_init_enter(&pool)) {
+        GThreadPool *new_pool = g_thread_pool_new((GFunc)picture_job_run, NULL, (int)g_get_num_processors(), false, NULL);
+        g_once_init_leave(&pool, new_pool);
+    }
+    g_thread_pool_push(pool, job, NULL);
+}
+
+/* MIME types of the picture types, indexed by PictType */
+static const char *pict_mime_types[] = {
+    "image/x-emf", "image/png", "image/jpeg", "image/x-pict",
+    "OS/2 Presentation Manager", "image/x-wmf", "image/x-bmp", "image-x-bmp"
+}; /* "OS/2 Presentation Manager" isn't supported */
+
+/* Return the name of the GdkPixbuf format that loads pictures of the given
+type, or NULL if our GdkPixbuf library has no module for it. Walking the list of
+formats and their MIME types is expensive, so it is done only once per process,
+the first time any picture is loaded. */
+static const char *
+get_format_for_pict_type(PictType type)
+{
+    static char *format_names[G_N_ELEMENTS(pict_mime_types)];
+    static size_t formats_initialized = 0;
+
+    if (g_once_init_enter(&formats_initialized)) {
+        g_autoptr(GSList) formats = gdk_pixbuf_get_formats();
+
+        for (GSList *iter = formats; iter; iter = g_slist_next(iter)) {
+            g_auto(GStrv) mimes = gdk_pixbuf_format_get_mime_types(iter->data);
+
+            for (size_t i = 0; mimes[i] != NULL; i++) {
+                for (size_t type_ix = 0; type_ix < G_N_ELEMENTS(pict_mime_types); type_ix++) {
+                    /* The names are kept for the lifetime of the process */
+                    if (format_names[type_ix] == NULL && g_ascii_strcasecmp(mimes[i], pict_mime_types[type_ix]) == 0)
+                        format_names[type_ix] = gdk_pixbuf_format_get_name(iter->data);
+                }
+            }
+        }
+        g_once_init_leave(&formats_initialized, 1);
+    }
+
+    return format_names[type];
+}
+
+/* Insert the picture from \pict data at iter, or start decoding it in the
+background */
+static void
+insert_picture_data(TextBufferOutput *out, GtkTextIter *iter, const DocumentObject *object)
+{
+    static int missing_module_warned[G_N_ELEMENTS(pict_mime_types)];
+
+    const char *format = get_format_for_pict_type(object->info.type);
+    if (format == NULL) {
+        /* Only warn about each missing module once */
+        if (g_atomic_int_compare_and_exchange(&missing_module_warned[object->info.type], 0, 1))
+            g_warning(_("Module for loading MIME type '%s' not found"), pict_mime_types[object->info.type]);
+        return;
+    }
+
+    if (out->async_pictures) {
+        PictureJob *job = picture_job_new(out, iter);
+        /* \bin data is a slice of the RTF code, which may not outlive the
+        import, so the worker thread gets a copy of it */
+        if (object->data_in_code)
+            job->data = g_bytes_new(g_bytes_get_data(object->data, NULL), g_bytes_get_size(object->data));
+        else
+            job->data = g_bytes_ref(object->data);
+        job->format = format;
+        job->info = object->info;
+        picture_job_start(job);
+        return;
+    }
+
+    g_autoptr(GdkPixbuf) pixbuf = load_picture_data(object->data, format, &object->info, out->max_picture_width, out->max_picture_height);
+    if (pixbuf)
+        gtk_text_buffer_insert_pixbuf(out->textbuffer, iter, pixbuf);
+}
+
+/* Insert the picture from a file at iter, at the given size in twips or its
+natural size in either dimension that is -1. In asynchronous picture mode, the
+file is loaded in the background. */
+static void
+insert_picture_file(TextBufferOutput *out, GtkTextIter *iter, const char *filename, int width, int height)
+{
+    if (width != -1)
+        width = PANGO_PIXELS(TWIPS_TO_PANGO(width));
+    if (height != -1)
+        height = PANGO_PIXELS(TWIPS_TO_PANGO(height));
+
+    if (out->async_pictures) {
+        PictureJob *job = picture_job_new(out, iter);
+        job->filename = g_strdup(filename);
+        job->width = width;
+        job->height = height;
+        picture_job_start(job);
+        return;
+    }
+
+    GError *error = NULL;
+    g_autoptr(GdkPixbuf) pixbuf = load_picture_file(filename, width, height, out->max_picture_width, out->max_picture_height, &error);
+    if (!pixbuf) {
+        g_warning(_("Error loading picture from file '%s': %s"), filename, error->message);
+        g_clear_error(&error);
+        return;
+    }
+    gtk_text_buffer_insert_pixbuf(out->textbuffer, iter, pixbuf);
+}
+
+/* Insert a picture from the document at iter, leaving iter after it. Nothing
+is inserted if the picture can't be loaded. */
+void
+pixbuf_insert_object(TextBufferOutput *out, GtkTextIter *iter, const DocumentObject *object)
+{
+    switch (object->type) {
+    case DOCUMENT_OBJECT_PICTURE:
+        insert_picture_data(out, iter, object);
+        break;
+    case DOCUMENT_OBJECT_PICTURE_FILE:
+        insert_picture_file(out, iter, object->filename, object->width, object->height);
+        break;
+    }
+}
@@ -0,0 +1,174 @@
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "rtf-scan.h"
+
+/* rtf-scan.c - Finding the group structure of RTF code without tokenizing it.
+Only braces, backslashes, and NUL bytes matter for that, and those are rare
+enough that they can be searched for many bytes at a time. */
+
+/* Return the position of the next brace, backslash, or NUL byte at or after
+pos, or end if there is none. With SSE2 this looks at 16 bytes at a time. */
+const char *
+find_structural_character(const char *pos, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i nul = _mm_setzero_si128();
+
+    while (end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)pos);
+        __m128i matches = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, open), _mm_cmpeq_epi8(chunk, close)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash), _mm_cmpeq_epi8(chunk, nul)));
+        int mask = _mm_movemask_epi8(matches);
+        if (mask != 0)
+            return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+#endif
+    for (; pos < end; pos++) {
+        if (*pos == '{' || *pos == '}' || *pos == '\\' || *pos == '\0')
+            break;
+    }
+    return pos;
+}
+
+/* Whether the control word 'word' is at pos, and not just the start of a
+longer one */
+bool
+is_control_word(const char *pos, const char *end, const char *word)
+{
+    size_t length = strlen(word);
+    return (size_t)(end - pos) > length + 1 && pos[0] == '\\' &&
+        strncmp(pos + 1, word, length) == 0 && !g_ascii_isalpha(pos[length + 1]);
+}
+
+/* Move past the backslash at pos and what it escapes. Returns NULL if there is
+invalid \binN data there. */
+const char *
+skip_backslash(const char *pos, const char *end)
+{
+    if (is_control_word(pos, end, "bin") && g_ascii_isdigit(pos[4])) {
+        /* Skip the binary data, which may contain braces */
+        char *digits_end;
+        unsigned long length = strtoul(pos + 4, &digits_end, 10);
+        pos = digits_end;
+        if (pos < end && *pos == ' ')
+            pos++;
+        if (length > (unsigned long)(end - pos))
+            return NULL;
+        return pos + length;
+    }
+    /* Skip the escaped character or the first letter of the control word,
+    neither of which can be a brace */
+    return pos + 2;
+}
+
+/* Find the closing brace of the group that pos is in. Escaped braces and
+\binN data are taken into account. Returns NULL if the end of the group couldn't
+be found because the code is malformed, in which case the caller should parse
+the group normally so that the usual error is reported. */
+const char *
+find_group_end(const char *pos, const char *end)
+{
+    int depth = 0;
+
+    while ((pos = find_structural_character(pos, end)) < end) {
+        switch (*pos) {
+        case '{':
+            depth++;
+            pos++;
+            break;
+        case '}':
+            if (depth == 0)
+                return pos;
+            depth--;
+            pos++;
+            break;
+        case '\\':
+            pos = skip_backslash(pos, end);
+            if (pos == NULL)
+                return NULL;
+            break;
+        default: /* NUL */
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Find places where a document can be split into pieces that can be parsed
+independently of each other. pos must be at the opening brace of the document.
+Those places are the paragraphs that start with "\pard\plain" directly in the
+document group, since all the formatting that they inherit is reset there.
+
+The first such paragraph is always included, since that is where the document's
+header ends; after that, each one is at least min_distance bytes after the one
+before. Returns an array of positions in the RTF code, which may be empty. */
+GPtrArray *
+find_split_points(const char *pos, const char *end, size_t min_distance)
+{
+    GPtrArray *points = g_ptr_array_new();
+    const char *last_point = NULL;
+    int depth = 0;
+
+    while ((pos = find_structural_character(pos, end)) < end) {
+        switch (*pos) {
+        case '{':
+            depth++;
+            pos++;
+            break;
+        case '}':
+            depth--;
+            if (depth == 0)
+                return points; /* End of the document */
+            pos++;
+            break;
+        case '\\':
+            if (depth == 1 && is_control_word(pos, end, "pard") &&
+                (last_point == NULL || (size_t)(pos - last_point) >= min_distance)) {
+                const char *plain = pos + 5;
+                if (plain < end && (*plain == ' ' || *plain == '\n' || *plain == '\r'))
+                    plain++;
+                if (is_control_word(plain, end, "plain")) {
+                    g_ptr_array_add(points, (void *)pos);
+                    last_point = pos;
+                }
+            }
+            pos = skip_backslash(pos, end);
+            if (pos == NULL)
+                return points;
+            break;
+        default: /* NUL */
+            return points;
+        }
+    }
+    return points;
+}
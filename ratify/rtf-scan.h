@@ -0,0 +1,27 @@
+#pragma once
+
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <glib.h>
+
+const char *find_structural_character(const char *pos, const char *end);
+bool is_control_word(const char *pos, const char *end, const char *word);
+const char *skip_backslash(const char *pos, const char *end);
+const char *find_group_end(const char *pos, const char *end);
+GPtrArray *find_split_points(const char *pos, const char *end, size_t min_distance);
@@ -19,7 +19,6 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
-#include <time.h>
 
 #include <gdk/gdk.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
@@ -27,7 +26,12 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include <glib/gi18n-lib.h>
 #include <gtk/gtk.h>
 
+#include "init.h"
+#include "rtf.h"
+#include "rtf-ir.h"
 #include "rtf-langcode.h"
+#include "rtf-serialize.h"
+#include "rtf-writer.h"
 
 /* rtf-serialize.c - RTF writer */
 
@@ -36,25 +40,153 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #define PANGO_TO_HALF_POINTS(pango) (2 * pango / PANGO_SCALE)
 #define PANGO_TO_TWIPS(pango) (20 * pango / PANGO_SCALE)
 
+/* In compact mode, control words are grouped by the property they set; a
+later word in a group overrides an earlier one. The character properties come
+first. */
+typedef enum {
+    GROUP_BACKGROUND,
+    GROUP_FONT,
+    GROUP_FOREGROUND,
+    GROUP_HIGHLIGHT,
+    GROUP_HIDDEN,
+    GROUP_LANGUAGE,
+    GROUP_RISE,
+    GROUP_SCALE,
+    GROUP_SIZE,
+    GROUP_STRIKETHROUGH,
+    GROUP_ITALIC,
+    GROUP_UNDERLINE,
+    GROUP_CAPS,
+    GROUP_BOLD,
+    GROUP_SUPERSUB,
+    GROUP_FIRST_INDENT,
+    GROUP_JUSTIFICATION,
+    GROUP_LEFT_MARGIN,
+    GROUP_SPACE_BEFORE,
+    GROUP_SPACE_AFTER,
+    GROUP_LEADING,
+    GROUP_RIGHT_MARGIN,
+    GROUP_TABS,
+    N_PROPERTY_GROUPS
+} PropertyGroup;
+
+#define FIRST_PARAGRAPH_GROUP GROUP_FIRST_INDENT
+
+/* A tag's RTF code in compact mode: the control words for each group, or NULL
+for the groups that the tag doesn't set */
 typedef struct {
-    GtkTextBuffer *textbuffer;
-    const GtkTextIter *start, *end;
-    GString *output;
-    GtkTextBuffer *linebuffer;
-    GHashTable *tag_codes; /* Translation table of GtkTextTags to RTF code */
-    GList *font_table;
-    GList *color_table;
+    char *values[N_PROPERTY_GROUPS];
+} CompactCode;
+
+typedef struct {
+    GHashTable *tag_codes; /* GtkTextTags converted to RTF code so far */
+    GPtrArray *tags; /* The tags in the buffer's tag table, by priority */
+    /* Font table, as interned family names, and their numbers plus one */
+    GPtrArray *fonts;
+    GHashTable *font_numbers;
+    /* Color table, as packed RGB values, and their numbers. Color 0 is always
+    black in this implementation, and isn't in either of them. */
+    GArray *colors;
+    GHashTable *color_numbers;
+    RtfExportFlags flags;
 } WriterContext;
 
+/* Sets of tags are bitsets, indexed by tag priority. The priorities in a tag
+table run from 0 to one less than its size, so they make a dense index, and
+going through a set in order writes the tags in order of priority. */
+typedef uint64_t TagSetWord;
+#define TAG_SET_WORD_BITS 64
+
+/* A snapshot is an immutable copy of the paragraphs to be exported, made on the
+buffer's thread. It holds everything needed to write them, including the tags'
+RTF code, so that blocks of paragraphs can be written on other threads. */
+
+/* A run of text without any tag flips. Its set of tags is in the snapshot's
+tag_sets. */
+typedef struct {
+    size_t start, end; /* Byte offsets in the snapshot's text */
+} SnapshotRun;
+
+typedef struct {
+    size_t start, end;
+    unsigned first_run, n_runs;
+    unsigned first_object; /* The first object at or after start */
+} SnapshotParagraph;
+
+/* An embedded object, which shows up in the text as U+FFFC */
+typedef struct {
+    size_t offset;
+    GdkPixbuf *pixbuf; /* NULL for a child anchor, which is left out */
+} SnapshotObject;
+
+typedef struct {
+    RtfExportFlags flags;
+    unsigned n_words; /* Number of words in a tag set */
+    GString *text;
+    GArray *paragraphs; /* SnapshotParagraph */
+    GArray *runs; /* SnapshotRun */
+    GArray *tag_sets; /* TagSetWord, n_words for each run */
+    GArray *objects; /* SnapshotObject, in order */
+    GArray *blocks; /* unsigned, the first paragraph of each block */
+    size_t block_start; /* Offset in the text of the last block */
+    bool block_full;
+    /* Tags' codes, and in compact mode their compact codes, by priority. They
+    are NULL for tags that aren't used in the snapshot. */
+    unsigned n_tags;
+    char **codes;
+    CompactCode **compact_codes;
+} BufferSnapshot;
+
+/* A new block is started after a block has this much text, or has a picture in
+it, since encoding pictures is slow */
+#define BLOCK_TEXT_LENGTH 16384
+
+/* RTF code for a GtkTextTag, kept with the tag until any of its properties
+change. The font and color table references are kept apart from the rest of
+the code, since each export has its own tables. */
+typedef struct {
+    const char *family; /* Interned font family, or NULL */
+    /* Colors as packed RGB values, or NO_COLOR */
+    int background;
+    int foreground;
+    int paragraph_background;
+    char *code; /* The rest of the code */
+} TagCode;
+
+#define NO_COLOR -1
+
+
+static GQuark
+tag_code_quark(void)
+{
+    return g_quark_from_static_string("ratify-tag-code");
+}
+
+struct _SerializedBuffer {
+    char *header; /* RTF code up to the document text */
+    BufferSnapshot *snapshot;
+};
+
+static void
+compact_code_free(CompactCode *compact)
+{
+    for (unsigned group = 0; group < N_PROPERTY_GROUPS; group++)
+        g_free(compact->values[group]);
+    g_slice_free(CompactCode, compact);
+}
+
 /* Initialize the writer context */
 static WriterContext *
-writer_context_new(void)
+writer_context_new(RtfExportFlags flags)
 {
     WriterContext *ctx = g_slice_new0(WriterContext);
-    ctx->output = g_string_new("");
+    ctx->flags = flags;
     ctx->tag_codes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
-    ctx->font_table = NULL;
-    ctx->color_table = g_list_prepend(NULL, g_strdup("")); /* Color 0 always black */
+    ctx->tags = g_ptr_array_new();
+    ctx->fonts = g_ptr_array_new();
+    ctx->font_numbers = g_hash_table_new(NULL, NULL);
+    ctx->colors = g_array_new(false, false, sizeof(int));
+    ctx->color_numbers = g_hash_table_new(NULL, NULL);
     return ctx;
 }
 
@@ -63,45 +195,74 @@ static void
 writer_context_free(WriterContext *ctx)
 {
     g_hash_table_unref(ctx->tag_codes);
-    g_list_foreach(ctx->color_table, (GFunc)g_free, NULL);
-    g_list_free(ctx->color_table);
+    g_ptr_array_unref(ctx->tags);
+    g_ptr_array_unref(ctx->fonts);
+    g_hash_table_unref(ctx->font_numbers);
+    g_array_unref(ctx->colors);
+    g_hash_table_unref(ctx->color_numbers);
     g_slice_free(WriterContext, ctx);
 }
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(WriterContext, writer_context_free);
 
-/* Return the number of color in the color table. If color is not in the color
+/* Read a color property of tag as a packed RGB value */
+static int
+get_color_property(GtkTextTag *tag, const char *property)
+{
+    GdkColor *color;
+    g_object_get(tag, property, &color, NULL);
+    int rgb = (color->red >> 8) << 16 | (color->green >> 8) << 8 | color->blue >> 8;
+    gdk_color_free(color);
+    return rgb;
+}
+
+/* Return the number of a color in the color table. If it is not in the color
 table, then add it. */
 static int
-get_color_from_gdk_color(GdkColor *color, WriterContext *ctx)
+get_color_number(WriterContext *ctx, int rgb)
 {
-    if (color->red == 0 && color->green == 0 && color->blue == 0)
+    if (rgb == 0)
         return 0; /* Color 0 always black in this implementation */
 
-    g_autofree char *colorcode = g_strdup_printf("\\red%d\\green%d\\blue%d", color->red >> 8, color->green >> 8, color->blue >> 8);
-    int colornum;
-    GList *link = g_list_find_custom(ctx->color_table, colorcode, (GCompareFunc)strcmp);
-    if (link == NULL) {
-        colornum = g_list_length(ctx->color_table);
-        ctx->color_table = g_list_append(ctx->color_table, g_strdup(colorcode));
-    } else {
-        colornum = g_list_position(ctx->color_table, link);
+    unsigned colornum = GPOINTER_TO_UINT(g_hash_table_lookup(ctx->color_numbers, GINT_TO_POINTER(rgb)));
+    if (colornum == 0) {
+        g_array_append_val(ctx->colors, rgb);
+        colornum = ctx->colors->len;
+        g_hash_table_insert(ctx->color_numbers, GINT_TO_POINTER(rgb), GUINT_TO_POINTER(colornum));
     }
-
-    g_assert(colornum > 0 && colornum < 256);
     return colornum;
 }
 
-/* Generate RTF code for tag, and add it to the context's hashtable of tags to
-RTF code. */
+/* Same for the font table; family must be interned */
+static int
+get_font_number(WriterContext *ctx, const char *family)
+{
+    unsigned fontnum = GPOINTER_TO_UINT(g_hash_table_lookup(ctx->font_numbers, family));
+    if (fontnum == 0) {
+        g_ptr_array_add(ctx->fonts, (char *)family);
+        fontnum = ctx->fonts->len;
+        g_hash_table_insert(ctx->font_numbers, (char *)family, GUINT_TO_POINTER(fontnum));
+    }
+    return fontnum - 1;
+}
+
 static void
-convert_tag_to_code(GtkTextTag *tag, WriterContext *ctx)
+tag_code_free(TagCode *tag_code)
+{
+    g_free(tag_code->code);
+    g_slice_free(TagCode, tag_code);
+}
+
+/* Generate RTF code for tag */
+static TagCode *
+convert_tag_to_code(GtkTextTag *tag)
 {
     gboolean val;
-    int pixels, pango, colornum;
+    int pixels, pango;
     double factor, points;
-    GdkColor *color;
     char *name;
+    TagCode *tag_code = g_slice_new0(TagCode);
+    tag_code->background = tag_code->foreground = tag_code->paragraph_background = NO_COLOR;
 
     /* First check if this is a ratify-named tag that doesn't have a direct
      Pango attributes equivalent, such as superscript or subscript. Treat these
@@ -109,13 +270,13 @@ convert_tag_to_code(GtkTextTag *tag, WriterContext *ctx)
     g_object_get(tag, "name", &name, NULL);
     if (name) {
         if (strcmp(name, "rtf-superscript") == 0) {
-            g_hash_table_insert(ctx->tag_codes, tag, g_strdup("\\super"));
+            tag_code->code = g_strdup("\\super");
             g_free(name);
-            return;
+            return tag_code;
         } else if (strcmp(name, "rtf-subscript") == 0) {
-            g_hash_table_insert(ctx->tag_codes, tag, g_strdup("\\sub"));
+            tag_code->code = g_strdup("\\sub");
             g_free(name);
-            return;
+            return tag_code;
         }
         g_free(name);
     }
@@ -124,34 +285,19 @@ convert_tag_to_code(GtkTextTag *tag, WriterContext *ctx)
     GString *code = g_string_new("");
 
     g_object_get(tag, "background-set", &val, NULL);
-    if (val) {
-        g_object_get(tag, "background-gdk", &color, NULL);
-        colornum = get_color_from_gdk_color(color, ctx);
-        g_string_append_printf(code, "\\chshdng0\\chcbpat%d\\cb%d", colornum, colornum);
-    }
+    if (val)
+        tag_code->background = get_color_property(tag, "background-gdk");
 
     g_object_get(tag, "family-set", &val, NULL);
     if (val) {
         g_autofree char *family = NULL;
         g_object_get(tag, "family", &family, NULL);
-
-        int fontnum;
-        GList *link = g_list_find_custom(ctx->font_table, family, (GCompareFunc)strcmp);
-        if (link == NULL) {
-            fontnum = g_list_length(ctx->font_table);
-            ctx->font_table = g_list_append(ctx->font_table, g_strdup(family));
-        } else {
-            fontnum = g_list_position(ctx->font_table, link);
-        }
-        g_string_append_printf(code, "\\f%d", fontnum);
+        tag_code->family = g_intern_string(family);
     }
 
     g_object_get(tag, "foreground-set", &val, NULL);
-    if (val) {
-        g_object_get(tag, "foreground-gdk", &color, NULL);
-        colornum = get_color_from_gdk_color(color, ctx);
-        g_string_append_printf(code, "\\cf%d", colornum);
-    }
+    if (val)
+        tag_code->foreground = get_color_property(tag, "foreground-gdk");
 
     g_object_get(tag, "indent-set", &val, NULL);
     if (val) {
@@ -202,11 +348,8 @@ convert_tag_to_code(GtkTextTag *tag, WriterContext *ctx)
     }
 
     g_object_get(tag, "paragraph-background-set", &val, NULL);
-    if (val) {
-        g_object_get(tag, "paragraph-background-gdk", &color, NULL);
-        colornum = get_color_from_gdk_color(color, ctx);
-        g_string_append_printf(code, "\\highlight%d", colornum);
-    }
+    if (val)
+        tag_code->paragraph_background = get_color_property(tag, "paragraph-background-gdk");
 
     g_object_get(tag, "pixels-above-lines-set", &val, NULL);
     if (val) {
@@ -297,6 +440,7 @@ convert_tag_to_code(GtkTextTag *tag, WriterContext *ctx)
             pango_tab_array_get_tab(tabs, count, NULL, &location);
             g_string_append_printf(code, "\\tx%d", in_pixels? PIXELS_TO_TWIPS(location) : PANGO_TO_TWIPS(location));
         }
+        pango_tab_array_free(tabs);
     }
 
     g_object_get(tag, "underline-set", &val, NULL);
@@ -364,331 +508,1093 @@ convert_tag_to_code(GtkTextTag *tag, WriterContext *ctx)
             g_string_append(code, "\\b0");
     }
 
-    g_hash_table_insert(ctx->tag_codes, tag, g_string_free(code, false));
+    tag_code->code = g_string_free(code, false);
+    return tag_code;
+}
+
+/* Any change to a tag makes its cached code out of date */
+static void
+on_tag_notify(GtkTextTag *tag, GParamSpec *pspec, void *unused)
+{
+    g_signal_handlers_disconnect_by_func(tag, on_tag_notify, NULL);
+    g_object_set_qdata(G_OBJECT(tag), tag_code_quark(), NULL);
+}
+
+/* Return the RTF code for tag in this export, converting the tag the first time
+it is used, so that tags which don't occur in the exported text cost nothing.
+The conversion is kept with the tag for the next export. */
+static const char *
+get_tag_code(WriterContext *ctx, GtkTextTag *tag)
+{
+    const char *code = g_hash_table_lookup(ctx->tag_codes, tag);
+    if (code != NULL)
+        return code;
+
+    TagCode *tag_code = g_object_get_qdata(G_OBJECT(tag), tag_code_quark());
+    if (tag_code == NULL) {
+        tag_code = convert_tag_to_code(tag);
+        g_object_set_qdata_full(G_OBJECT(tag), tag_code_quark(), tag_code, (GDestroyNotify)tag_code_free);
+        g_signal_connect(tag, "notify", G_CALLBACK(on_tag_notify), NULL);
+    }
+
+    GString *str = g_string_new("");
+    if (tag_code->background != NO_COLOR) {
+        int colornum = get_color_number(ctx, tag_code->background);
+        g_string_append_printf(str, "\\chshdng0\\chcbpat%d\\cb%d", colornum, colornum);
+    }
+    if (tag_code->family)
+        g_string_append_printf(str, "\\f%d", get_font_number(ctx, tag_code->family));
+    if (tag_code->foreground != NO_COLOR)
+        g_string_append_printf(str, "\\cf%d", get_color_number(ctx, tag_code->foreground));
+    if (tag_code->paragraph_background != NO_COLOR)
+        g_string_append_printf(str, "\\highlight%d", get_color_number(ctx, tag_code->paragraph_background));
+    g_string_append(str, tag_code->code);
+
+    code = g_string_free(str, false);
+    g_hash_table_insert(ctx->tag_codes, tag, (char *)code);
+    return code;
 }
 
-/* This function is run before processing the actual contents of the buffer. It
-generates RTF code for all of the tags in the buffer's tag table, and tells the
-context which portion of the text buffer to serialize. */
 static void
-analyze_buffer(WriterContext *ctx, GtkTextBuffer *textbuffer, const GtkTextIter *start, const GtkTextIter *end)
+index_tag(GtkTextTag *tag, GPtrArray *tags)
+{
+    g_ptr_array_index(tags, gtk_text_tag_get_priority(tag)) = tag;
+}
+
+/* Index the tags of the text buffer to be serialized by priority */
+static void
+analyze_buffer(WriterContext *ctx, GtkTextBuffer *textbuffer)
 {
     GtkTextTagTable *tagtable = gtk_text_buffer_get_tag_table(textbuffer);
-    gtk_text_tag_table_foreach(tagtable, (GtkTextTagTableForeach)convert_tag_to_code, ctx);
-    ctx->textbuffer = textbuffer;
-    ctx->start = start;
-    ctx->end = end;
-}
-
-/* Write a space to the output buffer if the number of characters output on the
-current line is less than 60; otherwise, a newline. If the next space occurs
-more than 20 characters further on, the line will still be wider than 80
-characters, but this is probably the easiest way to break lines without
-looking ahead or backtracking to insert spaces. */
-static void
-write_space_or_newline(WriterContext *ctx)
-{
-    size_t linelength = strlen(strrchr(ctx->output->str, '\n'));
-    g_string_append_c(ctx->output, (linelength > 60)? '\n' : ' ');
-}
-
-/* This function translates a piece of text, without formatting codes, to RTF.
-It replaces special characters by their RTF control word equivalents. */
-static void
-write_rtf_text(WriterContext *ctx, const char *text)
-{
-    for (const char *ptr = text; *ptr; ptr = g_utf8_next_char(ptr)) {
-        gunichar ch = g_utf8_get_char(ptr);
-
-        if (ch == 0x09) {
-            g_string_append(ctx->output, "\\tab");
-        } else if (ch == '\n') {
-            /* whatever value that is */
-            g_string_append(ctx->output, "\\par");
-        } else if (ch == ' ') {
-            if (strlen(strrchr(ctx->output->str, '\n')) > 60)
-                g_string_append_c(ctx->output, '\n');
-            g_string_append_c(ctx->output, ' ');
-            continue;
-        } else if (ch == 0x5C) {
-            g_string_append(ctx->output, "\\\\");
-            continue;
-        } else if (ch == 0x7B) {
-            g_string_append(ctx->output, "\\{");
-            continue;
-        } else if (ch == 0x7D) {
-            g_string_append(ctx->output, "\\}");
-            continue;
-        } else if (ch > 0 && ch < 0x80) {
-            g_string_append_c(ctx->output, (char)ch);
-            continue;
-        } else if (ch == 0xA0) {
-            g_string_append(ctx->output, "\\~");
-            continue;
-        } else if (ch == 0xAD) {
-            g_string_append(ctx->output, "\\-");
-            continue;
-        } else if (ch >= 0xA1 && ch <= 0xFF) {
-            g_string_append_printf(ctx->output, "\\'%2X", ch);
-            continue;
-        } else if (ch == 0x2002) {
-            g_string_append(ctx->output, "\\enspace");
-        } else if (ch == 0x2003) {
-            g_string_append(ctx->output, "\\emspace");
-        } else if (ch == 0x2005) {
-            g_string_append(ctx->output, "\\qmspace");
-        } else if (ch == 0x200B) {
-            g_string_append(ctx->output, "\\zwbo");
-        } else if (ch == 0x200C) {
-            g_string_append(ctx->output, "\\zwnj");
-        } else if (ch == 0x200D) {
-            g_string_append(ctx->output, "\\zwj");
-        } else if (ch == 0x200E) {
-            g_string_append(ctx->output, "\\ltrmark");
-        } else if (ch == 0x200F) {
-            g_string_append(ctx->output, "\\rtlmark");
-        } else if (ch == 0x2011) {
-            g_string_append(ctx->output, "\\_");
-            continue;
-        } else if (ch == 0x2013) {
-            g_string_append(ctx->output, "\\endash");
-        } else if (ch == 0x2014) {
-            g_string_append(ctx->output, "\\emdash");
-        } else if (ch == 0x2018) {
-            g_string_append(ctx->output, "\\lquote");
-        } else if (ch == 0x2019) {
-            g_string_append(ctx->output, "\\rquote");
-        } else if (ch == 0x201C) {
-            g_string_append(ctx->output, "\\ldblquote");
-        } else if (ch == 0x201D) {
-            g_string_append(ctx->output, "\\rdblquote");
-        } else if (ch == 0x2022) {
-            g_string_append(ctx->output, "\\bullet");
-        } else if (ch == 0x2028) {
-            g_string_append(ctx->output, "\\line");
-        } else {
-            g_string_append_printf(ctx->output, "\\u%d", ch);
+    g_ptr_array_set_size(ctx->tags, 0);
+    g_ptr_array_set_size(ctx->tags, gtk_text_tag_table_get_size(tagtable));
+    gtk_text_tag_table_foreach(tagtable, (GtkTextTagTableForeach)index_tag, ctx->tags);
+}
+
+/* Number of words in a set; always at least one, to keep things simple */
+static unsigned
+tag_set_words(WriterContext *ctx)
+{
+    return ctx->tags->len / TAG_SET_WORD_BITS + 1;
+}
+
+/* Make set the set of tags in list, and free list */
+static void
+tag_set_from_list(WriterContext *ctx, TagSetWord *set, GSList *list)
+{
+    memset(set, 0, tag_set_words(ctx) * sizeof(TagSetWord));
+    for (GSList *ptr = list; ptr; ptr = g_slist_next(ptr)) {
+        unsigned priority = gtk_text_tag_get_priority(ptr->data);
+        set[priority / TAG_SET_WORD_BITS] |= (TagSetWord)1 << (priority % TAG_SET_WORD_BITS);
+    }
+    g_slist_free(list);
+}
+
+/* Make set the set of tags toggled on or off at iter */
+static void
+get_toggled_tag_set(WriterContext *ctx, TagSetWord *set, const GtkTextIter *iter, bool toggled_on)
+{
+    tag_set_from_list(ctx, set, gtk_text_iter_get_toggled_tags(iter, toggled_on));
+}
+
+/* The control words that can occur in tag codes, and their groups */
+static const struct {
+    const char *word;
+    PropertyGroup group;
+} property_words[] = {
+    { "chshdng", GROUP_BACKGROUND },
+    { "chcbpat", GROUP_BACKGROUND },
+    { "cb", GROUP_BACKGROUND },
+    { "f", GROUP_FONT },
+    { "cf", GROUP_FOREGROUND },
+    { "highlight", GROUP_HIGHLIGHT },
+    { "v", GROUP_HIDDEN },
+    { "lang", GROUP_LANGUAGE },
+    { "up", GROUP_RISE },
+    { "dn", GROUP_RISE },
+    { "charscalex", GROUP_SCALE },
+    { "fs", GROUP_SIZE },
+    { "fsmilli", GROUP_SIZE },
+    { "strike", GROUP_STRIKETHROUGH },
+    { "i", GROUP_ITALIC },
+    { "ul", GROUP_UNDERLINE },
+    { "ulnone", GROUP_UNDERLINE },
+    { "uldb", GROUP_UNDERLINE },
+    { "ulwave", GROUP_UNDERLINE },
+    { "scaps", GROUP_CAPS },
+    { "caps", GROUP_CAPS },
+    { "b", GROUP_BOLD },
+    { "super", GROUP_SUPERSUB },
+    { "sub", GROUP_SUPERSUB },
+    { "fi", GROUP_FIRST_INDENT },
+    { "ql", GROUP_JUSTIFICATION },
+    { "qr", GROUP_JUSTIFICATION },
+    { "qc", GROUP_JUSTIFICATION },
+    { "qj", GROUP_JUSTIFICATION },
+    { "li", GROUP_LEFT_MARGIN },
+    { "sb", GROUP_SPACE_BEFORE },
+    { "sa", GROUP_SPACE_AFTER },
+    { "slleading", GROUP_LEADING },
+    { "ri", GROUP_RIGHT_MARGIN },
+    { "tx", GROUP_TABS }
+};
+
+/* Code that sets each character property back to its default, or NULL if only
+\plain can do that. Colors and sizes have no such code: color 0 is read back as
+black, and \fs24 as an explicit size. */
+static const char * const character_resets[FIRST_PARAGRAPH_GROUP] = {
+    [GROUP_BACKGROUND] = NULL,
+    [GROUP_FONT] = "\\f0",
+    [GROUP_FOREGROUND] = NULL,
+    [GROUP_HIGHLIGHT] = NULL,
+    [GROUP_HIDDEN] = "\\v0",
+    [GROUP_LANGUAGE] = NULL,
+    [GROUP_RISE] = "\\up0",
+    [GROUP_SCALE] = "\\charscalex100",
+    [GROUP_SIZE] = NULL,
+    [GROUP_STRIKETHROUGH] = "\\strike0",
+    [GROUP_ITALIC] = "\\i0",
+    [GROUP_UNDERLINE] = "\\ulnone",
+    [GROUP_CAPS] = "\\scaps0\\caps0",
+    [GROUP_BOLD] = "\\b0",
+    [GROUP_SUPERSUB] = "\\nosupersub"
+};
+
+static int
+find_property_group(const char *word, size_t length)
+{
+    for (unsigned ix = 0; ix < G_N_ELEMENTS(property_words); ix++) {
+        if (strlen(property_words[ix].word) == length && strncmp(property_words[ix].word, word, length) == 0)
+            return property_words[ix].group;
+    }
+    return -1;
+}
+
+/* Split up a tag's code for this export into groups */
+static CompactCode *
+compact_code_new(const char *code)
+{
+    GString *values[N_PROPERTY_GROUPS] = { NULL };
+    const char *pos = code;
+    while (*pos == '\\') {
+        const char *word = pos + 1, *end = word;
+        while (g_ascii_isalpha(*end))
+            end++;
+        int group = find_property_group(word, end - word);
+        if (*end == '-')
+            end++;
+        while (g_ascii_isdigit(*end))
+            end++;
+
+        g_warn_if_fail(group != -1);
+        if (group != -1) {
+            if (values[group] == NULL)
+                values[group] = g_string_new("");
+            g_string_append_len(values[group], pos, end - pos);
         }
-        write_space_or_newline(ctx);
+        pos = end;
+    }
+
+    CompactCode *compact = g_slice_new0(CompactCode);
+    for (unsigned group = 0; group < N_PROPERTY_GROUPS; group++) {
+        if (values[group])
+            compact->values[group] = g_string_free(values[group], false);
     }
+    return compact;
+}
+
+static void
+snapshot_object_clear(SnapshotObject *object)
+{
+    g_clear_object(&object->pixbuf);
+}
+
+static BufferSnapshot *
+buffer_snapshot_new(WriterContext *ctx)
+{
+    BufferSnapshot *snapshot = g_slice_new0(BufferSnapshot);
+    snapshot->flags = ctx->flags;
+    snapshot->n_words = tag_set_words(ctx);
+    snapshot->text = g_string_new("");
+    snapshot->paragraphs = g_array_new(false, false, sizeof(SnapshotParagraph));
+    snapshot->runs = g_array_new(false, false, sizeof(SnapshotRun));
+    snapshot->tag_sets = g_array_new(false, false, sizeof(TagSetWord));
+    snapshot->objects = g_array_new(false, false, sizeof(SnapshotObject));
+    g_array_set_clear_func(snapshot->objects, (GDestroyNotify)snapshot_object_clear);
+    snapshot->blocks = g_array_new(false, false, sizeof(unsigned));
+    snapshot->block_full = true;
+    snapshot->n_tags = ctx->tags->len;
+    snapshot->codes = g_new0(char *, snapshot->n_tags);
+    snapshot->compact_codes = g_new0(CompactCode *, snapshot->n_tags);
+    return snapshot;
 }
 
-/* Analyze a segment of text in which there are no tag flips, but possibly embedded pictures */
 static void
-write_rtf_text_and_pictures(WriterContext *ctx, const GtkTextIter *start, const GtkTextIter *end)
+buffer_snapshot_free(BufferSnapshot *snapshot)
 {
-    GtkTextIter iter;
-    GdkPixbuf *pixbuf = NULL;
+    g_string_free(snapshot->text, true);
+    g_array_unref(snapshot->paragraphs);
+    g_array_unref(snapshot->runs);
+    g_array_unref(snapshot->tag_sets);
+    g_array_unref(snapshot->objects);
+    g_array_unref(snapshot->blocks);
+    for (unsigned priority = 0; priority < snapshot->n_tags; priority++) {
+        g_free(snapshot->codes[priority]);
+        if (snapshot->compact_codes[priority])
+            compact_code_free(snapshot->compact_codes[priority]);
+    }
+    g_free(snapshot->codes);
+    g_free(snapshot->compact_codes);
+    g_slice_free(BufferSnapshot, snapshot);
+}
 
-    for (iter = *start; !gtk_text_iter_equal(&iter, end); gtk_text_iter_forward_char(&iter)) {
-        if ((pixbuf = gtk_text_iter_get_pixbuf(&iter)))
-            break;
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(BufferSnapshot, buffer_snapshot_free);
+
+/* Copy the text between start and end into the snapshot, and find the objects
+in it. Embedded objects show up in the text as U+FFFC, so only at those places
+does the buffer need to be asked whether there is a picture. */
+static void
+snapshot_text(BufferSnapshot *snapshot, const GtkTextIter *start, const GtkTextIter *end)
+{
+    g_autofree char *text = gtk_text_iter_get_slice(start, end);
+    const char *pos = text, *object;
+    GtkTextIter iter = *start;
+
+    while ((object = strstr(pos, OBJECT_REPLACEMENT_CHARACTER)) != NULL) {
+        gtk_text_iter_forward_chars(&iter, g_utf8_strlen(pos, object - pos));
+        pos = object + OBJECT_REPLACEMENT_LENGTH;
+        GdkPixbuf *pixbuf = gtk_text_iter_get_pixbuf(&iter);
+        bool is_anchor = gtk_text_iter_get_child_anchor(&iter) != NULL;
+        gtk_text_iter_forward_char(&iter);
+        if (pixbuf == NULL && !is_anchor)
+            continue; /* An actual U+FFFC in the text */
+
+        SnapshotObject snapshot_object = { snapshot->text->len + (object - text), NULL };
+        if (pixbuf != NULL) {
+            snapshot_object.pixbuf = g_object_ref(pixbuf);
+            snapshot->block_full = true;
+        }
+        g_array_append_val(snapshot->objects, snapshot_object);
     }
+    g_string_append(snapshot->text, text);
+}
 
-    if (!pixbuf) {
-        g_autofree char *text = gtk_text_buffer_get_text(ctx->linebuffer, start, end, true);
-        write_rtf_text(ctx, text);
-        return;
+/* Convert the tags in set to code, if that hasn't been done yet for this
+snapshot. This is done here, on the buffer's thread, so that the writers can
+share the code, and so that the fonts and colors are numbered in the order in
+which they occur. */
+static void
+snapshot_tag_codes(BufferSnapshot *snapshot, WriterContext *ctx, const TagSetWord *set)
+{
+    for (unsigned word = 0; word < snapshot->n_words; word++) {
+        for (TagSetWord bits = set[word]; bits != 0; bits &= bits - 1) {
+            unsigned priority = word * TAG_SET_WORD_BITS + __builtin_ctzll(bits);
+            if (snapshot->codes[priority] != NULL)
+                continue;
+            snapshot->codes[priority] = g_strdup(get_tag_code(ctx, g_ptr_array_index(ctx->tags, priority)));
+            if (snapshot->flags & RTF_EXPORT_COMPACT)
+                snapshot->compact_codes[priority] = compact_code_new(snapshot->codes[priority]);
+        }
     }
+}
+
+/* Add the paragraph from linestart to lineend to the snapshot: its text, its
+runs and the tags that apply to each of them */
+static void
+buffer_snapshot_add_paragraph(BufferSnapshot *snapshot, WriterContext *ctx, const GtkTextIter *linestart, const GtkTextIter *lineend)
+{
+    if (snapshot->block_full) {
+        unsigned first_paragraph = snapshot->paragraphs->len;
+        g_array_append_val(snapshot->blocks, first_paragraph);
+        snapshot->block_start = snapshot->text->len;
+        snapshot->block_full = false;
+    }
+
+    SnapshotParagraph paragraph;
+    paragraph.start = snapshot->text->len;
+    paragraph.first_run = snapshot->runs->len;
+    paragraph.first_object = snapshot->objects->len;
+
+    unsigned n_words = snapshot->n_words;
+    g_autofree TagSetWord *sets = g_new0(TagSetWord, 3 * n_words);
+    TagSetWord *open = sets, *toggled = sets + n_words, *all = sets + 2 * n_words;
+    tag_set_from_list(ctx, open, gtk_text_iter_get_tags(linestart));
+
+    GtkTextIter start = *linestart, end = *linestart;
+    while (gtk_text_iter_compare(&end, lineend) < 0) {
+        gtk_text_iter_forward_to_tag_toggle(&end, NULL);
+        if (gtk_text_iter_compare(&end, lineend) > 0)
+            end = *lineend;
+        SnapshotRun run;
+        run.start = snapshot->text->len;
+        snapshot_text(snapshot, &start, &end);
+        run.end = snapshot->text->len;
+        g_array_append_val(snapshot->runs, run);
+        g_array_append_vals(snapshot->tag_sets, open, n_words);
+        for (unsigned word = 0; word < n_words; word++)
+            all[word] |= open[word];
+
+        get_toggled_tag_set(ctx, toggled, &end, false);
+        for (unsigned word = 0; word < n_words; word++)
+            open[word] &= ~toggled[word];
+        get_toggled_tag_set(ctx, toggled, &end, true);
+        for (unsigned word = 0; word < n_words; word++)
+            open[word] |= toggled[word];
+        start = end;
+    }
+
+    paragraph.end = snapshot->text->len;
+    paragraph.n_runs = snapshot->runs->len - paragraph.first_run;
+    g_array_append_val(snapshot->paragraphs, paragraph);
+    snapshot_tag_codes(snapshot, ctx, all);
+
+    if (snapshot->text->len - snapshot->block_start >= BLOCK_TEXT_LENGTH)
+        snapshot->block_full = true;
+}
+
+/* Start a new block with the next paragraph */
+static void
+buffer_snapshot_end_block(BufferSnapshot *snapshot)
+{
+    snapshot->block_full = true;
+}
+
+/* Move iter from the start of a paragraph to the start of the next one, or to
+limit if that comes first. A paragraph ends after any clump of paragraph
+separators. */
+static void
+forward_to_paragraph_end(GtkTextIter *iter, const GtkTextIter *limit)
+{
+    gtk_text_iter_forward_to_line_end(iter);
+    while (gtk_text_iter_ends_line(iter) && !gtk_text_iter_is_end(iter))
+        gtk_text_iter_forward_char(iter);
+    if (gtk_text_iter_compare(iter, limit) > 0)
+        *iter = *limit;
+}
 
-    /* Write the text before the pixbuf, insert a \pict destination into the document, and recurse on the text after */
-    g_autofree char *text = gtk_text_buffer_get_text(ctx->linebuffer, start, &iter, true);
-    write_rtf_text(ctx, text);
+/* Everything from here until the exporter may be done on any thread, since it
+only touches the snapshot and the pixbufs in it */
 
+/* A writer of one block of paragraphs */
+typedef struct {
+    const BufferSnapshot *snapshot;
+    GString *output;
+    OutputLine line;
+    unsigned next_object;
+    /* Compact mode only: the character properties of the last run and the
+    paragraph properties of the last paragraph */
+    const char *character_state[FIRST_PARAGRAPH_GROUP];
+    GString *paragraph_state;
+} ParagraphWriter;
+
+static const TagSetWord *
+get_run_tags(const BufferSnapshot *snapshot, unsigned run)
+{
+    return &g_array_index(snapshot->tag_sets, TagSetWord, run * snapshot->n_words);
+}
+
+/* Write the codes for the tags in set. Returns whether anything was written. */
+static bool
+write_tag_set(ParagraphWriter *writer, const TagSetWord *set)
+{
+    size_t length = writer->output->len;
+    for (unsigned word = 0; word < writer->snapshot->n_words; word++) {
+        for (TagSetWord bits = set[word]; bits != 0; bits &= bits - 1) {
+            unsigned priority = word * TAG_SET_WORD_BITS + __builtin_ctzll(bits);
+            g_string_append(writer->output, writer->snapshot->codes[priority]);
+        }
+    }
+    return writer->output->len != length;
+}
+
+/* Encode pixbuf as a \pict destination */
+static void
+write_picture(GString *output, GdkPixbuf *pixbuf, RtfExportFlags flags)
+{
     char *pngbuffer;
     size_t bufsize;
     GError *error = NULL;
-    if (gdk_pixbuf_save_to_buffer(pixbuf, &pngbuffer, &bufsize, "png", &error, "compression", "9", NULL)) {
-        g_string_append_printf(ctx->output, "{\\pict\\pngblip\\picw%d\\pich%d", gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf));
-        for (size_t count = 0; count < bufsize; count++) {
-            if (count % 40 == 0)
-                g_string_append_c(ctx->output, '\n');
-            g_string_append_printf(ctx->output, "%02X", (unsigned char)pngbuffer[count]);
-        }
-        g_string_append(ctx->output, "\n}");
-        g_free(pngbuffer);
-    } else {
+    if (!gdk_pixbuf_save_to_buffer(pixbuf, &pngbuffer, &bufsize, "png", &error, "compression", "9", NULL)) {
         g_warning(_("Could not serialize picture, skipping: %s"), error->message);
+        g_error_free(error);
+        return;
+    }
+
+    g_autofree char *controls = g_strdup_printf("\\pngblip\\picw%d\\pich%d", gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf));
+    write_picture_data(output, controls, (const uint8_t *)pngbuffer, bufsize, flags & RTF_EXPORT_BINARY_PICTURES);
+    g_free(pngbuffer);
+}
+
+/* Write the text of the snapshot between start and end, in which there are no
+tag flips, but possibly embedded objects. Child anchors are left out, and
+pictures are encoded in their places. */
+static void
+write_text_and_pictures(ParagraphWriter *writer, size_t start, size_t end)
+{
+    const BufferSnapshot *snapshot = writer->snapshot;
+    const char *text = snapshot->text->str;
+    size_t pos = start;
+
+    for (; writer->next_object < snapshot->objects->len; writer->next_object++) {
+        const SnapshotObject *object = &g_array_index(snapshot->objects, SnapshotObject, writer->next_object);
+        if (object->offset >= end)
+            break;
+        write_rtf_text(writer->output, &writer->line, text + pos, object->offset - pos);
+        if (object->pixbuf != NULL)
+            write_picture(writer->output, object->pixbuf, snapshot->flags);
+        pos = object->offset + OBJECT_REPLACEMENT_LENGTH;
     }
+    write_rtf_text(writer->output, &writer->line, text + pos, end - pos);
+}
 
-    gtk_text_iter_forward_char(&iter);
-    write_rtf_text_and_pictures(ctx, &iter, end);
+/* Make set the tags of the paragraph's run ix, leaving out the ones in
+exclude. There are no tags past the last run. */
+static void
+get_paragraph_run_tags(const BufferSnapshot *snapshot, const SnapshotParagraph *paragraph, unsigned ix, const TagSetWord *exclude, TagSetWord *set)
+{
+    if (ix >= paragraph->n_runs) {
+        memset(set, 0, snapshot->n_words * sizeof(TagSetWord));
+        return;
+    }
+    const TagSetWord *tags = get_run_tags(snapshot, paragraph->first_run + ix);
+    for (unsigned word = 0; word < snapshot->n_words; word++)
+        set[word] = tags[word] & ~exclude[word];
 }
 
-/* Copy the text paragraph-by-paragraph into a separate buffer and output each
-one sequentially with formatting codes */
+/* Output one paragraph with formatting codes. The output starts and ends on a
+line of its own. */
 static void
-write_rtf_paragraphs(WriterContext *ctx)
+write_rtf_paragraph(ParagraphWriter *writer, const SnapshotParagraph *paragraph)
 {
-    GtkTextIter linestart = *(ctx->start), lineend = linestart;
+    const BufferSnapshot *snapshot = writer->snapshot;
+    GString *output = writer->output;
+    unsigned n_words = snapshot->n_words;
+
+    /* Begin the paragraph by resetting the paragraph properties */
+    g_string_append(output, "{\\pard\\plain");
+
+    /* The tags that apply to the whole paragraph are the ones that all of its
+    runs have. Insert codes for them, and then leave them out of the runs. */
+    g_autofree TagSetWord *sets = g_new0(TagSetWord, 7 * n_words);
+    TagSetWord *whole = sets, *current = sets + n_words, *next = sets + 2 * n_words;
+    memcpy(whole, get_run_tags(snapshot, paragraph->first_run), n_words * sizeof(TagSetWord));
+    for (unsigned ix = 1; ix < paragraph->n_runs; ix++) {
+        const TagSetWord *tags = get_run_tags(snapshot, paragraph->first_run + ix);
+        for (unsigned word = 0; word < n_words; word++)
+            whole[word] &= tags[word];
+    }
+    write_tag_set(writer, whole);
+    write_space_or_newline(output, &writer->line);
+    g_string_append_c(output, '{');
+
+    /* The tags that start at the start of the current run, the ones that end
+    at its end, the ones that do both, and the ones that apply to it */
+    TagSetWord *starting = sets + 3 * n_words, *ending = sets + 4 * n_words;
+    TagSetWord *only = sets + 5 * n_words, *open = sets + 6 * n_words;
+    get_paragraph_run_tags(snapshot, paragraph, 0, whole, current);
+    memcpy(starting, current, n_words * sizeof(TagSetWord));
+    memcpy(open, current, n_words * sizeof(TagSetWord));
+
+    for (unsigned ix = 0; ix < paragraph->n_runs; ix++) {
+        /* Tags that do not extend before or after this run go in their own
+        group */
+        get_paragraph_run_tags(snapshot, paragraph, ix + 1, whole, next);
+        bool any_only = false, any_ending = false;
+        for (unsigned word = 0; word < n_words; word++) {
+            ending[word] = current[word] & ~next[word];
+            only[word] = starting[word] & ending[word];
+            starting[word] &= ~only[word];
+            any_only = any_only || only[word] != 0;
+            any_ending = any_ending || (ending[word] & ~only[word]) != 0;
+        }
+
+        /* Output the tags that start here */
+        if (write_tag_set(writer, starting))
+            write_space_or_newline(output, &writer->line);
 
-    while (gtk_text_iter_in_range(&lineend, ctx->start, ctx->end)) {
-        /* Begin the paragraph by resetting the paragraph properties */
-        g_string_append(ctx->output, "{\\pard\\plain");
+        /* Output the tags that only apply to this run, within their own
+        group */
+        if (any_only) {
+            g_string_append_c(output, '{');
+            if (write_tag_set(writer, only))
+                write_space_or_newline(output, &writer->line);
+        }
 
-        /* Get two iterators around the next paragraph of text */
-        gtk_text_iter_forward_to_line_end(&lineend);
-        /* Skip to the end of any clump of paragraph separators */
-        while (gtk_text_iter_ends_line(&lineend) && !gtk_text_iter_is_end(&lineend))
-            gtk_text_iter_forward_char(&lineend);
-        if (gtk_text_iter_compare(&lineend, ctx->end) > 0)
-            lineend = *(ctx->end);
+        /* Output the actual contents of this run */
+        const SnapshotRun *run = &g_array_index(snapshot->runs, SnapshotRun, paragraph->first_run + ix);
+        write_text_and_pictures(writer, run->start, run->end);
 
-        /* Copy the entire paragraph to a separate buffer */
-        if (ctx->linebuffer)
-            g_object_unref(ctx->linebuffer);
-        ctx->linebuffer = gtk_text_buffer_new(gtk_text_buffer_get_tag_table(ctx->textbuffer));
-        GtkTextIter start, end;
-        gtk_text_buffer_get_start_iter(ctx->linebuffer, &start);
-        gtk_text_buffer_insert_range(ctx->linebuffer, &start, &linestart, &lineend);
-        gtk_text_buffer_get_bounds(ctx->linebuffer, &start, &end);
+        /* Close the group of tags that only apply to this run */
+        if (any_only)
+            g_string_append_c(output, '}');
 
-        /* Insert codes for tags that apply to the whole line, then remove those
-        tags because we've dealt with them */
-        g_autoptr(GSList) taglist = gtk_text_iter_get_tags(&linestart);
-        for (GSList *ptr = taglist; ptr; ptr = g_slist_next(ptr)) {
-            GtkTextIter tagend = start;
-            gtk_text_iter_forward_to_tag_toggle(&tagend, ptr->data);
-            if (gtk_text_iter_equal(&tagend, &end)) {
-                g_string_append(ctx->output, g_hash_table_lookup(ctx->tag_codes, ptr->data));
-                gtk_text_buffer_remove_tag(ctx->linebuffer, ptr->data, &start, &end);
-            }
+        /* The tags that start with the next run will be output in the next
+        iteration, and the ones that continue into it are the ones that applied
+        here and don't end here */
+        for (unsigned word = 0; word < n_words; word++) {
+            starting[word] = next[word] & ~current[word];
+            open[word] &= ~ending[word];
         }
-        write_space_or_newline(ctx);
-        g_string_append_c(ctx->output, '{');
-
-        end = start;
-        while (!gtk_text_iter_is_end(&end)) {
-            /* Enclose a section of text without any tag flips between start
-            and end. Then, make tagstartlist a list of tags that open at the
-            beginning of this section, and tagendlist a list of tags that end
-            at the end of this section. */
-
-            gtk_text_iter_forward_to_tag_toggle(&end, NULL);
-            g_autoptr(GSList) tagstartlist = gtk_text_iter_get_toggled_tags(&start, true);
-            g_autoptr(GSList) tagendlist = gtk_text_iter_get_toggled_tags(&end, false);
-            g_autoptr(GSList) tagonlylist = NULL;
-
-            /* Move tags that do not extend before or after this section to
-            tagonlylist. */
-            for (GSList *ptr = tagstartlist; ptr; ptr = g_slist_next(ptr)) {
-                if (g_slist_find(tagendlist, ptr->data))
-                    tagonlylist = g_slist_prepend(tagonlylist, ptr->data);
-            }
-            for (GSList *ptr = tagonlylist; ptr; ptr = g_slist_next(ptr)) {
-                tagstartlist = g_slist_remove(tagstartlist, ptr->data);
-                tagendlist = g_slist_remove(tagendlist, ptr->data);
-            }
 
-            /* Output the tags in tagstartlist */
-            size_t length = ctx->output->len;
-            for (GSList *ptr = tagstartlist; ptr; ptr = g_slist_next(ptr))
-                g_string_append(ctx->output, g_hash_table_lookup(ctx->tag_codes, ptr->data));
-            if (length != ctx->output->len)
-                write_space_or_newline(ctx);
-
-            /* Output the tags in tagonlylist, within their own group */
-            if (tagonlylist) {
-                g_string_append_c(ctx->output, '{');
-                length = ctx->output->len;
-                for (GSList *ptr = tagonlylist; ptr; ptr = g_slist_next(ptr))
-                    g_string_append(ctx->output, g_hash_table_lookup(ctx->tag_codes, ptr->data));
-                if (length != ctx->output->len)
-                    write_space_or_newline(ctx);
-            }
+        /* If any tags end here, close the group and open another one, then
+        output the tags that continue */
+        if (any_ending) {
+            g_string_append(output, "}{");
+            if (write_tag_set(writer, open))
+                write_space_or_newline(output, &writer->line);
+        }
 
-            /* Output the actual contents of this section */
-            write_rtf_text_and_pictures(ctx, &start, &end);
-
-            /* Close the tagonlylist group */
-            if (tagonlylist)
-                g_string_append_c(ctx->output, '}');
-
-            /* If any tags end here, close the group and open another one,
-            then output the tags that _apply_ to the end iter but do not _start_
-            there (those will be output in the next iteration and may need to
-            be in a separate group.) */
-            if (tagendlist) {
-                g_string_append(ctx->output, "}{");
-                g_autoptr(GSList) new_taglist = gtk_text_iter_get_tags(&end);
-                g_autoptr(GSList) new_tagstartlist = gtk_text_iter_get_toggled_tags(&end, true);
-                for (GSList *ptr = new_tagstartlist; ptr; ptr = g_slist_next(ptr))
-                    new_taglist = g_slist_remove(new_taglist, ptr->data);
-
-                length = ctx->output->len;
-                for (GSList *ptr = new_taglist; ptr; ptr = g_slist_next(ptr))
-                    g_string_append(ctx->output, g_hash_table_lookup(ctx->tag_codes, ptr->data));
-                if (length != ctx->output->len)
-                    write_space_or_newline(ctx);
+        for (unsigned word = 0; word < n_words; word++)
+            open[word] |= starting[word];
+        memcpy(current, next, n_words * sizeof(TagSetWord));
+    }
+    g_string_append(output, "}}\n");
+}
+
+/* Work out the properties that the tags in set give to the text, by going
+through them in order of priority */
+static void
+merge_tag_set(const BufferSnapshot *snapshot, const TagSetWord *set, const char **merged)
+{
+    memset(merged, 0, N_PROPERTY_GROUPS * sizeof(char *));
+    for (unsigned word = 0; word < snapshot->n_words; word++) {
+        for (TagSetWord bits = set[word]; bits != 0; bits &= bits - 1) {
+            unsigned priority = word * TAG_SET_WORD_BITS + __builtin_ctzll(bits);
+            const CompactCode *compact = snapshot->compact_codes[priority];
+            for (unsigned group = 0; group < N_PROPERTY_GROUPS; group++) {
+                if (compact->values[group])
+                    merged[group] = compact->values[group];
             }
+        }
+    }
+}
+
+/* Make properties the control words for the paragraph properties of all the
+tags in the paragraph */
+static void
+get_paragraph_properties(const BufferSnapshot *snapshot, const SnapshotParagraph *paragraph, GString *properties)
+{
+    g_autofree TagSetWord *all = g_new0(TagSetWord, snapshot->n_words);
+    for (unsigned ix = 0; ix < paragraph->n_runs; ix++) {
+        const TagSetWord *tags = get_run_tags(snapshot, paragraph->first_run + ix);
+        for (unsigned word = 0; word < snapshot->n_words; word++)
+            all[word] |= tags[word];
+    }
+
+    const char *merged[N_PROPERTY_GROUPS];
+    merge_tag_set(snapshot, all, merged);
+    g_string_truncate(properties, 0);
+    for (unsigned group = FIRST_PARAGRAPH_GROUP; group < N_PROPERTY_GROUPS; group++) {
+        if (merged[group])
+            g_string_append(properties, merged[group]);
+    }
+}
 
-            start = end;
+/* Write the control words for the character properties that differ from the
+last run's. If a property goes back to its default and there is no control word
+for that, start again from \plain. */
+static void
+write_character_changes(ParagraphWriter *writer, const char **merged)
+{
+    bool need_plain = false;
+    for (unsigned group = 0; group < FIRST_PARAGRAPH_GROUP; group++) {
+        if (merged[group] == NULL && writer->character_state[group] != NULL && character_resets[group] == NULL)
+            need_plain = true;
+    }
+
+    GString *output = writer->output;
+    size_t length = output->len;
+    if (need_plain)
+        g_string_append(output, "\\plain");
+    for (unsigned group = 0; group < FIRST_PARAGRAPH_GROUP; group++) {
+        if (need_plain) {
+            if (merged[group])
+                g_string_append(output, merged[group]);
+        } else if (g_strcmp0(merged[group], writer->character_state[group]) != 0) {
+            g_string_append(output, merged[group] ? merged[group] : character_resets[group]);
         }
-        g_string_append(ctx->output, "}}\n");
-        linestart = lineend;
+        writer->character_state[group] = merged[group];
     }
+    if (length != output->len)
+        write_space_or_newline(output, &writer->line);
 }
 
+/* Output one paragraph in compact mode. There are no groups, apart from those
+of the pictures. The paragraph starts with \pard and its properties only if
+they differ from those of the last paragraph, and each run of text starts with
+only the control words for the character properties that changed. */
 static void
-write_color_table_entry(const char *colorcode, WriterContext *ctx)
+write_compact_paragraph(ParagraphWriter *writer, const SnapshotParagraph *paragraph)
 {
-    g_string_append_printf(ctx->output, "%s;\n", colorcode);
+    const BufferSnapshot *snapshot = writer->snapshot;
+    g_autoptr(GString) properties = g_string_new("");
+    get_paragraph_properties(snapshot, paragraph, properties);
+    if (strcmp(properties->str, writer->paragraph_state->str) != 0) {
+        g_string_append(writer->output, "\\pard");
+        g_string_append(writer->output, properties->str);
+        write_space_or_newline(writer->output, &writer->line);
+        g_string_assign(writer->paragraph_state, properties->str);
+    }
+
+    const char *merged[N_PROPERTY_GROUPS];
+    for (unsigned ix = 0; ix < paragraph->n_runs; ix++) {
+        unsigned run_index = paragraph->first_run + ix;
+        merge_tag_set(snapshot, get_run_tags(snapshot, run_index), merged);
+        write_character_changes(writer, merged);
+        const SnapshotRun *run = &g_array_index(snapshot->runs, SnapshotRun, run_index);
+        write_text_and_pictures(writer, run->start, run->end);
+    }
 }
 
-/* Write the RTF header and assorted front matter */
-static char *
-write_rtf(WriterContext *ctx)
+/* Write one block of paragraphs of the snapshot to output */
+static void
+write_block(const BufferSnapshot *snapshot, unsigned block, GString *output)
 {
-    GList *iter;
-    int count;
+    unsigned first = g_array_index(snapshot->blocks, unsigned, block);
+    unsigned last = snapshot->paragraphs->len;
+    if (block + 1 < snapshot->blocks->len)
+        last = g_array_index(snapshot->blocks, unsigned, block + 1);
+
+    ParagraphWriter writer = { NULL };
+    writer.snapshot = snapshot;
+    writer.output = output;
+    writer.next_object = g_array_index(snapshot->paragraphs, SnapshotParagraph, first).first_object;
+    writer.paragraph_state = g_string_new("");
+
+    /* In compact mode, each paragraph's code depends on the properties that
+    the paragraph before it leaves, which the snapshot has too. The document
+    starts out with default properties. */
+    bool compact = snapshot->flags & RTF_EXPORT_COMPACT;
+    if (compact && first > 0) {
+        const SnapshotParagraph *previous = &g_array_index(snapshot->paragraphs, SnapshotParagraph, first - 1);
+        get_paragraph_properties(snapshot, previous, writer.paragraph_state);
+        const char *merged[N_PROPERTY_GROUPS];
+        merge_tag_set(snapshot, get_run_tags(snapshot, previous->first_run + previous->n_runs - 1), merged);
+        memcpy(writer.character_state, merged, sizeof(writer.character_state));
+    }
+
+    for (unsigned ix = first; ix < last; ix++) {
+        const SnapshotParagraph *paragraph = &g_array_index(snapshot->paragraphs, SnapshotParagraph, ix);
+        if (compact)
+            write_compact_paragraph(&writer, paragraph);
+        else
+            write_rtf_paragraph(&writer, paragraph);
+    }
+    g_string_free(writer.paragraph_state, true);
+}
 
-    /* Header */
-    g_string_append(ctx->output, "{\\rtf1\\ansi\\deff0\\uc0\n");
+/* The blocks are written on several threads, each taking the next block that
+nobody has started on yet, as in rtf-batch.c. Each block is written into a
+string of its own, and the strings are joined in order afterwards. */
+typedef struct {
+    const BufferSnapshot *snapshot;
+    GString **blocks;
+    volatile int next_block;
+    GCancellable *cancellable;
+} BlockBatch;
+
+static void *
+block_batch_worker(BlockBatch *batch)
+{
+    int ix;
+    while ((ix = g_atomic_int_add(&batch->next_block, 1)) < (int)batch->snapshot->blocks->len) {
+        if (g_cancellable_is_cancelled(batch->cancellable))
+            break;
+        batch->blocks[ix] = g_string_new("");
+        write_block(batch->snapshot, ix, batch->blocks[ix]);
+    }
+    return NULL;
+}
 
-    /* Font table */
-    g_string_append(ctx->output, "{\\fonttbl\n");
-    for (count = 0, iter = ctx->font_table; iter; iter = g_list_next(iter), count++) {
-        char **fontnames = g_strsplit(iter->data, ",", 2);
-        g_string_append_printf(ctx->output, "{\\f%d\\fnil %s;}\n", count, fontnames[0]);
-        g_strfreev(fontnames);
+/* Write the snapshot's blocks of paragraphs in parallel. Returns a
+NULL-terminated array of the blocks' code, or NULL if cancellable was
+cancelled. */
+static GString **
+write_snapshot(const BufferSnapshot *snapshot, GCancellable *cancellable, GError **error)
+{
+    BlockBatch batch;
+    batch.snapshot = snapshot;
+    batch.blocks = g_new0(GString *, snapshot->blocks->len + 1);
+    batch.next_block = 0;
+    batch.cancellable = cancellable;
+
+    /* The calling thread does its share of the work too */
+    unsigned n_threads = MIN(g_get_num_processors(), snapshot->blocks->len);
+    g_autofree GThread **threads = g_new0(GThread *, n_threads);
+    for (unsigned ix = 1; ix < n_threads; ix++)
+        threads[ix] = g_thread_new("rtf-writer", (GThreadFunc)block_batch_worker, &batch);
+    block_batch_worker(&batch);
+    for (unsigned ix = 1; ix < n_threads; ix++)
+        g_thread_join(threads[ix]);
+
+    if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+        for (unsigned ix = 0; ix < snapshot->blocks->len; ix++) {
+            if (batch.blocks[ix])
+                g_string_free(batch.blocks[ix], true);
+        }
+        g_free(batch.blocks);
+        return NULL;
     }
-    if (!ctx->font_table) /* Write at least one font if there are none */
-        g_string_append(ctx->output, "{\\f0\\fswiss Sans;}\n");
-    g_string_append(ctx->output, "}\n");
+    return batch.blocks;
+}
 
-    /* Color table */
-    g_string_append(ctx->output, "{\\colortbl\n");
-    g_list_foreach(ctx->color_table, (GFunc)write_color_table_entry, ctx);
-    g_string_append(ctx->output, "}\n");
+static int
+get_default_language(void)
+{
+    return language_to_wincode(pango_language_to_string(pango_language_get_default()));
+}
+
+/* Serializing is done in two stages, so that the slow part can be done on
+other threads. serialize_buffer() must be called on the thread that owns the
+buffer. It takes a snapshot of the text and formatting between start and end,
+with a reference to each picture, that the buffer can't change, and writes the
+header. serialized_buffer_write() writes the paragraphs of the snapshot in
+parallel blocks, encoding the pictures as it goes, and may be called on any
+thread. */
+SerializedBuffer *
+serialize_buffer(GtkTextBuffer *buffer, const GtkTextIter *start, const GtkTextIter *end, RtfExportFlags flags)
+{
+    g_autoptr(WriterContext) ctx = writer_context_new(flags);
+    analyze_buffer(ctx, buffer);
+    BufferSnapshot *snapshot = buffer_snapshot_new(ctx);
+
+    GtkTextIter linestart = *start, lineend = linestart;
+    while (gtk_text_iter_in_range(&lineend, start, end)) {
+        forward_to_paragraph_end(&lineend, end);
+        buffer_snapshot_add_paragraph(snapshot, ctx, &linestart, &lineend);
+        linestart = lineend;
+    }
 
-    /* Metadata (provide dummy values because Word will overwrite if missing) */
-    g_string_append_printf(ctx->output, "{\\*\\generator %s %s}\n", PACKAGE_NAME, PACKAGE_VERSION);
-    g_string_append(ctx->output, "{\\info {\\author .}{\\company .}{\\title .}\n");
-    char buffer[29];
-    time_t timer = time(NULL);
-    if (strftime(buffer, 29, "\\yr%Y\\mo%m\\dy%d\\hr%H\\min%M", localtime(&timer)))
-        g_string_append_printf(ctx->output, "{\\creatim%s}}\n", buffer);
+    /* All the tags have been converted, so the tables are complete */
+    GString *tables = g_string_new("");
+    write_rtf_tables(tables, ctx->fonts, ctx->colors);
 
+    SerializedBuffer *serialized = g_slice_new0(SerializedBuffer);
+    serialized->header = write_rtf_header(tables->str, get_default_language());
+    g_string_free(tables, true);
+    serialized->snapshot = snapshot;
+    return serialized;
+}
 
-    /* Preliminary formatting */
-    g_string_append_printf(ctx->output, "\\deflang%d", language_to_wincode(pango_language_to_string(pango_language_get_default())));
-    g_string_append(ctx->output, "\\plain\\widowctrl\\hyphauto\n");
+void
+serialized_buffer_free(SerializedBuffer *serialized)
+{
+    g_free(serialized->header);
+    buffer_snapshot_free(serialized->snapshot);
+    g_slice_free(SerializedBuffer, serialized);
+}
 
-    /* Document body */
-    write_rtf_paragraphs(ctx);
+/* Returns the complete RTF code, whose length is stored in length since it may
+contain binary data, or NULL if cancellable was cancelled */
+char *
+serialized_buffer_write(SerializedBuffer *serialized, size_t *length, GCancellable *cancellable, GError **error)
+{
+    const BufferSnapshot *snapshot = serialized->snapshot;
+    GString **blocks = write_snapshot(snapshot, cancellable, error);
+    if (blocks == NULL)
+        return NULL;
+
+    size_t total = strlen(serialized->header) + 1;
+    for (unsigned ix = 0; ix < snapshot->blocks->len; ix++)
+        total += blocks[ix]->len;
+
+    GString *output = g_string_sized_new(total + 1);
+    g_string_append(output, serialized->header);
+    for (unsigned ix = 0; ix < snapshot->blocks->len; ix++) {
+        g_string_append_len(output, blocks[ix]->str, blocks[ix]->len);
+        g_string_free(blocks[ix], true);
+    }
+    g_free(blocks);
+    g_string_append_c(output, '}');
 
-    g_string_append_c(ctx->output, '}');
-    return g_string_free(ctx->output, false);
+    *length = output->len;
+    return g_string_free(output, false);
 }
 
-/* This function is called by gtk_text_buffer_serialize(). */
+/* This function is called by gtk_text_buffer_serialize(). user_data holds the
+RtfExportFlags that the format was registered with. */
 uint8_t *
-rtf_serialize(GtkTextBuffer *register_buffer, GtkTextBuffer *content_buffer, const GtkTextIter *start, const GtkTextIter *end, size_t *length)
+rtf_serialize(GtkTextBuffer *register_buffer, GtkTextBuffer *content_buffer, const GtkTextIter *start, const GtkTextIter *end, size_t *length, void *user_data)
+{
+    g_autoptr(SerializedBuffer) serialized = serialize_buffer(content_buffer, start, end, GPOINTER_TO_UINT(user_data));
+    return (uint8_t *)serialized_buffer_write(serialized, length, NULL, NULL);
+}
+
+/* Exporting the same buffer over and over, with RtfExporter. The RTF code of
+each paragraph is kept, along with a mark at the start of the paragraph, until
+the buffer changes in a way that may affect it. */
+
+/* The RTF code for one paragraph, with its pictures */
+typedef struct {
+    char *code;
+    size_t length;
+} CachedParagraph;
+
+struct _RtfExporter {
+    GtkTextBuffer *buffer;
+    /* Kept from one export to the next, so that the font and color numbers in
+    the cached paragraphs stay the same. The tables only ever grow. */
+    WriterContext *ctx;
+    GHashTable *paragraphs; /* GtkTextMark -> CachedParagraph */
+    /* The font and color tables, as last written, and their sizes then */
+    GString *tables;
+    unsigned tables_fonts;
+    unsigned tables_colors;
+};
+
+static void
+cached_paragraph_free(CachedParagraph *paragraph)
+{
+    g_free(paragraph->code);
+    g_slice_free(CachedParagraph, paragraph);
+}
+
+static void
+forget_all_paragraphs(RtfExporter *exporter)
+{
+    GHashTableIter iter;
+    void *mark;
+    g_hash_table_iter_init(&iter, exporter->paragraphs);
+    while (g_hash_table_iter_next(&iter, &mark, NULL)) {
+        g_hash_table_iter_remove(&iter);
+        gtk_text_buffer_delete_mark(exporter->buffer, mark);
+    }
+}
+
+/* Forget the paragraphs that a change between start and end may affect: the
+ones it touches, and the one before, whose clump of paragraph separators may
+grow or shrink. Paragraphs start at the start of a line that isn't empty, except
+that the first one takes in the line after an empty first line. */
+static void
+forget_paragraphs_in_range(RtfExporter *exporter, const GtkTextIter *start, const GtkTextIter *end)
+{
+    GtkTextIter iter = *start;
+    gtk_text_iter_backward_char(&iter);
+    gtk_text_iter_set_line_offset(&iter, 0);
+    while (gtk_text_iter_ends_line(&iter) && gtk_text_iter_backward_line(&iter))
+        ;
+    if (gtk_text_iter_get_line(&iter) == 1)
+        gtk_text_iter_set_line(&iter, 0);
+
+    do {
+        g_autoptr(GSList) marks = gtk_text_iter_get_marks(&iter);
+        for (GSList *ptr = marks; ptr; ptr = g_slist_next(ptr)) {
+            if (g_hash_table_remove(exporter->paragraphs, ptr->data))
+                gtk_text_buffer_delete_mark(exporter->buffer, ptr->data);
+        }
+    } while (gtk_text_iter_forward_line(&iter) && gtk_text_iter_compare(&iter, end) <= 0);
+}
+
+/* These handlers run before the buffer changes */
+static void
+on_insert_text(GtkTextBuffer *buffer, GtkTextIter *location, char *text, int length, RtfExporter *exporter)
+{
+    forget_paragraphs_in_range(exporter, location, location);
+}
+
+static void
+on_insert_object(GtkTextBuffer *buffer, GtkTextIter *location, void *object, RtfExporter *exporter)
+{
+    forget_paragraphs_in_range(exporter, location, location);
+}
+
+static void
+on_delete_range(GtkTextBuffer *buffer, GtkTextIter *start, GtkTextIter *end, RtfExporter *exporter)
+{
+    forget_paragraphs_in_range(exporter, start, end);
+}
+
+static void
+on_tag_toggled(GtkTextBuffer *buffer, GtkTextTag *tag, GtkTextIter *start, GtkTextIter *end, RtfExporter *exporter)
+{
+    forget_paragraphs_in_range(exporter, start, end);
+}
+
+/* A tag that changes or goes away may be used anywhere */
+static void
+on_tag_changed(GtkTextTagTable *table, GtkTextTag *tag, gboolean size_changed, RtfExporter *exporter)
+{
+    forget_all_paragraphs(exporter);
+    g_hash_table_remove_all(exporter->ctx->tag_codes);
+}
+
+static void
+on_tag_removed(GtkTextTagTable *table, GtkTextTag *tag, RtfExporter *exporter)
+{
+    on_tag_changed(table, tag, false, exporter);
+}
+
+static CachedParagraph *
+lookup_paragraph(RtfExporter *exporter, const GtkTextIter *linestart)
+{
+    g_autoptr(GSList) marks = gtk_text_iter_get_marks(linestart);
+    for (GSList *ptr = marks; ptr; ptr = g_slist_next(ptr)) {
+        CachedParagraph *paragraph = g_hash_table_lookup(exporter->paragraphs, ptr->data);
+        if (paragraph != NULL)
+            return paragraph;
+    }
+    return NULL;
+}
+
+/**
+ * RtfExporter:
+ *
+ * An opaque structure that exports the same #GtkTextBuffer to RTF code
+ * repeatedly, for example to save it automatically every few seconds. Create
+ * it with rtf_exporter_new().
+ */
+
+/**
+ * rtf_exporter_new:
+ * @buffer: the text buffer to export
+ *
+ * Creates an exporter for @buffer. The exporter keeps the RTF code of each
+ * paragraph of @buffer between calls to rtf_exporter_export(), and watches
+ * @buffer for changes, so that each export only has to write the paragraphs
+ * that changed since the last one. It also keeps a reference to @buffer.
+ *
+ * Returns: (transfer full): a new #RtfExporter. Free it with
+ * rtf_exporter_free().
+ */
+RtfExporter *
+rtf_exporter_new(GtkTextBuffer *buffer)
+{
+    rtf_init();
+
+    g_return_val_if_fail(buffer != NULL, NULL);
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), NULL);
+
+    RtfExporter *exporter = g_slice_new0(RtfExporter);
+    exporter->buffer = g_object_ref(buffer);
+    exporter->ctx = writer_context_new(rtf_text_buffer_get_export_flags(buffer));
+    exporter->paragraphs = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)cached_paragraph_free);
+
+    g_signal_connect(buffer, "insert-text", G_CALLBACK(on_insert_text), exporter);
+    g_signal_connect(buffer, "insert-pixbuf", G_CALLBACK(on_insert_object), exporter);
+    g_signal_connect(buffer, "insert-child-anchor", G_CALLBACK(on_insert_object), exporter);
+    g_signal_connect(buffer, "delete-range", G_CALLBACK(on_delete_range), exporter);
+    g_signal_connect(buffer, "apply-tag", G_CALLBACK(on_tag_toggled), exporter);
+    g_signal_connect(buffer, "remove-tag", G_CALLBACK(on_tag_toggled), exporter);
+    GtkTextTagTable *tagtable = gtk_text_buffer_get_tag_table(buffer);
+    g_signal_connect(tagtable, "tag-changed", G_CALLBACK(on_tag_changed), exporter);
+    g_signal_connect(tagtable, "tag-removed", G_CALLBACK(on_tag_removed), exporter);
+
+    return exporter;
+}
+
+/**
+ * rtf_exporter_free:
+ * @exporter: an #RtfExporter
+ *
+ * Frees @exporter and the RTF code it kept, and stops watching its buffer.
+ */
+void
+rtf_exporter_free(RtfExporter *exporter)
+{
+    g_return_if_fail(exporter != NULL);
+
+    g_signal_handlers_disconnect_by_data(exporter->buffer, exporter);
+    g_signal_handlers_disconnect_by_data(gtk_text_buffer_get_tag_table(exporter->buffer), exporter);
+    forget_all_paragraphs(exporter);
+    g_hash_table_unref(exporter->paragraphs);
+    writer_context_free(exporter->ctx);
+    if (exporter->tables)
+        g_string_free(exporter->tables, true);
+    g_object_unref(exporter->buffer);
+    g_slice_free(RtfExporter, exporter);
+}
+
+/**
+ * rtf_exporter_export:
+ * @exporter: an #RtfExporter
+ *
+ * Serializes the contents of the buffer that @exporter was created for, like
+ * rtf_text_buffer_export_to_bytes() does. Only the paragraphs that changed
+ * since the last call are written again; the rest are copied from the last
+ * call.
+ *
+ * The font and color tables of the result may also list fonts and colors that
+ * were used in earlier versions of the buffer.
+ *
+ * If %RTF_EXPORT_COMPACT is set on the buffer, then each paragraph's code
+ * depends on the paragraphs before it, so all of them are written every time.
+ *
+ * Returns: (transfer full): a #GBytes containing RTF code.
+ */
+GBytes *
+rtf_exporter_export(RtfExporter *exporter)
 {
-    g_autoptr(WriterContext) ctx = writer_context_new();
+    g_return_val_if_fail(exporter != NULL, NULL);
+
+    WriterContext *ctx = exporter->ctx;
+    RtfExportFlags flags = rtf_text_buffer_get_export_flags(exporter->buffer);
+    if (flags != ctx->flags) {
+        /* The pictures in the cached paragraphs are written the other way */
+        forget_all_paragraphs(exporter);
+        ctx->flags = flags;
+    }
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(exporter->buffer, &start, &end);
+    analyze_buffer(ctx, exporter->buffer);
+
+    /* Take a snapshot of the paragraphs that aren't cached, each in a block of
+    its own, and write them all at once */
+    g_autoptr(BufferSnapshot) snapshot = buffer_snapshot_new(ctx);
+    g_autoptr(GPtrArray) paragraphs = g_ptr_array_new();
+    GtkTextIter linestart = start, lineend = start;
+    while (gtk_text_iter_in_range(&lineend, &start, &end)) {
+        forward_to_paragraph_end(&lineend, &end);
+        CachedParagraph *paragraph = lookup_paragraph(exporter, &linestart);
+        if (paragraph == NULL) {
+            paragraph = g_slice_new0(CachedParagraph);
+            GtkTextMark *mark = gtk_text_buffer_create_mark(exporter->buffer, NULL, &linestart, true);
+            g_hash_table_insert(exporter->paragraphs, mark, paragraph);
+            buffer_snapshot_add_paragraph(snapshot, ctx, &linestart, &lineend);
+            buffer_snapshot_end_block(snapshot);
+        }
+        g_ptr_array_add(paragraphs, paragraph);
+        linestart = lineend;
+    }
+
+    GString **blocks = write_snapshot(snapshot, NULL, NULL);
+    size_t length = 0;
+    unsigned block = 0;
+    for (unsigned ix = 0; ix < paragraphs->len; ix++) {
+        CachedParagraph *paragraph = g_ptr_array_index(paragraphs, ix);
+        if (paragraph->code == NULL) {
+            paragraph->length = blocks[block]->len;
+            paragraph->code = g_string_free(blocks[block++], false);
+        }
+        length += paragraph->length;
+    }
+    g_free(blocks);
+
+    /* Only write the tables again if there is anything new in them */
+    if (exporter->tables == NULL || exporter->tables_fonts != ctx->fonts->len ||
+        exporter->tables_colors != ctx->colors->len) {
+        if (exporter->tables == NULL)
+            exporter->tables = g_string_new("");
+        g_string_truncate(exporter->tables, 0);
+        write_rtf_tables(exporter->tables, ctx->fonts, ctx->colors);
+        exporter->tables_fonts = ctx->fonts->len;
+        exporter->tables_colors = ctx->colors->len;
+    }
+
+    g_autofree char *header = write_rtf_header(exporter->tables->str, get_default_language());
+    GString *output = g_string_sized_new(strlen(header) + length + 1);
+    g_string_append(output, header);
+    for (unsigned ix = 0; ix < paragraphs->len; ix++) {
+        const CachedParagraph *paragraph = g_ptr_array_index(paragraphs, ix);
+        g_string_append_len(output, paragraph->code, paragraph->length);
+    }
+    g_string_append_c(output, '}');
+
+    /* In compact mode each paragraph depends on the one before, so none of
+    them can be kept */
+    if (ctx->flags & RTF_EXPORT_COMPACT)
+        forget_all_paragraphs(exporter);
 
-    analyze_buffer(ctx, content_buffer, start, end);
-    char *contents = write_rtf(ctx);
-    *length = strlen(contents);
-    return (uint8_t *)contents;
+    length = output->len;
+    return g_bytes_new_take(g_string_free(output, false), length);
 }
@@ -15,8 +15,21 @@ PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
 You should have received a copy of the GNU Lesser General Public License along
 with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <gio/gio.h>
+#include <glib.h>
 #include <gtk/gtk.h>
 
-uint8_t *rtf_serialize(GtkTextBuffer *register_buffer, GtkTextBuffer *content_buffer, const GtkTextIter *start, const GtkTextIter *end, size_t *length);
+#include "rtf.h"
+
+typedef struct _SerializedBuffer SerializedBuffer;
+
+SerializedBuffer *serialize_buffer(GtkTextBuffer *buffer, const GtkTextIter *start, const GtkTextIter *end, RtfExportFlags flags);
+char *serialized_buffer_write(SerializedBuffer *serialized, size_t *length, GCancellable *cancellable, GError **error);
+void serialized_buffer_free(SerializedBuffer *serialized);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SerializedBuffer, serialized_buffer_free);
+
+uint8_t *rtf_serialize(GtkTextBuffer *register_buffer, GtkTextBuffer *content_buffer, const GtkTextIter *start, const GtkTextIter *end, size_t *length, void *user_data);
@@ -0,0 +1,96 @@
+#pragma once
+
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rtf-deserialize.h"
+#include "rtf-state.h"
+
+/* rtf-sink.h - The interface between the parser and whatever it is producing.
+The destinations don't know anything about the output; they call these
+functions with text and the attributes it should be formatted with, and the
+sink turns that into a document. The sink's own data is in ctx->sink_data. Any
+of the functions may be NULL, in which case that kind of output is discarded. */
+
+typedef enum {
+    PICT_TYPE_EMF,
+    PICT_TYPE_PNG,
+    PICT_TYPE_JPEG,
+    PICT_TYPE_MAC,
+    PICT_TYPE_OS2,
+    PICT_TYPE_WMF,
+    PICT_TYPE_DIB,
+    PICT_TYPE_BMP
+} PictType;
+
+/* Description of a \pict picture, as far as it has been read. Since size
+control words may come after the picture data, this may change while the
+picture is being written. */
+typedef struct {
+    PictType type;
+    int type_param;
+    long width; /* Pixels, or -1 if not given */
+    long height;
+    long width_goal; /* Twips, or -1 if not given */
+    long height_goal;
+    int xscale; /* Percent */
+    int yscale;
+} PictureInfo;
+
+struct _OutputSink {
+    /* Insert text at the insertion point, formatted with attr. If attr is NULL,
+    the text has no formatting of its own, but gets the formatting of the next
+    text inserted. */
+    void (*insert_text)(ParserContext *ctx, const char *text, const Attributes *attr);
+    /* Add text to the very end of the document, after the insertion point; used
+    for footnotes. attr may be NULL, as above. */
+    void (*append_text)(ParserContext *ctx, const char *text, const Attributes *attr);
+    /* Insert text at the beginning of the last line of the document */
+    void (*insert_at_line_start)(ParserContext *ctx, const char *text);
+    /* A footnote starts or ends; the text of the footnote is added with
+    append_text() in between */
+    void (*footnote_begin)(ParserContext *ctx);
+    void (*footnote_end)(ParserContext *ctx);
+
+    /* A font table entry has been read. family is a comma-separated list of
+    font family names, or NULL if nothing is known about the font. */
+    void (*define_font)(ParserContext *ctx, int index, const char *family);
+    /* A color table entry has been read; color is a "#rrggbb" string */
+    void (*define_color)(ParserContext *ctx, int index, const char *color);
+    /* A stylesheet entry has been read */
+    void (*define_style)(ParserContext *ctx, int index, const Attributes *attr);
+
+    /* Start a picture at the insertion point. Returns a handle that is passed
+    to the other picture functions, or NULL if the picture can't be loaded. */
+    void *(*picture_begin)(ParserContext *ctx, const PictureInfo *info);
+    /* Write a chunk of picture data. Returns false if the data can't be
+    loaded, in which case no more data is written. */
+    bool (*picture_write)(ParserContext *ctx, void *picture, const PictureInfo *info, const uint8_t *data, size_t length);
+    /* Finish the picture. If ok is false, the picture should be discarded. */
+    void (*picture_end)(ParserContext *ctx, void *picture, const PictureInfo *info, bool ok);
+    /* Insert a picture from a file at the insertion point, at the given size in
+    twips, or its natural size in either dimension that is -1. The filename is
+    absolute. */
+    void (*picture_file)(ParserContext *ctx, const char *filename, int width, int height);
+
+    /* A field instruction has been read. type is the name of the field, such
+    as "HYPERLINK", and argument is its argument, or NULL if it has none. The
+    field result, if it is used, follows as text. */
+    void (*field)(ParserContext *ctx, const char *type, const char *argument);
+};
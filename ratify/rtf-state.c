@@ -54,3 +54,12 @@ set_default_paragraph_attributes(Attributes *attr)
     attr->indent = 0;
     attr->leading = 0;
 }
+
+/* Copy a tab stop array, for copying the state */
+GArray *
+tab_array_copy(const GArray *tabs)
+{
+    GArray *copy = g_array_sized_new(false, false, sizeof(int), tabs->len);
+    g_array_append_vals(copy, tabs->data, tabs->len);
+    return copy;
+}
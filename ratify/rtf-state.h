@@ -18,25 +18,44 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include <stdbool.h>
 
 #include <glib.h>
-#include <gtk/gtk.h>
-#include <pango/pango.h>
 
 typedef void *StateNewFunc(void);
 typedef void *StateCopyFunc(const void *);
 typedef void StateFreeFunc(void *);
 
+/* Values for the formatting attributes that have a fixed set of choices. These
+are independent of any toolkit; the output sink translates them. */
+typedef enum {
+    JUSTIFY_LEFT,
+    JUSTIFY_RIGHT,
+    JUSTIFY_CENTER,
+    JUSTIFY_FILL
+} Justification;
+
+typedef enum {
+    DIRECTION_LTR,
+    DIRECTION_RTL
+} TextDirection;
+
+typedef enum {
+    UNDERLINE_NONE,
+    UNDERLINE_SINGLE,
+    UNDERLINE_DOUBLE,
+    UNDERLINE_WAVE
+} Underline;
+
 typedef struct {
     int style; /* Index into style sheet */
 
     /* Paragraph formatting */
 
-    int justification;  /* GtkJustification value or -1 if unset */
-    int pardirection;  /* GtkTextDirection value or -1 if unset */
+    int justification;  /* Justification value or -1 if unset */
+    int pardirection;  /* TextDirection value or -1 if unset */
     int space_before;
     int space_after;
     bool ignore_space_before;
     bool ignore_space_after;
-    PangoTabArray *tabs;
+    GArray *tabs; /* Tab stop positions in twips, or NULL */
     int left_margin;
     int right_margin;
     int indent;
@@ -56,8 +75,8 @@ typedef struct {
     bool subscript;
     bool superscript;
     bool invisible;
-    int underline;  /* PangoUnderline value or -1 if unset */
-    int chardirection;  /* GtkTextDirection value or -1 if unset */
+    int underline;  /* Underline value or -1 if unset */
+    int chardirection;  /* TextDirection value or -1 if unset */
     int language;
     int rise;
     int scale;
@@ -70,6 +89,7 @@ typedef struct {
 
 void set_default_character_attributes(Attributes *attr);
 void set_default_paragraph_attributes(Attributes *attr);
+GArray *tab_array_copy(const GArray *tabs);
 
 #ifndef G_PASTE_ARGS /* available since 2.20 */
 #define G_PASTE_ARGS(identifier1,identifier2) identifier1 ## identifier2
@@ -82,10 +102,10 @@ void set_default_paragraph_attributes(Attributes *attr);
     ((Attributes *)state)->unicode_ignore = false;
 #define ATTR_COPY \
     if (((Attributes *)state)->tabs) \
-        ((Attributes *)copy)->tabs = pango_tab_array_copy(((Attributes *)state)->tabs);
+        ((Attributes *)copy)->tabs = tab_array_copy(((Attributes *)state)->tabs);
 #define ATTR_FREE \
     if (((Attributes *)state)->tabs) \
-        pango_tab_array_free(((Attributes *)state)->tabs);
+        g_array_unref(((Attributes *)state)->tabs);
 
 #define DEFINE_STATE_FUNCTIONS_FULL(tn, fn, init_code, copy_code, free_code) \
     static void * \
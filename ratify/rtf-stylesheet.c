@@ -21,9 +21,9 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include <glib.h>
 #include <glib/gi18n-lib.h>
 
-#include "rtf.h"
 #include "rtf-deserialize.h"
 #include "rtf-document.h"
+#include "rtf-sink.h"
 #include "rtf-state.h"
 
 /* rtf-stylesheet.c - Implementation of style sheets. */
@@ -76,8 +76,8 @@ const DestinationInfo stylesheet_destination = {
     stylesheet_state_free
 };
 
-/* Add a style tag to the GtkTextBuffer's tag table with all the attributes of
-the current style */
+/* Tell the output sink about the style that has been read, with all the
+attributes of the current style */
 static void
 stylesheet_text(ParserContext *ctx)
 {
@@ -91,173 +91,9 @@ stylesheet_text(ParserContext *ctx)
     }
     g_string_assign(ctx->text, semicolon + 1); /* Leave the text after the semicolon in the buffer */
 
-    g_autofree char *tagname = g_strdup_printf("rtf-style-%i", state->index);
-    GtkTextTag *tag = gtk_text_tag_table_lookup(ctx->tags, tagname);
-    if (tag != NULL)
-        gtk_text_tag_table_remove(ctx->tags, tag);
-    tag = gtk_text_tag_new(tagname);
-
-    /* Add each paragraph attribute to the tag */
-    if (attr->justification != -1) {
-        g_object_set(tag,
-                     "justification", attr->justification,
-                     "justification-set", true,
-                     NULL);
-    }
-    if (attr->pardirection != -1)
-        g_object_set(tag, "direction", attr->pardirection, NULL);
-    if (attr->space_before != 0 && !attr->ignore_space_before) {
-        g_object_set(tag,
-                     "pixels-above-lines", PANGO_PIXELS(TWIPS_TO_PANGO(attr->space_before)),
-                     "pixels-above-lines-set", true,
-                     NULL);
-    }
-    if (attr->space_after != 0 && !attr->ignore_space_after) {
-        g_object_set(tag,
-                     "pixels-below-lines", PANGO_PIXELS(TWIPS_TO_PANGO(attr->space_after)),
-                     "pixels-below-lines-set", true,
-                     NULL);
-    }
-    if (attr->tabs) {
-        g_object_set(tag,
-                     "tabs", attr->tabs,
-                     "tabs-set", true,
-                     NULL);
-    }
-    if (attr->left_margin) {
-        g_object_set(tag,
-                     "left-margin", PANGO_PIXELS(TWIPS_TO_PANGO(attr->left_margin)),
-                     "left-margin-set", true,
-                     NULL);
-    }
-    if (attr->right_margin) {
-        g_object_set(tag,
-                     "right-margin", PANGO_PIXELS(TWIPS_TO_PANGO(attr->right_margin)),
-                     "right-margin-set", true,
-                     NULL);
-    }
-    if (attr->indent) {
-        g_object_set(tag,
-                     "indent", PANGO_PIXELS(TWIPS_TO_PANGO(attr->indent)),
-                     "indent-set", true,
-                     NULL);
-    }
-    if (attr->scale != 100) {
-        g_object_set(tag,
-                     "scale", (double)(attr->scale) / 100.0,
-                     "scale-set", true,
-                     NULL);
-    }
-
-    /* Add each character attribute to the tag */
-    if (attr->foreground != -1) {
-        const char *color = g_slist_nth_data(ctx->color_table, attr->foreground);
-        /* color must exist, because that was already checked when executing
-         the \cf command */
-        g_object_set(tag,
-                     "foreground", color,
-                     "foreground-set", true,
-                     NULL);
-    }
-    if (attr->background != -1) {
-        const char *color = g_slist_nth_data(ctx->color_table, attr->background);
-        /* color must exist, because that was already checked when executing
-         the \cf command */
-        g_object_set(tag,
-                     "background", color,
-                     "background-set", true,
-                     NULL);
-    }
-    if (attr->highlight != -1) {
-        const char *color = g_slist_nth_data(ctx->color_table, attr->highlight);
-        /* color must exist, because that was already checked when executing
-         the \cf command */
-        g_object_set(tag,
-                     "paragraph-background", color,
-                     "paragraph-background-set", true,
-                     NULL);
-    }
-    if (attr->font != -1) {
-        g_autofree char *tagname = g_strdup_printf("rtf-font-%d", attr->font);
-        GtkTextTag *fonttag = gtk_text_tag_table_lookup(ctx->tags, tagname);
-        PangoFontDescription *fontdesc;
-
-        g_object_get(fonttag, "font-desc", &fontdesc, NULL); /* do not free */
-        if (fontdesc && pango_font_description_get_family(fontdesc)) {
-            g_object_set(tag,
-                         "family", g_strdup(pango_font_description_get_family(fontdesc)),
-                         "family-set", true,
-                         NULL);
-        }
-    }
-    if (attr->size != 0.0) {
-        g_object_set(tag,
-                     "size", POINTS_TO_PANGO(attr->size),
-                     "size-set", true,
-                     NULL);
-    }
-    if (attr->italic) {
-        g_object_set(tag,
-                     "style", PANGO_STYLE_ITALIC,
-                     "style-set", true,
-                     NULL);
-    }
-    if (attr->bold) {
-        g_object_set(tag,
-                     "weight", PANGO_WEIGHT_BOLD,
-                     "weight-set", true,
-                     NULL);
-    }
-    if (attr->smallcaps) {
-        g_object_set(tag,
-                     "variant", PANGO_VARIANT_SMALL_CAPS,
-                     "variant-set", true,
-                     NULL);
-    }
-    if (attr->strikethrough) {
-        g_object_set(tag,
-                     "strikethrough", true,
-                     "strikethrough-set", true,
-                     NULL);
-    }
-    if (attr->subscript) {
-        g_object_set(tag,
-                     "rise", POINTS_TO_PANGO(-6),
-                     "rise-set", true,
-                     "scale", PANGO_SCALE_X_SMALL,
-                     "scale-set", true,
-                     NULL);
-    }
-    if (attr->superscript) {
-        g_object_set(tag,
-                     "rise", POINTS_TO_PANGO(6),
-                     "rise-set", true,
-                     "scale", PANGO_SCALE_X_SMALL,
-                     "scale-set", true,
-                     NULL);
-    }
-    if (attr->invisible) {
-        g_object_set(tag,
-                     "invisible", true,
-                     "invisible-set", true,
-                     NULL);
-    }
-    if (attr->underline != -1) {
-        g_object_set(tag,
-                     "underline", attr->underline,
-                     "underline-set", true,
-                     NULL);
-    }
-    if (attr->chardirection != -1)
-        g_object_set(tag, "direction", attr->chardirection, NULL);
-    if (attr->rise != 0) {
-        g_object_set(tag,
-                     "rise", HALF_POINTS_TO_PANGO(attr->rise),
-                     "rise-set", true,
-                     NULL);
-    }
-
-    gtk_text_tag_table_add(ctx->tags, tag);
+    g_hash_table_add(ctx->style_table, GINT_TO_POINTER(state->index));
+    if (ctx->sink->define_style)
+        ctx->sink->define_style(ctx, state->index, attr);
 
     state->index = 0;
     state->type = STYLE_PARAGRAPH;
@@ -0,0 +1,524 @@
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "rtf-core.h"
+#include "rtf-scan.h"
+#include "rtf-writer.h"
+
+/* rtf-template.c - Mail merge templates. A template is parsed once, into
+pieces of RTF code that are copied to the output as they are, and slots in
+between them that are filled with text each time the template is rendered. The
+slots are MERGEFIELD and DOCVARIABLE fields, and {{name}} markers in the text.
+Finding them only needs the group structure of the code, so rtf-scan.c does
+most of the work. */
+
+/* A piece of the template. Literal pieces have no name. Slots keep the code
+they replaced, to write if there is no value for them. */
+typedef struct {
+    const char *code; /* Points into the template's copy of the RTF code */
+    size_t length;
+    const char *name; /* Owned by the template's field_names, or NULL */
+    /* The control words at the start of a field's result, which format the
+    value too, or NULL */
+    char *formatting;
+} TemplatePart;
+
+struct _RtfTemplate {
+    char *code;
+    size_t length;
+    GArray *parts; /* TemplatePart */
+    GPtrArray *field_names; /* Distinct names, in order, NULL-terminated */
+};
+
+/* Append the plain text in the code of a field instruction, from pos to end,
+to text, leaving out control words and group braces. */
+static void
+get_instruction_text(const char *pos, const char *end, GString *text)
+{
+    while (pos < end) {
+        if (*pos == '{' || *pos == '}' || *pos == '\r' || *pos == '\n') {
+            pos++;
+            continue;
+        }
+        if (*pos != '\\') {
+            g_string_append_c(text, *pos++);
+            continue;
+        }
+        if (end - pos < 2)
+            return;
+
+        if (pos[1] == '\\' || pos[1] == '{' || pos[1] == '}') {
+            g_string_append_c(text, pos[1]);
+            pos += 2;
+        } else if (pos[1] == '\'' && end - pos >= 4 && g_ascii_isxdigit(pos[2]) && g_ascii_isxdigit(pos[3])) {
+            g_string_append_unichar(text, g_ascii_xdigit_value(pos[2]) << 4 | g_ascii_xdigit_value(pos[3]));
+            pos += 4;
+        } else if (is_control_word(pos, end, "u")) {
+            char *param_end;
+            long ch = strtol(pos + 2, &param_end, 10);
+            g_string_append_unichar(text, ch < 0 ? ch + 65536 : ch);
+            pos = param_end;
+            if (pos < end && *pos == ' ')
+                pos++;
+            /* Skip the ANSI replacement character */
+            if (end - pos >= 4 && pos[0] == '\\' && pos[1] == '\'')
+                pos += 4;
+            else if (pos < end && *pos != '\\' && *pos != '{' && *pos != '}')
+                pos++;
+        } else if (is_control_word(pos, end, "bin")) {
+            pos = skip_backslash(pos, end);
+            if (pos == NULL)
+                return;
+        } else if (g_ascii_isalpha(pos[1])) {
+            pos++;
+            while (pos < end && g_ascii_isalpha(*pos))
+                pos++;
+            if (pos < end && *pos == '-')
+                pos++;
+            while (pos < end && g_ascii_isdigit(*pos))
+                pos++;
+            if (pos < end && *pos == ' ')
+                pos++;
+        } else {
+            pos += 2; /* Other control symbols, such as \* */
+        }
+    }
+}
+
+/* If the field instruction is MERGEFIELD or DOCVARIABLE, return the name of
+the field, or NULL if it is another kind of field. Switches such as
+\* MERGEFORMAT are ignored. */
+static char *
+get_merge_field_name(const char *instruction)
+{
+    const char *pos = instruction;
+    while (g_ascii_isspace(*pos))
+        pos++;
+    const char *keyword = pos;
+    while (*pos != '\0' && !g_ascii_isspace(*pos))
+        pos++;
+    size_t keyword_length = pos - keyword;
+    if (!(keyword_length == strlen("MERGEFIELD") && g_ascii_strncasecmp(keyword, "MERGEFIELD", keyword_length) == 0) &&
+        !(keyword_length == strlen("DOCVARIABLE") && g_ascii_strncasecmp(keyword, "DOCVARIABLE", keyword_length) == 0))
+        return NULL;
+
+    while (g_ascii_isspace(*pos))
+        pos++;
+    const char *name = pos;
+    if (*pos == '"') {
+        name = ++pos;
+        while (*pos != '\0' && *pos != '"')
+            pos++;
+    } else {
+        while (*pos != '\0' && !g_ascii_isspace(*pos))
+            pos++;
+    }
+    if (pos == name)
+        return NULL;
+    return g_strndup(name, pos - name);
+}
+
+/* Control words that stand for text, which ends the formatting at the start of
+a field result */
+static const char * const text_words[] = {
+    "bin", "bullet", "emdash", "emspace", "endash", "enspace", "ldblquote",
+    "line", "lquote", "par", "rdblquote", "rquote", "tab", "u"
+};
+
+/* Return the control words at the start of the code of a field result, from
+pos to end, with any groups they are in opened up, or NULL if there are none.
+The field result's formatting, such as bold, is usually set there. */
+static char *
+get_result_formatting(const char *pos, const char *end)
+{
+    GString *formatting = g_string_new("");
+    while (pos < end) {
+        if (*pos == '{' || g_ascii_isspace(*pos)) {
+            pos++;
+            continue;
+        }
+        if (*pos != '\\' || end - pos < 2 || !g_ascii_isalpha(pos[1]))
+            break;
+
+        bool is_text = false;
+        for (unsigned ix = 0; ix < G_N_ELEMENTS(text_words); ix++)
+            is_text = is_text || is_control_word(pos, end, text_words[ix]);
+        if (is_text)
+            break;
+
+        const char *word = pos++;
+        while (pos < end && g_ascii_isalpha(*pos))
+            pos++;
+        if (pos < end && *pos == '-')
+            pos++;
+        while (pos < end && g_ascii_isdigit(*pos))
+            pos++;
+        g_string_append_len(formatting, word, pos - word);
+    }
+
+    if (formatting->len == 0) {
+        g_string_free(formatting, true);
+        return NULL;
+    }
+    return g_string_free(formatting, false);
+}
+
+/* pos is at the opening brace of a \field group, and end at its closing brace.
+Return the name of the field if it is a merge field, or NULL if not, and put
+the formatting of the field result in formatting. */
+static char *
+get_field_name(const char *pos, const char *end, char **formatting)
+{
+    char *name = NULL;
+
+    pos += strlen("{\\field");
+    while ((pos = find_structural_character(pos, end)) < end) {
+        if (*pos == '\\') {
+            pos = skip_backslash(pos, end);
+            if (pos == NULL)
+                return NULL;
+            continue;
+        }
+        if (*pos != '{')
+            break;
+
+        const char *group_end = find_group_end(pos + 1, end);
+        if (group_end == NULL)
+            break;
+        const char *word = pos + 1;
+        if (is_control_word(word, group_end, "*"))
+            word += 2;
+        while (word < group_end && g_ascii_isspace(*word))
+            word++;
+        if (name == NULL && is_control_word(word, group_end, "fldinst")) {
+            GString *instruction = g_string_new("");
+            get_instruction_text(word + strlen("\\fldinst"), group_end, instruction);
+            name = get_merge_field_name(instruction->str);
+            g_string_free(instruction, true);
+            if (name == NULL)
+                return NULL;
+        } else if (name != NULL && is_control_word(word, group_end, "fldrslt")) {
+            *formatting = get_result_formatting(word + strlen("\\fldrslt"), group_end);
+            break;
+        }
+        pos = group_end + 1;
+    }
+    return name;
+}
+
+/* If there is a {{name}} marker at pos, as it is written in RTF code, return
+the end of it and put the name in name. Only letters, digits, and the
+characters "_.-" may be in the name, so formatting in between the braces means
+it is not a marker. */
+static const char *
+find_marker_end(const char *pos, const char *end, char **name)
+{
+    static const char marker_start[] = "\\{\\{";
+    static const char marker_end[] = "\\}\\}";
+    size_t marker_length = strlen(marker_start);
+
+    if ((size_t)(end - pos) < 2 * marker_length || strncmp(pos, marker_start, marker_length) != 0)
+        return NULL;
+    const char *name_start = pos + marker_length;
+    for (pos = name_start; pos < end; pos++) {
+        if (!g_ascii_isalnum(*pos) && *pos != '_' && *pos != '.' && *pos != '-')
+            break;
+    }
+    if (pos == name_start || (size_t)(end - pos) < marker_length || strncmp(pos, marker_end, marker_length) != 0)
+        return NULL;
+    *name = g_strndup(name_start, pos - name_start);
+    return pos + marker_length;
+}
+
+static void
+add_part(RtfTemplate *tmpl, const char *start, const char *end, const char *name, char *formatting)
+{
+    if (start == end && name == NULL)
+        return;
+    TemplatePart part = { start, end - start, name, formatting };
+    g_array_append_val(tmpl->parts, part);
+}
+
+/* Add a slot for the code from start to end, taking ownership of name and
+formatting */
+static void
+add_slot(RtfTemplate *tmpl, GHashTable *names, const char *start, const char *end, char *name, char *formatting)
+{
+    char *existing = g_hash_table_lookup(names, name);
+    if (existing != NULL) {
+        g_free(name);
+        name = existing;
+    } else {
+        g_hash_table_add(names, name);
+        g_ptr_array_add(tmpl->field_names, name);
+    }
+    add_part(tmpl, start, end, name, formatting);
+}
+
+/* Split the template's code into literal pieces and slots */
+static void
+compile_template(RtfTemplate *tmpl)
+{
+    GHashTable *names = g_hash_table_new(g_str_hash, g_str_equal);
+    const char *end = tmpl->code + tmpl->length;
+    const char *literal_start = tmpl->code;
+    const char *pos = tmpl->code;
+
+    while ((pos = find_structural_character(pos, end)) < end) {
+        char *name = NULL, *formatting = NULL;
+        const char *slot_end = NULL;
+
+        if (*pos == '{' && is_control_word(pos + 1, end, "field")) {
+            const char *group_end = find_group_end(pos + 1, end);
+            if (group_end != NULL && (name = get_field_name(pos, group_end, &formatting)) != NULL)
+                slot_end = group_end + 1;
+        } else if (*pos == '\\') {
+            slot_end = find_marker_end(pos, end, &name);
+            if (slot_end == NULL) {
+                pos = skip_backslash(pos, end);
+                if (pos == NULL)
+                    break;
+                continue;
+            }
+        }
+
+        if (slot_end == NULL) {
+            pos++;
+            continue;
+        }
+        add_part(tmpl, literal_start, pos, NULL, NULL);
+        add_slot(tmpl, names, pos, slot_end, name, formatting);
+        pos = literal_start = slot_end;
+    }
+    add_part(tmpl, literal_start, end, NULL, NULL);
+
+    g_ptr_array_add(tmpl->field_names, NULL);
+    g_hash_table_unref(names);
+}
+
+/**
+ * RtfTemplate:
+ *
+ * An opaque structure holding a compiled mail merge template. Create it with
+ * rtf_template_new().
+ */
+
+static void
+template_part_clear(TemplatePart *part)
+{
+    g_free(part->formatting);
+}
+
+/**
+ * rtf_template_new:
+ * @data: RTF code of the template
+ * @length: length of @data in bytes, or -1 if @data is nul-terminated
+ * @error: return location for an error, or %NULL
+ *
+ * Compiles an RTF document into a template that can be filled in many times
+ * with rtf_template_render(), for example for a mail merge.
+ *
+ * The places to fill in are <quote>MERGEFIELD</quote> and
+ * <quote>DOCVARIABLE</quote> fields, such as those inserted by word processors,
+ * and markers of the form <literal>{{name}}</literal> in the text. A marker's
+ * name may only contain letters, digits, and the characters
+ * <literal>_.-</literal>, and must not have any formatting changes inside it.
+ * Both kinds of fields with the same name are filled in with the same value.
+ * Other fields are left as they are.
+ *
+ * The template is parsed once here to check that it is valid; after that,
+ * rendering it only copies code and escapes the values.
+ *
+ * Returns: (transfer full): a new #RtfTemplate, or %NULL if @data could not
+ * be parsed, in which case @error is set.
+ */
+RtfTemplate *
+rtf_template_new(const char *data, gssize length, GError **error)
+{
+    g_return_val_if_fail(data != NULL, NULL);
+    g_return_val_if_fail(error == NULL || *error == NULL, NULL);
+
+    if (length < 0)
+        length = strlen(data);
+
+    static const RtfParseCallbacks no_callbacks = { NULL };
+    if (!rtf_parse(data, length, &no_callbacks, NULL, error))
+        return NULL;
+
+    RtfTemplate *tmpl = g_slice_new0(RtfTemplate);
+    /* Binary data may contain NUL bytes, so g_strndup() won't do */
+    tmpl->code = g_malloc(length + 1);
+    memcpy(tmpl->code, data, length);
+    tmpl->code[length] = '\0';
+    tmpl->length = length;
+    tmpl->parts = g_array_new(false, false, sizeof(TemplatePart));
+    g_array_set_clear_func(tmpl->parts, (GDestroyNotify)template_part_clear);
+    tmpl->field_names = g_ptr_array_new_with_free_func(g_free);
+    compile_template(tmpl);
+    return tmpl;
+}
+
+/**
+ * rtf_template_free:
+ * @tmpl: an #RtfTemplate
+ *
+ * Frees @tmpl.
+ */
+void
+rtf_template_free(RtfTemplate *tmpl)
+{
+    g_return_if_fail(tmpl != NULL);
+
+    g_free(tmpl->code);
+    g_array_unref(tmpl->parts);
+    g_ptr_array_unref(tmpl->field_names);
+    g_slice_free(RtfTemplate, tmpl);
+}
+
+/**
+ * rtf_template_get_field_names:
+ * @tmpl: an #RtfTemplate
+ *
+ * Gets the names of the fields in @tmpl, each one once, in the order they
+ * first occur.
+ *
+ * Returns: (transfer none) (array zero-terminated=1): a %NULL-terminated array
+ * of names, owned by @tmpl.
+ */
+const char * const *
+rtf_template_get_field_names(RtfTemplate *tmpl)
+{
+    g_return_val_if_fail(tmpl != NULL, NULL);
+    return (const char * const *)tmpl->field_names->pdata;
+}
+
+/* Write the value of a slot. Each value is written in a group of its own, so
+that it can't run into a control word before it, with the formatting of the
+field result that it replaces. The template's code page may be any, and its
+\uc anything, so all non-ASCII characters are written as \uN under \uc0. */
+static void
+write_value(const TemplatePart *part, const char *value, GString *output, OutputLine *line)
+{
+    g_string_append(output, "{\\uc0 ");
+    if (part->formatting != NULL) {
+        g_string_append(output, part->formatting);
+        g_string_append_c(output, ' ');
+    }
+    write_rtf_unicode_text(output, line, value, strlen(value));
+    g_string_append_c(output, '}');
+}
+
+/* Return the value to fill in part with, or NULL if it is a literal piece or
+there is no value for it */
+static const char *
+get_value(const TemplatePart *part, GHashTable *values)
+{
+    return part->name != NULL ? g_hash_table_lookup(values, part->name) : NULL;
+}
+
+/**
+ * rtf_template_render:
+ * @tmpl: an #RtfTemplate
+ * @values: (element-type utf8 utf8): table of field names and UTF-8 text to
+ * fill them in with
+ *
+ * Fills in the fields in @tmpl with the values in @values. The text of each
+ * value is escaped as needed, and takes on the formatting in effect where the
+ * field is, along with any formatting set at the start of a field's result,
+ * such as bold. Fields that are not in @values are left as they were in the
+ * template.
+ *
+ * @tmpl is not changed, so it can be rendered from several threads at once.
+ *
+ * Returns: (transfer full): a #GBytes containing RTF code.
+ */
+GBytes *
+rtf_template_render(RtfTemplate *tmpl, GHashTable *values)
+{
+    g_return_val_if_fail(tmpl != NULL, NULL);
+    g_return_val_if_fail(values != NULL, NULL);
+
+    GString *output = g_string_sized_new(tmpl->length);
+    for (unsigned ix = 0; ix < tmpl->parts->len; ix++) {
+        const TemplatePart *part = &g_array_index(tmpl->parts, TemplatePart, ix);
+        const char *value = get_value(part, values);
+        if (value == NULL) {
+            g_string_append_len(output, part->code, part->length);
+            continue;
+        }
+        /* Break the value's lines counting from its start, the same as
+        rtf_template_render_to_stream() does */
+        OutputLine line = { output->len, output->len };
+        write_value(part, value, output, &line);
+    }
+    size_t length = output->len;
+    return g_bytes_new_take(g_string_free(output, false), length);
+}
+
+/**
+ * rtf_template_render_to_stream:
+ * @tmpl: an #RtfTemplate
+ * @values: (element-type utf8 utf8): table of field names and UTF-8 text to
+ * fill them in with
+ * @stream: the stream to write the RTF code to
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL
+ * @error: return location for an error, or %NULL
+ *
+ * Like rtf_template_render(), but writes the RTF code to @stream. @stream is
+ * not closed.
+ *
+ * The pieces of the template between the fields are written to @stream
+ * straight from @tmpl, and each value as soon as it is escaped, so nothing
+ * the size of the document is built up in memory. That means many small
+ * writes, so @stream may be worth wrapping in a #GBufferedOutputStream.
+ *
+ * Returns: %TRUE if the document was written successfully, %FALSE if not, in
+ * which case @error is set.
+ */
+gboolean
+rtf_template_render_to_stream(RtfTemplate *tmpl, GHashTable *values, GOutputStream *stream, GCancellable *cancellable, GError **error)
+{
+    g_return_val_if_fail(tmpl != NULL, false);
+    g_return_val_if_fail(values != NULL, false);
+    g_return_val_if_fail(G_IS_OUTPUT_STREAM(stream), false);
+    g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+    /* Each value is escaped into the same buffer in turn */
+    GString *buffer = g_string_new("");
+    bool retval = true;
+    for (unsigned ix = 0; ix < tmpl->parts->len && retval; ix++) {
+        const TemplatePart *part = &g_array_index(tmpl->parts, TemplatePart, ix);
+        const char *value = get_value(part, values);
+        if (value == NULL) {
+            retval = g_output_stream_write_all(stream, part->code, part->length, NULL, cancellable, error);
+            continue;
+        }
+        OutputLine line = { 0 };
+        g_string_truncate(buffer, 0);
+        write_value(part, value, buffer, &line);
+        retval = g_output_stream_write_all(stream, buffer->str, buffer->len, NULL, cancellable, error);
+    }
+    g_string_free(buffer, true);
+    return retval;
+}
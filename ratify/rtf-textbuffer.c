@@ -0,0 +1,706 @@
+/* Copyright 2009, 2012, 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gi18n-lib.h>
+#include <gtk/gtk.h>
+#include <pango/pango.h>
+
+#include "rtf.h"
+#include "rtf-ir.h"
+#include "rtf-langcode.h"
+#include "rtf-state.h"
+#include "rtf-textbuffer.h"
+
+/* rtf-textbuffer.c - Inserts a parsed document into a GtkTextBuffer. The
+formatting is expressed as GtkTextTags with names beginning with "rtf-", which
+are created the first time they are needed. */
+
+/* GTK equivalents of the attribute values in rtf-state.h */
+static const GtkJustification gtk_justification[] = {
+    GTK_JUSTIFY_LEFT, GTK_JUSTIFY_RIGHT, GTK_JUSTIFY_CENTER, GTK_JUSTIFY_FILL
+};
+static const GtkTextDirection gtk_direction[] = {
+    GTK_TEXT_DIR_LTR, GTK_TEXT_DIR_RTL
+};
+static const PangoUnderline pango_underline[] = {
+    PANGO_UNDERLINE_NONE, PANGO_UNDERLINE_SINGLE, PANGO_UNDERLINE_DOUBLE,
+    PANGO_UNDERLINE_ERROR
+};
+
+/* Space-saving function for apply_attributes(); applies a tag that must already
+exist */
+static void
+apply_named_tag(TextBufferOutput *out, GtkTextIter *start, GtkTextIter *end, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    g_autofree char *tagname = g_strdup_vprintf(format, args);
+    va_end(args);
+    gtk_text_buffer_apply_tag_by_name(out->textbuffer, tagname, start, end);
+}
+
+/* Apply the tag called tagname, first creating it with the given properties if
+it isn't in the tag table yet */
+static void
+apply_tag(TextBufferOutput *out, GtkTextIter *start, GtkTextIter *end, const char *tagname, const char *first_property, ...)
+{
+    GtkTextTag *tag = gtk_text_tag_table_lookup(out->tags, tagname);
+    if (tag == NULL) {
+        va_list args;
+
+        tag = gtk_text_tag_new(tagname);
+        va_start(args, first_property);
+        g_object_set_valist(G_OBJECT(tag), first_property, args);
+        va_end(args);
+        gtk_text_tag_table_add(out->tags, tag);
+        g_object_unref(tag);
+    }
+    gtk_text_buffer_apply_tag(out->textbuffer, tag, start, end);
+}
+
+/* Apply a tag with a numeric parameter in its name */
+#define APPLY_PARAM_TAG(format, param, ...) \
+    G_STMT_START { \
+        g_autofree char *tagname = g_strdup_printf(format, param); \
+        apply_tag(out, start, end, tagname, __VA_ARGS__, NULL); \
+    } G_STMT_END
+
+static const char *
+get_color(TextBufferOutput *out, int index)
+{
+    /* The color must exist, because that was already checked when executing the
+    control word */
+    return g_ptr_array_index(out->doc->colors, index);
+}
+
+/* Apply the tag for a set of tab stops; there is one tag for each distinct set
+of tab stops */
+static void
+apply_tabs(TextBufferOutput *out, GtkTextIter *start, GtkTextIter *end, const GArray *tabs)
+{
+    g_autoptr(GString) tagname = g_string_new("rtf-tabs");
+    for (unsigned ix = 0; ix < tabs->len; ix++)
+        g_string_append_printf(tagname, "-%d", g_array_index(tabs, int, ix));
+
+    GtkTextTag *tag = gtk_text_tag_table_lookup(out->tags, tagname->str);
+    if (tag == NULL) {
+        PangoTabArray *tab_array = pango_tab_array_new(tabs->len, false);
+        for (unsigned ix = 0; ix < tabs->len; ix++)
+            pango_tab_array_set_tab(tab_array, ix, PANGO_TAB_LEFT, TWIPS_TO_PANGO(g_array_index(tabs, int, ix)));
+
+        tag = gtk_text_tag_new(tagname->str);
+        g_object_set(tag,
+                     "tabs", tab_array,
+                     "tabs-set", true,
+                     NULL);
+        gtk_text_tag_table_add(out->tags, tag);
+        g_object_unref(tag);
+        pango_tab_array_free(tab_array);
+    }
+    gtk_text_buffer_apply_tag(out->textbuffer, tag, start, end);
+}
+
+/* Apply GtkTextTags to the range from start to end, depending on the current
+attributes 'attr'. */
+static void
+apply_attributes(TextBufferOutput *out, const Attributes *attr, GtkTextIter *start, GtkTextIter *end)
+{
+    /* Tags with parameters */
+    if (attr->style != -1)
+        apply_named_tag(out, start, end, "rtf-style-%i", attr->style);
+    if (attr->foreground != -1) {
+        APPLY_PARAM_TAG("rtf-foreground-%i", attr->foreground,
+                        "foreground", get_color(out, attr->foreground),
+                        "foreground-set", true);
+    }
+    if (attr->background != -1) {
+        APPLY_PARAM_TAG("rtf-background-%i", attr->background,
+                        "background", get_color(out, attr->background),
+                        "background-set", true);
+    }
+    if (attr->highlight != -1) {
+        APPLY_PARAM_TAG("rtf-highlight-%i", attr->highlight,
+                        "paragraph-background", get_color(out, attr->highlight),
+                        "paragraph-background-set", true);
+    }
+    if (attr->size != 0.0) {
+        APPLY_PARAM_TAG("rtf-fontsize-%.3f", attr->size,
+                        "size", POINTS_TO_PANGO(attr->size),
+                        "size-set", true);
+    }
+    if (attr->space_before != 0 && !attr->ignore_space_before) {
+        APPLY_PARAM_TAG("rtf-space-before-%i", attr->space_before,
+                        "pixels-above-lines", PANGO_PIXELS(TWIPS_TO_PANGO(attr->space_before)),
+                        "pixels-above-lines-set", true);
+    }
+    if (attr->space_after != 0 && !attr->ignore_space_after) {
+        APPLY_PARAM_TAG("rtf-space-after-%i", attr->space_after,
+                        "pixels-below-lines", PANGO_PIXELS(TWIPS_TO_PANGO(attr->space_after)),
+                        "pixels-below-lines-set", true);
+    }
+    if (attr->left_margin != 0) {
+        APPLY_PARAM_TAG("rtf-left-margin-%i", attr->left_margin,
+                        "left-margin", PANGO_PIXELS(TWIPS_TO_PANGO(attr->left_margin)),
+                        "left-margin-set", true);
+    }
+    if (attr->right_margin != 0) {
+        APPLY_PARAM_TAG("rtf-right-margin-%i", attr->right_margin,
+                        "right-margin", PANGO_PIXELS(TWIPS_TO_PANGO(attr->right_margin)),
+                        "right-margin-set", true);
+    }
+    if (attr->indent != 0) {
+        APPLY_PARAM_TAG("rtf-indent-%i", attr->indent,
+                        "indent", PANGO_PIXELS(TWIPS_TO_PANGO(attr->indent)),
+                        "indent-set", true);
+    }
+    if (attr->invisible) {
+        apply_tag(out, start, end, "rtf-invisible",
+                  "invisible", true,
+                  "invisible-set", true,
+                  NULL);
+    }
+    if (attr->language != 1024) {
+        APPLY_PARAM_TAG("rtf-language-%i", attr->language,
+                        "language", language_to_iso(attr->language),
+                        "language-set", true);
+    }
+    if (attr->rise > 0) {
+        APPLY_PARAM_TAG("rtf-up-%i", attr->rise,
+                        "rise", HALF_POINTS_TO_PANGO(attr->rise),
+                        "rise-set", true);
+    }
+    if (attr->rise < 0) {
+        APPLY_PARAM_TAG("rtf-down-%i", -attr->rise,
+                        "rise", HALF_POINTS_TO_PANGO(attr->rise),
+                        "rise-set", true);
+    }
+    if (attr->leading != 0) {
+        APPLY_PARAM_TAG("rtf-leading-%i", attr->leading,
+                        "pixels-inside-wrap", PANGO_PIXELS(TWIPS_TO_PANGO(attr->leading)),
+                        "pixels-inside-wrap-set", true);
+    }
+    if (attr->scale != 100) {
+        APPLY_PARAM_TAG("rtf-scale-%i", attr->scale,
+                        "scale", (double)attr->scale / 100.0,
+                        "scale-set", true);
+    }
+    /* Boolean tags */
+    if (attr->italic) {
+        apply_tag(out, start, end, "rtf-italic",
+                  "style", PANGO_STYLE_ITALIC,
+                  "style-set", true,
+                  NULL);
+    }
+    if (attr->bold)
+        apply_tag(out, start, end, "rtf-bold", "weight", PANGO_WEIGHT_BOLD, NULL);
+    if (attr->smallcaps) {
+        apply_tag(out, start, end, "rtf-smallcaps",
+                  "variant", PANGO_VARIANT_SMALL_CAPS,
+                  "variant-set", true,
+                  NULL);
+    }
+    if (attr->strikethrough) {
+        apply_tag(out, start, end, "rtf-strikethrough",
+                  "strikethrough", true,
+                  "strikethrough-set", true,
+                  NULL);
+    }
+    if (attr->underline == UNDERLINE_SINGLE) {
+        apply_tag(out, start, end, "rtf-underline-single",
+                  "underline", PANGO_UNDERLINE_SINGLE,
+                  "underline-set", true,
+                  NULL);
+    }
+    if (attr->underline == UNDERLINE_DOUBLE) {
+        apply_tag(out, start, end, "rtf-underline-double",
+                  "underline", PANGO_UNDERLINE_DOUBLE,
+                  "underline-set", true,
+                  NULL);
+    }
+    if (attr->underline == UNDERLINE_WAVE) {
+        apply_tag(out, start, end, "rtf-underline-wave",
+                  "underline", PANGO_UNDERLINE_ERROR,
+                  "underline-set", true,
+                  NULL);
+    }
+    if (attr->justification == JUSTIFY_LEFT) {
+        apply_tag(out, start, end, "rtf-left",
+                  "justification", GTK_JUSTIFY_LEFT,
+                  "justification-set", true,
+                  NULL);
+    }
+    if (attr->justification == JUSTIFY_RIGHT) {
+        apply_tag(out, start, end, "rtf-right",
+                  "justification", GTK_JUSTIFY_RIGHT,
+                  "justification-set", true,
+                  NULL);
+    }
+    if (attr->justification == JUSTIFY_CENTER) {
+        apply_tag(out, start, end, "rtf-center",
+                  "justification", GTK_JUSTIFY_CENTER,
+                  "justification-set", true,
+                  NULL);
+    }
+    if (attr->justification == JUSTIFY_FILL) {
+        apply_tag(out, start, end, "rtf-justified",
+                  "justification", GTK_JUSTIFY_FILL,
+                  "justification-set", true,
+                  NULL);
+    }
+    if (attr->pardirection == DIRECTION_RTL)
+        apply_tag(out, start, end, "rtf-right-to-left", "direction", GTK_TEXT_DIR_RTL, NULL);
+    if (attr->pardirection == DIRECTION_LTR)
+        apply_tag(out, start, end, "rtf-left-to-right", "direction", GTK_TEXT_DIR_LTR, NULL);
+    /* Character-formatting direction overrides paragraph formatting */
+    if (attr->chardirection == DIRECTION_RTL)
+        apply_tag(out, start, end, "rtf-right-to-left", "direction", GTK_TEXT_DIR_RTL, NULL);
+    if (attr->chardirection == DIRECTION_LTR)
+        apply_tag(out, start, end, "rtf-left-to-right", "direction", GTK_TEXT_DIR_LTR, NULL);
+    if (attr->subscript) {
+        apply_tag(out, start, end, "rtf-subscript",
+                  "rise", POINTS_TO_PANGO(-6),
+                  "rise-set", true,
+                  "scale", PANGO_SCALE_X_SMALL,
+                  "scale-set", true,
+                  NULL);
+    }
+    if (attr->superscript) {
+        apply_tag(out, start, end, "rtf-superscript",
+                  "rise", POINTS_TO_PANGO(6),
+                  "rise-set", true,
+                  "scale", PANGO_SCALE_X_SMALL,
+                  "scale-set", true,
+                  NULL);
+    }
+    /* Special */
+    if (attr->font != -1)
+        apply_named_tag(out, start, end, "rtf-font-%i", attr->font);
+    if (attr->tabs != NULL)
+        apply_tabs(out, start, end, attr->tabs);
+}
+
+/* Replace any tag that was previously in the tag table under this name with a
+new one */
+static GtkTextTag *
+replace_tag(TextBufferOutput *out, const char *tagname)
+{
+    GtkTextTag *tag = gtk_text_tag_table_lookup(out->tags, tagname);
+    if (tag != NULL)
+        gtk_text_tag_table_remove(out->tags, tag);
+    return gtk_text_tag_new(tagname);
+}
+
+/* Add a font tag to the tag table right away instead of when the font is used,
+since style tags copy the font family from it */
+static void
+define_font(TextBufferOutput *out, int index, const char *family)
+{
+    g_autofree char *tagname = g_strdup_printf("rtf-font-%i", index);
+    g_autoptr(GtkTextTag) tag = replace_tag(out, tagname);
+    if (family) {
+        g_object_set(tag,
+                     "family", family,
+                     "family-set", true,
+                     NULL);
+    }
+    gtk_text_tag_table_add(out->tags, tag);
+}
+
+/* Add a style tag to the tag table with all the attributes of the style */
+static void
+define_style(TextBufferOutput *out, int index, const Attributes *attr)
+{
+    g_autofree char *tagname = g_strdup_printf("rtf-style-%i", index);
+    g_autoptr(GtkTextTag) tag = replace_tag(out, tagname);
+
+    /* Add each paragraph attribute to the tag */
+    if (attr->justification != -1) {
+        g_object_set(tag,
+                     "justification", gtk_justification[attr->justification],
+                     "justification-set", true,
+                     NULL);
+    }
+    if (attr->pardirection != -1)
+        g_object_set(tag, "direction", gtk_direction[attr->pardirection], NULL);
+    if (attr->space_before != 0 && !attr->ignore_space_before) {
+        g_object_set(tag,
+                     "pixels-above-lines", PANGO_PIXELS(TWIPS_TO_PANGO(attr->space_before)),
+                     "pixels-above-lines-set", true,
+                     NULL);
+    }
+    if (attr->space_after != 0 && !attr->ignore_space_after) {
+        g_object_set(tag,
+                     "pixels-below-lines", PANGO_PIXELS(TWIPS_TO_PANGO(attr->space_after)),
+                     "pixels-below-lines-set", true,
+                     NULL);
+    }
+    if (attr->tabs) {
+        PangoTabArray *tab_array = pango_tab_array_new(attr->tabs->len, false);
+        for (unsigned ix = 0; ix < attr->tabs->len; ix++)
+            pango_tab_array_set_tab(tab_array, ix, PANGO_TAB_LEFT, TWIPS_TO_PANGO(g_array_index(attr->tabs, int, ix)));
+        g_object_set(tag,
+                     "tabs", tab_array,
+                     "tabs-set", true,
+                     NULL);
+        pango_tab_array_free(tab_array);
+    }
+    if (attr->left_margin) {
+        g_object_set(tag,
+                     "left-margin", PANGO_PIXELS(TWIPS_TO_PANGO(attr->left_margin)),
+                     "left-margin-set", true,
+                     NULL);
+    }
+    if (attr->right_margin) {
+        g_object_set(tag,
+                     "right-margin", PANGO_PIXELS(TWIPS_TO_PANGO(attr->right_margin)),
+                     "right-margin-set", true,
+                     NULL);
+    }
+    if (attr->indent) {
+        g_object_set(tag,
+                     "indent", PANGO_PIXELS(TWIPS_TO_PANGO(attr->indent)),
+                     "indent-set", true,
+                     NULL);
+    }
+    if (attr->scale != 100) {
+        g_object_set(tag,
+                     "scale", (double)(attr->scale) / 100.0,
+                     "scale-set", true,
+                     NULL);
+    }
+
+    /* Add each character attribute to the tag */
+    if (attr->foreground != -1) {
+        g_object_set(tag,
+                     "foreground", get_color(out, attr->foreground),
+                     "foreground-set", true,
+                     NULL);
+    }
+    if (attr->background != -1) {
+        g_object_set(tag,
+                     "background", get_color(out, attr->background),
+                     "background-set", true,
+                     NULL);
+    }
+    if (attr->highlight != -1) {
+        g_object_set(tag,
+                     "paragraph-background", get_color(out, attr->highlight),
+                     "paragraph-background-set", true,
+                     NULL);
+    }
+    if (attr->font != -1) {
+        g_autofree char *fonttagname = g_strdup_printf("rtf-font-%d", attr->font);
+        GtkTextTag *fonttag = gtk_text_tag_table_lookup(out->tags, fonttagname);
+        PangoFontDescription *fontdesc = NULL;
+
+        if (fonttag)
+            g_object_get(fonttag, "font-desc", &fontdesc, NULL);
+        if (fontdesc && pango_font_description_get_family(fontdesc)) {
+            g_object_set(tag,
+                         "family", pango_font_description_get_family(fontdesc),
+                         "family-set", true,
+                         NULL);
+        }
+        if (fontdesc)
+            pango_font_description_free(fontdesc);
+    }
+    if (attr->size != 0.0) {
+        g_object_set(tag,
+                     "size", POINTS_TO_PANGO(attr->size),
+                     "size-set", true,
+                     NULL);
+    }
+    if (attr->italic) {
+        g_object_set(tag,
+                     "style", PANGO_STYLE_ITALIC,
+                     "style-set", true,
+                     NULL);
+    }
+    if (attr->bold) {
+        g_object_set(tag,
+                     "weight", PANGO_WEIGHT_BOLD,
+                     "weight-set", true,
+                     NULL);
+    }
+    if (attr->smallcaps) {
+        g_object_set(tag,
+                     "variant", PANGO_VARIANT_SMALL_CAPS,
+                     "variant-set", true,
+                     NULL);
+    }
+    if (attr->strikethrough) {
+        g_object_set(tag,
+                     "strikethrough", true,
+                     "strikethrough-set", true,
+                     NULL);
+    }
+    if (attr->subscript) {
+        g_object_set(tag,
+                     "rise", POINTS_TO_PANGO(-6),
+                     "rise-set", true,
+                     "scale", PANGO_SCALE_X_SMALL,
+                     "scale-set", true,
+                     NULL);
+    }
+    if (attr->superscript) {
+        g_object_set(tag,
+                     "rise", POINTS_TO_PANGO(6),
+                     "rise-set", true,
+                     "scale", PANGO_SCALE_X_SMALL,
+                     "scale-set", true,
+                     NULL);
+    }
+    if (attr->invisible) {
+        g_object_set(tag,
+                     "invisible", true,
+                     "invisible-set", true,
+                     NULL);
+    }
+    if (attr->underline != -1) {
+        g_object_set(tag,
+                     "underline", pango_underline[attr->underline],
+                     "underline-set", true,
+                     NULL);
+    }
+    if (attr->chardirection != -1)
+        g_object_set(tag, "direction", gtk_direction[attr->chardirection], NULL);
+    if (attr->rise != 0) {
+        g_object_set(tag,
+                     "rise", HALF_POINTS_TO_PANGO(attr->rise),
+                     "rise-set", true,
+                     NULL);
+    }
+
+    gtk_text_tag_table_add(out->tags, tag);
+}
+
+/* Insert the text from start to end of the document at the iter, replacing the
+placeholders for any objects with the objects themselves. Returns the index of
+the first object after end. */
+static unsigned
+insert_text_and_objects(TextBufferOutput *out, GtkTextIter *iter, size_t start, size_t end, unsigned object_ix)
+{
+    const ParsedDocument *doc = out->doc;
+
+    for (; object_ix < doc->objects->len; object_ix++) {
+        const DocumentObject *object = &g_array_index(doc->objects, DocumentObject, object_ix);
+        if (object->offset >= end)
+            break;
+        gtk_text_buffer_insert(out->textbuffer, iter, doc->text + start, object->offset - start);
+        pixbuf_insert_object(out, iter, object);
+        start = object->offset + OBJECT_REPLACEMENT_LENGTH;
+    }
+    gtk_text_buffer_insert(out->textbuffer, iter, doc->text + start, end - start);
+    return object_ix;
+}
+
+/* Create the tags for the fonts and styles defined in the document */
+static void
+define_document_tags(TextBufferOutput *out)
+{
+    const ParsedDocument *doc = out->doc;
+
+    for (unsigned ix = 0; ix < doc->fonts->len; ix++) {
+        const FontDefinition *font = &g_array_index(doc->fonts, FontDefinition, ix);
+        define_font(out, font->index, font->family);
+    }
+    for (unsigned ix = 0; ix < doc->styles->len; ix++) {
+        const StyleDefinition *style = &g_array_index(doc->styles, StyleDefinition, ix);
+        define_style(out, style->index, g_ptr_array_index(doc->attrs, style->attr));
+    }
+}
+
+/* Insert one run of the document text at the end mark and format it, or, if
+it is part of a footnote, add it to the end of the buffer. Returns the index of
+the first object after the run. */
+static unsigned
+insert_run(TextBufferOutput *out, const TextRun *run, unsigned object_ix)
+{
+    const ParsedDocument *doc = out->doc;
+    GtkTextIter start, end;
+
+    if (run->offset < doc->notes_offset) {
+        gtk_text_buffer_get_iter_at_mark(out->textbuffer, &end, out->endmark);
+        object_ix = insert_text_and_objects(out, &end, run->offset, run->offset + run->length, object_ix);
+        gtk_text_buffer_get_iter_at_mark(out->textbuffer, &start, out->startmark);
+        gtk_text_buffer_get_iter_at_mark(out->textbuffer, &end, out->endmark);
+    } else {
+        gtk_text_buffer_get_end_iter(out->textbuffer, &end);
+        int start_offset = gtk_text_iter_get_offset(&end);
+        gtk_text_buffer_insert(out->textbuffer, &end, doc->text + run->offset, run->length);
+        gtk_text_buffer_get_iter_at_offset(out->textbuffer, &start, start_offset);
+    }
+
+    if (run->attr != -1)
+        apply_attributes(out, g_ptr_array_index(doc->attrs, run->attr), &start, &end);
+
+    /* Move the two marks back together again */
+    gtk_text_buffer_get_iter_at_mark(out->textbuffer, &end, out->endmark);
+    gtk_text_buffer_move_mark(out->textbuffer, out->startmark, &end);
+    return object_ix;
+}
+
+/* Insert the document text at the end mark, one run at a time, formatting each
+run as it goes, and then add the footnotes to the end of the buffer */
+static void
+insert_document(TextBufferOutput *out)
+{
+    unsigned object_ix = 0;
+
+    define_document_tags(out);
+    for (unsigned ix = 0; ix < out->doc->runs->len; ix++)
+        object_ix = insert_run(out, &g_array_index(out->doc->runs, TextRun, ix), object_ix);
+}
+
+/* Set up out to insert a document at iter, with the buffer's import options */
+static void
+text_buffer_output_init(TextBufferOutput *out, GtkTextBuffer *buffer, GtkTextIter *iter)
+{
+    out->doc = NULL;
+    out->textbuffer = buffer;
+    out->tags = gtk_text_buffer_get_tag_table(buffer);
+    out->startmark = gtk_text_buffer_create_mark(buffer, NULL, iter, true);
+    out->endmark = gtk_text_buffer_create_mark(buffer, NULL, iter, false);
+    rtf_text_buffer_get_max_picture_size(buffer, &out->max_picture_width, &out->max_picture_height);
+    out->async_pictures = rtf_text_buffer_get_import_flags(buffer) & RTF_IMPORT_ASYNC_PICTURES;
+}
+
+static void
+text_buffer_output_clear(TextBufferOutput *out)
+{
+    gtk_text_buffer_delete_mark(out->textbuffer, out->startmark);
+    gtk_text_buffer_delete_mark(out->textbuffer, out->endmark);
+}
+
+/* Insert a parsed document into buffer at iter, with the buffer's import
+options. This is the only part of an import that must be done on the thread
+that owns the buffer. */
+void
+text_buffer_insert_document(GtkTextBuffer *buffer, GtkTextIter *iter, const ParsedDocument *doc)
+{
+    TextBufferOutput out;
+    text_buffer_output_init(&out, buffer, iter);
+    out.doc = doc;
+    insert_document(&out);
+    text_buffer_output_clear(&out);
+}
+
+/* This function is called by gtk_text_buffer_deserialize(). The RTF code is
+parsed completely before anything is inserted into the buffer, so nothing is
+inserted if the code can't be parsed. user_data is the GFile of the directory
+that filenames in the document are relative to, or NULL. */
+bool
+rtf_deserialize(GtkTextBuffer *register_buffer, GtkTextBuffer *content_buffer, GtkTextIter *iter, const char *data, size_t length, bool create_tags, void *user_data, GError **error)
+{
+    GFile *base_dir = user_data;
+    /* The document is done with before data is */
+    g_autoptr(GBytes) code = g_bytes_new_static(data, length);
+    g_autoptr(ParsedDocument) doc = parse_rtf_to_document(code, base_dir, NULL, error);
+    if (doc == NULL)
+        return false;
+
+    text_buffer_insert_document(content_buffer, iter, doc);
+    return true;
+}
+
+/* Importing a document a little at a time, for rtf_text_buffer_insert_async().
+The document is first parsed a piece at a time, and then inserted a few runs at
+a time, so that as with rtf_deserialize(), nothing is inserted if the code
+can't be parsed. */
+
+/* How much RTF code to parse, and how many runs to insert, between checks of
+the clock */
+#define INCREMENTAL_PARSE_BYTES 65536
+#define INCREMENTAL_INSERT_RUNS 64
+
+struct _IncrementalImport {
+    DocumentParser *parser; /* NULL once parsing is finished */
+    ParsedDocument *doc; /* NULL until parsing is finished */
+    TextBufferOutput out;
+    unsigned run_ix;
+    unsigned object_ix;
+};
+
+/* Start importing length bytes of RTF code into buffer at iter. The code is
+copied, including any NUL bytes in binary data, and the copy is followed by a
+NUL byte as the parser requires; the parser and the document keep it. */
+IncrementalImport *
+incremental_import_new(GtkTextBuffer *buffer, GtkTextIter *iter, const char *data, size_t length, GFile *base_dir, GError **error)
+{
+    char *copy = g_malloc(length + 1);
+    memcpy(copy, data, length);
+    copy[length] = '\0';
+    g_autoptr(GBytes) code = g_bytes_new_take(copy, length);
+
+    IncrementalImport *import = g_slice_new0(IncrementalImport);
+    import->parser = document_parser_new(code, base_dir, error);
+    if (import->parser == NULL) {
+        g_slice_free(IncrementalImport, import);
+        return NULL;
+    }
+    text_buffer_output_init(&import->out, buffer, iter);
+    return import;
+}
+
+void
+incremental_import_free(IncrementalImport *import)
+{
+    g_clear_pointer(&import->parser, document_parser_free);
+    g_clear_pointer(&import->doc, parsed_document_unref);
+    text_buffer_output_clear(&import->out);
+    g_slice_free(IncrementalImport, import);
+}
+
+/* Do as much of the import as possible until the monotonic time passes
+deadline. Sets done when the whole document has been inserted. Returns false if
+the code couldn't be parsed, in which case nothing has been inserted. */
+bool
+incremental_import_step(IncrementalImport *import, int64_t deadline, bool *done, GError **error)
+{
+    *done = false;
+
+    while (import->parser != NULL) {
+        bool parsed;
+        if (!document_parser_step(import->parser, INCREMENTAL_PARSE_BYTES, &parsed, error))
+            return false;
+        if (parsed) {
+            import->doc = document_parser_finish(g_steal_pointer(&import->parser));
+            import->out.doc = import->doc;
+            define_document_tags(&import->out);
+        }
+        if (g_get_monotonic_time() >= deadline)
+            return true;
+    }
+
+    const GArray *runs = import->doc->runs;
+    while (import->run_ix < runs->len) {
+        unsigned stop = MIN(import->run_ix + INCREMENTAL_INSERT_RUNS, runs->len);
+        for (; import->run_ix < stop; import->run_ix++)
+            import->object_ix = insert_run(&import->out, &g_array_index(runs, TextRun, import->run_ix), import->object_ix);
+        if (g_get_monotonic_time() >= deadline)
+            break;
+    }
+
+    *done = import->run_ix == runs->len;
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <gtk/gtk.h>
+
+#include "rtf-ir.h"
+
+#define POINTS_TO_PANGO(pts) ((int)(pts * PANGO_SCALE))
+#define HALF_POINTS_TO_PANGO(halfpts) (halfpts * PANGO_SCALE / 2)
+#define TWIPS_TO_PANGO(twips) (twips * PANGO_SCALE / 20)
+
+/* Where and how a parsed document is inserted into a GtkTextBuffer */
+typedef struct {
+    const ParsedDocument *doc;
+    GtkTextBuffer *textbuffer;
+    GtkTextTagTable *tags;
+    /* Text is inserted at endmark, and formatted from startmark to endmark */
+    GtkTextMark *startmark;
+    GtkTextMark *endmark;
+
+    /* Import options; pictures are shrunk to fit within this size if the
+    values are positive */
+    int max_picture_width;
+    int max_picture_height;
+    /* Whether to decode pictures on worker threads */
+    bool async_pictures;
+} TextBufferOutput;
+
+/* Insert a picture from the document at iter, in rtf-pixbuf.c */
+void pixbuf_insert_object(TextBufferOutput *out, GtkTextIter *iter, const DocumentObject *object);
+
+void text_buffer_insert_document(GtkTextBuffer *buffer, GtkTextIter *iter, const ParsedDocument *doc);
+bool rtf_deserialize(GtkTextBuffer *register_buffer, GtkTextBuffer *content_buffer, GtkTextIter *iter, const char *data, size_t length, bool create_tags, void *user_data, GError **error);
+
+/* Importing a document a little at a time, see rtf_text_buffer_insert_async() */
+typedef struct _IncrementalImport IncrementalImport;
+
+IncrementalImport *incremental_import_new(GtkTextBuffer *buffer, GtkTextIter *iter, const char *data, size_t length, GFile *base_dir, GError **error);
+bool incremental_import_step(IncrementalImport *import, int64_t deadline, bool *done, GError **error);
+void incremental_import_free(IncrementalImport *import);
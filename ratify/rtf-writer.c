@@ -0,0 +1,964 @@
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "init.h"
+#include "rtf-core.h"
+#include "rtf-writer.h"
+
+/* rtf-writer.c - Writing RTF without GTK. The text escaping, the header and
+tables, and the picture encoding are shared with the GtkTextBuffer exporter in
+rtf-serialize.c; the rest is the public RtfWriter, which writes documents
+described one paragraph, format, and piece of text at a time. */
+
+/* Return the number of characters output since the last newline. Only what
+was added to the output since the last call is searched; other code may add
+newlines of its own. */
+static size_t
+current_column(GString *output, OutputLine *line)
+{
+    if (output->len < line->scanned) {
+        /* The output was truncated; search all of it again */
+        line->start = line->scanned = 0;
+    }
+    for (size_t pos = output->len; pos > line->scanned; pos--) {
+        if (output->str[pos - 1] == '\n') {
+            line->start = pos;
+            break;
+        }
+    }
+    line->scanned = output->len;
+    return output->len - line->start;
+}
+
+/* Write a space to the output buffer if the number of characters output on the
+current line is less than 60; otherwise, a newline. If the next space occurs
+more than 20 characters further on, the line will still be wider than 80
+characters, but this is probably the easiest way to break lines without
+looking ahead or backtracking to insert spaces. */
+void
+write_space_or_newline(GString *output, OutputLine *line)
+{
+    g_string_append_c(output, (current_column(output, line) >= 60)? '\n' : ' ');
+}
+
+/* How to write a character that has its own RTF code */
+typedef struct {
+    const char *code;
+    bool delimit; /* Whether the code is a control word that needs a space or
+                  newline after it */
+} CharacterEscape;
+
+/* Characters up to U+00FF. Other ASCII characters are written as themselves,
+and other Latin-1 characters as \'XX. */
+static const CharacterEscape latin1_escapes[0x100] = {
+    ['\t'] = { "\\tab", true },
+    ['\n'] = { "\\par", true },
+    ['\\'] = { "\\\\", false },
+    ['{'] = { "\\{", false },
+    ['}'] = { "\\}", false },
+    [0xA0] = { "\\~", false },
+    [0xAD] = { "\\-", false }
+};
+
+/* Characters from U+2000 to U+202F. Others are written as \uN. */
+#define PUNCTUATION_BASE 0x2000
+static const CharacterEscape punctuation_escapes[0x30] = {
+    [0x02] = { "\\enspace", true },
+    [0x03] = { "\\emspace", true },
+    [0x05] = { "\\qmspace", true },
+    [0x0B] = { "\\zwbo", true },
+    [0x0C] = { "\\zwnj", true },
+    [0x0D] = { "\\zwj", true },
+    [0x0E] = { "\\ltrmark", true },
+    [0x0F] = { "\\rtlmark", true },
+    [0x11] = { "\\_", false },
+    [0x13] = { "\\endash", true },
+    [0x14] = { "\\emdash", true },
+    [0x18] = { "\\lquote", true },
+    [0x19] = { "\\rquote", true },
+    [0x1C] = { "\\ldblquote", true },
+    [0x1D] = { "\\rdblquote", true },
+    [0x22] = { "\\bullet", true },
+    [0x28] = { "\\line", true }
+};
+
+/* Return the position of the next byte at or after pos that can't be copied to
+the output as it is, or end if there is none: a control character, a brace or
+backslash, or part of a non-ASCII character. With SSE2 this looks at 16 bytes
+at a time. */
+static const char *
+find_unsafe_character(const char *pos, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i first_safe = _mm_set1_epi8(' ');
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i backslash = _mm_set1_epi8('\\');
+
+    while (end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)pos);
+        /* The comparison is signed, so bytes of 0x80 and up count as less */
+        __m128i matches = _mm_or_si128(
+            _mm_or_si128(_mm_cmplt_epi8(chunk, first_safe), _mm_cmpeq_epi8(chunk, backslash)),
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, open), _mm_cmpeq_epi8(chunk, close)));
+        int mask = _mm_movemask_epi8(matches);
+        if (mask != 0)
+            return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+#endif
+    for (; pos < end; pos++) {
+        unsigned char byte = *pos;
+        if (byte < ' ' || byte >= 0x80 || byte == '\\' || byte == '{' || byte == '}')
+            break;
+    }
+    return pos;
+}
+
+/* Write a Latin-1 character as \'XX */
+static void
+write_hex_escape(GString *output, gunichar ch)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    const char code[4] = { '\\', '\'', digits[ch >> 4], digits[ch & 0xF] };
+    g_string_append_len(output, code, sizeof(code));
+}
+
+/* Write any other character as \uN */
+static void
+write_unicode_escape(GString *output, gunichar ch)
+{
+    char code[12];
+    char *pos = code + sizeof(code);
+    do {
+        *--pos = '0' + ch % 10;
+        ch /= 10;
+    } while (ch != 0);
+    *--pos = 'u';
+    *--pos = '\\';
+    g_string_append_len(output, pos, code + sizeof(code) - pos);
+}
+
+/* Copy text from pos to end, which needs no escaping, to the output. The lines
+are broken before the last space that keeps them to 60 characters, or if there
+is none, before the first space after that. */
+static void
+write_plain_text(GString *output, OutputLine *line, const char *pos, const char *end)
+{
+    size_t column = current_column(output, line);
+    while (column + (end - pos) > 60) {
+        const char *limit = pos + (column < 60 ? 60 - column : 0);
+        const char *space = NULL;
+        for (const char *scan = MIN(limit, end - 1); scan >= pos && space == NULL; scan--) {
+            /* Don't leave an empty line */
+            if (*scan == ' ' && (scan > pos || column > 0))
+                space = scan;
+        }
+        if (space == NULL && limit + 1 < end)
+            space = memchr(limit + 1, ' ', end - limit - 1);
+        if (space == NULL)
+            break;
+
+        g_string_append_len(output, pos, space - pos);
+        g_string_append_c(output, '\n');
+        column = 0;
+        pos = space;
+    }
+    g_string_append_len(output, pos, end - pos);
+
+    /* There are no newlines in the text itself */
+    line->start = output->len - column - (end - pos);
+    line->scanned = output->len;
+}
+
+/* Translate length bytes of text, without formatting codes, to RTF, replacing
+special characters by their RTF control word equivalents. Latin-1 characters
+are written as \'XX if hex_escapes is set, and otherwise as \uN like all other
+non-ASCII characters. */
+static void
+write_escaped_text(GString *output, OutputLine *line, const char *text, size_t length, bool hex_escapes)
+{
+    const char *end = text + length;
+
+    for (const char *ptr = text; ptr < end; ) {
+        const char *safe_end = find_unsafe_character(ptr, end);
+        if (safe_end != ptr) {
+            write_plain_text(output, line, ptr, safe_end);
+            ptr = safe_end;
+            continue;
+        }
+
+        gunichar ch = g_utf8_get_char(ptr);
+        ptr = g_utf8_next_char(ptr);
+
+        const CharacterEscape *escape = NULL;
+        if (ch < G_N_ELEMENTS(latin1_escapes))
+            escape = &latin1_escapes[ch];
+        else if (ch >= PUNCTUATION_BASE && ch < PUNCTUATION_BASE + G_N_ELEMENTS(punctuation_escapes))
+            escape = &punctuation_escapes[ch - PUNCTUATION_BASE];
+
+        if (escape != NULL && escape->code != NULL) {
+            g_string_append(output, escape->code);
+            if (!escape->delimit)
+                continue;
+        } else if (ch < 0x80) {
+            g_string_append_c(output, (char)ch);
+            continue;
+        } else if (hex_escapes && ch >= 0xA1 && ch <= 0xFF) {
+            write_hex_escape(output, ch);
+            continue;
+        } else {
+            write_unicode_escape(output, ch);
+        }
+        write_space_or_newline(output, line);
+    }
+}
+
+/* Write text for a document written by Ratify, whose header says that it uses
+the ANSI code page, so that Latin-1 characters can be written as \'XX. The
+document must also say \uc0, since \uN is written without a fallback. */
+void
+write_rtf_text(GString *output, OutputLine *line, const char *text, size_t length)
+{
+    write_escaped_text(output, line, text, length, true);
+}
+
+/* Write text for a document with any code page, writing all non-ASCII
+characters as \uN. The text must go where \uc0 is in effect. */
+void
+write_rtf_unicode_text(GString *output, OutputLine *line, const char *text, size_t length)
+{
+    write_escaped_text(output, line, text, length, false);
+}
+
+/* Write the font and color tables */
+void
+write_rtf_tables(GString *header, const GPtrArray *fonts, const GArray *colors)
+{
+    /* Font table */
+    g_string_append(header, "{\\fonttbl\n");
+    for (unsigned ix = 0; ix < fonts->len; ix++) {
+        char **fontnames = g_strsplit(g_ptr_array_index(fonts, ix), ",", 2);
+        g_string_append_printf(header, "{\\f%u\\fnil %s;}\n", ix, fontnames[0]);
+        g_strfreev(fontnames);
+    }
+    if (fonts->len == 0) /* Write at least one font if there are none */
+        g_string_append(header, "{\\f0\\fswiss Sans;}\n");
+    g_string_append(header, "}\n");
+
+    /* Color table; color 0 has an empty entry */
+    g_string_append(header, "{\\colortbl\n;\n");
+    for (unsigned ix = 0; ix < colors->len; ix++) {
+        int rgb = g_array_index(colors, int, ix);
+        g_string_append_printf(header, "\\red%d\\green%d\\blue%d;\n", rgb >> 16, (rgb >> 8) & 0xff, rgb & 0xff);
+    }
+    g_string_append(header, "}\n");
+}
+
+/* Write the RTF header and assorted front matter, around the tables. language
+is the Windows language code of the document's default language. */
+char *
+write_rtf_header(const char *tables, int language)
+{
+    GString *header = g_string_new("{\\rtf1\\ansi\\deff0\\uc0\n");
+    g_string_append(header, tables);
+
+    /* Metadata (provide dummy values because Word will overwrite if missing) */
+    g_string_append_printf(header, "{\\*\\generator %s %s}\n", PACKAGE_NAME, PACKAGE_VERSION);
+    g_string_append(header, "{\\info {\\author .}{\\company .}{\\title .}\n");
+    char buffer[29];
+    time_t timer = time(NULL);
+    if (strftime(buffer, 29, "\\yr%Y\\mo%m\\dy%d\\hr%H\\min%M", localtime(&timer)))
+        g_string_append_printf(header, "{\\creatim%s}}\n", buffer);
+
+
+    /* Preliminary formatting */
+    g_string_append_printf(header, "\\deflang%d", language);
+    g_string_append(header, "\\plain\\widowctrl\\hyphauto\n");
+
+    return g_string_free(header, false);
+}
+
+/* Write a \pict destination with the given control words, which describe the
+picture, and data */
+void
+write_picture_data(GString *output, const char *controls, const uint8_t *data, size_t length, bool binary)
+{
+    g_string_append(output, "{\\pict");
+    g_string_append(output, controls);
+    if (binary) {
+        /* Raw bytes, half the size of the hex encoding */
+        g_string_append_printf(output, "\\bin%" G_GSIZE_FORMAT " ", length);
+        g_string_append_len(output, (const char *)data, length);
+    } else {
+        /* 40 bytes to a line */
+        static const char digits[] = "0123456789ABCDEF";
+        char line[81];
+        line[0] = '\n';
+        for (size_t start = 0; start < length; start += 40) {
+            size_t count = MIN(40, length - start);
+            for (size_t ix = 0; ix < count; ix++) {
+                line[1 + 2 * ix] = digits[data[start + ix] >> 4];
+                line[2 + 2 * ix] = digits[data[start + ix] & 0xF];
+            }
+            g_string_append_len(output, line, 1 + 2 * count);
+        }
+    }
+    g_string_append(output, "\n}");
+}
+
+/* The public RtfWriter. The font and color tables have to come before the
+text. Usually they aren't complete until the end, so the text is kept until
+rtf_writer_finish() and the header is written then. A writer made with
+rtf_writer_new_for_stream() instead writes the header, with the fonts and colors
+declared up to then, when the first paragraph begins, and after that writes the
+text to its stream a chunk at a time. */
+
+/* How much output a streaming writer collects before writing it */
+#define STREAM_CHUNK_SIZE 65536
+
+struct _RtfWriter {
+    GString *output; /* Everything after the header, or not yet streamed */
+    OutputLine line;
+    /* Streaming only */
+    GOutputStream *stream;
+    GCancellable *cancellable;
+    GError *error; /* The first error writing to the stream */
+    bool header_written; /* No more fonts or colors can be added */
+    /* Font table, as family names, and their numbers plus one */
+    GPtrArray *fonts;
+    GHashTable *font_numbers;
+    /* Color table, as packed RGB values, and their numbers */
+    GArray *colors;
+    GHashTable *color_numbers;
+    bool in_paragraph;
+    unsigned depth; /* Number of formats pushed in the current paragraph */
+};
+
+/* Return the number of a font in the font table, adding it if it is not there
+yet, or -1 if it can't be added any more */
+static int
+get_font_number(RtfWriter *writer, const char *family)
+{
+    unsigned fontnum = GPOINTER_TO_UINT(g_hash_table_lookup(writer->font_numbers, family));
+    if (fontnum == 0) {
+        if (writer->header_written) {
+            g_warning("Font '%s' was not declared before the first paragraph", family);
+            return -1;
+        }
+        char *name = g_strdup(family);
+        g_ptr_array_add(writer->fonts, name);
+        fontnum = writer->fonts->len;
+        g_hash_table_insert(writer->font_numbers, name, GUINT_TO_POINTER(fontnum));
+    }
+    return fontnum - 1;
+}
+
+/* Return the number of a "#rrggbb" color in the color table, adding it if it
+is not there yet, or -1 if it is not a valid color or can't be added any more */
+static int
+get_color_number(RtfWriter *writer, const char *color)
+{
+    if (color[0] != '#' || strlen(color) != 7) {
+        g_warning("Invalid color '%s', expected #rrggbb", color);
+        return -1;
+    }
+    int rgb = 0;
+    for (int ix = 1; ix < 7; ix++) {
+        int digit = g_ascii_xdigit_value(color[ix]);
+        if (digit == -1) {
+            g_warning("Invalid color '%s', expected #rrggbb", color);
+            return -1;
+        }
+        rgb = rgb << 4 | digit;
+    }
+    if (rgb == 0)
+        return 0; /* Color 0 always black in this implementation */
+
+    unsigned colornum = GPOINTER_TO_UINT(g_hash_table_lookup(writer->color_numbers, GINT_TO_POINTER(rgb)));
+    if (colornum == 0) {
+        if (writer->header_written) {
+            g_warning("Color '%s' was not declared before the first paragraph", color);
+            return -1;
+        }
+        g_array_append_val(writer->colors, rgb);
+        colornum = writer->colors->len;
+        g_hash_table_insert(writer->color_numbers, GINT_TO_POINTER(rgb), GUINT_TO_POINTER(colornum));
+    }
+    return colornum;
+}
+
+/* Write a color control word, unless the color can't be used */
+static void
+write_color(RtfWriter *writer, const char *format, const char *color)
+{
+    int colornum = get_color_number(writer, color);
+    if (colornum != -1)
+        g_string_append_printf(writer->output, format, colornum, colornum);
+}
+
+/* Return the header, with the font and color tables as they are now */
+static char *
+write_header(RtfWriter *writer)
+{
+    GString *tables = g_string_new("");
+    write_rtf_tables(tables, writer->fonts, writer->colors);
+    char *header = write_rtf_header(tables->str, 1024);
+    g_string_free(tables, true);
+    writer->header_written = true;
+    return header;
+}
+
+/* Write the output to the writer's stream, if it has one. Unless finishing,
+only whole lines are written, and only once there is a chunk's worth, so that
+the line breaking still works and the stream isn't written to too often. After
+an error, nothing more is written. */
+static void
+flush_output(RtfWriter *writer, bool finishing)
+{
+    if (writer->stream == NULL || !writer->header_written)
+        return;
+    if (!finishing && writer->output->len < STREAM_CHUNK_SIZE)
+        return;
+
+    size_t length = writer->output->len;
+    if (!finishing) {
+        current_column(writer->output, &writer->line);
+        length = writer->line.start;
+    }
+    if (writer->error == NULL)
+        g_output_stream_write_all(writer->stream, writer->output->str, length, NULL, writer->cancellable, &writer->error);
+    g_string_erase(writer->output, 0, length);
+    writer->line.start = 0;
+    writer->line.scanned = writer->output->len;
+}
+
+/* Close the groups of the current paragraph, if there is one */
+static void
+end_paragraph(RtfWriter *writer)
+{
+    if (!writer->in_paragraph)
+        return;
+    for (; writer->depth > 0; writer->depth--)
+        g_string_append_c(writer->output, '}');
+    g_string_append(writer->output, "}\n");
+    writer->in_paragraph = false;
+}
+
+static void
+ensure_paragraph(RtfWriter *writer)
+{
+    if (!writer->in_paragraph)
+        rtf_writer_begin_paragraph(writer, NULL);
+}
+
+/**
+ * RtfWriter:
+ *
+ * An opaque structure that writes an RTF document without a #GtkTextBuffer.
+ * Create it with rtf_writer_new().
+ */
+
+/**
+ * RtfAlignment:
+ * @RTF_ALIGNMENT_LEFT: Lines are aligned to the left margin.
+ * @RTF_ALIGNMENT_RIGHT: Lines are aligned to the right margin.
+ * @RTF_ALIGNMENT_CENTER: Lines are centered.
+ * @RTF_ALIGNMENT_JUSTIFIED: Lines are aligned to both margins.
+ *
+ * Alignments of a paragraph in #RtfParagraphAttributes.
+ */
+
+/**
+ * RtfParagraphAttributes:
+ * @alignment: how the lines are aligned
+ * @left_margin: left margin in twips
+ * @right_margin: right margin in twips
+ * @first_indent: indentation of the first line with respect to the left
+ * margin, in twips; negative for a hanging indent
+ * @space_before: space above the paragraph in twips
+ * @space_after: space below the paragraph in twips
+ *
+ * Formatting of a paragraph, passed to rtf_writer_begin_paragraph(). A
+ * zero-filled structure describes a plain paragraph.
+ */
+
+/**
+ * rtf_writer_new:
+ *
+ * Creates a writer for a new RTF document. Describe the document by calling
+ * rtf_writer_begin_paragraph(), rtf_writer_push_format(),
+ * rtf_writer_pop_format(), rtf_writer_text(), and rtf_writer_picture() in
+ * order, and get the RTF code with rtf_writer_finish() or
+ * rtf_writer_finish_to_stream(). The code is the same as that written by
+ * Ratify's #GtkTextBuffer exporter, but nothing in GTK is needed.
+ *
+ * The whole document is kept in memory until it is finished, since the font
+ * and color tables come first in the RTF code. To write a long document as it
+ * goes, use rtf_writer_new_for_stream() instead.
+ *
+ * Returns: (transfer full): a new #RtfWriter.
+ */
+RtfWriter *
+rtf_writer_new(void)
+{
+    rtf_init();
+
+    RtfWriter *writer = g_slice_new0(RtfWriter);
+    writer->output = g_string_new("");
+    writer->fonts = g_ptr_array_new_with_free_func(g_free);
+    writer->font_numbers = g_hash_table_new(g_str_hash, g_str_equal);
+    writer->colors = g_array_new(false, false, sizeof(int));
+    writer->color_numbers = g_hash_table_new(NULL, NULL);
+    return writer;
+}
+
+/**
+ * rtf_writer_new_for_stream:
+ * @stream: the stream to write the RTF code to
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL
+ *
+ * Creates a writer like rtf_writer_new() does, that writes the RTF code to
+ * @stream as the document is described, instead of keeping all of it until the
+ * end. The code is written in chunks, so there is no need to wrap @stream in a
+ * #GBufferedOutputStream.
+ *
+ * The font and color tables are written when the first paragraph begins, so
+ * all the fonts and colors used in the document must be declared before that
+ * with rtf_writer_declare_font() and rtf_writer_declare_color(). Formats that
+ * use any others are written without those fonts or colors, with a warning.
+ *
+ * Finish the document with rtf_writer_finish_to_stream(), passing @stream
+ * again. If writing to @stream fails, nothing more is written, and that
+ * function returns the error.
+ *
+ * Returns: (transfer full): a new #RtfWriter.
+ */
+RtfWriter *
+rtf_writer_new_for_stream(GOutputStream *stream, GCancellable *cancellable)
+{
+    g_return_val_if_fail(G_IS_OUTPUT_STREAM(stream), NULL);
+
+    RtfWriter *writer = rtf_writer_new();
+    writer->stream = g_object_ref(stream);
+    if (cancellable != NULL)
+        writer->cancellable = g_object_ref(cancellable);
+    return writer;
+}
+
+/**
+ * rtf_writer_declare_font:
+ * @writer: an #RtfWriter
+ * @family: name of a font family
+ *
+ * Adds @family to the document's font table. Fonts are added to the table
+ * when they are first used, so this is only needed for a writer made with
+ * rtf_writer_new_for_stream(). It must be called before the first paragraph
+ * begins.
+ */
+void
+rtf_writer_declare_font(RtfWriter *writer, const char *family)
+{
+    g_return_if_fail(writer != NULL);
+    g_return_if_fail(family != NULL);
+    g_return_if_fail(!writer->header_written);
+
+    get_font_number(writer, family);
+}
+
+/**
+ * rtf_writer_declare_color:
+ * @writer: an #RtfWriter
+ * @color: a color in the form "#rrggbb"
+ *
+ * Adds @color to the document's color table, like rtf_writer_declare_font()
+ * does for fonts.
+ */
+void
+rtf_writer_declare_color(RtfWriter *writer, const char *color)
+{
+    g_return_if_fail(writer != NULL);
+    g_return_if_fail(color != NULL);
+    g_return_if_fail(!writer->header_written);
+
+    get_color_number(writer, color);
+}
+
+/**
+ * rtf_writer_free:
+ * @writer: an #RtfWriter
+ *
+ * Frees @writer, discarding the document it was writing. This is not needed
+ * after rtf_writer_finish() or rtf_writer_finish_to_stream().
+ */
+void
+rtf_writer_free(RtfWriter *writer)
+{
+    g_return_if_fail(writer != NULL);
+
+    g_string_free(writer->output, true);
+    g_clear_object(&writer->stream);
+    g_clear_object(&writer->cancellable);
+    g_clear_error(&writer->error);
+    g_hash_table_unref(writer->font_numbers);
+    g_ptr_array_unref(writer->fonts);
+    g_hash_table_unref(writer->color_numbers);
+    g_array_unref(writer->colors);
+    g_slice_free(RtfWriter, writer);
+}
+
+/**
+ * rtf_writer_begin_paragraph:
+ * @writer: an #RtfWriter
+ * @attributes: (allow-none): formatting of the paragraph, or %NULL for a plain
+ * paragraph
+ *
+ * Ends the current paragraph, if there is one, along with any formats pushed
+ * in it, and starts a new one. Text written before the first call to this
+ * function goes in a plain paragraph.
+ */
+void
+rtf_writer_begin_paragraph(RtfWriter *writer, const RtfParagraphAttributes *attributes)
+{
+    g_return_if_fail(writer != NULL);
+
+    if (writer->in_paragraph) {
+        for (; writer->depth > 0; writer->depth--)
+            g_string_append_c(writer->output, '}');
+        g_string_append(writer->output, "\\par");
+        end_paragraph(writer);
+        flush_output(writer, false);
+    } else if (writer->stream != NULL && !writer->header_written) {
+        g_autofree char *header = write_header(writer);
+        g_string_append(writer->output, header);
+    }
+
+    GString *output = writer->output;
+    g_string_append(output, "{\\pard\\plain");
+    if (attributes != NULL) {
+        switch (attributes->alignment) {
+        case RTF_ALIGNMENT_LEFT:
+            break;
+        case RTF_ALIGNMENT_RIGHT:
+            g_string_append(output, "\\qr");
+            break;
+        case RTF_ALIGNMENT_CENTER:
+            g_string_append(output, "\\qc");
+            break;
+        case RTF_ALIGNMENT_JUSTIFIED:
+            g_string_append(output, "\\qj");
+            break;
+        }
+        if (attributes->left_margin != 0)
+            g_string_append_printf(output, "\\li%d", attributes->left_margin);
+        if (attributes->right_margin != 0)
+            g_string_append_printf(output, "\\ri%d", attributes->right_margin);
+        if (attributes->first_indent != 0)
+            g_string_append_printf(output, "\\fi%d", attributes->first_indent);
+        if (attributes->space_before != 0)
+            g_string_append_printf(output, "\\sb%d", attributes->space_before);
+        if (attributes->space_after != 0)
+            g_string_append_printf(output, "\\sa%d", attributes->space_after);
+    }
+    write_space_or_newline(output, &writer->line);
+    writer->in_paragraph = true;
+}
+
+/**
+ * rtf_writer_push_format:
+ * @writer: an #RtfWriter
+ * @attributes: formatting of the text
+ *
+ * Gives the text written after this call the character formatting in
+ * @attributes, until the matching call to rtf_writer_pop_format() or the end of
+ * the paragraph. The formatting replaces that of any format pushed before.
+ *
+ * The fields of @attributes have the same meaning as for the
+ * <structfield>on_run_attributes</structfield> callback of rtf_parse(), so
+ * formatting read by rtf_parse() can be written again as it is. A size or
+ * scale of 0 and a language of 0 mean the default. The
+ * <structfield>style</structfield> field is ignored.
+ */
+void
+rtf_writer_push_format(RtfWriter *writer, const RtfRunAttributes *attributes)
+{
+    g_return_if_fail(writer != NULL);
+    g_return_if_fail(attributes != NULL);
+
+    ensure_paragraph(writer);
+    GString *output = writer->output;
+    g_string_append(output, "{\\plain");
+    writer->depth++;
+
+    if (attributes->background)
+        write_color(writer, "\\chshdng0\\chcbpat%d\\cb%d", attributes->background);
+    if (attributes->font_family) {
+        int fontnum = get_font_number(writer, attributes->font_family);
+        if (fontnum != -1)
+            g_string_append_printf(output, "\\f%d", fontnum);
+    }
+    if (attributes->foreground)
+        write_color(writer, "\\cf%d", attributes->foreground);
+    if (attributes->highlight)
+        write_color(writer, "\\highlight%d", attributes->highlight);
+    if (attributes->hidden)
+        g_string_append(output, "\\v");
+    if (attributes->language != 0 && attributes->language != 1024)
+        g_string_append_printf(output, "\\lang%d", attributes->language);
+    if (attributes->rise > 0)
+        g_string_append_printf(output, "\\up%d", attributes->rise);
+    else if (attributes->rise < 0)
+        g_string_append_printf(output, "\\dn%d", -attributes->rise);
+    if (attributes->scale != 0 && attributes->scale != 100)
+        g_string_append_printf(output, "\\charscalex%d", attributes->scale);
+    if (attributes->size > 0) {
+        g_string_append_printf(output, "\\fs%d", (int)(attributes->size * 2));
+        /* Override with an \fsmilli command if the font size is not a multiple
+        of 1/2 point */
+        int milli = (int)(attributes->size * 1000);
+        if (milli % 500 != 0)
+            g_string_append_printf(output, "\\fsmilli%d", milli);
+    }
+    if (attributes->strikethrough)
+        g_string_append(output, "\\strike");
+    if (attributes->italic)
+        g_string_append(output, "\\i");
+    switch (attributes->underline) {
+    case RTF_UNDERLINE_NONE:
+        break;
+    case RTF_UNDERLINE_SINGLE:
+        g_string_append(output, "\\ul");
+        break;
+    case RTF_UNDERLINE_DOUBLE:
+        g_string_append(output, "\\uldb");
+        break;
+    case RTF_UNDERLINE_WAVE:
+        g_string_append(output, "\\ulwave");
+        break;
+    }
+    if (attributes->smallcaps)
+        g_string_append(output, "\\scaps");
+    if (attributes->bold)
+        g_string_append(output, "\\b");
+    if (attributes->superscript)
+        g_string_append(output, "\\super");
+    else if (attributes->subscript)
+        g_string_append(output, "\\sub");
+
+    write_space_or_newline(output, &writer->line);
+}
+
+/**
+ * rtf_writer_pop_format:
+ * @writer: an #RtfWriter
+ *
+ * Goes back to the formatting in effect before the last call to
+ * rtf_writer_push_format() in the current paragraph.
+ */
+void
+rtf_writer_pop_format(RtfWriter *writer)
+{
+    g_return_if_fail(writer != NULL);
+    g_return_if_fail(writer->depth > 0);
+
+    g_string_append_c(writer->output, '}');
+    writer->depth--;
+}
+
+/**
+ * rtf_writer_text:
+ * @writer: an #RtfWriter
+ * @text: UTF-8 text
+ * @length: length of @text in bytes, or -1 if @text is nul-terminated
+ *
+ * Writes @text in the current formatting, escaping characters as needed. A
+ * newline in @text ends a paragraph and starts another one with the same
+ * formatting.
+ */
+void
+rtf_writer_text(RtfWriter *writer, const char *text, gssize length)
+{
+    g_return_if_fail(writer != NULL);
+    g_return_if_fail(text != NULL);
+
+    if (length < 0)
+        length = strlen(text);
+    ensure_paragraph(writer);
+    write_rtf_text(writer->output, &writer->line, text, length);
+    flush_output(writer, false);
+}
+
+static const char *
+picture_type_control_word(RtfPictureType type)
+{
+    switch (type) {
+    case RTF_PICTURE_EMF:
+        return "\\emfblip";
+    case RTF_PICTURE_PNG:
+        return "\\pngblip";
+    case RTF_PICTURE_JPEG:
+        return "\\jpegblip";
+    case RTF_PICTURE_MACPICT:
+        return "\\macpict";
+    case RTF_PICTURE_OS2:
+        return "\\pmmetafile0";
+    case RTF_PICTURE_WMF:
+        return "\\wmetafile8";
+    case RTF_PICTURE_DIB:
+        return "\\dibitmap0";
+    case RTF_PICTURE_BMP:
+        return "\\wbitmap0";
+    }
+    g_return_val_if_reached("\\pngblip");
+}
+
+/**
+ * rtf_writer_picture:
+ * @writer: an #RtfWriter
+ * @info: description of the picture
+ * @data: (array length=length): the picture data, in the format given by
+ * @info
+ * @length: length of @data in bytes
+ * @binary: whether to write @data as raw bytes instead of hexadecimal digits
+ *
+ * Embeds a picture in the text. The data is not decoded, so it must already
+ * be in the format given by the <structfield>type</structfield> field of
+ * @info, such as PNG. Sizes and scales in @info of -1, or a scale of 0, are
+ * left out.
+ *
+ * Writing the data as raw bytes roughly halves its size, like
+ * %RTF_EXPORT_BINARY_PICTURES does for the #GtkTextBuffer exporter, but the
+ * document is no longer plain text.
+ */
+void
+rtf_writer_picture(RtfWriter *writer, const RtfPictureInfo *info, const guint8 *data, gsize length, gboolean binary)
+{
+    g_return_if_fail(writer != NULL);
+    g_return_if_fail(info != NULL);
+    g_return_if_fail(data != NULL || length == 0);
+
+    GString *controls = g_string_new(picture_type_control_word(info->type));
+    if (info->width >= 0)
+        g_string_append_printf(controls, "\\picw%ld", info->width);
+    if (info->height >= 0)
+        g_string_append_printf(controls, "\\pich%ld", info->height);
+    if (info->width_goal >= 0)
+        g_string_append_printf(controls, "\\picwgoal%ld", info->width_goal);
+    if (info->height_goal >= 0)
+        g_string_append_printf(controls, "\\pichgoal%ld", info->height_goal);
+    if (info->xscale > 0 && info->xscale != 100)
+        g_string_append_printf(controls, "\\picscalex%d", info->xscale);
+    if (info->yscale > 0 && info->yscale != 100)
+        g_string_append_printf(controls, "\\picscaley%d", info->yscale);
+
+    ensure_paragraph(writer);
+    write_picture_data(writer->output, controls->str, data, length, binary);
+    g_string_free(controls, true);
+    flush_output(writer, false);
+}
+
+/* Close the document. Returns the header, unless it has already been written,
+while the rest is left in writer->output. */
+static char *
+finish_document(RtfWriter *writer)
+{
+    end_paragraph(writer);
+    g_string_append_c(writer->output, '}');
+    if (writer->header_written)
+        return NULL;
+    return write_header(writer);
+}
+
+/**
+ * rtf_writer_finish:
+ * @writer: (transfer full): an #RtfWriter
+ *
+ * Ends the document and frees @writer. @writer must not have been made with
+ * rtf_writer_new_for_stream().
+ *
+ * Returns: (transfer full): a #GBytes containing RTF code.
+ */
+GBytes *
+rtf_writer_finish(RtfWriter *writer)
+{
+    g_return_val_if_fail(writer != NULL, NULL);
+    g_return_val_if_fail(writer->stream == NULL, NULL);
+
+    g_autofree char *header = finish_document(writer);
+    size_t header_length = strlen(header);
+    size_t length = header_length + writer->output->len;
+    char *code = g_malloc(length);
+    memcpy(code, header, header_length);
+    memcpy(code + header_length, writer->output->str, writer->output->len);
+    rtf_writer_free(writer);
+    return g_bytes_new_take(code, length);
+}
+
+/**
+ * rtf_writer_finish_to_stream:
+ * @writer: (transfer full): an #RtfWriter
+ * @stream: the stream to write the RTF code to
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL
+ * @error: return location for an error, or %NULL
+ *
+ * Ends the document, writes it to @stream, and frees @writer. @stream is not
+ * closed. If @writer was made with rtf_writer_new_for_stream(), then @stream
+ * must be the stream it was made with, and only the rest of the document is
+ * written.
+ *
+ * Returns: %TRUE if the document was written successfully, %FALSE if not, in
+ * which case @error is set.
+ */
+gboolean
+rtf_writer_finish_to_stream(RtfWriter *writer, GOutputStream *stream, GCancellable *cancellable, GError **error)
+{
+    g_return_val_if_fail(writer != NULL, false);
+    g_return_val_if_fail(G_IS_OUTPUT_STREAM(stream), false);
+    g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+    g_return_val_if_fail(writer->stream == NULL || writer->stream == stream, false);
+
+    g_autofree char *header = finish_document(writer);
+    if (writer->stream != NULL) {
+        if (header != NULL) /* There were no paragraphs */
+            g_string_prepend(writer->output, header);
+        g_set_object(&writer->cancellable, cancellable);
+        flush_output(writer, true);
+        bool retval = writer->error == NULL;
+        if (!retval)
+            g_propagate_error(error, g_steal_pointer(&writer->error));
+        rtf_writer_free(writer);
+        return retval;
+    }
+
+    bool retval = g_output_stream_write_all(stream, header, strlen(header), NULL, cancellable, error) &&
+        g_output_stream_write_all(stream, writer->output->str, writer->output->len, NULL, cancellable, error);
+    rtf_writer_free(writer);
+    return retval;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+/* Copyright 2019 P. F. Chimento
+This file is part of Ratify.
+
+Ratify is free software: you can redistribute it and/or modify it under the
+terms of the GNU Lesser General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+Ratify is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+/* rtf-writer.h - The parts of the RTF writer that don't need GTK, shared by
+RtfWriter and the GtkTextBuffer exporter. Font tables are arrays of family
+names, and color tables arrays of colors packed as 0xRRGGBB ints, starting from
+color 1; color 0 is always black. */
+
+/* Where the current line of some output starts, so that lines can be broken
+without scanning back over the output each time. Start it out zeroed, along
+with the output. */
+typedef struct {
+    size_t start;
+    size_t scanned; /* How much of the output has been searched for newlines */
+} OutputLine;
+
+void write_space_or_newline(GString *output, OutputLine *line);
+void write_rtf_text(GString *output, OutputLine *line, const char *text, size_t length);
+void write_rtf_unicode_text(GString *output, OutputLine *line, const char *text, size_t length);
+void write_rtf_tables(GString *header, const GPtrArray *fonts, const GArray *colors);
+char *write_rtf_header(const char *tables, int language);
+void write_picture_data(GString *output, const char *controls, const uint8_t *data, size_t length, bool binary);
@@ -15,21 +15,19 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "config.h"
 
-#include <errno.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
 #include <gdk/gdk.h>
 #include <glib.h>
-#include <glib/gstdio.h>
 #include <glib/gi18n-lib.h>
 #include <gtk/gtk.h>
 
 #include "init.h"
 #include "rtf.h"
 #include "rtf-serialize.h"
-#include "rtf-deserialize.h"
+#include "rtf-textbuffer.h"
 
 /**
  * SECTION:rtf
@@ -48,21 +46,6 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
  * RTF</ulink>.
  */
 
-/**
- * rtf_error_quark:
- *
- * The error domain for RTF serializer errors.
- *
- * Returns: The string <quote>rtf-error-quark</quote> as a
- * <link linkend="GQuark">GQuark</link>.
- */
-GQuark
-rtf_error_quark(void)
-{
-    rtf_init();
-    return g_quark_from_static_string("rtf-error-quark");
-}
-
 /**
  * rtf_register_serialize_format:
  * @buffer: a text buffer
@@ -70,6 +53,9 @@ rtf_error_quark(void)
  * Registers the RTF text serialization format with @buffer. This allows the
  * contents of @buffer to be exported to Rich Text Format (MIME type text/rtf).
  *
+ * The format uses the export flags set on @buffer with
+ * rtf_text_buffer_set_export_flags() at the time of registering.
+ *
  * Returns: (transfer none): a <link linkend="GdkAtom">GdkAtom</link>
  * representing the serialization format, to be passed to
  * gtk_text_buffer_serialize().
@@ -82,7 +68,8 @@ rtf_register_serialize_format(GtkTextBuffer *buffer)
     g_return_val_if_fail(buffer != NULL, GDK_NONE);
     g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), GDK_NONE);
 
-    return gtk_text_buffer_register_serialize_format(buffer, "text/rtf", (GtkTextBufferSerializeFunc)rtf_serialize, NULL, NULL);
+    RtfExportFlags flags = rtf_text_buffer_get_export_flags(buffer);
+    return gtk_text_buffer_register_serialize_format(buffer, "text/rtf", (GtkTextBufferSerializeFunc)rtf_serialize, GUINT_TO_POINTER(flags), NULL);
 }
 
 /**
@@ -110,28 +97,67 @@ rtf_register_deserialize_format(GtkTextBuffer *buffer)
     return format;
 }
 
-typedef char Pushd;
+/* Replace the contents of buffer with a parsed document */
+static void
+replace_with_document(GtkTextBuffer *buffer, const ParsedDocument *doc)
+{
+    gtk_text_buffer_set_text(buffer, "", -1);
+    GtkTextIter start;
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    text_buffer_insert_document(buffer, &start, doc);
+}
 
-static Pushd *
-push_cwd(const char *newdir, GError **error)
+/* Replace the contents of buffer with the RTF code in data, which may contain
+binary data and therefore NUL bytes. data must nevertheless be followed by a NUL
+byte. Filenames in the RTF code are resolved relative to base_dir, or the
+current directory if it is NULL. */
+static bool
+import_from_data(GtkTextBuffer *buffer, const char *data, size_t length, GFile *base_dir, GCancellable *cancellable, GError **error)
 {
-    g_autofree char *cwd = g_get_current_dir();
-    if (g_chdir(newdir) == -1) {
-        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno), _("Could not change directory to '%s': %s"), newdir, g_strerror(errno));
-        return NULL;
-    }
-    return g_steal_pointer(&cwd);
+    /* The document is done with before data is */
+    g_autoptr(GBytes) code = g_bytes_new_static(data, length);
+    g_autoptr(ParsedDocument) doc = parse_rtf_to_document(code, base_dir, cancellable, error);
+    if (doc == NULL)
+        return false;
+
+    replace_with_document(buffer, doc);
+    return true;
 }
 
-static void
-pop_cwd(Pushd *old_cwd)
+/* Return the file containing the RTF code of file, which is file itself unless
+it is an RTFD package */
+static GFile *
+get_rtf_file(GFile *file, GCancellable *cancellable)
 {
-    if (g_chdir(old_cwd) == -1)
-        g_warning(_("Could not restore current directory: %s"), g_strerror(errno));
-    g_free(old_cwd);
+    g_autofree char *basename = g_file_get_basename(file);
+    g_autofree char *tmpstr = g_ascii_strdown(basename, -1);
+    g_autoptr(GFile) check_file = g_file_get_child(file, "TXT.rtf");
+    if (g_str_has_suffix(tmpstr, ".rtfd") &&
+        g_file_query_file_type(file, G_FILE_QUERY_INFO_NONE, cancellable) == G_FILE_TYPE_DIRECTORY &&
+        g_file_query_exists(check_file, cancellable)) {
+        /* Open TXT.rtf in the package directory */
+        return g_steal_pointer(&check_file);
+    }
+    return g_object_ref(file);
 }
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC(Pushd, pop_cwd);
+/* Read file and parse it, without touching any text buffer, so that this may be
+done on another thread */
+static ParsedDocument *
+load_document(GFile *file, GCancellable *cancellable, GError **error)
+{
+    g_autoptr(GFile) real_file = get_rtf_file(file, cancellable);
+    char *contents;
+    size_t length;
+    if (!g_file_load_contents(real_file, cancellable, &contents, &length, NULL, error))
+        return NULL;
+    /* The document may keep slices of the contents */
+    g_autoptr(GBytes) code = g_bytes_new_take(contents, length);
+
+    /* The RTF file may refer to other files relative to its own path */
+    g_autoptr(GFile) parent = g_file_get_parent(real_file);
+    return parse_rtf_to_document(code, parent, cancellable, error);
+}
 
 /**
  * rtf_text_buffer_import_file:
@@ -146,9 +172,8 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(Pushd, pop_cwd);
  * a <link linkend="GtkTextBuffer">GtkTextBuffer</link>. All unsupported
  * features are ignored.
  *
- * This function automatically registers the RTF deserialization format and
- * deregisters it afterwards, so there is no need to call
- * rtf_register_deserialize_format().
+ * There is no need to call rtf_register_deserialize_format() first; this
+ * function does not go through a registered format.
  *
  * <note><para>
  *  This function also supports OS X and NeXTSTEP's RTFD packages. If @filename
@@ -157,6 +182,8 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC(Pushd, pop_cwd);
  * </para></note>
  *
  * If @cancellable is triggered from another thread, the operation is cancelled.
+ * See rtf_text_buffer_import_file_async() for a version of this function that
+ * doesn't block.
  *
  * Returns: %TRUE if the operation was successful, %FALSE if not, in which case
  * @error is set.
@@ -173,34 +200,105 @@ rtf_text_buffer_import_file(GtkTextBuffer *buffer, GFile *file, GCancellable *ca
     g_return_val_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable), false);
     g_return_val_if_fail(error == NULL || *error == NULL, false);
 
-    /* Check whether this is an RTFD package */
-    g_autofree char *basename = g_file_get_basename(file);
-    g_autofree char *tmpstr = g_ascii_strdown(basename, -1);
-    g_autoptr(GFile) check_file = g_file_get_child(file, "TXT.rtf");
-    g_autoptr(GFile) real_file = NULL;
-    if (g_str_has_suffix(tmpstr, ".rtfd") &&
-        g_file_query_file_type(file, G_FILE_QUERY_INFO_NONE, NULL) == G_FILE_TYPE_DIRECTORY &&
-        g_file_query_exists(check_file, NULL)) {
-        /* cd to the package directory and open TXT.rtf */
-        real_file = g_object_ref(check_file);
-    } else {
-        real_file = g_object_ref(file);
+    g_autoptr(ParsedDocument) doc = load_document(file, cancellable, error);
+    if (doc == NULL)
+        return false;
+
+    replace_with_document(buffer, doc);
+    return true;
+}
+
+static void
+load_document_thread(GTask *task, void *source_object, GFile *file, GCancellable *cancellable)
+{
+    GError *error = NULL;
+    ParsedDocument *doc = load_document(file, cancellable, &error);
+    if (doc == NULL)
+        g_task_return_error(task, error);
+    else
+        g_task_return_pointer(task, doc, (GDestroyNotify)parsed_document_unref);
+}
+
+/* Back on the buffer's thread, put the parsed document into the buffer and
+complete the import */
+static void
+on_document_loaded(GObject *source_object, GAsyncResult *result, GTask *task)
+{
+    GError *error = NULL;
+    g_autoptr(ParsedDocument) doc = g_task_propagate_pointer(G_TASK(result), &error);
+    if (doc == NULL) {
+        g_task_return_error(task, error);
+    } else if (!g_task_return_error_if_cancelled(task)) {
+        replace_with_document(g_task_get_source_object(task), doc);
+        g_task_return_boolean(task, true);
     }
+    g_object_unref(task);
+}
 
-    /* Change directory */
-    g_autoptr(GFile) parent = g_file_get_parent(real_file);
-    g_autofree char *newdir = g_file_get_path(parent);
-    /* Save the current directory for later, because the RTF file may refer to
-    other files relative to its own path */
-    g_autoptr(Pushd) olddir = push_cwd(newdir, error);
-    if (olddir == NULL)
-        return false;
+/**
+ * rtf_text_buffer_import_file_async:
+ * @buffer: the text buffer into which to import text
+ * @file: a #GFile pointing to an RTF text file
+ * @io_priority: the I/O priority of the request
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the import is
+ *   finished
+ * @user_data: (closure): data to pass to @callback
+ *
+ * Deserializes the contents of @file to @buffer without blocking. The file is
+ * read and parsed on a worker thread; only putting the result into @buffer is
+ * done in the thread-default main context. If the document can't be parsed,
+ * or @cancellable is cancelled before the document is put into @buffer, then
+ * @buffer is left unchanged. See rtf_text_buffer_import_file() for details.
+ *
+ * Pictures in the document are still decoded when the document is put into
+ * @buffer, unless %RTF_IMPORT_ASYNC_PICTURES is set on @buffer.
+ *
+ * When the import is finished, @callback will be called. Call
+ * rtf_text_buffer_import_file_finish() from it to get the result of the
+ * operation.
+ */
+void
+rtf_text_buffer_import_file_async(GtkTextBuffer *buffer, GFile *file, int io_priority, GCancellable *cancellable, GAsyncReadyCallback callback, void *user_data)
+{
+    rtf_init();
 
-    g_autofree char *contents = NULL;
-    if (!g_file_load_contents(real_file, cancellable, &contents, NULL, NULL, error))
-        return false;
+    g_return_if_fail(buffer != NULL);
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(file != NULL);
+    g_return_if_fail(G_IS_FILE(file));
+    g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+    GTask *task = g_task_new(buffer, cancellable, callback, user_data);
+    g_task_set_source_tag(task, rtf_text_buffer_import_file_async);
+    g_task_set_priority(task, io_priority);
+
+    /* The worker thread doesn't get to see the buffer; this inner task only
+    loads the document, and passes it on to on_document_loaded() */
+    g_autoptr(GTask) load_task = g_task_new(NULL, cancellable, (GAsyncReadyCallback)on_document_loaded, task);
+    g_task_set_priority(load_task, io_priority);
+    g_task_set_task_data(load_task, g_object_ref(file), g_object_unref);
+    g_task_run_in_thread(load_task, (GTaskThreadFunc)load_document_thread);
+}
 
-    return rtf_text_buffer_import_from_string(buffer, contents, error);
+/**
+ * rtf_text_buffer_import_file_finish:
+ * @buffer: the text buffer passed to rtf_text_buffer_import_file_async()
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for an error, or %NULL
+ *
+ * Finishes an operation started with rtf_text_buffer_import_file_async().
+ *
+ * Returns: %TRUE if the operation was successful, %FALSE if not, in which case
+ * @error is set.
+ */
+gboolean
+rtf_text_buffer_import_file_finish(GtkTextBuffer *buffer, GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail(g_task_is_valid(result, buffer), false);
+    g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
 }
 
 /**
@@ -260,15 +358,137 @@ rtf_text_buffer_import_from_string(GtkTextBuffer *buffer, const char *string, GE
     g_return_val_if_fail(string != NULL, false);
     g_return_val_if_fail(error == NULL || *error == NULL, false);
 
-    gtk_text_buffer_set_text(buffer, "", -1);
-    GtkTextIter start;
-    gtk_text_buffer_get_start_iter(buffer, &start);
+    return import_from_data(buffer, string, strlen(string), NULL, NULL, error);
+}
+
+/* How long each step of rtf_text_buffer_insert_async() may take, in
+microseconds. This is half of a frame at 60 frames per second, leaving the rest
+of the frame for drawing. */
+#define INSERT_TIME_SLICE 8000
+
+static gboolean
+insert_async_step(GTask *task)
+{
+    IncrementalImport *import = g_task_get_task_data(task);
+    GError *error = NULL;
+    bool done;
 
-    GdkAtom format = rtf_register_deserialize_format(buffer);
-    bool retval = gtk_text_buffer_deserialize(buffer, buffer, format, &start, (uint8_t *)string, strlen(string), error);
-    gtk_text_buffer_unregister_deserialize_format(buffer, format);
+    if (g_task_return_error_if_cancelled(task))
+        return G_SOURCE_REMOVE;
 
-    return retval;
+    if (!incremental_import_step(import, g_get_monotonic_time() + INSERT_TIME_SLICE, &done, &error)) {
+        g_task_return_error(task, error);
+        return G_SOURCE_REMOVE;
+    }
+    if (!done)
+        return G_SOURCE_CONTINUE;
+
+    g_task_return_boolean(task, true);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * rtf_text_buffer_insert_async:
+ * @buffer: the text buffer into which to insert the document
+ * @iter: the position in @buffer at which to insert the document
+ * @string: a string containing RTF code
+ * @length: length of @string in bytes, or -1 if @string is nul-terminated
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the document
+ *   has been inserted
+ * @user_data: (closure): data to pass to @callback
+ *
+ * Inserts the RTF document in @string into @buffer at @iter, like
+ * rtf_text_buffer_import_from_string() does for the whole buffer, but a little
+ * at a time from idle callbacks in the thread-default main context, so that
+ * pasting a large document doesn't make the user interface freeze. Each step
+ * takes only a few milliseconds, leaving time for the widgets to be redrawn.
+ *
+ * @string is copied, so it may be freed as soon as this function returns.
+ * The document is parsed completely before any of it is inserted, so if it
+ * can't be parsed, @buffer is left unchanged. The insertion point moves along
+ * with any changes made to @buffer in the meantime.
+ *
+ * If @cancellable is cancelled while the document is being inserted, then the
+ * part of it that was already inserted remains in @buffer.
+ *
+ * When the document has been inserted, @callback will be called. Call
+ * rtf_text_buffer_insert_finish() from it to get the result of the operation.
+ */
+void
+rtf_text_buffer_insert_async(GtkTextBuffer *buffer, GtkTextIter *iter, const char *string, gssize length, GCancellable *cancellable, GAsyncReadyCallback callback, void *user_data)
+{
+    rtf_init();
+
+    g_return_if_fail(buffer != NULL);
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(iter != NULL);
+    g_return_if_fail(string != NULL);
+    g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+    if (length < 0)
+        length = strlen(string);
+
+    GTask *task = g_task_new(buffer, cancellable, callback, user_data);
+    g_task_set_source_tag(task, rtf_text_buffer_insert_async);
+
+    GError *error = NULL;
+    IncrementalImport *import = incremental_import_new(buffer, iter, string, length, NULL, &error);
+    if (import == NULL) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+    g_task_set_task_data(task, import, (GDestroyNotify)incremental_import_free);
+
+    GSource *source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_DEFAULT_IDLE);
+    g_source_set_name(source, "[ratify] rtf_text_buffer_insert_async");
+    g_task_attach_source(task, source, (GSourceFunc)insert_async_step);
+    g_source_unref(source);
+    g_object_unref(task);
+}
+
+/**
+ * rtf_text_buffer_insert_finish:
+ * @buffer: the text buffer passed to rtf_text_buffer_insert_async()
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for an error, or %NULL
+ *
+ * Finishes an operation started with rtf_text_buffer_insert_async().
+ *
+ * Returns: %TRUE if the document was inserted, %FALSE if not, in which case
+ * @error is set.
+ */
+gboolean
+rtf_text_buffer_insert_finish(GtkTextBuffer *buffer, GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail(g_task_is_valid(result, buffer), false);
+    g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+/* Write the RTF code for the whole of buffer, leaving out the pictures; see
+serialize_buffer() */
+static SerializedBuffer *
+serialize_whole_buffer(GtkTextBuffer *buffer)
+{
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    return serialize_buffer(buffer, &start, &end, rtf_text_buffer_get_export_flags(buffer));
+}
+
+/* Encode the pictures and write the RTF code to file. This doesn't touch the
+buffer, so it may be done on another thread. */
+static bool
+write_serialized_buffer(SerializedBuffer *serialized, GFile *file, GCancellable *cancellable, GError **error)
+{
+    size_t length;
+    g_autofree char *data = serialized_buffer_write(serialized, &length, cancellable, error);
+    if (data == NULL)
+        return false;
+    return g_file_replace_contents(file, data, length, NULL, false, G_FILE_CREATE_NONE, NULL, cancellable, error);
 }
 
 /**
@@ -285,12 +505,12 @@ rtf_text_buffer_import_from_string(GtkTextBuffer *buffer, const char *string, GE
  * that RTF is capable of representing, such as styles, are preserved across
  * loading and saving.
  *
- * This function automatically registers the RTF serialization format and
- * deregisters it afterwards, so there is no need to call
- * rtf_register_serialize_format().
+ * There is no need to call rtf_register_serialize_format() first; this
+ * function does not go through a registered format.
  *
  * The operation can be cancelled by triggering @cancellable from another
- * thread.
+ * thread. See rtf_text_buffer_export_file_async() for a version of this
+ * function that doesn't block.
  *
  * Returns: %TRUE if the operation succeeded, %FALSE if not, in which case
  * @error is set.
@@ -307,8 +527,93 @@ rtf_text_buffer_export_file(GtkTextBuffer *buffer, GFile *file, GCancellable *ca
     g_return_val_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable), false);
     g_return_val_if_fail(error == NULL || *error == NULL, false);
 
-    g_autofree char *string = rtf_text_buffer_export_to_string(buffer);
-    return g_file_replace_contents(file, string, strlen(string), NULL, false, G_FILE_CREATE_NONE, NULL, cancellable, error);
+    g_autoptr(SerializedBuffer) serialized = serialize_whole_buffer(buffer);
+    return write_serialized_buffer(serialized, file, cancellable, error);
+}
+
+typedef struct {
+    GFile *file;
+    SerializedBuffer *serialized;
+} ExportData;
+
+static void
+export_data_free(ExportData *data)
+{
+    g_object_unref(data->file);
+    serialized_buffer_free(data->serialized);
+    g_slice_free(ExportData, data);
+}
+
+static void
+write_serialized_buffer_thread(GTask *task, void *source_object, ExportData *data, GCancellable *cancellable)
+{
+    GError *error = NULL;
+    if (write_serialized_buffer(data->serialized, data->file, cancellable, &error))
+        g_task_return_boolean(task, true);
+    else
+        g_task_return_error(task, error);
+}
+
+/**
+ * rtf_text_buffer_export_file_async:
+ * @buffer: the text buffer to export
+ * @file: a #GFile to export to
+ * @io_priority: the I/O priority of the request
+ * @cancellable: (allow-none): optional #GCancellable object, or %NULL
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the export is
+ *   finished
+ * @user_data: (closure): data to pass to @callback
+ *
+ * Serializes the contents of @buffer to an RTF text file, @file, without
+ * blocking. The text and formatting of @buffer are read before this function
+ * returns, so @buffer may be changed afterwards without affecting the result.
+ * Encoding the pictures and writing the file are done on a worker thread. See
+ * rtf_text_buffer_export_file() for details.
+ *
+ * When the export is finished, @callback will be called. Call
+ * rtf_text_buffer_export_file_finish() from it to get the result of the
+ * operation.
+ */
+void
+rtf_text_buffer_export_file_async(GtkTextBuffer *buffer, GFile *file, int io_priority, GCancellable *cancellable, GAsyncReadyCallback callback, void *user_data)
+{
+    rtf_init();
+
+    g_return_if_fail(buffer != NULL);
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+    g_return_if_fail(file != NULL);
+    g_return_if_fail(G_IS_FILE(file));
+    g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+    ExportData *data = g_slice_new0(ExportData);
+    data->file = g_object_ref(file);
+    data->serialized = serialize_whole_buffer(buffer);
+
+    g_autoptr(GTask) task = g_task_new(buffer, cancellable, callback, user_data);
+    g_task_set_source_tag(task, rtf_text_buffer_export_file_async);
+    g_task_set_priority(task, io_priority);
+    g_task_set_task_data(task, data, (GDestroyNotify)export_data_free);
+    g_task_run_in_thread(task, (GTaskThreadFunc)write_serialized_buffer_thread);
+}
+
+/**
+ * rtf_text_buffer_export_file_finish:
+ * @buffer: the text buffer passed to rtf_text_buffer_export_file_async()
+ * @result: the #GAsyncResult passed to the callback
+ * @error: return location for an error, or %NULL
+ *
+ * Finishes an operation started with rtf_text_buffer_export_file_async().
+ *
+ * Returns: %TRUE if the operation succeeded, %FALSE if not, in which case
+ * @error is set.
+ */
+gboolean
+rtf_text_buffer_export_file_finish(GtkTextBuffer *buffer, GAsyncResult *result, GError **error)
+{
+    g_return_val_if_fail(g_task_is_valid(result, buffer), false);
+    g_return_val_if_fail(error == NULL || *error == NULL, false);
+
+    return g_task_propagate_boolean(G_TASK(result), error);
 }
 
 /**
@@ -333,8 +638,24 @@ rtf_text_buffer_export(GtkTextBuffer *buffer, const char *filename, GError **err
     g_return_val_if_fail(filename != NULL, false);
     g_return_val_if_fail(error == NULL || *error == NULL, false);
 
-    g_autofree char *string = rtf_text_buffer_export_to_string(buffer);
-    return g_file_set_contents(filename, string, -1, error);
+    g_autoptr(GBytes) bytes = rtf_text_buffer_export_to_bytes(buffer);
+    size_t length;
+    const char *data = g_bytes_get_data(bytes, &length);
+    return g_file_set_contents(filename, data, length, error);
+}
+
+/* Serialize the whole of buffer, returning the RTF code and its length */
+static char *
+export_to_data(GtkTextBuffer *buffer, size_t *length)
+{
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+
+    GdkAtom format = rtf_register_serialize_format(buffer);
+    char *string = (char *)gtk_text_buffer_serialize(buffer, buffer, format, &start, &end, length);
+    gtk_text_buffer_unregister_serialize_format(buffer, format);
+
+    return string;
 }
 
 /**
@@ -344,6 +665,12 @@ rtf_text_buffer_export(GtkTextBuffer *buffer, const char *filename, GError **err
  * Serializes the contents of @buffer to a string in RTF format. See
  * rtf_text_buffer_export() for details.
  *
+ * <note><para>
+ *   If %RTF_EXPORT_BINARY_PICTURES is set on @buffer, then the string may
+ *   contain NUL bytes. Use rtf_text_buffer_export_to_bytes() instead in that
+ *   case.
+ * </para></note>
+ *
  * Returns: (transfer full): a string containing RTF text.
  */
 char *
@@ -353,13 +680,159 @@ rtf_text_buffer_export_to_string(GtkTextBuffer *buffer)
 
     g_return_val_if_fail(buffer != NULL, NULL);
 
-    GtkTextIter start, end;
-    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    size_t length;
+    return export_to_data(buffer, &length);
+}
+
+/**
+ * rtf_text_buffer_export_to_bytes:
+ * @buffer: the text buffer to export
+ *
+ * Serializes the contents of @buffer to RTF code. Unlike
+ * rtf_text_buffer_export_to_string(), the result can hold binary data, such as
+ * pictures written with %RTF_EXPORT_BINARY_PICTURES. See
+ * rtf_text_buffer_export() for details.
+ *
+ * Returns: (transfer full): a #GBytes containing RTF code.
+ */
+GBytes *
+rtf_text_buffer_export_to_bytes(GtkTextBuffer *buffer)
+{
+    rtf_init();
+
+    g_return_val_if_fail(buffer != NULL, NULL);
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), NULL);
 
-    GdkAtom format = rtf_register_serialize_format(buffer);
     size_t length;
-    char *string = (char *)gtk_text_buffer_serialize(buffer, buffer, format, &start, &end, &length);
-    gtk_text_buffer_unregister_serialize_format(buffer, format);
+    char *data = export_to_data(buffer, &length);
+    return g_bytes_new_take(data, length);
+}
 
-    return string;
+/**
+ * rtf_text_buffer_set_export_flags:
+ * @buffer: a text buffer
+ * @flags: options for exporting @buffer
+ *
+ * Sets options that change the RTF code written when @buffer is exported, by
+ * rtf_text_buffer_export_file() and friends, or through a serialization format
+ * registered afterwards with rtf_register_serialize_format().
+ */
+void
+rtf_text_buffer_set_export_flags(GtkTextBuffer *buffer, RtfExportFlags flags)
+{
+    rtf_init();
+
+    g_return_if_fail(buffer != NULL);
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+
+    g_object_set_data(G_OBJECT(buffer), "rtf-export-flags", GUINT_TO_POINTER(flags));
+}
+
+/**
+ * rtf_text_buffer_get_export_flags:
+ * @buffer: a text buffer
+ *
+ * Gets the options set with rtf_text_buffer_set_export_flags().
+ *
+ * Returns: the export options for @buffer.
+ */
+RtfExportFlags
+rtf_text_buffer_get_export_flags(GtkTextBuffer *buffer)
+{
+    rtf_init();
+
+    g_return_val_if_fail(buffer != NULL, RTF_EXPORT_DEFAULT);
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), RTF_EXPORT_DEFAULT);
+
+    return GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(buffer), "rtf-export-flags"));
+}
+
+/**
+ * rtf_text_buffer_set_import_flags:
+ * @buffer: a text buffer
+ * @flags: options for importing into @buffer
+ *
+ * Sets options that change how RTF code is imported into @buffer, by
+ * rtf_text_buffer_import_file() and friends, or through a deserialization
+ * format registered with rtf_register_deserialize_format().
+ */
+void
+rtf_text_buffer_set_import_flags(GtkTextBuffer *buffer, RtfImportFlags flags)
+{
+    rtf_init();
+
+    g_return_if_fail(buffer != NULL);
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+
+    g_object_set_data(G_OBJECT(buffer), "rtf-import-flags", GUINT_TO_POINTER(flags));
+}
+
+/**
+ * rtf_text_buffer_get_import_flags:
+ * @buffer: a text buffer
+ *
+ * Gets the options set with rtf_text_buffer_set_import_flags().
+ *
+ * Returns: the import options for @buffer.
+ */
+RtfImportFlags
+rtf_text_buffer_get_import_flags(GtkTextBuffer *buffer)
+{
+    rtf_init();
+
+    g_return_val_if_fail(buffer != NULL, RTF_IMPORT_DEFAULT);
+    g_return_val_if_fail(GTK_IS_TEXT_BUFFER(buffer), RTF_IMPORT_DEFAULT);
+
+    return GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(buffer), "rtf-import-flags"));
+}
+
+/**
+ * rtf_text_buffer_set_max_picture_size:
+ * @buffer: a text buffer
+ * @max_width: maximum width of imported pictures in pixels, or 0 for no limit
+ * @max_height: maximum height of imported pictures in pixels, or 0 for no
+ * limit
+ *
+ * Limits the size of pictures imported into @buffer, by
+ * rtf_text_buffer_import_file() and friends, or through a deserialization
+ * format registered with rtf_register_deserialize_format(). Pictures that are
+ * larger are shrunk to fit, preserving their aspect ratio. They are decoded
+ * directly at the smaller size, so this also limits the memory used when
+ * importing documents with large embedded pictures.
+ */
+void
+rtf_text_buffer_set_max_picture_size(GtkTextBuffer *buffer, int max_width, int max_height)
+{
+    rtf_init();
+
+    g_return_if_fail(buffer != NULL);
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+
+    g_object_set_data(G_OBJECT(buffer), "rtf-max-picture-width", GINT_TO_POINTER(MAX(max_width, 0)));
+    g_object_set_data(G_OBJECT(buffer), "rtf-max-picture-height", GINT_TO_POINTER(MAX(max_height, 0)));
+}
+
+/**
+ * rtf_text_buffer_get_max_picture_size:
+ * @buffer: a text buffer
+ * @max_width: (out) (optional): return location for the maximum width, or
+ * %NULL
+ * @max_height: (out) (optional): return location for the maximum height, or
+ * %NULL
+ *
+ * Gets the limits set with rtf_text_buffer_set_max_picture_size(). A limit of
+ * 0 means that pictures are not limited in that dimension.
+ */
+void
+rtf_text_buffer_get_max_picture_size(GtkTextBuffer *buffer, int *max_width, int *max_height)
+{
+    rtf_init();
+
+    g_return_if_fail(buffer != NULL);
+    g_return_if_fail(GTK_IS_TEXT_BUFFER(buffer));
+
+    if (max_width)
+        *max_width = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(buffer), "rtf-max-picture-width"));
+    if (max_height)
+        *max_height = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(buffer), "rtf-max-picture-height"));
 }
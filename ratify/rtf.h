@@ -19,71 +19,76 @@ with Ratify.  If not, see <http://www.gnu.org/licenses/>. */
 #include <glib.h>
 #include <gtk/gtk.h>
 
+#include "rtf-core.h"
+
 G_BEGIN_DECLS
 
 /**
- * RtfError:
- * @RTF_ERROR_FAILED: A generic error.
- * @RTF_ERROR_INVALID_RTF: The file was not correct RTF.
- * @RTF_ERROR_MISSING_PARAMETER: A numerical parameter was missing from a
- * control word which requires one.
- * @RTF_ERROR_MISSING_BRACE: Not all groups were closed before the end of the
- * file.
- * @RTF_ERROR_EXTRA_CHARACTERS: There was junk after the last '}'.
- * @RTF_ERROR_BAD_VERSION: The RTF file was an incompatible version.
- * @RTF_ERROR_UNDEFINED_COLOR: A color was used which was not defined in the
- * color table.
- * @RTF_ERROR_UNDEFINED_FONT: A font was used which was not defined in the font
- * table.
- * @RTF_ERROR_UNDEFINED_STYLE: A style was used which was not defined in the
- * stylesheet.
- * @RTF_ERROR_BAD_HEX_CODE: Incorrect characters were encountered when expecting
- * hexadecimal digits (0-9, A-F)
- * @RTF_ERROR_BAD_PICT_TYPE: An invalid type of bitmap was specified.
- * @RTF_ERROR_BAD_FONT_SIZE: A negative font size was specified.
- * @RTF_ERROR_UNSUPPORTED_CHARSET: A character set with no iconv equivalent was
- * specified.
+ * RtfExportFlags:
+ * @RTF_EXPORT_DEFAULT: No special options.
+ * @RTF_EXPORT_BINARY_PICTURES: Write embedded pictures as raw binary data
+ * (using the <code>\bin</code> control word) instead of hexadecimal digits.
+ * This roughly halves the space taken up by pictures, but the output is no
+ * longer plain text and may contain NUL bytes.
+ * @RTF_EXPORT_COMPACT: Write as little RTF code as possible for the formatting.
+ * Instead of putting each paragraph and each run of text in its own group,
+ * write only the control words for the properties that change from one run
+ * or paragraph to the next. The result is typically much smaller, but harder
+ * for people to read.
  *
- * The different codes which can be thrown in the #RTF_ERROR domain.
+ * Options that change the RTF code written by Ratify's export functions. See
+ * rtf_text_buffer_set_export_flags().
  */
 typedef enum {
-    RTF_ERROR_FAILED,
-    RTF_ERROR_INVALID_RTF,
-    RTF_ERROR_MISSING_PARAMETER,
-    RTF_ERROR_MISSING_BRACE,
-    RTF_ERROR_EXTRA_CHARACTERS,
-    RTF_ERROR_BAD_VERSION,
-    RTF_ERROR_UNDEFINED_COLOR,
-    RTF_ERROR_UNDEFINED_FONT,
-    RTF_ERROR_UNDEFINED_STYLE,
-    RTF_ERROR_BAD_HEX_CODE,
-    RTF_ERROR_BAD_PICT_TYPE,
-    RTF_ERROR_BAD_FONT_SIZE,
-    RTF_ERROR_UNSUPPORTED_CHARSET
-} RtfError;
+    RTF_EXPORT_DEFAULT = 0,
+    RTF_EXPORT_BINARY_PICTURES = 1 << 0,
+    RTF_EXPORT_COMPACT = 1 << 1
+} RtfExportFlags;
 
 /**
- * RTF_ERROR:
+ * RtfImportFlags:
+ * @RTF_IMPORT_DEFAULT: No special options.
+ * @RTF_IMPORT_ASYNC_PICTURES: Decode pictures on worker threads while the rest
+ * of the document is being imported. The text appears in the buffer
+ * immediately, with a placeholder child anchor in place of each picture. The
+ * placeholders are replaced by the pictures as they are decoded, during later
+ * iterations of the thread-default main context of the thread that imported
+ * the document.
  *
- * The domain of errors raised by RTF processing in Ratify.
+ * Options that change how Ratify's import functions read RTF code. See
+ * rtf_text_buffer_set_import_flags().
  */
-#define RTF_ERROR rtf_error_quark()
+typedef enum {
+    RTF_IMPORT_DEFAULT = 0,
+    RTF_IMPORT_ASYNC_PICTURES = 1 << 0
+} RtfImportFlags;
 
-#ifdef G_HAVE_GNUC_VISIBILITY
-#define _RTF_API __attribute__((visibility("default")))
-#else
-#define _RTF_API
-#endif
+typedef struct _RtfExporter RtfExporter;
 
-_RTF_API GQuark rtf_error_quark(void);
 _RTF_API GdkAtom rtf_register_serialize_format(GtkTextBuffer *buffer);
 _RTF_API GdkAtom rtf_register_deserialize_format(GtkTextBuffer *buffer);
 _RTF_API gboolean rtf_text_buffer_import_file(GtkTextBuffer *buffer, GFile *file, GCancellable *cancellable, GError **error);
+_RTF_API void rtf_text_buffer_import_file_async(GtkTextBuffer *buffer, GFile *file, int io_priority, GCancellable *cancellable, GAsyncReadyCallback callback, void *user_data);
+_RTF_API gboolean rtf_text_buffer_import_file_finish(GtkTextBuffer *buffer, GAsyncResult *result, GError **error);
 _RTF_API gboolean rtf_text_buffer_import(GtkTextBuffer *buffer, const char *filename, GError **error);
 _RTF_API gboolean rtf_text_buffer_import_from_string(GtkTextBuffer *buffer, const char *string, GError **error);
+_RTF_API void rtf_text_buffer_insert_async(GtkTextBuffer *buffer, GtkTextIter *iter, const char *string, gssize length, GCancellable *cancellable, GAsyncReadyCallback callback, void *user_data);
+_RTF_API gboolean rtf_text_buffer_insert_finish(GtkTextBuffer *buffer, GAsyncResult *result, GError **error);
 _RTF_API gboolean rtf_text_buffer_export_file(GtkTextBuffer *buffer, GFile *file, GCancellable *cancellable, GError **error);
+_RTF_API void rtf_text_buffer_export_file_async(GtkTextBuffer *buffer, GFile *file, int io_priority, GCancellable *cancellable, GAsyncReadyCallback callback, void *user_data);
+_RTF_API gboolean rtf_text_buffer_export_file_finish(GtkTextBuffer *buffer, GAsyncResult *result, GError **error);
 _RTF_API gboolean rtf_text_buffer_export(GtkTextBuffer *buffer, const char *filename, GError **error);
 _RTF_API char *rtf_text_buffer_export_to_string(GtkTextBuffer *buffer);
+_RTF_API GBytes *rtf_text_buffer_export_to_bytes(GtkTextBuffer *buffer);
+_RTF_API void rtf_text_buffer_set_export_flags(GtkTextBuffer *buffer, RtfExportFlags flags);
+_RTF_API RtfExportFlags rtf_text_buffer_get_export_flags(GtkTextBuffer *buffer);
+_RTF_API void rtf_text_buffer_set_import_flags(GtkTextBuffer *buffer, RtfImportFlags flags);
+_RTF_API RtfImportFlags rtf_text_buffer_get_import_flags(GtkTextBuffer *buffer);
+_RTF_API void rtf_text_buffer_set_max_picture_size(GtkTextBuffer *buffer, int max_width, int max_height);
+_RTF_API void rtf_text_buffer_get_max_picture_size(GtkTextBuffer *buffer, int *max_width, int *max_height);
+_RTF_API RtfExporter *rtf_exporter_new(GtkTextBuffer *buffer);
+_RTF_API GBytes *rtf_exporter_export(RtfExporter *exporter);
+_RTF_API void rtf_exporter_free(RtfExporter *exporter);
 
 G_END_DECLS
 
@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <glib.h>
+#include <gtk/gtk.h>
+#include <ratify/rtf.h>
+
+/* This benchmark compares the throughput of rtf_extract_text() with that of
+importing the same documents into a GtkTextBuffer. Run it with
+'meson test --benchmark'.
+
+Both share the tokenizer, which is the ceiling for extraction: on its own,
+extraction runs only 1-2 times as fast as parsing a document for import, before
+anything is inserted into the buffer. Whatever speedup this benchmark shows
+beyond that comes from skipping the insertion. */
+
+/* Minimum time to spend on each measurement, in seconds */
+#define MIN_TIME 1.0
+
+static const char *files[] = {
+    "outtake_latin.rtf",
+    "p069_styles.rtf",
+    "RtfInterpreterTest_4.rtf", /* JPEG image */
+    "RtfInterpreterTest_13.rtf",
+    "RtfInterpreterTest_14.rtf",
+    NULL
+};
+
+static void
+import_once(const char *contents, size_t length)
+{
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    GError *error = NULL;
+
+    if (!rtf_text_buffer_import_from_string(buffer, contents, &error))
+        g_error("Import failed: %s", error->message);
+}
+
+static void
+extract_once(const char *contents, size_t length)
+{
+    GError *error = NULL;
+
+    g_autofree char *text = rtf_extract_text(contents, length, &error);
+    if (!text)
+        g_error("Extraction failed: %s", error->message);
+}
+
+/* Run func on the document repeatedly for at least MIN_TIME, and return the
+throughput in megabytes per second */
+static double
+measure(void (*func)(const char *, size_t), const char *contents, size_t length)
+{
+    g_autoptr(GTimer) timer = g_timer_new();
+    unsigned iterations = 0;
+
+    do {
+        func(contents, length);
+        iterations++;
+    } while (g_timer_elapsed(timer, NULL) < MIN_TIME);
+
+    return (double)length * iterations / g_timer_elapsed(timer, NULL) / 1e6;
+}
+
+int
+main(int argc, char **argv)
+{
+    gtk_init(&argc, &argv);
+
+    g_print("%-28s %12s %12s %8s\n", "File", "Import MB/s", "Extract MB/s", "Speedup");
+    for (const char **name = files; *name; name++) {
+        g_autofree char *filename = g_build_filename(TESTFILEDIR, *name, NULL);
+        g_autofree char *contents = NULL;
+        size_t length;
+        GError *error = NULL;
+
+        if (!g_file_get_contents(filename, &contents, &length, &error))
+            g_error("Could not read %s: %s", filename, error->message);
+
+        double import_rate = measure(import_once, contents, length);
+        double extract_rate = measure(extract_once, contents, length);
+        g_print("%-28s %12.2f %12.2f %7.1fx\n", *name, import_rate, extract_rate, extract_rate / import_rate);
+    }
+
+    return EXIT_SUCCESS;
+}
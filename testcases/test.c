@@ -41,6 +41,48 @@ rtf_parse_pass_case(const void *name)
     g_assert_no_error(error);
 }
 
+/* This test extracts the text of an RTF file, and checks that it is the same as
+the text that importing the file into a GtkTextBuffer produces. */
+static void
+rtf_extract_text_case(const void *name)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    g_autofree char *filename = build_filename(name);
+    g_autofree char *contents = NULL;
+    size_t length;
+
+    g_assert_true(rtf_text_buffer_import(buffer, filename, &error));
+    g_assert_no_error(error);
+    g_assert_true(g_file_get_contents(filename, &contents, &length, &error));
+    g_assert_no_error(error);
+    g_autofree char *extracted = rtf_extract_text(contents, length, &error);
+    g_assert_no_error(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer, &start, &end, true);
+    g_assert_cmpstr(extracted, ==, text);
+}
+
+/* This test checks that ignored groups are skipped up to the right closing
+brace, even if they contain escaped braces or braces in binary data. */
+static void
+rtf_skip_ignored_group_case(void)
+{
+    GError *error = NULL;
+    g_autofree char *text = rtf_extract_text("{\\rtf1 a{\\*\\unknown b{c}\\{\\}\\\\ \\bin2 }{}"
+                                             "d{\\info{\\title x}}e}", -1, &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(text, ==, "ade");
+
+    /* Errors in a group that can't be skipped are still reported */
+    g_autofree char *bad_text = rtf_extract_text("{\\rtf1 a{\\*\\unknown \\bin9 }", -1, &error);
+    g_assert_null(bad_text);
+    g_assert_error(error, RTF_ERROR, RTF_ERROR_INVALID_RTF);
+    g_clear_error(&error);
+}
+
 /* This test is commented out. */
 #if 0
 static void
@@ -87,6 +129,1203 @@ rtf_write_pass_case(const void *name)
     g_assert_cmpstr(text1, ==, text2);
 }
 
+/* This test exports a buffer containing a picture whose hex data is much larger
+than the chunks in which picture data is streamed into the loader, imports it
+again, and checks that the picture survived intact. */
+static void
+rtf_large_picture_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer1 = gtk_text_buffer_new(NULL);
+    g_autoptr(GtkTextBuffer) buffer2 = gtk_text_buffer_new(NULL);
+
+    /* Fill the picture with noise so that it doesn't compress well */
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, 256, 256);
+    guint8 *pixels = gdk_pixbuf_get_pixels(pixbuf);
+    size_t size = gdk_pixbuf_get_byte_length(pixbuf);
+    g_autoptr(GRand) rand = g_rand_new_with_seed(42);
+    for (size_t i = 0; i < size; i++)
+        pixels[i] = g_rand_int_range(rand, 0, 256);
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer1, &iter);
+    gtk_text_buffer_insert_pixbuf(buffer1, &iter, pixbuf);
+    g_autofree char *string = rtf_text_buffer_export_to_string(buffer1);
+    g_assert_cmpuint(strlen(string), >, 4 * 65536);
+
+    if (!rtf_text_buffer_import_from_string(buffer2, string, &error))
+        g_test_message("Import error message: %s", error->message);
+    g_assert_no_error(error);
+
+    gtk_text_buffer_get_start_iter(buffer2, &iter);
+    GdkPixbuf *picture = gtk_text_iter_get_pixbuf(&iter);
+    g_assert_nonnull(picture);
+    g_assert_cmpint(gdk_pixbuf_get_width(picture), ==, 256);
+    g_assert_cmpint(gdk_pixbuf_get_height(picture), ==, 256);
+    g_assert_cmpmem(gdk_pixbuf_read_pixels(picture), size, gdk_pixbuf_read_pixels(pixbuf), size);
+}
+
+/* This test exports several pictures, which are encoded in parallel, imports
+them again, and checks that they are still in the right order. */
+static void
+rtf_several_pictures_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer1 = gtk_text_buffer_new(NULL);
+    g_autoptr(GtkTextBuffer) buffer2 = gtk_text_buffer_new(NULL);
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer1, &iter);
+    for (int width = 1; width <= 8; width++) {
+        g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, width, 4);
+        gdk_pixbuf_fill(pixbuf, 0x336699ff);
+        gtk_text_buffer_insert(buffer1, &iter, "x", -1);
+        gtk_text_buffer_insert_pixbuf(buffer1, &iter, pixbuf);
+    }
+    g_autofree char *string = rtf_text_buffer_export_to_string(buffer1);
+
+    g_assert_true(rtf_text_buffer_import_from_string(buffer2, string, &error));
+    g_assert_no_error(error);
+
+    gtk_text_buffer_get_start_iter(buffer2, &iter);
+    for (int width = 1; width <= 8; width++) {
+        g_assert_cmpint(gtk_text_iter_get_char(&iter), ==, 'x');
+        gtk_text_iter_forward_char(&iter);
+        GdkPixbuf *picture = gtk_text_iter_get_pixbuf(&iter);
+        g_assert_nonnull(picture);
+        g_assert_cmpint(gdk_pixbuf_get_width(picture), ==, width);
+        gtk_text_iter_forward_char(&iter);
+    }
+}
+
+/* This test checks that pictures are told apart from child anchors, which
+aren't exported, and from an actual U+FFFC character in the text. */
+static void
+rtf_embedded_objects_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer1 = gtk_text_buffer_new(NULL);
+    g_autoptr(GtkTextBuffer) buffer2 = gtk_text_buffer_new(NULL);
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, 4, 4);
+    gdk_pixbuf_fill(pixbuf, 0x336699ff);
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer1, &iter);
+    gtk_text_buffer_insert(buffer1, &iter, "a", -1);
+    gtk_text_buffer_create_child_anchor(buffer1, &iter);
+    gtk_text_buffer_insert(buffer1, &iter, "b\uFFFC", -1);
+    gtk_text_buffer_insert_pixbuf(buffer1, &iter, pixbuf);
+    gtk_text_buffer_insert(buffer1, &iter, "c", -1);
+    g_autofree char *string = rtf_text_buffer_export_to_string(buffer1);
+
+    g_assert_true(rtf_text_buffer_import_from_string(buffer2, string, &error));
+    g_assert_no_error(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer2, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer2, &start, &end, true);
+    g_assert_cmpstr(text, ==, "ab\uFFFCc");
+    gtk_text_buffer_get_iter_at_offset(buffer2, &iter, 3);
+    g_assert_nonnull(gtk_text_iter_get_pixbuf(&iter));
+}
+
+/* This test exports a picture as binary data with \binN, imports it again,
+and checks that the picture survived intact. */
+static void
+rtf_binary_picture_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer1 = gtk_text_buffer_new(NULL);
+    g_autoptr(GtkTextBuffer) buffer2 = gtk_text_buffer_new(NULL);
+
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, 16, 16);
+    gdk_pixbuf_fill(pixbuf, 0x336699ff);
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer1, &iter);
+    gtk_text_buffer_insert(buffer1, &iter, "before", -1);
+    gtk_text_buffer_insert_pixbuf(buffer1, &iter, pixbuf);
+    gtk_text_buffer_insert(buffer1, &iter, "after", -1);
+
+    rtf_text_buffer_set_export_flags(buffer1, RTF_EXPORT_BINARY_PICTURES);
+    g_assert_cmpint(rtf_text_buffer_get_export_flags(buffer1), ==, RTF_EXPORT_BINARY_PICTURES);
+    g_autoptr(GBytes) bytes = rtf_text_buffer_export_to_bytes(buffer1);
+    size_t length;
+    const char *data = g_bytes_get_data(bytes, &length);
+    g_assert_nonnull(g_strstr_len(data, length, "\\bin"));
+
+    /* Go through a file, because the data isn't a valid string */
+    g_autoptr(GFileIOStream) stream = NULL;
+    g_autoptr(GFile) file = g_file_new_tmp("ratify-XXXXXX.rtf", &stream, &error);
+    g_assert_no_error(error);
+    g_assert_true(g_file_replace_contents(file, data, length, NULL, false, G_FILE_CREATE_NONE, NULL, NULL, &error));
+    g_assert_no_error(error);
+    if (!rtf_text_buffer_import_file(buffer2, file, NULL, &error))
+        g_test_message("Import error message: %s", error->message);
+    g_assert_no_error(error);
+    g_file_delete(file, NULL, NULL);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer2, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer2, &start, &end, true);
+    g_assert_cmpstr(text, ==, "beforeafter");
+    gtk_text_buffer_get_iter_at_offset(buffer2, &iter, 6);
+    GdkPixbuf *picture = gtk_text_iter_get_pixbuf(&iter);
+    g_assert_nonnull(picture);
+    g_assert_cmpint(gdk_pixbuf_get_width(picture), ==, 16);
+    g_assert_cmpint(gdk_pixbuf_get_height(picture), ==, 16);
+}
+
+/* This test checks that tags are only written if they are used, and that a
+change to a tag shows up in the next export. */
+static void
+rtf_tag_code_case(void)
+{
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    GtkTextTag *used = gtk_text_buffer_create_tag(buffer, NULL, "family", "Used Font", "weight", PANGO_WEIGHT_BOLD, NULL);
+    gtk_text_buffer_create_tag(buffer, NULL, "family", "Unused Font", NULL);
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    gtk_text_buffer_insert_with_tags(buffer, &iter, "tagged", -1, used, NULL);
+
+    g_autofree char *code1 = rtf_text_buffer_export_to_string(buffer);
+    g_assert_nonnull(strstr(code1, "Used Font"));
+    g_assert_null(strstr(code1, "Unused Font"));
+    g_assert_nonnull(strstr(code1, "\\b"));
+
+    g_object_set(used, "family", "Changed Font", "weight", PANGO_WEIGHT_NORMAL, NULL);
+    g_autofree char *code2 = rtf_text_buffer_export_to_string(buffer);
+    g_assert_null(strstr(code2, "Used Font"));
+    g_assert_nonnull(strstr(code2, "Changed Font"));
+    g_assert_nonnull(strstr(code2, "\\b0"));
+}
+
+/* Whether the text at offset in buffer is bold and italic */
+static void
+get_bold_italic(GtkTextBuffer *buffer, int offset, bool *bold, bool *italic)
+{
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, offset);
+    GtkTextAttributes *values = gtk_text_attributes_new();
+    values->font = pango_font_description_new();
+    gtk_text_iter_get_attributes(&iter, values);
+    *bold = pango_font_description_get_weight(values->font) == PANGO_WEIGHT_BOLD;
+    *italic = pango_font_description_get_style(values->font) == PANGO_STYLE_ITALIC;
+    gtk_text_attributes_unref(values);
+}
+
+/* Whether any tag on the text at offset in buffer sets property, such as
+"background-set" */
+static bool
+has_tag_property(GtkTextBuffer *buffer, int offset, const char *property)
+{
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, offset);
+    GSList *tags = gtk_text_iter_get_tags(&iter);
+    bool is_set = false;
+    for (GSList *link = tags; link != NULL; link = link->next) {
+        gboolean value;
+        g_object_get(link->data, property, &value, NULL);
+        is_set = is_set || value;
+    }
+    g_slist_free(tags);
+    return is_set;
+}
+
+/* This test checks that overlapping tags survive a round trip, with enough
+tags in the tag table that their sets take more than one word. */
+static void
+rtf_overlapping_tags_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer1 = gtk_text_buffer_new(NULL);
+    g_autoptr(GtkTextBuffer) buffer2 = gtk_text_buffer_new(NULL);
+    for (int count = 0; count < 70; count++)
+        gtk_text_buffer_create_tag(buffer1, NULL, "size-points", 10.0 + count, NULL);
+    GtkTextTag *bold = gtk_text_buffer_create_tag(buffer1, NULL, "weight", PANGO_WEIGHT_BOLD, NULL);
+    GtkTextTag *italic = gtk_text_buffer_create_tag(buffer1, NULL, "style", PANGO_STYLE_ITALIC, NULL);
+
+    gtk_text_buffer_set_text(buffer1, "abcdef", -1);
+    GtkTextIter start, end;
+    gtk_text_buffer_get_iter_at_offset(buffer1, &start, 0);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &end, 4);
+    gtk_text_buffer_apply_tag(buffer1, bold, &start, &end);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &start, 2);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &end, 6);
+    gtk_text_buffer_apply_tag(buffer1, italic, &start, &end);
+
+    g_autofree char *string = rtf_text_buffer_export_to_string(buffer1);
+    g_assert_true(rtf_text_buffer_import_from_string(buffer2, string, &error));
+    g_assert_no_error(error);
+
+    bool is_bold, is_italic;
+    get_bold_italic(buffer2, 1, &is_bold, &is_italic);
+    g_assert_true(is_bold && !is_italic);
+    get_bold_italic(buffer2, 3, &is_bold, &is_italic);
+    g_assert_true(is_bold && is_italic);
+    get_bold_italic(buffer2, 5, &is_bold, &is_italic);
+    g_assert_true(!is_bold && is_italic);
+}
+
+/* Count the occurrences of needle in haystack */
+static unsigned
+count_occurrences(const char *haystack, const char *needle)
+{
+    unsigned count = 0;
+    for (const char *pos = strstr(haystack, needle); pos; pos = strstr(pos + 1, needle))
+        count++;
+    return count;
+}
+
+/* This test checks that compact output only writes the changes in formatting,
+and that the formatting survives a round trip. */
+static void
+rtf_compact_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer1 = gtk_text_buffer_new(NULL);
+    g_autoptr(GtkTextBuffer) buffer2 = gtk_text_buffer_new(NULL);
+    GtkTextTag *bold = gtk_text_buffer_create_tag(buffer1, NULL, "weight", PANGO_WEIGHT_BOLD, NULL);
+    GtkTextTag *italic = gtk_text_buffer_create_tag(buffer1, NULL, "style", PANGO_STYLE_ITALIC, NULL);
+    GtkTextTag *center = gtk_text_buffer_create_tag(buffer1, NULL, "justification", GTK_JUSTIFY_CENTER, NULL);
+    GtkTextTag *yellow = gtk_text_buffer_create_tag(buffer1, NULL, "background", "yellow", NULL);
+    GtkTextTag *large = gtk_text_buffer_create_tag(buffer1, NULL, "size-points", 18.0, NULL);
+
+    gtk_text_buffer_set_text(buffer1, "abcdef\nsecond\nthird", -1);
+    GtkTextIter start, end;
+    gtk_text_buffer_get_iter_at_offset(buffer1, &start, 7);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &end, 9);
+    gtk_text_buffer_apply_tag(buffer1, yellow, &start, &end);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &start, 14);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &end, 16);
+    gtk_text_buffer_apply_tag(buffer1, large, &start, &end);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &start, 0);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &end, 4);
+    gtk_text_buffer_apply_tag(buffer1, bold, &start, &end);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &start, 2);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &end, 6);
+    gtk_text_buffer_apply_tag(buffer1, italic, &start, &end);
+    gtk_text_buffer_get_iter_at_offset(buffer1, &start, 0);
+    gtk_text_buffer_get_iter_at_line(buffer1, &end, 2);
+    gtk_text_buffer_apply_tag(buffer1, center, &start, &end);
+
+    rtf_text_buffer_set_export_flags(buffer1, RTF_EXPORT_COMPACT);
+    g_autofree char *string = rtf_text_buffer_export_to_string(buffer1);
+    g_assert_null(strstr(string, "}{"));
+    g_assert_null(strstr(string, "{\\pard"));
+    g_assert_cmpuint(count_occurrences(string, "\\qc"), ==, 1);
+    g_assert_cmpuint(count_occurrences(string, "\\b0"), ==, 1);
+    g_assert_cmpuint(count_occurrences(string, "\\i0"), ==, 1);
+
+    g_assert_true(rtf_text_buffer_import_from_string(buffer2, string, &error));
+    g_assert_no_error(error);
+
+    GtkTextIter iter1, iter2;
+    gtk_text_buffer_get_bounds(buffer2, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer2, &start, &end, true);
+    g_assert_cmpstr(text, ==, "abcdef\nsecond\nthird");
+    bool is_bold, is_italic;
+    get_bold_italic(buffer2, 1, &is_bold, &is_italic);
+    g_assert_true(is_bold && !is_italic);
+    get_bold_italic(buffer2, 3, &is_bold, &is_italic);
+    g_assert_true(is_bold && is_italic);
+    get_bold_italic(buffer2, 5, &is_bold, &is_italic);
+    g_assert_true(!is_bold && is_italic);
+    get_bold_italic(buffer2, 8, &is_bold, &is_italic);
+    g_assert_true(!is_bold && !is_italic);
+
+    /* Colors and sizes are ended with \plain, not set to color 0 or 12 pt */
+    g_assert_true(has_tag_property(buffer2, 7, "background-set"));
+    g_assert_false(has_tag_property(buffer2, 10, "background-set"));
+    g_assert_false(has_tag_property(buffer2, 10, "foreground-set"));
+    g_assert_true(has_tag_property(buffer2, 14, "size-set"));
+    g_assert_false(has_tag_property(buffer2, 17, "size-set"));
+
+    GtkTextAttributes *values = gtk_text_attributes_new();
+    gtk_text_buffer_get_iter_at_line(buffer2, &iter1, 1);
+    gtk_text_iter_get_attributes(&iter1, values);
+    g_assert_cmpint(values->justification, ==, GTK_JUSTIFY_CENTER);
+    gtk_text_attributes_unref(values);
+    values = gtk_text_attributes_new();
+    gtk_text_buffer_get_iter_at_line(buffer2, &iter2, 2);
+    gtk_text_iter_get_attributes(&iter2, values);
+    g_assert_cmpint(values->justification, ==, GTK_JUSTIFY_LEFT);
+    gtk_text_attributes_unref(values);
+}
+
+/* This test checks that special characters are escaped, and that the text
+survives a round trip. */
+static void
+rtf_escape_case(void)
+{
+    const char *text = "Plain ASCII text long enough for a few chunks, {braced}\\slashed\t"
+        "caf\u00e9 \u00a0\u2014\u4e2d.";
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer1 = gtk_text_buffer_new(NULL);
+    g_autoptr(GtkTextBuffer) buffer2 = gtk_text_buffer_new(NULL);
+    gtk_text_buffer_set_text(buffer1, text, -1);
+
+    g_autofree char *code = rtf_text_buffer_export_to_string(buffer1);
+    g_assert_nonnull(strstr(code, "\\{braced\\}\\\\slashed\\tab"));
+    g_assert_nonnull(strstr(code, "caf\\'E9"));
+    g_assert_nonnull(strstr(code, "\\~\\emdash"));
+    g_assert_nonnull(strstr(code, "\\u20013"));
+
+    g_assert_true(rtf_text_buffer_import_from_string(buffer2, code, &error));
+    g_assert_no_error(error);
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer2, &start, &end);
+    g_autofree char *text2 = gtk_text_buffer_get_text(buffer2, &start, &end, true);
+    g_assert_cmpstr(text2, ==, text);
+}
+
+/* This test checks that a buffer with more colors than used to fit in the
+color table can be exported. */
+static void
+rtf_many_colors_case(void)
+{
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+
+    for (int count = 1; count <= 300; count++) {
+        GdkRGBA color = { (count & 0xff) / 255.0, (count >> 8) / 255.0, 0.5, 1.0 };
+        GtkTextTag *tag = gtk_text_buffer_create_tag(buffer, NULL, "foreground-rgba", &color, NULL);
+        gtk_text_buffer_insert_with_tags(buffer, &iter, "x", -1, tag, NULL);
+    }
+
+    g_autofree char *code = rtf_text_buffer_export_to_string(buffer);
+    g_assert_nonnull(strstr(code, "\\cf300"));
+    g_assert_null(strstr(code, "\\cf301"));
+}
+
+/* Import the RTF code in bytes into a new buffer, and return its text */
+static char *
+reimport_text(GBytes *bytes)
+{
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    GError *error = NULL;
+    g_autofree char *code = g_strndup(g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes));
+    g_assert_true(rtf_text_buffer_import_from_string(buffer, code, &error));
+    g_assert_no_error(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    return gtk_text_buffer_get_text(buffer, &start, &end, true);
+}
+
+/* This test exports a buffer long enough to be written in several blocks, in
+both modes, and checks that the formatting survives the joins between blocks */
+static void
+rtf_many_blocks_case(void)
+{
+    g_autoptr(GtkTextBuffer) buffer1 = gtk_text_buffer_new(NULL);
+    GtkTextTag *bold = gtk_text_buffer_create_tag(buffer1, NULL, "weight", PANGO_WEIGHT_BOLD, NULL);
+    GtkTextIter start, end;
+    gtk_text_buffer_get_start_iter(buffer1, &end);
+    for (int count = 0; count < 3000; count++) {
+        g_autofree char *line = g_strdup_printf("Paragraph number %d\n", count);
+        if (count % 3 == 0)
+            gtk_text_buffer_insert_with_tags(buffer1, &end, line, -1, bold, NULL);
+        else
+            gtk_text_buffer_insert(buffer1, &end, line, -1);
+    }
+    gtk_text_buffer_get_bounds(buffer1, &start, &end);
+    g_autofree char *text1 = gtk_text_buffer_get_text(buffer1, &start, &end, true);
+
+    RtfExportFlags modes[] = { RTF_EXPORT_DEFAULT, RTF_EXPORT_COMPACT };
+    for (unsigned ix = 0; ix < G_N_ELEMENTS(modes); ix++) {
+        GError *error = NULL;
+        g_autoptr(GtkTextBuffer) buffer2 = gtk_text_buffer_new(NULL);
+        rtf_text_buffer_set_export_flags(buffer1, modes[ix]);
+        g_autofree char *string = rtf_text_buffer_export_to_string(buffer1);
+        g_assert_true(rtf_text_buffer_import_from_string(buffer2, string, &error));
+        g_assert_no_error(error);
+
+        gtk_text_buffer_get_bounds(buffer2, &start, &end);
+        g_autofree char *text2 = gtk_text_buffer_get_text(buffer2, &start, &end, true);
+        g_assert_cmpstr(text1, ==, text2);
+        for (int line = 0; line < 3000; line += 7) {
+            gtk_text_buffer_get_iter_at_line(buffer2, &start, line);
+            bool is_bold, is_italic;
+            get_bold_italic(buffer2, gtk_text_iter_get_offset(&start), &is_bold, &is_italic);
+            g_assert_true(is_bold == (line % 3 == 0));
+        }
+    }
+}
+
+/* Check that the exporter's RTF code has the same text as that of a complete
+export */
+static void
+check_exporter_text(RtfExporter *exporter, GtkTextBuffer *buffer, const char *expected)
+{
+    g_autoptr(GBytes) bytes1 = rtf_exporter_export(exporter);
+    g_autoptr(GBytes) bytes2 = rtf_text_buffer_export_to_bytes(buffer);
+    g_autofree char *text1 = reimport_text(bytes1);
+    g_autofree char *text2 = reimport_text(bytes2);
+    g_assert_cmpstr(text1, ==, text2);
+    g_assert_nonnull(strstr(text1, expected));
+}
+
+/* This test checks that an RtfExporter picks up changes to the text and to the
+tags between exports. */
+static void
+rtf_exporter_case(void)
+{
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    GtkTextTag *bold = gtk_text_buffer_create_tag(buffer, NULL, "weight", PANGO_WEIGHT_BOLD, NULL);
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    gtk_text_buffer_insert(buffer, &iter, "one\n\ntwo\n", -1);
+    gtk_text_buffer_insert_with_tags(buffer, &iter, "three", -1, bold, NULL);
+    gtk_text_buffer_insert(buffer, &iter, "\nfour", -1);
+
+    RtfExporter *exporter = rtf_exporter_new(buffer);
+
+    check_exporter_text(exporter, buffer, "two\nthree\nfour");
+
+    gtk_text_buffer_get_iter_at_line(buffer, &iter, 2);
+    gtk_text_buffer_insert(buffer, &iter, "and ", -1);
+    GtkTextIter start, end;
+    gtk_text_buffer_get_iter_at_line(buffer, &start, 3);
+    end = start;
+    gtk_text_iter_backward_char(&start);
+    gtk_text_buffer_delete(buffer, &start, &end);
+    check_exporter_text(exporter, buffer, "and twothree\nfour");
+
+    g_object_set(bold, "weight", PANGO_WEIGHT_NORMAL, NULL);
+    g_autoptr(GBytes) bytes3 = rtf_exporter_export(exporter);
+    g_autofree char *code3 = g_strndup(g_bytes_get_data(bytes3, NULL), g_bytes_get_size(bytes3));
+    g_assert_nonnull(strstr(code3, "\\b0"));
+
+    rtf_exporter_free(exporter);
+}
+
+/* This test checks that a document written with RtfWriter, without a text
+buffer, can be imported with its formatting and picture. */
+static void
+rtf_headless_writer_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, 8, 8);
+    gdk_pixbuf_fill(pixbuf, 0x336699ff);
+    g_autofree char *png = NULL;
+    gsize png_length;
+    g_assert_true(gdk_pixbuf_save_to_buffer(pixbuf, &png, &png_length, "png", &error, NULL));
+    g_assert_no_error(error);
+
+    RtfWriter *writer = rtf_writer_new();
+    RtfParagraphAttributes centered = { .alignment = RTF_ALIGNMENT_CENTER };
+    rtf_writer_begin_paragraph(writer, &centered);
+    RtfRunAttributes bold_red = { .bold = true, .foreground = "#ff0000" };
+    rtf_writer_push_format(writer, &bold_red);
+    rtf_writer_text(writer, "Hello {world}", -1);
+    rtf_writer_pop_format(writer);
+    rtf_writer_text(writer, " plain", -1);
+    rtf_writer_begin_paragraph(writer, NULL);
+    RtfPictureInfo info = { RTF_PICTURE_PNG, 8, 8, -1, -1, 100, 100 };
+    rtf_writer_picture(writer, &info, (const guint8 *)png, png_length, false);
+    g_autoptr(GBytes) bytes = rtf_writer_finish(writer);
+
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    g_autofree char *code = g_strndup(g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes));
+    g_assert_true(rtf_text_buffer_import_from_string(buffer, code, &error));
+    g_assert_no_error(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer, &start, &end, true);
+    g_assert_cmpstr(text, ==, "Hello {world} plain\n");
+    bool is_bold, is_italic;
+    get_bold_italic(buffer, 1, &is_bold, &is_italic);
+    g_assert_true(is_bold);
+    get_bold_italic(buffer, 15, &is_bold, &is_italic);
+    g_assert_false(is_bold);
+
+    GtkTextAttributes *values = gtk_text_attributes_new();
+    gtk_text_iter_get_attributes(&start, values);
+    g_assert_cmpint(values->justification, ==, GTK_JUSTIFY_CENTER);
+    gtk_text_attributes_unref(values);
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_line(buffer, &iter, 1);
+    GdkPixbuf *imported = gtk_text_iter_get_pixbuf(&iter);
+    g_assert_nonnull(imported);
+    g_assert_cmpint(gdk_pixbuf_get_width(imported), ==, 8);
+
+    writer = rtf_writer_new();
+    rtf_writer_text(writer, "streamed", -1);
+    g_autoptr(GOutputStream) stream = g_memory_output_stream_new_resizable();
+    g_assert_true(rtf_writer_finish_to_stream(writer, stream, NULL, &error));
+    g_assert_no_error(error);
+    g_assert_true(g_output_stream_close(stream, NULL, &error));
+    g_autoptr(GBytes) streamed = g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(stream));
+    g_assert_true(g_str_has_prefix(g_bytes_get_data(streamed, NULL), "{\\rtf1"));
+    g_autofree char *text2 = reimport_text(streamed);
+    g_assert_cmpstr(text2, ==, "streamed");
+}
+
+/* This test checks that a streaming writer writes its output as it goes, with
+the fonts and colors that were declared before the first paragraph */
+static void
+rtf_streaming_writer_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GOutputStream) stream = g_memory_output_stream_new_resizable();
+    RtfWriter *writer = rtf_writer_new_for_stream(stream, NULL);
+    rtf_writer_declare_font(writer, "Serif");
+    rtf_writer_declare_color(writer, "#ff0000");
+
+    g_autoptr(GString) expected = g_string_new("");
+    RtfRunAttributes red_serif = { .font_family = "Serif", .foreground = "#ff0000" };
+    for (int count = 0; count < 5000; count++) {
+        g_autofree char *line = g_strdup_printf("Paragraph number %d", count);
+        rtf_writer_begin_paragraph(writer, NULL);
+        rtf_writer_push_format(writer, &red_serif);
+        rtf_writer_text(writer, line, -1);
+        rtf_writer_pop_format(writer);
+        if (count > 0)
+            g_string_append_c(expected, '\n');
+        g_string_append(expected, line);
+    }
+    g_assert_cmpuint(g_memory_output_stream_get_data_size(G_MEMORY_OUTPUT_STREAM(stream)), >, 0);
+    g_assert_true(rtf_writer_finish_to_stream(writer, stream, NULL, &error));
+    g_assert_no_error(error);
+
+    GMemoryOutputStream *memory = G_MEMORY_OUTPUT_STREAM(stream);
+    const char *code = g_memory_output_stream_get_data(memory);
+    gsize length = g_memory_output_stream_get_data_size(memory);
+    g_autofree char *head = g_strndup(code, 200);
+    g_assert_nonnull(strstr(head, "{\\f0\\fnil Serif;}"));
+    g_assert_nonnull(strstr(head, "\\red255\\green0\\blue0;"));
+
+    g_autofree char *extracted = rtf_extract_text(code, length, &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(extracted, ==, expected->str);
+}
+
+/* This test checks that long runs of text are broken into lines at spaces, and
+that the text is unchanged by that */
+static void
+rtf_line_breaking_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GString) text = g_string_new("");
+    for (int count = 0; count < 100; count++)
+        g_string_append_printf(text, "word%d ", count);
+    g_string_append(text, "unbreakable-unbreakable-unbreakable-unbreakable-unbreakable end");
+
+    RtfWriter *writer = rtf_writer_new();
+    rtf_writer_begin_paragraph(writer, NULL);
+    rtf_writer_text(writer, text->str, -1);
+    g_autoptr(GBytes) bytes = rtf_writer_finish(writer);
+    g_autofree char *code = g_strndup(g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes));
+
+    g_auto(GStrv) lines = g_strsplit(code, "\n", -1);
+    for (char **line = lines; *line; line++) {
+        if (strstr(*line, "unbreakable") == NULL && strstr(*line, "word") != NULL)
+            g_assert_cmpuint(strlen(*line), <=, 60);
+    }
+
+    g_autofree char *extracted = rtf_extract_text(code, -1, &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(extracted, ==, text->str);
+}
+
+/* This test checks that a template's merge fields and markers are filled in
+with escaped values, and that everything else is left as it was. */
+static void
+rtf_template_case(void)
+{
+    static const char *code = "{\\rtf1\\ansi{\\fonttbl{\\f0 Sans;}}\\pard\\b Dear "
+        "{\\field{\\*\\fldinst { MERGEFIELD FirstName \\\\* MERGEFORMAT }}{\\fldrslt {\\'abFirstName\\'bb}}}, "
+        "your balance is \\{\\{balance\\}\\}. "
+        "{\\field{\\*\\fldinst HYPERLINK \"http://example.com\"}{\\fldrslt link}} "
+        "{\\field{\\*\\fldinst DOCVARIABLE \"FirstName\"}{\\fldrslt x}} \\{\\{missing\\}\\}}";
+    GError *error = NULL;
+
+    RtfTemplate *tmpl = rtf_template_new(code, -1, &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(tmpl);
+    const char * const *names = rtf_template_get_field_names(tmpl);
+    g_assert_cmpstr(names[0], ==, "FirstName");
+    g_assert_cmpstr(names[1], ==, "balance");
+    g_assert_cmpstr(names[2], ==, "missing");
+    g_assert_null(names[3]);
+
+    g_autoptr(GHashTable) values = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(values, "FirstName", "Zo\u00eb {\\x}");
+    g_hash_table_insert(values, "balance", "42");
+
+    g_autoptr(GBytes) bytes = rtf_template_render(tmpl, values);
+    g_autofree char *rendered = g_strndup(g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes));
+    g_assert_null(strstr(rendered, "MERGEFIELD"));
+    g_assert_nonnull(strstr(rendered, "HYPERLINK"));
+    g_autofree char *text = rtf_extract_text(rendered, -1, &error);
+    g_assert_no_error(error);
+    g_assert_cmpstr(text, ==, "Dear Zo\u00eb {\\x}, your balance is 42. link Zo\u00eb {\\x} {{missing}}");
+
+    g_autoptr(GOutputStream) stream = g_memory_output_stream_new_resizable();
+    g_assert_true(rtf_template_render_to_stream(tmpl, values, stream, NULL, &error));
+    g_assert_no_error(error);
+    g_assert_true(g_output_stream_close(stream, NULL, &error));
+    g_autoptr(GBytes) streamed = g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(stream));
+    g_assert_true(g_bytes_equal(bytes, streamed));
+    rtf_template_free(tmpl);
+
+    g_assert_null(rtf_template_new("{\\rtf1 {\\field", -1, &error));
+    g_assert_error(error, RTF_ERROR, RTF_ERROR_MISSING_BRACE);
+    g_clear_error(&error);
+}
+
+/* Render a template with one field, named name, and return the extracted text */
+static char *
+render_one_field(const char *code, const char *value, char **rendered)
+{
+    GError *error = NULL;
+    RtfTemplate *tmpl = rtf_template_new(code, -1, &error);
+    g_assert_no_error(error);
+
+    g_autoptr(GHashTable) values = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(values, "name", (char *)value);
+    g_autoptr(GBytes) bytes = rtf_template_render(tmpl, values);
+    rtf_template_free(tmpl);
+
+    *rendered = g_strndup(g_bytes_get_data(bytes, NULL), g_bytes_get_size(bytes));
+    char *text = rtf_extract_text(*rendered, -1, &error);
+    g_assert_no_error(error);
+    return text;
+}
+
+/* This test checks that values are filled in correctly whatever the
+template's code page and \uc are, and keep the formatting of the field's
+result. */
+static void
+rtf_template_encoding_case(void)
+{
+    g_autofree char *rendered = NULL;
+    g_autofree char *text = render_one_field("{\\rtf1\\ansi Cost: \\{\\{name\\}\\}!}", "\u20ac5", &rendered);
+    g_assert_cmpstr(text, ==, "Cost: \u20ac5!");
+    g_clear_pointer(&rendered, g_free);
+    g_clear_pointer(&text, g_free);
+
+    text = render_one_field("{\\rtf1\\ansi\\ansicpg1251\\uc2 \\{\\{name\\}\\}x}", "Caf\u00e9 \u0416", &rendered);
+    g_assert_cmpstr(text, ==, "Caf\u00e9 \u0416x");
+    g_assert_null(strchr(rendered, '\''));
+    g_clear_pointer(&rendered, g_free);
+    g_clear_pointer(&text, g_free);
+
+    text = render_one_field("{\\rtf1\\ansi {\\field{\\*\\fldinst MERGEFIELD name}"
+        "{\\fldrslt {\\b\\fs28 \\'abname\\'bb}}}.}", "Zo\u00eb", &rendered);
+    g_assert_cmpstr(text, ==, "Zo\u00eb.");
+    g_assert_nonnull(strstr(rendered, "{\\uc0 \\b\\fs28 Zo\\u235 }"));
+
+    /* Binary data with NUL bytes in it is copied as it is */
+    static const char binary[] = "{\\rtf1 {\\*\\logo \\bin3 \0a\0}\\{\\{name\\}\\}}";
+    GError *error = NULL;
+    RtfTemplate *tmpl = rtf_template_new(binary, sizeof(binary) - 1, &error);
+    g_assert_no_error(error);
+    g_autoptr(GHashTable) values = g_hash_table_new(g_str_hash, g_str_equal);
+    g_hash_table_insert(values, "name", "x");
+    g_autoptr(GBytes) bytes = rtf_template_render(tmpl, values);
+    rtf_template_free(tmpl);
+    size_t length;
+    const char *data = g_bytes_get_data(bytes, &length);
+    const char *payload = g_strstr_len(data, length, "\\bin3 ") + strlen("\\bin3 ");
+    g_assert_cmpint(memcmp(payload, "\0a\0", 3), ==, 0);
+}
+
+/* This test checks that binary data in a destination that doesn't understand
+it is skipped, even if it contains braces and backslashes. */
+static void
+rtf_binary_skip_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+
+    g_assert_true(rtf_text_buffer_import_from_string(buffer, "{\\rtf1 a{\\*\\foo \\bin4 }{\\\\}b}", &error));
+    g_assert_no_error(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer, &start, &end, true);
+    g_assert_cmpstr(text, ==, "ab");
+
+    g_assert_false(rtf_text_buffer_import_from_string(buffer, "{\\rtf1 \\bin99 }", &error));
+    g_assert_error(error, RTF_ERROR, RTF_ERROR_INVALID_RTF);
+    g_clear_error(&error);
+}
+
+/* Export a pixbuf of the given size, and return the RTF code */
+static char *
+export_picture(int width, int height)
+{
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, width, height);
+    gdk_pixbuf_fill(pixbuf, 0x336699ff);
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    gtk_text_buffer_insert_pixbuf(buffer, &iter, pixbuf);
+    return rtf_text_buffer_export_to_string(buffer);
+}
+
+/* Import RTF code and return the size of the picture at the start of it */
+static void
+import_picture_size(GtkTextBuffer *buffer, const char *string, int *width, int *height)
+{
+    GError *error = NULL;
+    if (!rtf_text_buffer_import_from_string(buffer, string, &error))
+        g_test_message("Import error message: %s", error->message);
+    g_assert_no_error(error);
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer, &iter);
+    GdkPixbuf *picture = gtk_text_iter_get_pixbuf(&iter);
+    g_assert_nonnull(picture);
+    *width = gdk_pixbuf_get_width(picture);
+    *height = gdk_pixbuf_get_height(picture);
+}
+
+/* This test checks that pictures are imported at the size given by the scale
+control words, and are shrunk to fit within the maximum picture size. */
+static void
+rtf_picture_size_case(void)
+{
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    g_autofree char *string = export_picture(64, 32);
+    int width, height;
+
+    import_picture_size(buffer, string, &width, &height);
+    g_assert_cmpint(width, ==, 64);
+    g_assert_cmpint(height, ==, 32);
+
+    g_auto(GStrv) parts = g_strsplit(string, "\\pngblip", 2);
+    g_autofree char *scaled = g_strjoin("\\pngblip\\picscalex50\\picscaley200", parts[0], parts[1], NULL);
+    import_picture_size(buffer, scaled, &width, &height);
+    g_assert_cmpint(width, ==, 32);
+    g_assert_cmpint(height, ==, 64);
+
+    rtf_text_buffer_set_max_picture_size(buffer, 16, 0);
+    int max_width, max_height;
+    rtf_text_buffer_get_max_picture_size(buffer, &max_width, &max_height);
+    g_assert_cmpint(max_width, ==, 16);
+    g_assert_cmpint(max_height, ==, 0);
+    import_picture_size(buffer, string, &width, &height);
+    g_assert_cmpint(width, ==, 16);
+    g_assert_cmpint(height, ==, 8);
+}
+
+/* This test imports a picture in asynchronous picture mode, and checks that a
+placeholder is inserted at first and replaced by the picture later. */
+static void
+rtf_async_picture_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    g_autofree char *picture = export_picture(64, 32);
+    g_autofree char *string = g_strconcat("{\\rtf1 before", strchr(picture + 1, '{'), NULL);
+
+    rtf_text_buffer_set_import_flags(buffer, RTF_IMPORT_ASYNC_PICTURES);
+    g_assert_cmpint(rtf_text_buffer_get_import_flags(buffer), ==, RTF_IMPORT_ASYNC_PICTURES);
+    g_assert_true(rtf_text_buffer_import_from_string(buffer, string, &error));
+    g_assert_no_error(error);
+
+    /* The text is there, and the picture is still pending */
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, 6);
+    g_assert_nonnull(gtk_text_iter_get_child_anchor(&iter));
+    g_assert_null(gtk_text_iter_get_pixbuf(&iter));
+
+    while (gtk_text_iter_get_child_anchor(&iter)) {
+        g_main_context_iteration(NULL, true);
+        gtk_text_buffer_get_iter_at_offset(buffer, &iter, 6);
+    }
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer, &start, &end, true);
+    g_assert_cmpstr(text, ==, "before");
+    GdkPixbuf *pixbuf = gtk_text_iter_get_pixbuf(&iter);
+    g_assert_nonnull(pixbuf);
+    g_assert_cmpint(gdk_pixbuf_get_width(pixbuf), ==, 64);
+    g_assert_cmpint(gdk_pixbuf_get_height(pixbuf), ==, 32);
+}
+
+static void
+on_async_finished(GtkTextBuffer *buffer, GAsyncResult *result, GAsyncResult **result_out)
+{
+    *result_out = g_object_ref(result);
+}
+
+static void
+wait_for_result(GAsyncResult **result)
+{
+    while (*result == NULL)
+        g_main_context_iteration(NULL, true);
+}
+
+/* Insert length bytes of string, or all of it if length is -1, into buffer at
+offset with rtf_text_buffer_insert_async(), and wait for it to finish */
+static gboolean
+insert_async(GtkTextBuffer *buffer, int offset, const char *string, gssize length, GCancellable *cancellable, GError **error)
+{
+    g_autoptr(GAsyncResult) result = NULL;
+    GtkTextIter iter;
+
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, offset);
+    rtf_text_buffer_insert_async(buffer, &iter, string, length, cancellable, (GAsyncReadyCallback)on_async_finished, &result);
+    wait_for_result(&result);
+    return rtf_text_buffer_insert_finish(buffer, result, error);
+}
+
+/* This test checks that a document is inserted in the middle of a buffer a
+little at a time, and that nothing is inserted if the insertion is cancelled
+before it starts or the document can't be parsed. */
+static void
+rtf_insert_async_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    g_autoptr(GString) string = g_string_new("{\\rtf1 ");
+    g_autoptr(GString) expected = g_string_new("before");
+
+    for (int count = 0; count < 5000; count++) {
+        g_string_append_printf(string, "{\\b %d}\\par\n", count);
+        g_string_append_printf(expected, "%d\n", count);
+    }
+    g_string_append_c(string, '}');
+    g_string_append(expected, "after");
+
+    gtk_text_buffer_set_text(buffer, "beforeafter", -1);
+    g_assert_true(insert_async(buffer, 6, string->str, -1, NULL, &error));
+    g_assert_no_error(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer, &start, &end, true);
+    g_assert_cmpstr(text, ==, expected->str);
+
+    GtkTextTag *bold = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(buffer), "rtf-bold");
+    g_assert_nonnull(bold);
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 6);
+    g_assert_true(gtk_text_iter_has_tag(&start, bold));
+
+    g_autoptr(GCancellable) cancellable = g_cancellable_new();
+    g_cancellable_cancel(cancellable);
+    gtk_text_buffer_set_text(buffer, "existing", -1);
+    g_assert_false(insert_async(buffer, 0, string->str, -1, cancellable, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    g_clear_error(&error);
+
+    g_assert_false(insert_async(buffer, 0, "{\\rtf1 Hello {\\b world}", -1, NULL, &error));
+    g_assert_nonnull(error);
+    g_clear_error(&error);
+
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree char *unchanged = gtk_text_buffer_get_text(buffer, &start, &end, true);
+    g_assert_cmpstr(unchanged, ==, "existing");
+
+    /* A \bin picture's PNG data contains NUL bytes, which must survive */
+    g_autoptr(GtkTextBuffer) picture_buffer = gtk_text_buffer_new(NULL);
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, 16, 16);
+    gdk_pixbuf_fill(pixbuf, 0x336699ff);
+    gtk_text_buffer_get_start_iter(picture_buffer, &start);
+    gtk_text_buffer_insert_pixbuf(picture_buffer, &start, pixbuf);
+    rtf_text_buffer_set_export_flags(picture_buffer, RTF_EXPORT_BINARY_PICTURES);
+    g_autoptr(GBytes) bytes = rtf_text_buffer_export_to_bytes(picture_buffer);
+    size_t length;
+    const char *data = g_bytes_get_data(bytes, &length);
+    g_assert_nonnull(memchr(data, '\0', length));
+
+    gtk_text_buffer_set_text(buffer, "", -1);
+    g_assert_true(insert_async(buffer, 0, data, length, NULL, &error));
+    g_assert_no_error(error);
+    gtk_text_buffer_get_start_iter(buffer, &start);
+    GdkPixbuf *picture = gtk_text_iter_get_pixbuf(&start);
+    g_assert_nonnull(picture);
+    g_assert_cmpint(gdk_pixbuf_get_width(picture), ==, 16);
+    g_assert_cmpint(gdk_pixbuf_get_height(picture), ==, 16);
+}
+
+/* This test checks that a buffer can be exported to a file and imported again
+without blocking, and that a cancelled import leaves the buffer unchanged. */
+static void
+rtf_file_async_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer1 = gtk_text_buffer_new(NULL);
+    g_autoptr(GtkTextBuffer) buffer2 = gtk_text_buffer_new(NULL);
+    g_autoptr(GdkPixbuf) pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, false, 8, 16, 16);
+    gdk_pixbuf_fill(pixbuf, 0x00ff00ff);
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_start_iter(buffer1, &iter);
+    gtk_text_buffer_insert(buffer1, &iter, "before", -1);
+    gtk_text_buffer_insert_pixbuf(buffer1, &iter, pixbuf);
+    gtk_text_buffer_insert(buffer1, &iter, "after", -1);
+
+    g_autoptr(GFileIOStream) stream = NULL;
+    g_autoptr(GFile) file = g_file_new_tmp("ratify-XXXXXX.rtf", &stream, &error);
+    g_assert_no_error(error);
+
+    g_autoptr(GAsyncResult) export_result = NULL;
+    rtf_text_buffer_export_file_async(buffer1, file, G_PRIORITY_DEFAULT, NULL, (GAsyncReadyCallback)on_async_finished, &export_result);
+    /* The buffer has already been read */
+    gtk_text_buffer_set_text(buffer1, "changed", -1);
+    wait_for_result(&export_result);
+    g_assert_true(rtf_text_buffer_export_file_finish(buffer1, export_result, &error));
+    g_assert_no_error(error);
+
+    g_autoptr(GAsyncResult) import_result = NULL;
+    rtf_text_buffer_import_file_async(buffer2, file, G_PRIORITY_DEFAULT, NULL, (GAsyncReadyCallback)on_async_finished, &import_result);
+    wait_for_result(&import_result);
+    g_assert_true(rtf_text_buffer_import_file_finish(buffer2, import_result, &error));
+    g_assert_no_error(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer2, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer2, &start, &end, true);
+    g_assert_cmpstr(text, ==, "beforeafter");
+    gtk_text_buffer_get_iter_at_offset(buffer2, &iter, 6);
+    GdkPixbuf *picture = gtk_text_iter_get_pixbuf(&iter);
+    g_assert_nonnull(picture);
+    g_assert_cmpint(gdk_pixbuf_get_width(picture), ==, 16);
+
+    g_autoptr(GCancellable) cancellable = g_cancellable_new();
+    g_cancellable_cancel(cancellable);
+    g_autoptr(GAsyncResult) cancelled_result = NULL;
+    rtf_text_buffer_import_file_async(buffer1, file, G_PRIORITY_DEFAULT, cancellable, (GAsyncReadyCallback)on_async_finished, &cancelled_result);
+    wait_for_result(&cancelled_result);
+    g_assert_false(rtf_text_buffer_import_file_finish(buffer1, cancelled_result, &error));
+    g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+    g_clear_error(&error);
+    g_file_delete(file, NULL, NULL);
+
+    gtk_text_buffer_get_bounds(buffer1, &start, &end);
+    g_autofree char *unchanged = gtk_text_buffer_get_text(buffer1, &start, &end, true);
+    g_assert_cmpstr(unchanged, ==, "changed");
+}
+
+/* This test checks that a picture in an RTFD package is found relative to the
+package, without changing the current directory of the process. */
+static void
+rtf_relative_picture_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    g_autofree char *filename = build_filename("rtfdtest.rtfd");
+    g_autofree char *cwd = g_get_current_dir();
+
+    g_assert_true(rtf_text_buffer_import(buffer, filename, &error));
+    g_assert_no_error(error);
+
+    g_autofree char *cwd_after = g_get_current_dir();
+    g_assert_cmpstr(cwd_after, ==, cwd);
+
+    GtkTextIter iter;
+    gtk_text_buffer_get_iter_at_offset(buffer, &iter, 6);
+    g_assert_nonnull(gtk_text_iter_get_pixbuf(&iter));
+}
+
+/* This test imports a document that is large enough to be parsed in several
+pieces on multi-core machines, with formatting and footnote numbers that carry
+over from one piece to the next, and checks that the result is the same as
+parsing it in one piece. */
+static void
+rtf_large_document_case(void)
+{
+    const char *extras[] = {
+        "",
+        "{\\super\\chftn}{\\footnote{\\super\\chftn} n1}",
+        "",
+        "\\b ",
+        "\\u8364 x",
+        "{\\super\\chftn}{\\footnote{\\super\\chftn} n5}"
+    };
+    GError *error = NULL;
+    g_autofree char *junk = g_strnfill(3 * 1024 * 1024, 'x');
+    g_autoptr(GString) rtf = g_string_new("{\\rtf1\\ansi{\\fonttbl{\\f0 Times;}}\n");
+    for (unsigned ix = 0; ix < G_N_ELEMENTS(extras); ix++)
+        g_string_append_printf(rtf, "\\pard\\plain p%u%s{\\*\\junk %s}\\par\n", ix, extras[ix], junk);
+    g_string_append_c(rtf, '}');
+
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+    g_assert_true(rtf_text_buffer_import_from_string(buffer, rtf->str, &error));
+    g_assert_no_error(error);
+    g_autofree char *extracted = rtf_extract_text(rtf->str, rtf->len, &error);
+    g_assert_no_error(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer, &start, &end, true);
+    g_assert_cmpstr(text, ==, extracted);
+    g_assert_true(g_str_has_prefix(text, "p0\np11\np2\np3\np4\u20ac\np52\n"));
+
+    GtkTextTag *bold = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(buffer), "rtf-bold");
+    g_assert_nonnull(bold);
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, g_utf8_pointer_to_offset(text, strstr(text, "p3")));
+    g_assert_true(gtk_text_iter_has_tag(&start, bold));
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, g_utf8_pointer_to_offset(text, strstr(text, "p4")));
+    g_assert_false(gtk_text_iter_has_tag(&start, bold));
+}
+
+/* This test checks that each stretch of text gets its own formatting, and that
+footnotes end up after the rest of the document. */
+static void
+rtf_runs_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+
+    g_assert_true(rtf_text_buffer_import_from_string(buffer, "{\\rtf1 a{\\b b}c{\\footnote note}d}", &error));
+    g_assert_no_error(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer, &start, &end, true);
+    g_assert_cmpstr(text, ==, "abcd\nnote");
+
+    GtkTextTag *bold = gtk_text_tag_table_lookup(gtk_text_buffer_get_tag_table(buffer), "rtf-bold");
+    g_assert_nonnull(bold);
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 0);
+    g_assert_false(gtk_text_iter_has_tag(&start, bold));
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 1);
+    g_assert_true(gtk_text_iter_has_tag(&start, bold));
+    gtk_text_buffer_get_iter_at_offset(buffer, &start, 2);
+    g_assert_false(gtk_text_iter_has_tag(&start, bold));
+}
+
+/* This test checks that nothing is inserted into the buffer if the RTF code
+can't be parsed. */
+static void
+rtf_no_partial_import_case(void)
+{
+    g_autoptr(GError) error = NULL;
+    g_autoptr(GtkTextBuffer) buffer = gtk_text_buffer_new(NULL);
+
+    gtk_text_buffer_set_text(buffer, "existing", -1);
+    g_assert_false(rtf_text_buffer_import_from_string(buffer, "{\\rtf1 Hello {\\b world}", &error));
+    g_assert_nonnull(error);
+
+    GtkTextIter start, end;
+    gtk_text_buffer_get_bounds(buffer, &start, &end);
+    g_autofree char *text = gtk_text_buffer_get_text(buffer, &start, &end, true);
+    g_assert_cmpstr(text, ==, "existing");
+}
+
+/* Records the calls to the parse callbacks as a string */
+static void
+record_text(const char *text, gsize length, void *user_data)
+{
+    g_string_append_len(user_data, text, length);
+}
+
+static void
+record_run_attributes(const RtfRunAttributes *attributes, void *user_data)
+{
+    g_string_append(user_data, attributes->bold ? "<b>" : "<>");
+}
+
+static void
+record_paragraph_end(void *user_data)
+{
+    g_string_append(user_data, "<p>");
+}
+
+static void
+record_field(const char *type, const char *argument, void *user_data)
+{
+    g_string_append_printf(user_data, "<%s %s>", type, argument);
+}
+
+static void
+record_footnote_begin(void *user_data)
+{
+    g_string_append(user_data, "<fn>");
+}
+
+static void
+record_footnote_end(void *user_data)
+{
+    g_string_append(user_data, "</fn>");
+}
+
+/* This test checks that the parse callbacks are called in document order */
+static void
+rtf_parse_callbacks_case(void)
+{
+    GError *error = NULL;
+    g_autoptr(GString) record = g_string_new("");
+    const RtfParseCallbacks callbacks = {
+        .on_text = record_text,
+        .on_run_attributes = record_run_attributes,
+        .on_paragraph_end = record_paragraph_end,
+        .on_field = record_field,
+        .on_footnote_begin = record_footnote_begin,
+        .on_footnote_end = record_footnote_end
+    };
+
+    g_assert_true(rtf_parse("{\\rtf1 a{\\b b}\\par c{\\footnote d}"
+                            "{\\field{\\*\\fldinst HYPERLINK \"http://example.com\"}{\\fldrslt e}}}",
+                            -1, &callbacks, record, &error));
+    g_assert_no_error(error);
+    g_assert_cmpstr(record->str, ==, "<>a<b>b<><p>c<fn>d</fn><HYPERLINK http://example.com>e");
+
+    /* Text without attributes of its own, such as a PAGE field result or list
+    indentation, is reported with the attributes of the text after it */
+    const RtfParseCallbacks text_callbacks = {
+        .on_text = record_text,
+        .on_run_attributes = record_run_attributes,
+        .on_paragraph_end = record_paragraph_end
+    };
+    g_string_truncate(record, 0);
+    g_assert_true(rtf_parse("{\\rtf1 {\\b a}{\\field{\\*\\fldinst PAGE}{\\fldrslt 9}}c\\par {\\b \\ilvl1 d}}",
+                            -1, &text_callbacks, record, &error));
+    g_assert_no_error(error);
+    g_assert_cmpstr(record->str, ==, "<b>a<>1c<p><b>\td");
+}
+
+/* This test extracts the text from several files at once on two threads, and
+checks that each result is the same as extracting the text on its own. */
+static void
+rtf_extract_text_batch_case(void)
+{
+    const char *names[] = {
+        "p004_hello_world.rtf",
+        "p007_salvete_omnes.rtf",
+        "p027_grep.rtf",
+        "RtfInterpreterTest_13.rtf",
+        "nonexistent.rtf"
+    };
+    size_t n_files = G_N_ELEMENTS(names);
+    g_autoptr(GPtrArray) files = g_ptr_array_new_with_free_func(g_object_unref);
+    for (size_t ix = 0; ix < n_files; ix++) {
+        g_autofree char *filename = build_filename(names[ix]);
+        g_ptr_array_add(files, g_file_new_for_path(filename));
+    }
+
+    g_autoptr(GPtrArray) results = rtf_extract_text_batch((GFile **)files->pdata, n_files, 2, NULL);
+    g_assert_cmpuint(results->len, ==, n_files);
+
+    for (size_t ix = 0; ix < n_files - 1; ix++) {
+        RtfBatchResult *result = g_ptr_array_index(results, ix);
+        g_assert_true(result->file == g_ptr_array_index(files, ix));
+        g_assert_no_error(result->error);
+
+        GError *error = NULL;
+        g_autofree char *filename = build_filename(names[ix]);
+        g_autofree char *contents = NULL;
+        g_assert_true(g_file_get_contents(filename, &contents, NULL, &error));
+        g_autofree char *expected = rtf_extract_text(contents, -1, &error);
+        g_assert_no_error(error);
+        g_assert_cmpstr(result->text, ==, expected);
+    }
+
+    RtfBatchResult *result = g_ptr_array_index(results, n_files - 1);
+    g_assert_error(result->error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+    g_assert_null(result->text);
+}
+
 static void
 yes_clicked(GtkButton *button, bool *was_correct)
 {
@@ -350,6 +1589,7 @@ main(int argc, char **argv)
     add_tests(codeprojectfailcases, "/rtf/parse/fail/", rtf_fail_case);
     /* Other */
     add_tests(variousfailcases, "/rtf/parse/fail/", rtf_fail_case);
+    g_test_add_func("/rtf/parse/fail/No partial import", rtf_no_partial_import_case);
 
     /* Pass cases */
     /* Examples from 'RTF Pocket Guide' by Sean M. Burke */
@@ -358,6 +1598,10 @@ main(int argc, char **argv)
     add_tests(codeprojectpasscases, "/rtf/parse/pass/", rtf_parse_pass_case);
     /* Other */
     add_tests(variouspasscases, "/rtf/parse/pass/", rtf_parse_pass_case);
+    /* These tests compare the extracted text with the imported text */
+    add_tests(rtfbookexamples, "/rtf/extract/", rtf_extract_text_case);
+    add_tests(codeprojectpasscases, "/rtf/extract/", rtf_extract_text_case);
+    g_test_add_func("/rtf/extract/Skipped groups", rtf_skip_ignored_group_case);
     /* These tests export the RTF to a string and re-import it */
     add_tests(rtfbookexamples, "/rtf/write/", rtf_write_pass_case);
     add_tests(codeprojectpasscases, "/rtf/write/", rtf_write_pass_case);
@@ -365,6 +1609,34 @@ main(int argc, char **argv)
     /* RTFD tests */
     g_test_add_data_func("/rtf/parse/pass/RTFD test", "rtfdtest.rtfd", rtf_parse_pass_case);
     g_test_add_data_func("/rtf/write/RTFD test", "rtfdtest.rtfd", rtf_write_pass_case);
+    /* Picture larger than the streaming chunk size */
+    g_test_add_func("/rtf/write/Large picture", rtf_large_picture_case);
+    /* \binN pictures and skipping */
+    g_test_add_func("/rtf/write/Binary picture", rtf_binary_picture_case);
+    g_test_add_func("/rtf/write/Several pictures", rtf_several_pictures_case);
+    g_test_add_func("/rtf/write/Embedded objects", rtf_embedded_objects_case);
+    g_test_add_func("/rtf/write/Tag codes", rtf_tag_code_case);
+    g_test_add_func("/rtf/write/Many colors", rtf_many_colors_case);
+    g_test_add_func("/rtf/write/Escapes", rtf_escape_case);
+    g_test_add_func("/rtf/write/Overlapping tags", rtf_overlapping_tags_case);
+    g_test_add_func("/rtf/write/Compact", rtf_compact_case);
+    g_test_add_func("/rtf/write/Many blocks", rtf_many_blocks_case);
+    g_test_add_func("/rtf/write/Exporter", rtf_exporter_case);
+    g_test_add_func("/rtf/write/Headless writer", rtf_headless_writer_case);
+    g_test_add_func("/rtf/parse/pass/Skipped binary data", rtf_binary_skip_case);
+    g_test_add_func("/rtf/parse/pass/Picture size", rtf_picture_size_case);
+    g_test_add_func("/rtf/parse/pass/Asynchronous picture", rtf_async_picture_case);
+    g_test_add_func("/rtf/parse/pass/Relative picture path", rtf_relative_picture_case);
+    g_test_add_func("/rtf/parse/pass/Asynchronous insert", rtf_insert_async_case);
+    g_test_add_func("/rtf/write/Asynchronous file", rtf_file_async_case);
+    g_test_add_func("/rtf/parse/pass/Formatting runs", rtf_runs_case);
+    g_test_add_func("/rtf/parse/pass/Large document", rtf_large_document_case);
+    g_test_add_func("/rtf/parse/pass/Parse callbacks", rtf_parse_callbacks_case);
+    g_test_add_func("/rtf/extract/Batch", rtf_extract_text_batch_case);
+    g_test_add_func("/rtf/extract/Template", rtf_template_case);
+    g_test_add_func("/rtf/extract/Template encoding", rtf_template_encoding_case);
+    g_test_add_func("/rtf/write/Line breaking", rtf_line_breaking_case);
+    g_test_add_func("/rtf/write/Streaming writer", rtf_streaming_writer_case);
 
     /* Human tests -- only on thorough testing */
     if (g_test_thorough()) {